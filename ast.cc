@@ -7,6 +7,8 @@
 #include "parser.h"
 #include "token.h"
 
+#include <algorithm>
+
 
 static MemPoolImp<BinaryOp>         binaryOpPool;
 static MemPoolImp<ConditionalOp>    conditionalOpPool;
@@ -21,6 +23,7 @@ static MemPoolImp<UnaryOp>          unaryOpPool;
 static MemPoolImp<EmptyStmt>        emptyStmtPool;
 static MemPoolImp<IfStmt>           ifStmtPool;
 static MemPoolImp<JumpStmt>         jumpStmtPool;
+static MemPoolImp<SwitchStmt>       switchStmtPool;
 static MemPoolImp<ReturnStmt>       returnStmtPool;
 static MemPoolImp<LabelStmt>        labelStmtPool;
 static MemPoolImp<CompoundStmt>     compoundStmtPool;
@@ -57,6 +60,11 @@ void JumpStmt::Accept(Visitor* v) {
 }
 
 
+void SwitchStmt::Accept(Visitor* v) {
+  v->VisitSwitchStmt(this);
+}
+
+
 void ReturnStmt::Accept(Visitor* v) {
   v->VisitReturnStmt(this);
 }
@@ -336,7 +344,7 @@ void BinaryOp::AdditiveOpTypeChecking() {
     std::swap(lhs_, rhs_); // To simplify code gen
   } else {
     if (!lhs_->Type()->ToArithm() || !rhs_->Type()->ToArithm()) {
-      Error(this, "invalid operands to binary %s", tok_->str_.c_str());
+      Error(this, "invalid operands to binary %s", tok_->str_->c_str());
     }
     type_ = Convert();
   }
@@ -372,7 +380,7 @@ void BinaryOp::EqualityOpTypeChecking() {
     EnsureCompatibleOrVoidPointer(lhs_->Type(), rhs_->Type());
   } else {
     if (!lhs_->Type()->ToArithm() || !rhs_->Type()->ToArithm())
-      Error(this, "invalid operands to binary %s", tok_->str_.c_str());
+      Error(this, "invalid operands to binary %s", tok_->str_->c_str());
     Convert();
   }
 
@@ -800,6 +808,54 @@ JumpStmt* JumpStmt::New(LabelStmt* label) {
 }
 
 
+SwitchStmt* SwitchStmt::New(Expr* select) {
+  auto ret = new (switchStmtPool.Alloc()) SwitchStmt(select);
+  ret->pool_ = &switchStmtPool;
+  return ret;
+}
+
+
+// The controlling expression is promoted
+SwitchStmt::SwitchStmt(Expr* select): end_(LabelStmt::New()) {
+  if (auto arithm = select->Type()->ToArithm())
+    select = Expr::MayCast(select, ArithmType::IntegerPromote(arithm));
+  select_ = select;
+}
+
+
+bool SwitchStmt::IsUnsigned() const {
+  return select_->Type()->IsUnsigned();
+}
+
+
+void SwitchStmt::Finish() {
+  auto width = select_->Type()->Width();
+  auto convert = [this, width](long val) {
+    if (width != 4)
+      return val;
+    return IsUnsigned() ? static_cast<long>(static_cast<unsigned>(val)):
+                          static_cast<long>(static_cast<int>(val));
+  };
+  CaseList cases;
+  for (const auto& c: cases_) {
+    auto begin = convert(c.begin_), end = convert(c.end_);
+    // Empty range
+    if (Less(end, begin))
+      continue;
+    cases.push_back({begin, end, c.label_, c.tok_});
+  }
+  std::sort(cases.begin(), cases.end(),
+            [this](const Case& lhs, const Case& rhs) {
+    return Less(lhs.begin_, rhs.begin_);
+  });
+  for (size_t i = 1; i < cases.size(); ++i) {
+    if (!Less(cases[i - 1].end_, cases[i].begin_))
+      Error(cases[i].tok_, "duplicate case value");
+  }
+  cases_ = cases;
+}
+
+
 ReturnStmt* ReturnStmt::New(Expr* expr) {
   auto ret = new (returnStmtPool.Alloc()) ReturnStmt(expr);
   ret->pool_ = &returnStmtPool;
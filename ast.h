@@ -8,13 +8,16 @@
 #include <cassert>
 #include <list>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 
 class Visitor;
 template<typename T> class Evaluator;
 class AddrEvaluator;
 class Generator;
+class IRBuilder;
 
 class Scope;
 class Parser;
@@ -83,6 +86,7 @@ class EmptyStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static EmptyStmt* New();
@@ -98,6 +102,7 @@ class LabelStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static LabelStmt* New();
@@ -122,6 +127,10 @@ class IfStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
+  friend class Pruner;
+  friend class Reachability;
 public:
   static IfStmt* New(Expr* cond, Stmt* then, Stmt* els=nullptr);
   virtual ~IfStmt() {}
@@ -142,6 +151,8 @@ class JumpStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Pruner;
 
 public:
   static JumpStmt* New(LabelStmt* label);
@@ -157,10 +168,67 @@ private:
 };
 
 
+/*
+ * The cases keep the values converted to the promoted type of the
+ * controlling expression, sorted and without overlap. How to dispatch
+ * is left to the backends (switch_lowering.h).
+ */
+class SwitchStmt: public Stmt {
+  template<typename T> friend class Evaluator;
+  friend class AddrEvaluator;
+  friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
+  friend class Pruner;
+  friend class Reachability;
+
+public:
+  // A case label, or a GNU case range 'begin ... end'
+  struct Case {
+    long begin_;
+    long end_;
+    LabelStmt* label_;
+    const Token* tok_;
+  };
+  typedef std::vector<Case> CaseList;
+
+  static SwitchStmt* New(Expr* select);
+  virtual ~SwitchStmt() {}
+  virtual void Accept(Visitor* v);
+  Expr* Select() { return select_; }
+  CaseList& Cases() { return cases_; }
+  LabelStmt* Default() { return default_; }
+  LabelStmt* End() { return end_; }
+  bool IsUnsigned() const;
+  // The order of the values, unsigned if the type is unsigned
+  bool Less(long lhs, long rhs) const {
+    return IsUnsigned() ? static_cast<unsigned long>(lhs) <
+                          static_cast<unsigned long>(rhs): lhs < rhs;
+  }
+  void SetBody(Stmt* body) { body_ = body; }
+  void SetDefault(LabelStmt* label) { default_ = label; }
+  // Converts and sorts the cases, after the body is parsed
+  void Finish();
+
+protected:
+  SwitchStmt(Expr* select);
+
+private:
+  Expr* select_;
+  Stmt* body_ {nullptr};
+  CaseList cases_;
+  LabelStmt* default_ {nullptr};
+  LabelStmt* end_;    // The destination of 'break'
+};
+
+
 class ReturnStmt: public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
+  friend class Reachability;
 
 public:
   static ReturnStmt* New(Expr* expr);
@@ -181,6 +249,8 @@ class CompoundStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
 
 public:
   static CompoundStmt* New(StmtList& stmts, ::Scope* scope=nullptr);
@@ -230,6 +300,8 @@ class Declaration: public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
 
 public:
   static Declaration* New(Object* obj);
@@ -263,6 +335,7 @@ class Expr : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
   friend class LValGenerator;
 
 public:
@@ -305,8 +378,11 @@ class BinaryOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
   friend class LValGenerator;
   friend class Declaration;
+  friend class Reachability;
 
 public:
   static BinaryOp* New(const Token* tok, Expr* lhs, Expr* rhs);
@@ -369,7 +445,10 @@ class UnaryOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
   friend class LValGenerator;
+  friend class Reachability;
 
 public:
   static UnaryOp* New(int op, Expr* operand, QualType type=nullptr);
@@ -403,6 +482,9 @@ class ConditionalOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
+  friend class Reachability;
 
 public:
   static ConditionalOp* New(const Token* tok,
@@ -429,6 +511,9 @@ class FuncCall : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
+  friend class Reachability;
 
 public:        
   typedef std::vector<Expr*> ArgList;
@@ -442,7 +527,7 @@ public:
   virtual bool IsLVal() { return false; }
   ArgList* Args() { return &args_; }
   Expr* Designator() { return designator_; }
-  const std::string& Name() const { return tok_->str_; }
+  const std::string& Name() const { return *tok_->str_; }
   ::FuncType* FuncType() { return designator_->Type()->ToFunc(); }
   virtual void TypeChecking();
 
@@ -460,6 +545,7 @@ class Constant: public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static Constant* New(const Token* tok, int tag, long val);
@@ -499,6 +585,7 @@ class TempVar : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static TempVar* New(QualType type);
@@ -531,6 +618,7 @@ class Identifier: public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
   friend class LValGenerator;
 
 public:
@@ -550,7 +638,7 @@ public:
       return nullptr;
     return this;
   }
-  virtual const std::string Name() const { return tok_->str_; }
+  virtual const std::string& Name() const { return *tok_->str_; }
   enum Linkage Linkage() const { return linkage_; }
   void SetLinkage(enum Linkage linkage) { linkage_ = linkage; }
   virtual void TypeChecking() {}
@@ -568,6 +656,7 @@ class Enumerator: public Identifier {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static Enumerator* New(const Token* tok, int val);
@@ -589,6 +678,7 @@ class Object : public Identifier {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
   friend class LValGenerator;
 
 public:
@@ -642,7 +732,9 @@ public:
 
   bool HasInit() const { return decl_ && decl_->Inits().size(); }
   bool Anonymous() const { return anonymous_; }
-  virtual const std::string Name() const { return Identifier::Name(); }
+  virtual const std::string& Name() const {
+    return Identifier::Name();
+  }
   std::string Repr() const {
     assert(IsStatic() || anonymous_);
     if (anonymous_)
@@ -692,6 +784,8 @@ class FuncDef : public ExtDecl {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class Folder;
 
 public:
   typedef std::vector<Object*> ParamList;
@@ -703,7 +797,7 @@ public:
   ::FuncType* FuncType() { return ident_->Type()->ToFunc(); }
   CompoundStmt* Body() { return body_; }
   void SetBody(CompoundStmt* body) { body_ = body; }
-  std::string Name() const { return ident_->Name(); }
+  const std::string& Name() const { return ident_->Name(); }
   enum Linkage Linkage() { return ident_->Linkage(); }
 
 protected:
@@ -723,6 +817,7 @@ class TranslationUnit : public ASTNode {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   static TranslationUnit* New() { return new TranslationUnit();}
@@ -1,10 +1,14 @@
 #include "code_gen.h"
 
 #include "evaluator.h"
+#include "ir_code_gen.h"
 #include "parser.h"
+#include "reach.h"
 #include "token.h"
 
+#include <climits>
 #include <cstdarg>
+#include <map>
 #include <queue>
 #include <set>
 
@@ -12,10 +16,15 @@
 extern std::string inFileName;
 extern std::string outFileName;
 extern bool debug;
+extern int optLevel;
+extern int copyUnrollMax;
+extern int copyInlineMax;
 
 const std::string* Generator::last_file = nullptr;
 Parser* Generator::parser_ = nullptr;
 FILE* Generator::outFile_ = nullptr;
+AsmList Generator::insts_;
+bool Generator::volatile_ = false;
 RODataList Generator::rodatas_;
 std::vector<Declaration*> Generator::staticDecls_;
 int Generator::offset_ = 0;
@@ -26,7 +35,7 @@ FuncDef* Generator::curFunc_ = nullptr;
 /*
  * Register usage:
  *  xmm0: accumulator of floating datas;
- *  xmm8: temp register for param passing(xmm0)
+ *  xmm8: temp register for block copy and zeroing
  *  xmm9: source operand register;
  *  xmm10: tmp register for floating data swap;
  *  rax: accumulator;
@@ -35,6 +44,7 @@ FuncDef* Generator::curFunc_ = nullptr;
  *  r10: base register when LValGenerator eval the address.
  *  rcx: tempvar register, like the tempvar of 'switch'
  *       temp register for struct copy
+ *  rsi, rdi: the operands of 'rep movsb' and 'rep stosb'
  */
 
 static std::vector<const char*> regs {
@@ -48,64 +58,75 @@ static std::vector<const char*> xregs {
 };
 
 
-static ParamClass Classify(Type* paramType, int offset=0) {
-  if (paramType->IsInteger() || paramType->ToPointer()
-      || paramType->ToArray()) {
-    return ParamClass::INTEGER;
+// Merges the class of each eightbyte that ['begin', 'end') overlaps
+static void MergeClass(ParamClass cls, int begin, int end,
+                       ClassList& classes) {
+  for (int i = begin / 8; i <= (end - 1) / 8; ++i) {
+    if (cls == ParamClass::MEMORY)
+      classes[0] = cls;
+    else if (classes[i] == ParamClass::NO_CLASS || cls == ParamClass::INTEGER)
+      classes[i] = cls;
   }
-  
-  if (paramType->ToArithm()) {
-    auto type = paramType->ToArithm();
-    if (type->Tag() == T_FLOAT || type->Tag() == T_DOUBLE)
-      return ParamClass::SSE;
-    if (type->Tag() == (T_LONG | T_DOUBLE)) {
-      // TODO(wgtdkp):
-      return ParamClass::SSE;
-      assert(false); 
-      return ParamClass::X87;
+}
+
+
+static void ClassifyField(Type* type, int offset, ClassList& classes) {
+  if (auto structType = type->ToStruct()) {
+    for (auto member: structType->Members()) {
+      // The members of an anonymous struct/union are offseted already
+      auto base = member->Anonymous() ? offset: offset + member->Offset();
+      if (member->BitFieldWidth()) {
+        MergeClass(ParamClass::INTEGER, base + member->BitFieldBegin() / 8,
+                   base + (member->BitFieldEnd() + 7) / 8, classes);
+      } else {
+        ClassifyField(member->Type(), base, classes);
+      }
     }
-    
-    // TODO(wgtdkp):
-    assert(false);
-    // It is complex
-    if ((type->Tag() & T_LONG) && (type->Tag() & T_DOUBLE))
-      return ParamClass::COMPLEX_X87;
-  }
-  auto type = paramType->ToStruct();
-  assert(type);
-  return ParamClass::MEMORY;
-  // TODO(wgtdkp): Support agrregate type 
-  assert(false);
-  /*
-  auto type = paramType->ToStruct();
-  assert(type);
-
-  if (type->Width() > 4 * 8)
-    return PC_MEMORY;
-
-  std::vector<ParamClass> classes;
-  int cnt = (type->Width() + 7) / 8;
-  for (int i = 0; i < cnt; ++i) {
-    auto  types = FieldsIn8Bytes(type, i);
-    assert(types.size() > 0);
-    
-    auto fieldClass = (types.size() == 1)
-        ? PC_NO_CLASS: FieldClass(types, 0);
-    classes.push_back(fieldClass);
-    
+  } else if (auto arrType = type->ToArray()) {
+    auto elemType = arrType->Derived().GetPtr();
+    for (int i = 0; i < arrType->Len(); ++i)
+      ClassifyField(elemType, offset + arrType->GetElementOffset(i), classes);
+  } else if (type->IsInteger() || type->ToPointer()) {
+    MergeClass(ParamClass::INTEGER, offset, offset + type->Width(), classes);
+  } else {
+    auto arithmType = type->ToArithm();
+    auto x87 = arithmType->Tag() == (T_LONG | T_DOUBLE);
+    auto cls = x87 || arithmType->IsComplex() ?
+        ParamClass::MEMORY: ParamClass::SSE;
+    MergeClass(cls, offset, offset + type->Width(), classes);
   }
+}
+
+
+ClassList Classify(Type* type) {
+  if (type->IsInteger() || type->ToPointer() || type->ToArray())
+    return {ParamClass::INTEGER};
+  if (type->ToArithm()) {
+    // TODO(wgtdkp): long double and complex
+    return {ParamClass::SSE};
+  }
+
+  auto structType = type->ToStruct();
+  assert(structType);
+  if (structType->Width() > 2 * 8 || structType->Width() == 0)
+    return {ParamClass::MEMORY};
 
-  bool sawX87 = false;
-  for (int i = 0; i < classes.size(); ++i) {
-    if (classes[i] == PC_MEMORY)
-      return PC_MEMORY;
-    if (classes[i] == PC_X87_UP && sawX87)
-      return PC_MEMORY;
-    if (classes[i] == PC_X87)
-      sawX87 = true;
+  ClassList classes((structType->Width() + 7) / 8, ParamClass::NO_CLASS);
+  ClassifyField(structType, 0, classes);
+  if (classes[0] == ParamClass::MEMORY)
+    return {ParamClass::MEMORY};
+  for (auto& cls: classes) {
+    // Padding only
+    if (cls == ParamClass::NO_CLASS)
+      cls = ParamClass::SSE;
   }
-  */
-  return ParamClass::NO_CLASS; // Make compiler happy
+  return classes;
+}
+
+
+// Whether 'type' is a struct/union passed in memory
+static bool InMemory(Type* type) {
+  return type->ToStruct() && Classify(type)[0] == ParamClass::MEMORY;
 }
 
 
@@ -163,6 +184,52 @@ static std::string GetInst(const std::string& inst, Type* type) {
 }
 
 
+// The base 2 logarithm of 'expr' if it is an integer constant
+// that is a power of two, -1 otherwise
+static int Log2(Expr* expr) {
+  auto cons = dynamic_cast<Constant*>(expr);
+  if (!cons || !cons->Type()->IsInteger())
+    return -1;
+  auto val = cons->IVal();
+  if (val <= 0 || (val & (val - 1)))
+    return -1;
+  return __builtin_ctzl(val);
+}
+
+
+// The condition code of a relational or equality operator
+static const char* GetCond(int op, bool flt, bool sign) {
+  auto below = flt || !sign;
+  switch (op) {
+  case '<': return below ? "b": "l";
+  case '>': return below ? "a": "g";
+  case Token::LE: return below ? "be": "le";
+  case Token::GE: return below ? "ae": "ge";
+  case Token::EQ: return "e";
+  case Token::NE: return "ne";
+  default: return nullptr;
+  }
+}
+
+
+static std::string NegateCond(const std::string& cc) {
+  static const std::map<std::string, std::string> negs {
+    {"e", "ne"}, {"ne", "e"}, {"l", "ge"}, {"ge", "l"},
+    {"g", "le"}, {"le", "g"}, {"b", "ae"}, {"ae", "b"},
+    {"a", "be"}, {"be", "a"},
+  };
+  return negs.at(cc);
+}
+
+
+// The low 32 bits of a parameter register
+static std::string GetReg32(const std::string& reg) {
+  if (reg[2] >= '0' && reg[2] <= '9')
+    return reg + "d";
+  return "%e" + reg.substr(2);
+}
+
+
 static std::string GetReg(int width) {
   switch (width) {
   case 1: return "%al";
@@ -304,6 +371,17 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
   auto flt = type->IsFloat();
   auto sign = !type->IsUnsigned();
 
+  // Multiplies and divides by a power of two are shifts
+  auto shift = flt ? -1: Log2(binary->rhs_);
+  if (op == '%' && shift > 31)
+    shift = -1; // The mask doesn't fit in an immediate
+  if (shift >= 0 && (op == '*' || op == '/' || op == '%')) {
+    Visit(binary->lhs_);
+    if (op == '*')
+      return GenMulOp(width, flt, shift);
+    return GenDivOp(flt, sign, width, op, shift);
+  }
+
   Visit(binary->lhs_);
   Spill(flt);
   Visit(binary->rhs_);
@@ -311,22 +389,12 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
 
   const char* inst = nullptr;
 
+  if (auto cc = GetCond(op, flt, sign))
+    return GenCompOp(width, flt, cc);
+
   switch (op) {
-  case '*': return GenMulOp(width, flt, sign); 
+  case '*': return GenMulOp(width, flt);
   case '/': case '%': return GenDivOp(flt, sign, width, op);
-  case '<': 
-    return GenCompOp(width, flt, (flt || !sign) ? "setb": "setl");
-  case '>':
-    return GenCompOp(width, flt, (flt || !sign) ? "seta": "setg");
-  case Token::LE:
-    return GenCompOp(width, flt, (flt || !sign) ? "setbe": "setle");
-  case Token::GE:
-    return GenCompOp(width, flt, (flt || !sign) ? "setae": "setge");
-  case Token::EQ:
-    return GenCompOp(width, flt, "sete");
-  case Token::NE:
-    return GenCompOp(width, flt, "setne");
-
   case '+': inst = "add"; break;
   case '-': inst = "sub"; break;
   case '|': inst = "or"; break;
@@ -348,13 +416,18 @@ void Generator::GenCommaOp(BinaryOp* comma) {
 }
 
 
-void Generator::GenMulOp(int width, bool flt, bool sign) {
-  auto inst = flt ? "mul": (sign ? "imul": "mul");
-  
+void Generator::GenMulOp(int width, bool flt, int shift) {
+  if (shift >= 0) {
+    Emit(GetInst("sal", width, flt), shift, GetReg(width));
+    return;
+  }
   if (flt) {
-    Emit(GetInst(inst, width, flt), "%xmm9", "%xmm0");
+    Emit(GetInst("mul", width, flt), "%xmm9", "%xmm0");
   } else {
-    Emit(GetInst(inst, width, flt), GetSrc(width, flt));
+    // The low half of the product doesn't depend on the sign,
+    // the two-operand form leaves %rdx alone.
+    Emit(GetInst("imul", width, flt),
+         GetSrc(width, flt), GetDes(width, flt));
   }
 }
 
@@ -373,17 +446,61 @@ void Generator::GenCompZero(Type* type) {
 }
 
 
-void Generator::GenAndOp(BinaryOp* andOp) {
-  VisitExpr(andOp->lhs_);
-  GenCompZero(andOp->lhs_->Type());
-
-  auto labelFalse = LabelStmt::New();
-  Emit("je", labelFalse);
+/*
+ * Jumps to 'label' if the truth of 'cond' is 'jumpIf', falls through
+ * otherwise. A comparison branches on the flags it sets, '&&', '||'
+ * and '!' turn into control flow; only the other expressions are
+ * evaluated and compared to 0.
+ */
+void Generator::GenCondJump(Expr* cond, bool jumpIf, LabelStmt* label) {
+  auto binary = dynamic_cast<BinaryOp*>(cond);
+  auto unary = dynamic_cast<UnaryOp*>(cond);
+  if (binary && (binary->op_ == Token::LOGICAL_AND
+      || binary->op_ == Token::LOGICAL_OR)) {
+    // Jump if both(&&)/either(||) have the truth 'jumpIf'
+    if (jumpIf == (binary->op_ == Token::LOGICAL_OR)) {
+      GenCondJump(binary->lhs_, jumpIf, label);
+      GenCondJump(binary->rhs_, jumpIf, label);
+    } else {
+      auto skip = LabelStmt::New();
+      GenCondJump(binary->lhs_, !jumpIf, skip);
+      GenCondJump(binary->rhs_, jumpIf, label);
+      EmitLabel(skip->Repr());
+    }
+    return;
+  } else if (binary && binary->op_ == ',') {
+    VisitExpr(binary->lhs_);
+    return GenCondJump(binary->rhs_, jumpIf, label);
+  } else if (unary && unary->op_ == '!') {
+    return GenCondJump(unary->operand_, !jumpIf, label);
+  }
+
+  const char* cc = nullptr;
+  if (binary) {
+    auto type = binary->lhs_->Type();
+    cc = GetCond(binary->op_, type->IsFloat(), !type->IsUnsigned());
+  }
+  if (cc) {
+    EmitLoc(binary);
+    auto width = binary->lhs_->Type()->Width();
+    auto flt = binary->lhs_->Type()->IsFloat();
+    Visit(binary->lhs_);
+    Spill(flt);
+    Visit(binary->rhs_);
+    Restore(flt);
+    GenComp(width, flt);
+  } else {
+    VisitExpr(cond);
+    GenCompZero(cond->Type());
+    cc = "ne";
+  }
+  Emit("j" + (jumpIf ? cc: NegateCond(cc)), label);
+}
 
-  VisitExpr(andOp->rhs_);
-  GenCompZero(andOp->rhs_->Type());
 
-  Emit("je", labelFalse);
+void Generator::GenAndOp(BinaryOp* andOp) {
+  auto labelFalse = LabelStmt::New();
+  GenCondJump(andOp, false, labelFalse);
   
   Emit("movq", "$1", "%rax");
   auto labelTrue = LabelStmt::New();
@@ -395,16 +512,8 @@ void Generator::GenAndOp(BinaryOp* andOp) {
 
 
 void Generator::GenOrOp(BinaryOp* orOp) {
-  VisitExpr(orOp->lhs_);
-  GenCompZero(orOp->lhs_->Type());
-
   auto labelTrue = LabelStmt::New();
-  Emit("jne", labelTrue);
-
-  VisitExpr(orOp->rhs_);
-  GenCompZero(orOp->rhs_->Type());
-
-  Emit("jne", labelTrue);
+  GenCondJump(orOp, true, labelTrue);
   
   Emit("xorq", "%rax", "%rax"); // Set %rax to 0
   auto labelFalse = LabelStmt::New();
@@ -418,7 +527,7 @@ void Generator::GenOrOp(BinaryOp* orOp) {
 void Generator::GenMemberRefOp(BinaryOp* ref) {
   // As the lhs will always be struct/union 
   auto addr = LValGenerator().GenExpr(ref->lhs_);
-  const auto& name = ref->rhs_->Tok()->str_;
+  auto name = ref->rhs_->Tok()->str_;
   auto structType = ref->lhs_->Type()->ToStruct();
   auto member = structType->GetMember(name);
 
@@ -427,11 +536,13 @@ void Generator::GenMemberRefOp(BinaryOp* ref) {
   if (!ref->Type()->IsScalar()) {
     Emit("leaq", addr, "%rax");
   } else {
+    volatile_ = ref->IsVolatileQualified();
     if (member->BitFieldWidth()) {
       EmitLoadBitField(addr.Repr(), member);
     } else {
       EmitLoad(addr.Repr(), ref->Type());
     }
+    volatile_ = false;
   }
 }
 
@@ -464,6 +575,7 @@ void Generator::GenAssignOp(BinaryOp* assign) {
   if (addr.base_ == "%r10")
     Pop(addr.base_);
 
+  volatile_ = assign->lhs_->IsVolatileQualified();
   if (assign->Type()->IsScalar()) {
       EmitStore(addr, assign->Type());
   } else {
@@ -471,6 +583,7 @@ void Generator::GenAssignOp(BinaryOp* assign) {
     // The address of rhs is in %rax
     CopyStruct(addr, assign->Type()->Width());
   }
+  volatile_ = false;
 }
 
 
@@ -492,7 +605,32 @@ void Generator::EmitStoreBitField(const ObjectAddr& addr, Type* type) {
 }
 
 
+/*
+ * Copies 'width' bytes from the address in %rax to 'desAddr'. A small
+ * block is copied by scalar moves, a medium one by 16 bytes moves, the
+ * last of which overlaps the previous one, a large one by 'rep movsb'.
+ * EmitZero is tiered the same.
+ */
 void Generator::CopyStruct(ObjectAddr desAddr, int width) {
+  if (width > copyInlineMax) {
+    Emit("movq", "%rax", "%rsi");
+    Emit("leaq", desAddr, "%rdi");
+    Emit("movq", width, "%rcx");
+    Emit("rep movsb");
+    return;
+  } else if (width > copyUnrollMax && width >= 16) {
+    ObjectAddr srcAddr = {"", "%rax", 0};
+    for (int offset = 0; offset < width; offset += 16) {
+      auto begin = std::min(offset, width - 16);
+      srcAddr.offset_ = begin;
+      auto des = desAddr;
+      des.offset_ += begin;
+      Emit("movdqu", srcAddr, "%xmm8");
+      Emit("movdqu", "%xmm8", des);
+    }
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   Emit("movq", "%rax", "%rcx");
   ObjectAddr srcAddr = {"", "%rcx", 0};
@@ -508,26 +646,33 @@ void Generator::CopyStruct(ObjectAddr desAddr, int width) {
 }
 
 
-void Generator::GenCompOp(int width, bool flt, const char* set) {
+void Generator::GenComp(int width, bool flt) {
   std::string cmp;
   if (flt) {
     cmp = width == 8 ? "ucomisd": "ucomiss";
   } else {
     cmp = GetInst("cmp", width, flt);
   }
-
   Emit(cmp, GetSrc(width, flt), GetDes(width, flt));
-  Emit(set, "%al");
+}
+
+
+void Generator::GenCompOp(int width, bool flt, const std::string& cc) {
+  GenComp(width, flt);
+  Emit("set" + cc, "%al");
   Emit("movzbq", "%al", "%rax");
 }
 
 
-void Generator::GenDivOp(bool flt, bool sign, int width, int op) {
+void Generator::GenDivOp(bool flt, bool sign, int width, int op,
+                         int shift) {
   if (flt) {
     auto inst = width == 4 ? "divss": "divsd";
     Emit(inst, "%xmm9", "%xmm0");
     return;
   }
+  if (shift >= 0)
+    return GenDivByShift(sign, width, op, shift);
   if (!sign) {
     Emit("xor", "%rdx", "%rdx");
     Emit(GetInst("div", width, flt), GetSrc(width, flt));
@@ -540,6 +685,39 @@ void Generator::GenDivOp(bool flt, bool sign, int width, int op) {
 }
 
  
+/*
+ * The dividend is in %rax, the divisor is 1 << shift.
+ * A negative dividend is biased by the divisor - 1 (in %rcx),
+ * so that the quotient rounds toward zero.
+ */
+void Generator::GenDivByShift(bool sign, int width, int op, int shift) {
+  auto reg = GetReg(width);
+  auto tmp = width == 4 ? "%ecx": "%rcx";
+  auto mask = static_cast<int>((1L << shift) - 1);
+
+  if (!sign) {
+    if (op == '/')
+      Emit(GetInst("shr", width, false), shift, reg);
+    else
+      Emit(GetInst("and", width, false), mask, reg);
+  } else if (shift == 0) {
+    if (op == '%')
+      Emit(GetInst("xor", width, false), reg, reg);
+  } else {
+    Emit(GetInst("mov", width, false), reg, tmp);
+    Emit(GetInst("sar", width, false), width * 8 - 1, tmp);
+    Emit(GetInst("shr", width, false), width * 8 - shift, tmp);
+    Emit(GetInst("add", width, false), tmp, reg);
+    if (op == '/') {
+      Emit(GetInst("sar", width, false), shift, reg);
+    } else {
+      Emit(GetInst("and", width, false), mask, reg);
+      Emit(GetInst("sub", width, false), tmp, reg);
+    }
+  }
+}
+
+
 void Generator::GenPointerArithm(BinaryOp* binary) {
   assert(binary->op_ == '+' || binary->op_ == '-');
   // For '+', we have swapped lhs_ and rhs_ to ensure that 
@@ -574,7 +752,9 @@ void Generator::VisitObject(Object* obj) {
     // Return the address of the object in rax
     Emit("leaq", addr, "%rax");
   } else {
+    volatile_ = obj->IsVolatileQualified();
     EmitLoad(addr, obj->Type());
+    volatile_ = false;
   }
 }
 
@@ -592,7 +772,7 @@ void Generator::GenCastOp(UnaryOp* cast) {
     // Handle bool
     if (desType->IsBool()) {
       Emit("pxor", "%xmm9", "%xmm9");
-      GenCompOp(srcType->Width(), true, "setne");
+      GenCompOp(srcType->Width(), true, "ne");
     } else {
       auto inst = srcType->Width() == 4 ? "cvttss2si": "cvttsd2si";
       Emit(inst, "%xmm0", "%rax");
@@ -680,7 +860,9 @@ void Generator::GenDerefOp(UnaryOp* deref) {
   VisitExpr(deref->operand_);
   if (deref->Type()->IsScalar()) {
     ObjectAddr addr {"", "%rax", 0};
+    volatile_ = deref->IsVolatileQualified();
     EmitLoad(addr.Repr(), deref->Type());
+    volatile_ = false;
   } else {
     // Just let it go!
   }
@@ -710,7 +892,9 @@ void Generator::GenIncDec(Expr* operand,
   auto flt = operand->Type()->IsFloat();
   
   auto addr = LValGenerator().GenExpr(operand).Repr();
+  volatile_ = operand->IsVolatileQualified();
   EmitLoad(addr, operand->Type());
+  volatile_ = false;
   if (postfix) Save(flt);
 
   Constant* cons;
@@ -728,7 +912,9 @@ void Generator::GenIncDec(Expr* operand,
   }
 
   Emit(GetInst(inst, operand->Type()), ConsLabel(cons), GetDes(width, flt));
+  volatile_ = operand->IsVolatileQualified();
   EmitStore(addr, operand->Type());
+  volatile_ = false;
   if (postfix && flt) {
     Emit("movsd", "%xmm9", "%xmm0");
   } else if (postfix) {
@@ -804,6 +990,7 @@ void Generator::VisitDeclaration(Declaration* decl) {
       if (lastEnd != addr.offset_)
         EmitZero(ObjectAddr(lastEnd), addr.offset_ - lastEnd);
       VisitExpr(init.expr_);
+      volatile_ = obj->IsVolatileQualified();
       if (init.type_->IsScalar()) {
         EmitStore(addr, init.type_);
       } else if (init.type_->ToStruct()) {
@@ -811,6 +998,7 @@ void Generator::VisitDeclaration(Declaration* decl) {
       } else {
         assert(false);
       }
+      volatile_ = false;
       lastEnd = addr.offset_ + init.type_->Width();
     }
     auto objEnd = obj->Offset() + obj->Type()->Width();
@@ -900,19 +1088,22 @@ void Generator::VisitEmptyStmt(EmptyStmt* emptyStmt) {
 
 
 void Generator::VisitIfStmt(IfStmt* ifStmt) {
-  VisitExpr(ifStmt->cond_);
+  // The loops: 'if (cond) goto label' and 'if (cond) ; else goto label'
+  auto thenJump = dynamic_cast<JumpStmt*>(ifStmt->then_);
+  auto elseJump = dynamic_cast<JumpStmt*>(ifStmt->else_);
+  if (thenJump) {
+    GenCondJump(ifStmt->cond_, true, thenJump->label_);
+    if (ifStmt->else_)
+      VisitStmt(ifStmt->else_);
+    return;
+  } else if (elseJump && dynamic_cast<EmptyStmt*>(ifStmt->then_)) {
+    GenCondJump(ifStmt->cond_, false, elseJump->label_);
+    return;
+  }
 
-  // Compare to 0
   auto elseLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
-
-  GenCompZero(ifStmt->cond_->Type());
-
-  if (ifStmt->else_) {
-    Emit("je", elseLabel);
-  } else {
-    Emit("je", endLabel);
-  }
+  GenCondJump(ifStmt->cond_, false, ifStmt->else_ ? elseLabel: endLabel);
 
   VisitStmt(ifStmt->then_);
   
@@ -931,6 +1122,106 @@ void Generator::VisitJumpStmt(JumpStmt* jumpStmt) {
 }
 
 
+/*
+ * switch: the value stays in %rax while dispatching,
+ * %rcx and %rdx are free.
+ */
+void Generator::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  VisitExpr(switchStmt->select_);
+  auto clusters = ClusterCases(switchStmt);
+  auto dflt = switchStmt->default_ ? switchStmt->default_: switchStmt->end_;
+  GenSwitch(switchStmt, clusters, 0, clusters.size(), dflt);
+  VisitStmt(switchStmt->body_);
+  EmitLabel(switchStmt->end_->Repr());
+}
+
+
+void Generator::GenSwitch(SwitchStmt* switchStmt,
+                          const ClusterList& clusters,
+                          size_t first, size_t last, LabelStmt* dflt) {
+  if (last - first <= maxLinearClusters) {
+    for (auto i = first; i < last; ++i)
+      GenCaseCluster(switchStmt, clusters[i]);
+    Emit("jmp", dflt);
+    return;
+  }
+  auto width = switchStmt->select_->Type()->Width();
+  auto reg = width == 8 ? "%rax": "%eax";
+  auto mid = (first + last) / 2;
+  auto right = LabelStmt::New();
+  GenCaseCmp(reg, clusters[mid].low_, width);
+  Emit(switchStmt->IsUnsigned() ? "jae": "jge", right);
+  GenSwitch(switchStmt, clusters, first, mid, dflt);
+  EmitLabel(right->Repr());
+  GenSwitch(switchStmt, clusters, mid, last, dflt);
+}
+
+
+// Jumps to the case if the value is in the cluster, falls through if not
+void Generator::GenCaseCluster(SwitchStmt* switchStmt,
+                               const CaseCluster& cluster) {
+  auto width = switchStmt->select_->Type()->Width();
+  auto mov = width == 8 ? "movq": "movl";
+  auto rax = width == 8 ? "%rax": "%eax";
+  auto rcx = width == 8 ? "%rcx": "%ecx";
+  if (!cluster.IsTable() && cluster.low_ == cluster.high_) {
+    GenCaseCmp(rax, cluster.low_, width);
+    Emit("je", cluster.label_);
+    return;
+  }
+
+  // Unsigned 'value - low_ <= high_ - low_'
+  Emit(mov, rax, rcx);
+  GenCaseSub(rcx, cluster.low_, width);
+  GenCaseCmp(rcx, cluster.high_ - cluster.low_, width);
+  if (!cluster.IsTable()) {
+    Emit("jbe", cluster.label_);
+    return;
+  }
+
+  auto next = LabelStmt::New();
+  auto table = LabelStmt::New();
+  auto dflt = switchStmt->default_ ? switchStmt->default_: switchStmt->end_;
+  Emit("ja", next);
+  Emit("leaq", table->Repr() + "(%rip)", "%rdx");
+  Emit("movslq", "(%rdx,%rcx,4)", "%rcx");
+  Emit("addq", "%rdx", "%rcx");
+  Emit("jmp", "*%rcx");
+  Emit(".section", ".rodata");
+  Emit(".align", "4");
+  EmitLabel(table->Repr());
+  for (auto label: cluster.table_) {
+    Emit(".long", (label ? label: dflt)->Repr() + " - " + table->Repr());
+  }
+  Emit(".text");
+  EmitLabel(next->Repr());
+}
+
+
+void Generator::GenCaseCmp(const std::string& reg, long val, int width) {
+  if (width == 8 && (val < INT_MIN || val > INT_MAX)) {
+    Emit("movabsq", "$" + std::to_string(val), "%rdx");
+    Emit("cmpq", "%rdx", reg);
+  } else if (width == 8) {
+    Emit("cmpq", "$" + std::to_string(val), reg);
+  } else {
+    Emit("cmpl", "$" + std::to_string(static_cast<int>(val)), reg);
+  }
+}
+
+
+void Generator::GenCaseSub(const std::string& reg, long val, int width) {
+  if (width == 8 && (val < INT_MIN || val > INT_MAX)) {
+    Emit("movabsq", "$" + std::to_string(val), "%rdx");
+    Emit("subq", "%rdx", reg);
+  } else if (width == 8) {
+    Emit("subq", "$" + std::to_string(val), reg);
+  } else {
+    Emit("subl", "$" + std::to_string(static_cast<int>(val)), reg);
+  }
+}
+
+
 void Generator::VisitLabelStmt(LabelStmt* labelStmt) {
   EmitLabel(labelStmt->Repr());
 }
@@ -940,7 +1231,12 @@ void Generator::VisitReturnStmt(ReturnStmt* returnStmt) {
   auto expr = returnStmt->expr_;
   if (expr) { // The return expr could be nil
     Visit(expr);
-    if (expr->Type()->ToStruct()) {
+    if (expr->Type()->ToStruct() && !InMemory(expr->Type())) {
+      // Copied, so that it is readable by eightbytes
+      auto base = offset_;
+      LoadStructRegs(Classify(expr->Type()), ObjectAddr(Push(expr->Type())));
+      offset_ = base;
+    } else if (expr->Type()->ToStruct()) {
       // %rax now has the address of the struct/union
       ObjectAddr addr = ObjectAddr(retAddrOffset_);
       Emit("movq", addr, "%r11");
@@ -1013,17 +1309,14 @@ void Generator::GetParamRegOffsets(int& gpOffset,
   TypeList types;
   for (auto param: funcType->Params())
     types.push_back(param->Type());
-  auto locations = GetParamLocations(types, funcType->Derived());
-  gpOffset = 0;
-  fpOffset = 48;
+  bool retStruct = InMemory(funcType->Derived().GetPtr());
+  auto locations = GetParamLocations(types, retStruct);
+  gpOffset = locations.regCnt_ * 8;
+  fpOffset = 48 + locations.xregCnt_ * 16;
   overflow = 16;
-  for (const auto& loc: locations.locs_) {
-    if (loc[1] == 'x')
-      fpOffset += 16;
-    else if (loc[1] == 'm')
-      overflow += 8;
-    else
-      gpOffset += 8;
+  for (size_t i = 0; i < types.size(); ++i) {
+    if (locations.locs_[i][1] == 'm')
+      overflow += Type::MakeAlign(types[i]->Width(), 8);
   }
 }
 
@@ -1079,34 +1372,48 @@ void Generator::GenBuiltin(FuncCall* funcCall) {
     auto endLabel = ".L_va_arg_end" + std::to_string(++cnt[1]);
 
     auto argType = funcCall->args_[1]->Type()->ToPointer()->Derived();
-    auto cls = Classify(argType.GetPtr());
-    if (cls == ParamClass::INTEGER) {
-      Emit("movq", saveAreaAddr, "%rax");
-      Emit("movq", "%rax", "%r11");
-      Emit("movl", gpOffsetAddr, "%eax");
-      Emit("cltq");
-      Emit("cmpq", 48, "%rax");
-      Emit("jae",  overflowLabel);
-      Emit("addq", "%rax", "%r11");
-      Emit("addq", 8, "%rax");
-      Emit("movl", "%eax", gpOffsetAddr);
-      Emit("movq", "%r11", "%rax");
-      Emit("jmp",  endLabel);
-    } else if (cls == ParamClass::SSE) {
-      Emit("movq", saveAreaAddr, "%rax");
-      Emit("movq", "%rax", "%r11");
-      Emit("movl", fpOffsetAddr, "%eax");
-      Emit("cltq");
-      Emit("cmpq", 176, "%rax");
-      Emit("jae",  overflowLabel);
-      Emit("addq", "%rax", "%r11");
-      Emit("addq", 16, "%rax");
-      Emit("movl", "%eax", fpOffsetAddr);
-      Emit("movq", "%r11", "%rax");
+    auto classes = Classify(argType.GetPtr());
+    if (classes[0] != ParamClass::MEMORY) {
+      int regCnt = 0, xregCnt = 0;
+      for (auto cls: classes) {
+        regCnt += cls == ParamClass::INTEGER;
+        xregCnt += cls == ParamClass::SSE;
+      }
+      // All the eightbytes must be left in the save area
+      if (regCnt) {
+        Emit("movl", gpOffsetAddr, "%eax");
+        Emit("cmpq", 56 - 8 * regCnt, "%rax");
+        Emit("jae",  overflowLabel);
+      }
+      if (xregCnt) {
+        Emit("movl", fpOffsetAddr, "%eax");
+        Emit("cmpq", 192 - 16 * xregCnt, "%rax");
+        Emit("jae",  overflowLabel);
+      }
+      Emit("movq", saveAreaAddr, "%r11");
+      if (xregCnt == 0 || classes.size() == 1) {
+        // The eightbytes are adjacent in the save area
+        const auto& offsetAddr = regCnt ? gpOffsetAddr: fpOffsetAddr;
+        Emit("movl", offsetAddr, "%eax");
+        Emit("addq", "%rax", "%r11");
+        Emit("addq", regCnt ? 8 * regCnt: 16, "%rax");
+        Emit("movl", "%eax", offsetAddr);
+        Emit("movq", "%r11", "%rax");
+      } else {
+        // Gathered below the frame, like a struct returned by a call
+        auto tmp = Type::MakeAlign(offset_ - argType->Width(), 8);
+        for (size_t i = 0; i < classes.size(); ++i) {
+          auto sse = classes[i] == ParamClass::SSE;
+          const auto& offsetAddr = sse ? fpOffsetAddr: gpOffsetAddr;
+          Emit("movl", offsetAddr, "%eax");
+          Emit("movq", "(%r11,%rax)", "%rcx");
+          Emit("movq", "%rcx", ObjectAddr(tmp + 8 * i));
+          Emit("addq", sse ? 16: 8, "%rax");
+          Emit("movl", "%eax", offsetAddr);
+        }
+        Emit("leaq", ObjectAddr(tmp), "%rax");
+      }
       Emit("jmp",  endLabel);
-    } else if (cls == ParamClass::MEMORY) {
-    } else {
-      Error("internal error");
     }
     EmitLabel(overflowLabel);
     Emit("movq", overflowAddr, "%rax");
@@ -1131,10 +1438,13 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
   // Alloc memory for return value if it is struct/union
   int retStructOffset;
   auto retType = funcCall->Type()->ToStruct();
+  auto retStruct = retType && InMemory(retType);
   if (retType) {
+    // Returned in registers, it is stored by eightbytes
     retStructOffset = offset_;
-    retStructOffset -= retType->Width();
-    retStructOffset = Type::MakeAlign(retStructOffset, retType->Align());
+    retStructOffset -= Type::MakeAlign(retType->Width(), 8);
+    retStructOffset = Type::MakeAlign(retStructOffset,
+                                      std::max(retType->Align(), 8));
     // No!!! you can't suppose that the 
     // visition of arguments won't change the value of %rdi
     //Emit("leaq %d(#rbp), #rdi", offset);
@@ -1146,12 +1456,17 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
     types.push_back(arg->Type());
   }
   
-  const auto& locations = GetParamLocations(types, retType);
+  const auto& locations = GetParamLocations(types, retStruct);
   // Align stack frame by 16 bytes
   const auto& locs = locations.locs_;
-  auto byMemCnt = locs.size() - locations.regCnt_ - locations.xregCnt_;
+  const auto& highLocs = locations.highLocs_;
+  int byMemSize = 0;
+  for (size_t i = 0; i < locs.size(); ++i) {
+    if (locs[i][1] == 'm')
+      byMemSize += Type::MakeAlign(types[i]->Width(), 8);
+  }
 
-  offset_ = Type::MakeAlign(offset_ - byMemCnt * 8, 16) + byMemCnt * 8;  
+  offset_ = Type::MakeAlign(offset_ - byMemSize, 16) + byMemSize;
   for (int i = locs.size() - 1; i >=0; --i) {
     if (locs[i][1] == 'm') {
       Visit(funcCall->args_[i]);
@@ -1159,23 +1474,43 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
     }
   }
 
+  // Only the register args that may clobber the others are staged
+  // on the stack, the rest are evaluated into their registers after
+  // them. %xmm0 is the accumulator, so it is set at last. A struct
+  // is staged and loaded by eightbytes.
+  auto stageBase = offset_;
+  std::map<int, int> slots;
+  int last = -1;
   for (int i = locs.size() - 1; i >= 0; i--) {
-    if (locs[i][1] == 'm')
+    auto arg = funcCall->args_[i];
+    if (locs[i] == "%xmm0" || highLocs[i] == "%xmm0")
+      last = i;
+    if (locs[i][1] == 'm' || (!MayClobber(arg) && !arg->Type()->ToStruct()))
       continue;
-    Visit(funcCall->args_[i]);
-    Push(funcCall->args_[i]->Type());
+    Visit(arg);
+    slots[i] = Push(arg->Type());
   }
 
-  for (const auto& loc: locs) {
-    if (loc[1] != 'm')
-      Pop(loc);
+  for (const auto& slot: slots) {
+    if (slot.first != last)
+      GenArgLoad(locs[slot.first], highLocs[slot.first], slot.second);
+  }
+  for (size_t i = 0; i < locs.size(); ++i) {
+    if (locs[i][1] != 'm' && (int)i != last && !slots.count(i))
+      GenArg(funcCall->args_[i], locs[i]);
   }
+  if (slots.count(last)) {
+    GenArgLoad(locs[last], highLocs[last], slots[last]);
+  } else if (last != -1) {
+    GenArg(funcCall->args_[last], locs[last]);
+  }
+  offset_ = stageBase;
 
   // If variadic, set %al to floating param number
   if (funcType->Variadic()) {
     Emit("movq", locations.xregCnt_, "%rax");
   }
-  if (retType) {
+  if (retStruct) {
     Emit("leaq", ObjectAddr(retStructOffset), "%rdi");
   }
 
@@ -1188,6 +1523,11 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
     Emit("call", "*%r10");
   }
 
+  if (retType && !retStruct) {
+    StoreStructRegs(Classify(retType), ObjectAddr(retStructOffset));
+    Emit("leaq", ObjectAddr(retStructOffset), "%rax");
+  }
+
   // Reset stack frame
   offset_ = base;    
 }
@@ -1200,23 +1540,137 @@ ParamLocations Generator::GetParamLocations(const TypeList& types,
   locations.regCnt_ = retStruct;
   locations.xregCnt_ = 0;
   for (auto type: types) {
-    auto cls = Classify(type);
-
-    const char* reg = nullptr;
-    if (cls == ParamClass::INTEGER) {
-      if (locations.regCnt_ < regs.size())
-        reg = regs[locations.regCnt_++];
-    } else if (cls == ParamClass::SSE) {
-      if (locations.xregCnt_ < xregs.size())
-        reg = xregs[locations.xregCnt_++];
+    auto classes = Classify(type);
+    size_t regCnt = 0, xregCnt = 0;
+    for (auto cls: classes) {
+      regCnt += cls == ParamClass::INTEGER;
+      xregCnt += cls == ParamClass::SSE;
+    }
+
+    // A struct goes to memory if any of its eightbytes doesn't fit
+    LocationList locs;
+    if (classes[0] != ParamClass::MEMORY
+        && locations.regCnt_ + regCnt <= regs.size()
+        && locations.xregCnt_ + xregCnt <= xregs.size()) {
+      for (auto cls: classes) {
+        if (cls == ParamClass::INTEGER)
+          locs.push_back(regs[locations.regCnt_++]);
+        else
+          locs.push_back(xregs[locations.xregCnt_++]);
+      }
+    } else {
+      locs.push_back("%mem");
     }
-    locations.locs_.push_back(reg ? reg: "%mem");
+    locations.locs_.push_back(locs[0]);
+    locations.highLocs_.push_back(locs.size() > 1 ? locs[1]: "");
   }
   return locations;
 }
 
 
+/*
+ * Whether evaluating 'expr' may write a parameter register other than
+ * %xmm0: the calls, the divisions and shifts (%rdx, %rcx), the struct
+ * copies (%rcx) and the compound literals.
+ */
+bool Generator::MayClobber(Expr* expr) {
+  if (auto binary = dynamic_cast<BinaryOp*>(expr)) {
+    auto op = binary->op_;
+    auto divOrShift = op == '/' || op == '%'
+        || op == Token::LEFT || op == Token::RIGHT;
+    if (divOrShift && !binary->Type()->IsFloat())
+      return true;
+    if (op == '=' && !binary->Type()->IsScalar())
+      return true;
+    return MayClobber(binary->lhs_) || MayClobber(binary->rhs_);
+  } else if (auto unary = dynamic_cast<UnaryOp*>(expr)) {
+    return MayClobber(unary->operand_);
+  } else if (auto cond = dynamic_cast<ConditionalOp*>(expr)) {
+    return MayClobber(cond->cond_) || MayClobber(cond->exprTrue_)
+        || MayClobber(cond->exprFalse_);
+  } else if (auto obj = dynamic_cast<Object*>(expr)) {
+    return obj->Anonymous() && !obj->IsStatic();
+  }
+  return dynamic_cast<FuncCall*>(expr) || dynamic_cast<TempVar*>(expr);
+}
+
+
+// Evaluates the argument 'arg' into its register 'reg'
+void Generator::GenArg(Expr* arg, const std::string& reg) {
+  auto type = arg->Type();
+  auto flt = reg[1] == 'x';
+  auto obj = dynamic_cast<Object*>(arg);
+  auto cons = dynamic_cast<Constant*>(arg);
+  auto unary = dynamic_cast<UnaryOp*>(arg);
+  if (unary && unary->op_ == Token::ADDR)
+    obj = dynamic_cast<Object*>(unary->operand_);
+
+  if (obj && (unary || !type->IsScalar())) {
+    // The address of an object
+    Emit("leaq", LValGenerator().GenExpr(obj), reg);
+  } else if (obj) {
+    auto addr = LValGenerator().GenExpr(obj).Repr();
+    auto width = type->Width();
+    auto des = width == 4 && !flt ? GetReg32(reg): reg;
+    Emit(GetLoad(width, flt), addr, des);
+  } else if (cons && type->IsInteger()) {
+    Emit("movq", ConsLabel(cons), reg);
+  } else if (cons && type->IsFloat()) {
+    Emit(GetLoad(type->Width(), true), ConsLabel(cons), reg);
+  } else {
+    Visit(arg);
+    if (reg != "%xmm0")
+      Emit(flt ? "movsd": "movq", flt ? "%xmm0": "%rax", reg);
+  }
+}
+
+
+// Loads an arg staged at 'offset', 'high' is the register of the
+// second eightbyte of a struct
+void Generator::GenArgLoad(const std::string& reg,
+                           const std::string& high, int offset) {
+  Emit(reg[1] == 'x' ? "movsd": "movq", ObjectAddr(offset), reg);
+  if (!high.empty())
+    Emit(high[1] == 'x' ? "movsd": "movq", ObjectAddr(offset + 8), high);
+}
+
+
+// The registers a struct of 'classes' is returned in
+static LocationList GetRetRegs(const ClassList& classes) {
+  static const char* retRegs[] = {"%rax", "%rdx"};
+  static const char* retXRegs[] = {"%xmm0", "%xmm1"};
+  LocationList regs;
+  int regCnt = 0, xregCnt = 0;
+  for (auto cls: classes) {
+    if (cls == ParamClass::INTEGER)
+      regs.push_back(retRegs[regCnt++]);
+    else
+      regs.push_back(retXRegs[xregCnt++]);
+  }
+  return regs;
+}
+
+
+void Generator::StoreStructRegs(const ClassList& classes, ObjectAddr addr) {
+  for (const auto& reg: GetRetRegs(classes)) {
+    Emit(reg[1] == 'x' ? "movsd": "movq", reg, addr);
+    addr.offset_ += 8;
+  }
+}
+
+
+// The struct at 'addr' is readable up to a whole eightbyte
+void Generator::LoadStructRegs(const ClassList& classes, ObjectAddr addr) {
+  for (const auto& reg: GetRetRegs(classes)) {
+    Emit(reg[1] == 'x' ? "movsd": "movq", addr, reg);
+    addr.offset_ += 8;
+  }
+}
+
+
 void Generator::VisitFuncDef(FuncDef* funcDef) {
+  if (optLevel > 0 && IRCodeGen::GenFuncDef(funcDef))
+    return;
   curFunc_ = funcDef;
 
   auto name = funcDef->Name();
@@ -1237,21 +1691,20 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
 
   auto& params = funcDef->FuncType()->Params();
   // Arrange space to store params passed by registers
-  bool retStruct = funcDef->FuncType()->Derived()->ToStruct();
+  bool retStruct = InMemory(funcDef->FuncType()->Derived().GetPtr());
   TypeList types;
   for (auto param: params)
     types.push_back(param->Type());
 
   auto locations = GetParamLocations(types, retStruct);
   const auto& locs = locations.locs_;
+  const auto& highLocs = locations.highLocs_;
 
   if (funcDef->FuncType()->Variadic()) {
     GenSaveArea(); // 'offset' is now the begin of save area
-    if (retStruct) {
+    if (retStruct)
       retAddrOffset_ = offset_;
-      offset_ += 8;
-    }
-    int regOffset = offset_;
+    int regOffset = offset_ + (retStruct ? 8: 0);
     int xregOffset = offset_ + 48;
     int byMemOffset = 16;
     for (size_t i = 0; i < locs.size(); ++i) {
@@ -1262,12 +1715,28 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
         // What about the var args, var args offset always increment by 8
         byMemOffset += params[i]->Type()->Width();
         byMemOffset = Type::MakeAlign(byMemOffset, 8);
-      } else if (locs[i][1] == 'x') {
-        params[i]->SetOffset(xregOffset);
-        xregOffset += 16;
+        continue;
+      }
+
+      int offsets[2];
+      for (int j = 0; j < 1 + !highLocs[i].empty(); ++j) {
+        auto reg = j == 0 ? locs[i]: highLocs[i];
+        if (reg[1] == 'x') {
+          offsets[j] = xregOffset;
+          xregOffset += 16;
+        } else {
+          offsets[j] = regOffset;
+          regOffset += 8;
+        }
+      }
+      if (highLocs[i].empty() || offsets[1] == offsets[0] + 8) {
+        params[i]->SetOffset(offsets[0]);
       } else {
-        params[i]->SetOffset(regOffset);
-        regOffset += 8;
+        // The eightbytes of the struct are apart in the save area
+        Emit("movq", ObjectAddr(offsets[1]), "%rax");
+        Push("%rax");
+        Emit("movq", ObjectAddr(offsets[0]), "%rax");
+        params[i]->SetOffset(Push("%rax"));
       }
     }
   } else {
@@ -1283,6 +1752,8 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
         byMemOffset = Type::MakeAlign(byMemOffset, 8);
         continue;
       }
+      if (!highLocs[i].empty())
+        Push(highLocs[i]);
       params[i]->SetOffset(Push(locs[i]));
     }
   }
@@ -1320,9 +1791,17 @@ void Generator::GenSaveArea() {
 }
 
 
+// The static definitions not referred to are not emitted
 void Generator::VisitTranslationUnit(TranslationUnit* unit) {
+  Reachability reach(unit);
+  HeldCode held;
   for (auto extDecl: unit->ExtDecls()) {
+    if (!reach.Reached(extDecl))
+      continue;
     Visit(extDecl);
+    auto funcDef = dynamic_cast<FuncDef*>(extDecl);
+    if (optLevel > 0 && funcDef && funcDef->Linkage() == L_INTERNAL)
+      held.Hold(funcDef->Name(), insts_);
 
     // float and string literal
     if (rodatas_.size())
@@ -1344,10 +1823,17 @@ void Generator::VisitTranslationUnit(TranslationUnit* unit) {
     rodatas_.clear();
 
     for (auto staticDecl: staticDecls_) {
-      GenStaticDecl(staticDecl);
+      if (reach.Reached(staticDecl))
+        GenStaticDecl(staticDecl);
     }
     staticDecls_.clear();
+    if (held.Empty())
+      Flush();
+    else
+      held.Hold("", insts_);
   }
+  held.Print(outFile_);
+  Flush();
 }
 
 
@@ -1361,13 +1847,17 @@ void Generator::EmitLoc(Expr* expr) {
   if (!debug) {
     return;
   }
+  EmitLoc(expr->tok_);
+}
+
 
+void Generator::EmitLoc(const Token* tok) {
   static int fileno = 0;
-  if (expr->tok_ == nullptr) {
+  if (tok == nullptr) {
     return;
   }
 
-  const auto loc = &expr->tok_->loc_;
+  const auto loc = &tok->loc_;
   if (loc->fileName_ != last_file) {
     Emit(".file", std::to_string(++fileno) + " \"" + *loc->fileName_ + "\"");
     last_file = loc->fileName_;
@@ -1416,12 +1906,31 @@ void Generator::EmitStore(const std::string& addr, int width, bool flt) {
 }
 
 
-void Generator::EmitLabel(const std::string& label) {
-  fprintf(outFile_, "%s:\n", label.c_str());
+void Generator::Flush() {
+  Peephole(insts_);
+  for (const auto& inst: insts_)
+    inst.Print(outFile_);
+  insts_.clear();
 }
 
 
 void Generator::EmitZero(ObjectAddr addr, int width) {
+  if (width > copyInlineMax) {
+    Emit("leaq", addr, "%rdi");
+    Emit("movq", width, "%rcx");
+    Emit("xorl", "%eax", "%eax");
+    Emit("rep stosb");
+    return;
+  } else if (width > copyUnrollMax && width >= 16) {
+    Emit("pxor", "%xmm8", "%xmm8");
+    for (int offset = 0; offset < width; offset += 16) {
+      auto des = addr;
+      des.offset_ += std::min(offset, width - 16);
+      Emit("movdqu", "%xmm8", des);
+    }
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   Emit("xorq", "%rax", "%rax");
   for (auto unit: units) {
@@ -1439,7 +1948,7 @@ void LValGenerator::VisitBinaryOp(BinaryOp* binary) {
   assert(binary->op_ == '.');
 
   addr_ = LValGenerator().GenExpr(binary->lhs_);
-  const auto& name = binary->rhs_->Tok()->str_;
+  auto name = binary->rhs_->Tok()->str_;
   auto structType = binary->lhs_->Type()->ToStruct();
   auto member = structType->GetMember(name);
 
@@ -1458,6 +1967,15 @@ void LValGenerator::VisitUnaryOp(UnaryOp* unary) {
 }
 
 
+// A struct returned by a call, its address is left in %rax
+void LValGenerator::VisitFuncCall(FuncCall* funcCall) {
+  EmitLoc(funcCall);
+  Generator().VisitExpr(funcCall);
+  Emit("movq", "%rax", "%r10");
+  addr_ = {"", "%r10", 0};
+}
+
+
 void LValGenerator::VisitObject(Object* obj) {
   EmitLoc(obj);
   if (!obj->IsStatic() && obj->Anonymous()) {
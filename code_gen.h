@@ -2,6 +2,8 @@
 #define _WGTCC_CODE_GEN_H_
 
 #include "ast.h"
+#include "peephole.h"
+#include "switch_lowering.h"
 #include "visitor.h"
 
 
@@ -28,12 +30,20 @@ enum class ParamClass {
   MEMORY
 };
 
+typedef std::vector<ParamClass> ClassList;
+
 struct ParamLocations {
   LocationList locs_;
+  // The register of the second eightbyte of a struct, empty if none
+  LocationList highLocs_;
   size_t regCnt_;
   size_t xregCnt_;
 };
 
+// The classes of the eightbytes of 'type', a single MEMORY if
+// it is passed in memory (System V ABI, 3.2.3)
+ClassList Classify(Type* type);
+
 struct ROData {
   ROData(long ival, int align): ival_(ival), align_(align) {
     label_ = ".LC" + std::to_string(GenTag());
@@ -108,6 +118,7 @@ public:
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt);
   virtual void VisitIfStmt(IfStmt* ifStmt);
   virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
   virtual void VisitReturnStmt(ReturnStmt* returnStmt);
   virtual void VisitLabelStmt(LabelStmt* labelStmt);
   virtual void VisitCompoundStmt(CompoundStmt* compoundStmt);
@@ -137,10 +148,20 @@ protected:
   void GenDerefOp(UnaryOp* deref);
   void GenMinusOp(UnaryOp* minus);
   void GenPointerArithm(BinaryOp* binary);
-  void GenDivOp(bool flt, bool sign, int width, int op);
-  void GenMulOp(int width, bool flt, bool sign);
-  void GenCompOp(int width, bool flt, const char* set);
+  void GenDivOp(bool flt, bool sign, int width, int op, int shift=-1);
+  void GenDivByShift(bool sign, int width, int op, int shift);
+  void GenMulOp(int width, bool flt, int shift=-1);
+  void GenComp(int width, bool flt);
+  void GenCompOp(int width, bool flt, const std::string& cc);
   void GenCompZero(Type* type);
+  void GenCondJump(Expr* cond, bool jumpIf, LabelStmt* label);
+
+  // Switch
+  void GenSwitch(SwitchStmt* switchStmt, const ClusterList& clusters,
+                 size_t first, size_t last, LabelStmt* dflt);
+  void GenCaseCluster(SwitchStmt* switchStmt, const CaseCluster& cluster);
+  void GenCaseCmp(const std::string& reg, long val, int width);
+  void GenCaseSub(const std::string& reg, long val, int width);
 
   // Unary
   void GenIncDec(Expr* operand, bool postfix, const std::string& inst);
@@ -152,6 +173,12 @@ protected:
   
   void GenSaveArea();
   void GenBuiltin(FuncCall* funcCall);
+  static bool MayClobber(Expr* expr);
+  void GenArg(Expr* arg, const std::string& reg);
+  void GenArgLoad(const std::string& reg,
+                  const std::string& high, int offset);
+  void StoreStructRegs(const ClassList& classes, ObjectAddr addr);
+  void LoadStructRegs(const ClassList& classes, ObjectAddr addr);
 
   void AllocObjects(Scope* scope,
       const FuncDef::ParamList& params=FuncDef::ParamList());
@@ -166,50 +193,66 @@ protected:
 
   //void Emit(const char* format, ...);
   void Emit(const std::string& str) {
-    fprintf(outFile_, "\t%s\n", str.c_str());
+    insts_.push_back(AsmInst::Parse(str));
   }
 
   void Emit(const std::string& inst,
             const std::string& src,
             const std::string& des) {
-    Emit(inst + "\t" + src + ", " + des);
+    EmitInst(inst, {src, des});
   }
 
   void Emit(const std::string& inst,
             int imm,
             const std::string& reg) {
-    Emit(inst + "\t$" + std::to_string(imm) + ", " + reg);
+    EmitInst(inst, {"$" + std::to_string(imm), reg});
   }
 
   void Emit(const std::string& inst,
             const std::string& des) {
-    Emit(inst + "\t" + des);
+    EmitInst(inst, {des});
   }
 
   void Emit(const std::string& inst,
             const LabelStmt* label) {
-    Emit(inst + "\t" + label->Repr());
+    EmitInst(inst, {label->Repr()});
   }
 
   void Emit(const std::string& inst,
             const ObjectAddr& src,
             const ObjectAddr& des) {
-    Emit(inst, src.Repr(), des.Repr());
+    EmitInst(inst, {src.Repr(), des.Repr()});
   }
 
   void Emit(const std::string& inst,
             const std::string& src,
             const ObjectAddr& des) {
-    Emit(inst, src, des.Repr());
+    EmitInst(inst, {src, des.Repr()});
   }
 
   void Emit(const std::string& inst,
             const ObjectAddr& src,
             const std::string& des) {
-    Emit(inst, src.Repr(), des);
+    EmitInst(inst, {src.Repr(), des});
   }
 
-  void EmitLabel(const std::string& label);
+  // The operands are already split, only a directive is kept as text
+  void EmitInst(const std::string& inst, std::vector<std::string> opds) {
+    if (inst[0] != '.') {
+      insts_.push_back({AsmInst::INST, inst, std::move(opds), volatile_});
+      return;
+    }
+    auto line = inst + "\t" + opds[0];
+    for (size_t i = 1; i < opds.size(); ++i)
+      line += ", " + opds[i];
+    insts_.push_back({AsmInst::DIRECTIVE, line, {}});
+  }
+
+  void EmitLabel(const std::string& label) {
+    insts_.push_back(AsmInst::Label(label));
+  }
+  // Prints the buffered code, after the peephole pass
+  void Flush();
   void EmitZero(ObjectAddr addr, int width);
   void EmitLoad(const std::string& addr, Type* type);
   void EmitLoad(const std::string& addr, int width, bool flt);
@@ -219,6 +262,7 @@ protected:
   void EmitLoadBitField(const std::string& addr, Object* bitField);
   void EmitStoreBitField(const ObjectAddr& addr, Type* type);
   void EmitLoc(Expr* expr);
+  void EmitLoc(const Token* tok);
 
   int Push(Type* type);
   int Push(const std::string& reg);
@@ -236,6 +280,9 @@ protected:
   static const std::string* last_file;
   static Parser* parser_;
   static FILE* outFile_;
+  static AsmList insts_;
+  // The instructions emitted access a volatile object
+  static bool volatile_;
   static RODataList rodatas_;
   static int offset_;
 
@@ -259,7 +306,7 @@ public:
   virtual void VisitIdentifier(Identifier* ident);
 
   virtual void VisitConditionalOp(ConditionalOp* condOp) { assert(false); }
-  virtual void VisitFuncCall(FuncCall* funcCall) { assert(false); }
+  virtual void VisitFuncCall(FuncCall* funcCall);
   virtual void VisitEnumerator(Enumerator* enumer) { assert(false); }
   virtual void VisitConstant(Constant* cons) { assert(false); }
   virtual void VisitTempVar(TempVar* tempVar);
@@ -4,9 +4,10 @@
 #include "parser.h"
 
 #include <ctime>
-#include <fcntl.h>
-#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <unordered_map>
+#include <vector>
 
 
 extern std::string inFileName;
@@ -14,6 +15,12 @@ extern std::string outFileName;
 
 typedef std::unordered_map<std::string, int> DirectiveMap;
 
+static DirMap dirCache;
+static TokenCache tokenCache;
+static SearchCacheMap searchCaches;
+// The names searched in this process: name, '\0', then the search paths
+static std::vector<std::string> newSearches;
+
 static const DirectiveMap directiveMap {
   {"if", Token::PP_IF},
   {"ifdef", Token::PP_IFDEF},
@@ -43,49 +50,41 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
   while (!is.Empty()) {
     UpdateFirstTokenLine(is);
     auto tok = is.Peek();
-    const auto& name = tok->str_;
+    auto name = tok->str_;
 
     if ((direcitve = GetDirective(is)) != Token::INVALID) {
       ParseDirective(os, is, direcitve);
     } else if (!inCond && !NeedExpand()) {
       // Discards the token
       is.Next();
-    } else if (tok->hs_ && tok->hs_->find(name) != tok->hs_->end()) {
+    } else if (tok->hs_ && tok->hs_->Contains(name)) {
       os.InsertBack(is.Next());
     } else if ((macro = FindMacro(name))) {
       is.Next();
 
-      if (name == "__FILE__") {
+      if (*name == "__FILE__") {
         HandleTheFileMacro(os, tok);
-      } else if (name == "__LINE__") {
+      } else if (*name == "__LINE__") {
         HandleTheLineMacro(os, tok);
       } else if (macro->ObjLike()) {
-        // Make a copy, as subst will change repSeq
-        auto repSeq = macro->RepSeq(tok->loc_.fileName_, tok->loc_.line_);
-
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
-        ParamMap paramMap;
+        ArgList args;
         // TODO(wgtdkp): hideset is not right
-        // Make a copy of hideset
         // HS U {name}
-        auto hs = tok->hs_ ? *tok->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Add(tok->hs_, name);
+        Subst(repSeqSubsted, macro, tok, hs, args);
         is.InsertFront(repSeqSubsted);
       } else if (is.Try('(')) {
-        ParamMap paramMap;
-        auto rpar = ParseActualParam(is, macro, paramMap);
-        auto repSeq = macro->RepSeq(tok->loc_.fileName_, tok->loc_.line_);
-        //const_cast<Token*>(repSeq.Peek())->ws_ = tok->ws_;
+        ArgList args;
+        auto rpar = ParseActualParam(is, macro, args);
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
 
         // (HS ^ HS') U {name}
         // Use HS' U {name} directly                
-        auto hs = rpar->hs_ ? *rpar->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Add(rpar->hs_, name);
+        Subst(repSeqSubsted, macro, tok, hs, args);
         is.InsertFront(repSeqSubsted);
       } else {
         os.InsertBack(tok);
@@ -97,63 +96,71 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
 }
 
 
-static bool FindActualParam(TokenSequence& ap,
-                            ParamMap& params,
-                            const std::string& fp) {
-  auto res = params.find(fp);
-  if (res == params.end()) {
+static bool FindActualParam(TokenSequence& ap, ArgList& args, int param) {
+  if (param < 0 || param >= static_cast<int>(args.size()))
     return false;
-  }
-  ap.Copy(res->second);
+  ap.Copy(args[param]);
   return true;
 }
 
 
+/*
+ * params:
+ *  name: the macro name token, expanded tokens take its location
+ */
 void Preprocessor::Subst(TokenSequence& os,
-                         TokenSequence is,
-                         bool leadingWS,
-                         const HideSet& hs,
-                         ParamMap& params) {
+                         Macro* macro,
+                         const Token* name,
+                         const HideSet* hs,
+                         ArgList& args) {
   TokenSequence ap;
-
-  while (!is.Empty()) {
-    if (is.Test('#') && FindActualParam(ap, params, is.Peek2()->str_)) {
-      is.Next(); is.Next();
+  const auto& body = macro->GetBody();
+  const size_t n = body.size();
+  auto tag = [&](size_t i) {
+    return i < n ? body[i].tok_->tag_: static_cast<int>(Token::END);
+  };
+  auto param = [&](size_t i) { return i < n ? body[i].param_: -1; };
+
+  size_t i = 0;
+  while (i < n) {
+    if (tag(i) == '#' && FindActualParam(ap, args, param(i + 1))) {
+      i += 2;
       auto tok = Stringize(ap);
       os.InsertBack(tok);
-    } else if (is.Test(Token::DSHARP) &&
-               FindActualParam(ap, params, is.Peek2()->str_)) {
-      is.Next(); is.Next();
+    } else if (tag(i) == Token::DSHARP &&
+               FindActualParam(ap, args, param(i + 1))) {
+      i += 2;
       if (!ap.Empty())
         Glue(os, ap);
-    } else if (is.Test(Token::DSHARP)) {
-      is.Next();
-      auto tok = is.Next();
-      Glue(os, tok);
-    } else if (is.Peek2()->tag_ == Token::DSHARP &&
-               FindActualParam(ap, params, is.Peek()->str_)) {
-      is.Next();
+    } else if (tag(i) == Token::DSHARP) {
+      Glue(os, body[i + 1].tok_);
+      i += 2;
+    } else if (tag(i + 1) == Token::DSHARP &&
+               FindActualParam(ap, args, param(i))) {
+      ++i;
 
       if (ap.Empty()) {
-        is.Next();
-        if (FindActualParam(ap, params, is.Peek()->str_)) {
-          is.Next();
+        ++i;
+        if (FindActualParam(ap, args, param(i))) {
+          ++i;
           os.InsertBack(ap);
         }
       } else {
         os.InsertBack(ap);
       }
-    } else if (FindActualParam(ap, params, is.Peek()->str_)) {
-      auto tok = is.Next();
+    } else if (FindActualParam(ap, args, param(i))) {
+      auto tok = body[i++].tok_;
       const_cast<Token*>(ap.Peek())->ws_ = tok->ws_;
       Expand(os, ap);
     } else {
-      os.InsertBack(is.Peek());
-      is.Next();
+      auto tok = Token::New(*body[i++].tok_);
+      tok->loc_.fileName_ = name->loc_.fileName_;
+      tok->loc_.line_ = name->loc_.line_;
+      os.InsertBack(tok);
     }
   }
 
-  os.FinalizeSubst(leadingWS, hs);
+  os.FinalizeSubst(name->ws_, hs);
 }
 
 
@@ -168,7 +175,7 @@ void Preprocessor::Glue(TokenSequence& os, TokenSequence is) {
   auto lhs = os.Back();
   auto rhs = is.Peek();
 
-  auto str = new std::string(lhs->str_ + rhs->str_);
+  auto str = new std::string(*lhs->str_ + *rhs->str_);
   TokenSequence ts;
   Scanner scanner(str, lhs->loc_);
   scanner.Tokenize(ts);
@@ -206,20 +213,20 @@ const Token* Preprocessor::Stringize(TokenSequence is) {
     // and is not the first token of the sequence
     str.append(tok->ws_ && str.size() > 1, ' ');
     if (tok->tag_ == Token::LITERAL || tok->tag_ == Token::C_CONSTANT) {
-      for (auto c: tok->str_) {
+      for (auto c: *tok->str_) {
         if (c == '"' || c == '\\')
           str.push_back('\\');
         str.push_back(c);
       }
     } else {
-      str += tok->str_;
+      str += *tok->str_;
     }
   }
   str.push_back('\"');
 
   auto ret = Token::New(*is.Peek());
   ret->tag_ = Token::LITERAL;
-  ret->str_ = str;
+  ret->str_ = Intern(str);
   return ret;
 }
 
@@ -233,8 +240,10 @@ void Preprocessor::Finalize(TokenSequence os) {
       auto tag = Token::KeyWordTag(tok->str_);
       if (Token::IsKeyWord(tag)) {
         const_cast<Token*>(tok)->tag_ = tag;
-      } else {
-        const_cast<Token*>(tok)->str_ = Scanner(tok).ScanIdentifier();
+      } else if (tok->str_->find('\\') != std::string::npos) {
+        // Universal character names
+        auto str = Scanner(tok).ScanIdentifier();
+        const_cast<Token*>(tok)->str_ = Intern(str);
       }
     }
     if (!tok->loc_.fileName_) {
@@ -253,18 +262,24 @@ void Preprocessor::Process(TokenSequence& os) {
 
   // Becareful about the include order, as include file always puts
   // the file to the header of the token sequence
-  auto wgtccHeaderFile = SearchFile("wgtcc.h", true, false, inFileName);
-  if (!wgtccHeaderFile)
-    Error("can't find header files, try reinstall wgtcc");
-  IncludeFile(is, wgtccHeaderFile);
-  Expand(os, is);
-  Finalize(os);
+  if (!pchLoaded_) {
+    auto wgtccHeaderFile = SearchFile("wgtcc.h", true, false, inFileName);
+    if (!wgtccHeaderFile)
+      Error("can't find header files, try reinstall wgtcc");
+    IncludeFile(is, wgtccHeaderFile);
+  }
+
+  // Tokens restored from precompiled header are finalized already
+  TokenSequence ts;
+  Expand(ts, is);
+  Finalize(ts);
+  os.InsertBack(ts);
 }
 
 
 const Token* Preprocessor::ParseActualParam(TokenSequence& is,
                                             Macro* macro,
-                                            ParamMap& paramMap) {
+                                            ArgList& args) {
   const Token* ret;
   if (macro->Params().size() == 0 && !macro->Variadic()) {
     ret = is.Next();
@@ -293,11 +308,11 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
         if (!macro->Variadic())
           Error(is.Peek(), "too many arguments");
         if (cnt == 0)
-          paramMap.insert(std::make_pair("__VA_ARGS__", ap));
+          args.push_back(ap);
         else
           ap.InsertBack(is.Peek());
       } else {
-        paramMap.insert(std::make_pair(*fp, ap));
+        args.push_back(ap);
         ap = TokenSequence();
         ++fp;
       }
@@ -317,14 +332,14 @@ void Preprocessor::ReplaceDefOp(TokenSequence& is) {
   TokenSequence os;
   while (!is.Empty()) {
     auto tok = is.Next();
-    if (tok->tag_ == Token::IDENTIFIER && tok->str_ == "defined") {
+    if (tok->tag_ == Token::IDENTIFIER && *tok->str_ == "defined") {
       auto hasPar = false;
       if (is.Try('(')) hasPar = true;
       tok = is.Expect(Token::IDENTIFIER);
       auto cons = Token::New(*tok);
       if (hasPar) is.Expect(')');
       cons->tag_ = Token::I_CONSTANT;
-      cons->str_ = FindMacro(tok->str_) ? "1": "0";
+      cons->str_ = Intern(FindMacro(tok->str_) ? "1": "0");
       os.InsertBack(cons);
     } else {
       os.InsertBack(tok);
@@ -341,7 +356,7 @@ void Preprocessor::ReplaceIdent(TokenSequence& is) {
     if (tok->tag_ == Token::IDENTIFIER) {
       auto cons = Token::New(*tok);
       cons->tag_ = Token::I_CONSTANT;
-      cons->str_ = "0";
+      cons->str_ = Intern("0");
       os.InsertBack(cons);
     } else {
       os.InsertBack(tok);
@@ -362,7 +377,7 @@ int Preprocessor::GetDirective(TokenSequence& is) {
   auto tag = is.Peek()->tag_;
   if (tag == Token::IDENTIFIER || Token::IsKeyWord(tag)) {
     auto str = is.Peek()->str_;
-    auto res = directiveMap.find(str);
+    auto res = directiveMap.find(*str);
     if (res == directiveMap.end())
       return Token::PP_NONE;
     return res->second;
@@ -423,8 +438,12 @@ void Preprocessor::ParseDirective(TokenSequence& os,
 
 
 void Preprocessor::ParsePragma(TokenSequence ls) {
-  // TODO(wgtdkp):  
-  ls.Next();
+  auto directive = ls.Next();
+  auto tok = ls.Peek();
+  if (tok->tag_ == Token::IDENTIFIER && *tok->str_ == "once") {
+    AddOnceFile(*directive->loc_.fileName_);
+  }
+  // TODO(wgtdkp): other pragmas are ignored
 }
 
 
@@ -446,11 +465,11 @@ void Preprocessor::ParseLine(TokenSequence ls) {
   int line = 0;
   size_t end = 0;
   try {
-    line = stoi(tok->str_, &end, 10);
+    line = stoi(*tok->str_, &end, 10);
   } catch (const std::out_of_range oor) {
     Error(tok, "line number out of range");
   }
-  if (line == 0 || end != tok->str_.size()) {
+  if (line == 0 || end != tok->str_->size()) {
     Error(tok, "illegal line number");
   }
   
@@ -461,7 +480,7 @@ void Preprocessor::ParseLine(TokenSequence ls) {
   tok = ts.Expect(Token::LITERAL);
   
   // Enusure "s-char-sequence"
-  if (tok->str_.front() != '"' || tok->str_.back() != '"') {
+  if (tok->str_->front() != '"' || tok->str_->back() != '"') {
     Error(tok, "expect s-char-sequence");
   }
 }
@@ -618,7 +637,7 @@ void Preprocessor::ParseEndif(TokenSequence ls) {
 
 // Have Read the '#'
 void Preprocessor::ParseInclude(TokenSequence& is, TokenSequence ls) {
-  bool next = ls.Next()->str_ == "include_next"; // Skip 'include'
+  bool next = *ls.Next()->str_ == "include_next"; // Skip 'include'
   if (!ls.Test(Token::LITERAL) && !ls.Test('<')) {
     TokenSequence ts;
     Expand(ts, ls, true);
@@ -636,6 +655,7 @@ void Preprocessor::ParseInclude(TokenSequence& is, TokenSequence ls) {
     if (fullPath == nullptr)
       Error(tok, "%s: No such file or directory", fileName.c_str());
 
+    UpdateIncludeDepth(tok, fullPath);
     IncludeFile(is, fullPath);
   } else if (tok->tag_ == '<') {
     auto lhs = tok;
@@ -659,6 +679,7 @@ void Preprocessor::ParseInclude(TokenSequence& is, TokenSequence ls) {
     if (fullPath == nullptr) {
       Error(tok, "%s: No such file or directory", fileName.c_str());
     }
+    UpdateIncludeDepth(tok, fullPath);
     IncludeFile(is, fullPath);
   } else {
     Error(tok, "expect filename(string or in '<>')");
@@ -666,6 +687,18 @@ void Preprocessor::ParseInclude(TokenSequence& is, TokenSequence ls) {
 }
 
 
+// As file descriptors are not held anymore,
+// recursive including is detected by nesting depth.
+void Preprocessor::UpdateIncludeDepth(const Token* tok,
+                                      const std::string* fileName) {
+  static const int maxDepth = 200;
+  auto depth = includeDepth_[tok->loc_.fileName_] + 1;
+  if (depth > maxDepth)
+    Error(tok, "#include nested too deeply, may recursive include");
+  includeDepth_[fileName] = depth;
+}
+
+
 void Preprocessor::ParseUndef(TokenSequence ls) {
   ls.Next(); // Skip directive
 
@@ -730,15 +763,133 @@ bool Preprocessor::ParseIdentList(ParamList& params, TokenSequence& is) {
 
 void Preprocessor::IncludeFile(TokenSequence& is,
                                const std::string* fileName) {
+  if (!NeedInclude(*fileName))
+    return;
+
   TokenSequence ts {is.tokList_, is.begin_, is.begin_};
-  Scanner scanner(ReadFile(*fileName), fileName);
-  scanner.Tokenize(ts);
+  auto cached = tokenCache.find(*fileName);
+  if (cached != tokenCache.end() &&
+      cached->second.buf_ == SourceBuffer::Find(*fileName)) {
+    // Tokens may be modified by the expansion, hence copied
+    for (auto tok: cached->second.toks_) {
+      auto copy = Token::New(*tok);
+      copy->loc_.fileName_ = fileName;
+      ts.InsertBack(copy);
+    }
+  } else {
+    Scanner scanner(SourceBuffer::Get(*fileName), fileName);
+    scanner.Tokenize(ts);
+  }
+  if (includeGuards_.find(*fileName) == includeGuards_.end())
+    DetectIncludeGuard(ts, *fileName);
   
   // We done including header file
   is.begin_ = ts.begin_;
 }
 
 
+/*
+ * A file that was included with '#pragma once', or whose guard macro
+ * is still defined, would produce no tokens. So we don't even read it.
+ */
+bool Preprocessor::NeedInclude(const std::string& fileName) {
+  if (onceFiles_.find(fileName) != onceFiles_.end())
+    return false;
+  // The same file by another path, e.g. "./a.h" for "a.h"
+  if (onceIds_.size()) {
+    auto buf = SourceBuffer::TryGet(fileName);
+    if (buf && onceIds_.count(buf->FileId())) {
+      onceFiles_.insert(fileName);
+      return false;
+    }
+  }
+  auto iter = includeGuards_.find(fileName);
+  return iter == includeGuards_.end() || !FindMacro(iter->second);
+}
+
+
+void Preprocessor::AddOnceFile(const std::string& fileName) {
+  onceFiles_.insert(fileName);
+  if (auto buf = SourceBuffer::TryGet(fileName))
+    onceIds_.insert(buf->FileId());
+}
+
+
+static bool IsDirective(const std::vector<const Token*>& line,
+                        const char* name) {
+  return line.size() >= 2 && line[0]->tag_ == '#' &&
+         line[1]->tag_ == Token::IDENTIFIER && *line[1]->str_ == name;
+}
+
+
+// '#ifndef X' or '#if !defined X' or '#if !defined(X)'
+static const Token* GetGuardMacro(const std::vector<const Token*>& line) {
+  if (IsDirective(line, "ifndef")) {
+    if (line.size() == 3 && line[2]->tag_ == Token::IDENTIFIER)
+      return line[2];
+  } else if (IsDirective(line, "if")) {
+    if (line.size() < 5 || line[2]->tag_ != '!' ||
+        line[3]->tag_ != Token::IDENTIFIER || *line[3]->str_ != "defined") {
+      return nullptr;
+    }
+    if (line.size() == 5 && line[4]->tag_ == Token::IDENTIFIER)
+      return line[4];
+    if (line.size() == 7 && line[4]->tag_ == '(' &&
+        line[5]->tag_ == Token::IDENTIFIER && line[6]->tag_ == ')') {
+      return line[5];
+    }
+  }
+  return nullptr;
+}
+
+
+/*
+ * Detect the shape:
+ *   #ifndef X
+ *   ...
+ *   #endif
+ * with nothing but newlines(comments are gone) out of the conditional.
+ * Then including the file again has no effect as long as X is defined.
+ */
+void Preprocessor::DetectIncludeGuard(TokenSequence ts,
+                                      const std::string& fileName) {
+  const Token* guard = nullptr;
+  std::vector<const Token*> line;
+  int depth = 0;
+  bool closed = false;
+  for (auto iter = ts.begin_; ; ++iter) {
+    if (iter != ts.end_ && (*iter)->tag_ != Token::NEW_LINE) {
+      line.push_back(*iter);
+      continue;
+    }
+
+    if (line.size()) {
+      if (closed) // Tokens after the '#endif'
+        return;
+      if (guard == nullptr) {
+        if ((guard = GetGuardMacro(line)) == nullptr)
+          return;
+        depth = 1;
+      } else if (IsDirective(line, "if") || IsDirective(line, "ifdef") ||
+                 IsDirective(line, "ifndef")) {
+        ++depth;
+      } else if (depth == 1 && (IsDirective(line, "elif") ||
+                                IsDirective(line, "else"))) {
+        return;
+      } else if (IsDirective(line, "endif")) {
+        closed = --depth == 0;
+      }
+      line.clear();
+    }
+    if (iter == ts.end_)
+      break;
+  }
+
+  if (closed)
+    includeGuards_[fileName] = guard->str_;
+}
+
+
 static std::string GetDir(const std::string& path) {
   auto pos = path.rfind('/');
   if (pos == std::string::npos)
@@ -747,45 +898,176 @@ static std::string GetDir(const std::string& path) {
 }
 
 
-std::string* Preprocessor::SearchFile(const std::string& name,
-                                      const bool libHeader,
-                                      bool next,
-                                      const std::string& curPath) {
-  if (libHeader && !next) {
-    searchPaths_.push_back(GetDir(curPath));
-  } else {
-    searchPaths_.push_front(GetDir(curPath));
+// Each directory is read at most once per process,
+// unless it is modified(see ForgetModified)
+static const FileSet* ListDir(const std::string& dir) {
+  auto iter = dirCache.find(dir);
+  if (iter != dirCache.end())
+    return iter->second.files_;
+
+  DirEntry entry {nullptr, 0, 0};
+  struct stat st;
+  if (stat(dir.c_str(), &st) == 0) {
+    entry.mtime_ = st.st_mtim.tv_sec;
+    entry.mtimeNsec_ = st.st_mtim.tv_nsec;
+  }
+  auto dp = opendir(dir.c_str());
+  if (dp) {
+    entry.files_ = new FileSet();
+    while (auto ent = readdir(dp))
+      entry.files_->insert(ent->d_name);
+    closedir(dp);
   }
+  dirCache[dir] = entry;
+  return entry.files_;
+}
 
-  PathList::iterator begin, end;
-  auto iter = searchPaths_.begin();
-  for (; iter != searchPaths_.end(); ++iter) {
-    auto dd = open(iter->c_str(), O_RDONLY);
-    if (dd == -1) // TODO(wgtdkp): or ensure it before preprocessing
-      continue;
-    auto fd = openat(dd, name.c_str(), O_RDONLY);
-    close(dd);
-    if (fd != -1) {
-      // Intentional, so that recursive include
-      // will result in running out of file descriptor
-      //close(fd);
-      auto path = *iter + name;
-      if (next) {
-        if (path != curPath)
-          continue;
-        else
-          next = false;
-      } else {
-        if (path == curPath)
-          continue;
-        if (libHeader && !next)
-          searchPaths_.pop_back();
-        else
-          searchPaths_.pop_front();
-        return new std::string(path);
-      }
-    } else if (errno == EMFILE) {
-      Error("may recursive include");
+
+/*
+ * Load and tokenize the file ahead, the tokens are copied out
+ * by IncludeFile(). The compile server warms the headers its
+ * compilations have read, so that later ones needn't read them again.
+ */
+void Preprocessor::WarmFile(const std::string& path) {
+  auto buf = SourceBuffer::TryGet(path);
+  if (buf == nullptr)
+    return;
+  ListDir(GetDir(path));
+  auto& entry = tokenCache[path];
+  if (entry.buf_ == buf)
+    return;
+
+  TokenSequence ts;
+  Scanner(buf, Intern(path)).Tokenize(ts);
+  entry.buf_ = buf;
+  entry.toks_.clear();
+  for (auto iter = ts.begin_; iter != ts.end_; ++iter)
+    entry.toks_.push_back(*iter);
+}
+
+
+void Preprocessor::ForgetModified() {
+  SourceBuffer::ForgetModified();
+  for (auto iter = tokenCache.begin(); iter != tokenCache.end();) {
+    if (SourceBuffer::Find(iter->first) != iter->second.buf_)
+      iter = tokenCache.erase(iter);
+    else
+      ++iter;
+  }
+  // The searches are listed again if any directory is modified,
+  // a missing one has mtime 0
+  for (auto iter = dirCache.begin(); iter != dirCache.end();) {
+    struct stat st;
+    if (stat(iter->first.c_str(), &st) != 0)
+      st.st_mtim = {0, 0};
+    if (st.st_mtim.tv_sec != iter->second.mtime_ ||
+        st.st_mtim.tv_nsec != iter->second.mtimeNsec_) {
+      iter = dirCache.erase(iter);
+      searchCaches.clear();
+    } else {
+      ++iter;
+    }
+  }
+}
+
+
+static bool FileExists(const std::string& path) {
+  auto pos = path.rfind('/');
+  auto entries = ListDir(path.substr(0, pos + 1));
+  return entries && entries->find(path.substr(pos + 1)) != entries->end();
+}
+
+
+static CandidateList FindCandidates(const std::string& name,
+                                    const PathList& paths) {
+  CandidateList candidates;
+  for (const auto& dir: paths) {
+    auto path = dir + name;
+    if (FileExists(path))
+      candidates.push_back(Intern(path));
+  }
+  return candidates;
+}
+
+
+/*
+ * The searches in the search paths are kept with the directory listings,
+ * the server warms those of its compilations (see WarmSearch). Those of
+ * relative search paths are left to the process, they depend on the
+ * working directory.
+ */
+const CandidateList& Preprocessor::FindInPaths(const std::string& name) {
+  if (searchCache_ == nullptr) {
+    searchKey_.clear();
+    for (const auto& dir: searchPaths_)
+      searchKey_ += dir + '\0';
+    searchCache_ = &searchCaches[searchKey_];
+  }
+  auto iter = searchCache_->find(name);
+  if (iter != searchCache_->end())
+    return iter->second;
+
+  bool absolute = true;
+  for (const auto& dir: searchPaths_)
+    absolute = absolute && dir[0] == '/';
+  if (absolute)
+    newSearches.push_back(name + '\0' + searchKey_);
+  auto candidates = FindCandidates(name, searchPaths_);
+  return searchCache_->emplace(name, candidates).first->second;
+}
+
+
+void Preprocessor::WarmSearch(const std::string& search) {
+  auto pos = search.find('\0');
+  if (pos == std::string::npos)
+    return;
+  auto name = search.substr(0, pos);
+  auto& cache = searchCaches[search.substr(pos + 1)];
+  if (cache.count(name))
+    return;
+  PathList paths;
+  for (auto begin = pos + 1; begin < search.size(); ) {
+    auto end = search.find('\0', begin);
+    paths.push_back(search.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  cache.emplace(name, FindCandidates(name, paths));
+}
+
+
+const std::vector<std::string>& Preprocessor::NewSearches() {
+  return newSearches;
+}
+
+
+/*
+ * The directory of the including file is searched first for
+ * "name" or #include_next, and last for <name>. The file itself is never
+ * returned, and #include_next returns the one after it.
+ * Existing paths are cached, so there is no syscall for a name
+ * that has been searched in the same directories.
+ */
+const std::string* Preprocessor::SearchFile(const std::string& name,
+                                            const bool libHeader,
+                                            bool next,
+                                            const std::string& curPath) {
+  CandidateList candidates;
+  auto local = name[0] == '/' ? name: GetDir(curPath) + name;
+  if (FileExists(local))
+    candidates.push_back(Intern(local));
+  if (name[0] != '/') {
+    const auto& found = FindInPaths(name);
+    auto curDirLast = libHeader && !next;
+    auto pos = curDirLast ? candidates.begin(): candidates.end();
+    candidates.insert(pos, found.begin(), found.end());
+  }
+
+  for (auto path: candidates) {
+    if (next) {
+      if (*path == curPath)
+        next = false;
+    } else if (*path != curPath) {
+      return path;
     }
   }
   return nullptr;
@@ -800,7 +1082,7 @@ void Preprocessor::AddMacro(const std::string& name,
   scanner.Tokenize(ts);
   Macro macro(ts, preDef);
 
-  AddMacro(name, macro);
+  AddMacro(Intern(name), macro);
 }
 
 
@@ -825,8 +1107,8 @@ void Preprocessor::Init() {
   
   // The __FILE__ and __LINE__ macro is empty
   // They are handled seperately
-  AddMacro("__FILE__", Macro(TokenSequence(), true));
-  AddMacro("__LINE__", Macro(TokenSequence(), true));
+  AddMacro(Intern("__FILE__"), Macro(TokenSequence(), true));
+  AddMacro(Intern("__LINE__"), Macro(TokenSequence(), true));
 
   AddMacro("__DATE__", Date(), true);
   AddMacro("__STDC__", new std::string("1"), true);
@@ -838,7 +1120,7 @@ void Preprocessor::Init() {
 void Preprocessor::HandleTheFileMacro(TokenSequence& os, const Token* macro) {
   auto file = Token::New(*macro);
   file->tag_ = Token::LITERAL;
-  file->str_ = "\"" + *macro->loc_.fileName_ + "\"";
+  file->str_ = Intern("\"" + *macro->loc_.fileName_ + "\"");
   os.InsertBack(file);
 }
 
@@ -846,7 +1128,7 @@ void Preprocessor::HandleTheFileMacro(TokenSequence& os, const Token* macro) {
 void Preprocessor::HandleTheLineMacro(TokenSequence& os, const Token* macro) {
   auto line = Token::New(*macro);
   line->tag_ = Token::I_CONSTANT;
-  line->str_ = std::to_string(macro->loc_.line_);
+  line->str_ = Intern(std::to_string(macro->loc_.line_));
   os.InsertBack(line);
 }
 
@@ -858,20 +1140,29 @@ void Preprocessor::UpdateFirstTokenLine(TokenSequence ts) {
 }
 
 
-TokenSequence Macro::RepSeq(const std::string* fileName, unsigned line) {
-  // Update line
-  TokenList tl;
-  TokenSequence ret(&tl);
-  ret.Copy(repSeq_);
-  auto ts = ret;
-  while (!ts.Empty()) {
-    auto loc = ts.Peek()->loc_;
-    loc.fileName_ = fileName;
-    loc.line_ = line;
-    ts.UpdateHeadLocation(loc);
-    ts.Next();
+void Macro::Compile(TokenSequence repSeq) {
+  while (!repSeq.Empty()) {
+    auto tok = repSeq.Next();
+    body_.push_back({tok, ParamIndex(tok->str_)});
   }
-  return ret;
+  if (body_.empty())
+    return;
+  for (auto tok: {body_.front().tok_, body_.back().tok_}) {
+    if (tok->tag_ == Token::DSHARP)
+      Error(tok, "'##' cannot appear at either end of macro expansion");
+  }
+}
+
+
+int Macro::ParamIndex(const std::string* name) const {
+  for (size_t i = 0; i < params_.size(); ++i) {
+    if (params_[i] == name)
+      return i;
+  }
+  static auto vaArgs = Intern("__VA_ARGS__");
+  if (variadic_ && name == vaArgs)
+    return params_.size();
+  return -1;
 }
 
 
@@ -881,4 +1172,5 @@ void Preprocessor::AddSearchPath(std::string path) {
   if (path[0] != '/')
     path = "./" + path;
   searchPaths_.push_front(path);
+  searchCache_ = nullptr;
 }
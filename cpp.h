@@ -9,27 +9,81 @@
 #include <set>
 #include <stack>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/types.h>
 
 class Macro;
 struct CondDirective;
 
-typedef std::map<std::string, Macro> MacroMap; 
-typedef std::list<std::string> ParamList;
-typedef std::map<std::string, TokenSequence> ParamMap;
+// Macro names are interned, hence hashed and compared by pointer
+typedef std::unordered_map<const std::string*, Macro> MacroMap;
+// Interned names of the formal parameters
+typedef std::vector<const std::string*> ParamList;
+// Actual arguments, in the order of the formal parameters,
+// followed by that of '__VA_ARGS__'
+typedef std::vector<TokenSequence> ArgList;
 typedef std::stack<CondDirective> PPCondStack;
 typedef std::list<std::string> PathList;
-
-
+// Resolved path -> the include guard macro of the file
+typedef std::unordered_map<std::string, const std::string*> IncludeGuardMap;
+typedef std::unordered_set<std::string> FileSet;
+typedef std::set<std::pair<dev_t, ino_t>> FileIdSet;
+struct DirEntry {
+  FileSet* files_; // nullptr if it can't be opened
+  time_t mtime_;
+  long mtimeNsec_;
+};
+// Directory -> names of entries in it
+typedef std::unordered_map<std::string, DirEntry> DirMap;
+struct TokenCacheEntry {
+  const SourceBuffer* buf_;
+  std::vector<const Token*> toks_;
+};
+// Resolved path -> tokens of the file, filled by the compile server
+typedef std::unordered_map<std::string, TokenCacheEntry> TokenCache;
+typedef std::vector<const std::string*> CandidateList;
+// Name -> existing paths of the name in the search paths, in searching
+// order, empty if there is none.
+typedef std::unordered_map<std::string, CandidateList> SearchCache;
+// Search paths, joined by '\0' -> the names searched in them
+typedef std::unordered_map<std::string, SearchCache> SearchCacheMap;
+
+
+/*
+ * The replacement list is compiled once, when the macro is defined:
+ * each token is paired with the index of the parameter it names
+ * (the index of '__VA_ARGS__' is the number of named parameters).
+ * The tokens are referenced, not copied; Subst() copies only the
+ * tokens it emits.
+ */
 class Macro {
 public:
+  struct Item {
+    const Token* tok_;
+    int param_; // -1 if the token is not a parameter
+  };
+  typedef std::vector<Item> Body;
+
   Macro(const TokenSequence& repSeq, bool preDef=false)
-      : funcLike_(false), variadic_(false),
-        preDef_(preDef), repSeq_(repSeq) {}
+      : funcLike_(false), variadic_(false), preDef_(preDef) {
+    Compile(repSeq);
+  }
 
   Macro(bool variadic, ParamList& params,
         TokenSequence& repSeq, bool preDef=false)
       : funcLike_(true), variadic_(variadic), preDef_(preDef),
-        params_(params), repSeq_(repSeq) {}
+        params_(params) {
+    Compile(repSeq);
+  }
+
+  // A macro compiled before, see PCHReader
+  Macro(bool funcLike, bool variadic,
+        const ParamList& params, const Body& body)
+      : funcLike_(funcLike), variadic_(variadic), preDef_(false),
+        params_(params), body_(body) {}
   
   ~Macro() {}
   bool FuncLike() { return funcLike_; }
@@ -37,14 +91,17 @@ public:
   bool Variadic() { return variadic_; }
   bool PreDef() { return preDef_; }
   ParamList& Params() { return params_; }
-  TokenSequence RepSeq(const std::string* fileName, unsigned line);
+  const Body& GetBody() const { return body_; }
 
 private:
+  void Compile(TokenSequence repSeq);
+  int ParamIndex(const std::string* name) const;
+
   bool funcLike_;
   bool variadic_;
   bool preDef_;
   ParamList params_;
-  TokenSequence repSeq_;
+  Body body_;
 };
 
 
@@ -56,9 +113,13 @@ struct CondDirective {
 
 
 class Preprocessor {
+  friend class PCHWriter;
+  friend class PCHReader;
+
 public:
   Preprocessor(const std::string* fileName)
-      : curLine_(1), lineLine_(0), curCond_(true) {
+      : curLine_(1), lineLine_(0), curCond_(true), pchLoaded_(false),
+        searchCache_(nullptr) {
     // Add predefined
     Init();
   }
@@ -67,13 +128,13 @@ public:
   void Finalize(TokenSequence os);
   void Process(TokenSequence& os);
   void Expand(TokenSequence& os, TokenSequence is, bool inCond=false);
-  void Subst(TokenSequence& os, TokenSequence is,
-             bool leadingWS, const HideSet& hs, ParamMap& params);
+  void Subst(TokenSequence& os, Macro* macro, const Token* name,
+             const HideSet* hs, ArgList& args);
   void Glue(TokenSequence& os, TokenSequence is);
   void Glue(TokenSequence& os, const Token* tok);
   const Token* Stringize(TokenSequence is);
   void Stringize(std::string& str, TokenSequence is);
-  const Token* ParseActualParam(TokenSequence& is, Macro* macro, ParamMap& paramMap);
+  const Token* ParseActualParam(TokenSequence& is, Macro* macro, ArgList& args);
   int GetDirective(TokenSequence& is);
   void ReplaceDefOp(TokenSequence& is);
   void ReplaceIdent(TokenSequence& is);
@@ -91,10 +152,14 @@ public:
   void ParseError(TokenSequence ls);
   void ParsePragma(TokenSequence ls);
   void IncludeFile(TokenSequence& is, const std::string* fileName);
+  void UpdateIncludeDepth(const Token* tok, const std::string* fileName);
+  bool NeedInclude(const std::string& fileName);
+  void AddOnceFile(const std::string& fileName);
+  void DetectIncludeGuard(TokenSequence ts, const std::string& fileName);
   bool ParseIdentList(ParamList& params, TokenSequence& is);
   
 
-  Macro* FindMacro(const std::string& name) {
+  Macro* FindMacro(const std::string* name) {
     auto res = macroMap_.find(name);
     if (res == macroMap_.end())
       return nullptr;
@@ -104,7 +169,7 @@ public:
   void AddMacro(const std::string& name,
                 std::string* text, bool preDef=false);
 
-  void AddMacro(const std::string& name, const Macro& macro) {
+  void AddMacro(const std::string* name, const Macro& macro) {
     auto res = macroMap_.find(name);
     if (res != macroMap_.end()) {
       // TODO(wgtdkp): give warning
@@ -113,7 +178,7 @@ public:
     macroMap_.insert(std::make_pair(name, macro));
   }
 
-  void RemoveMacro(const std::string& name) {
+  void RemoveMacro(const std::string* name) {
     auto res = macroMap_.find(name);
     if (res == macroMap_.end())
       return;
@@ -122,16 +187,24 @@ public:
     macroMap_.erase(res);
   }
 
-  std::string* SearchFile(const std::string& name,
-                          const bool libHeader,
-                          bool next,
-                          const std::string& curPath);
+  const std::string* SearchFile(const std::string& name,
+                                const bool libHeader,
+                                bool next,
+                                const std::string& curPath);
+  const CandidateList& FindInPaths(const std::string& name);
 
   void AddSearchPath(std::string path);
   void HandleTheFileMacro(TokenSequence& os, const Token* macro);
   void HandleTheLineMacro(TokenSequence& os, const Token* macro);
   void UpdateFirstTokenLine(TokenSequence ts);
 
+  // Caches shared by the compilations in a process, see Server
+  static void WarmFile(const std::string& path);
+  static void WarmSearch(const std::string& search);
+  static void ForgetModified();
+  // The searches of this process, to be warmed by the server
+  static const std::vector<std::string>& NewSearches();
+
   bool NeedExpand() const {
     if (ppCondStack_.empty())
       return true;
@@ -146,9 +219,23 @@ private:
   unsigned curLine_;
   unsigned lineLine_;
   bool curCond_;
+  // The precompiled header includes 'wgtcc.h' already
+  bool pchLoaded_;
   
   MacroMap macroMap_;
   PathList searchPaths_;  
+
+  // Multiple-include optimization
+  IncludeGuardMap includeGuards_;
+  FileSet onceFiles_;
+  // The '#pragma once' files, by another path than that in 'onceFiles_'
+  FileIdSet onceIds_;
+
+  // That of 'searchPaths_' in the shared SearchCacheMap
+  SearchCache* searchCache_;
+  std::string searchKey_;
+  // Nesting depth of including, keyed by the file name of tokens
+  std::unordered_map<const std::string*, int> includeDepth_;
 };
 
 #endif
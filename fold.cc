@@ -0,0 +1,432 @@
+#include "fold.h"
+
+#include "token.h"
+
+#include <cmath>
+
+
+// The constant of arithmetic type that 'expr' is, or nullptr
+static Constant* ToArithmConstant(Expr* expr) {
+  auto cons = dynamic_cast<Constant*>(expr);
+  if (!cons || !cons->Type()->ToArithm())
+    return nullptr;
+  if (cons->Type()->ToArithm()->IsComplex())
+    return nullptr;
+  return cons;
+}
+
+
+// 'val' truncated to the width of 'type', then zero extended if
+// 'type' is unsigned and sign extended otherwise
+static long Normalize(unsigned long val, ArithmType* type) {
+  if (type->IsBool())
+    return val != 0;
+  auto bits = type->Width() * 8;
+  if (bits < 64) {
+    val &= (1UL << bits) - 1;
+    if (!type->IsUnsigned() && (val >> (bits - 1)))
+      val |= ~0UL << bits;
+  }
+  return val;
+}
+
+
+static Constant* NewInt(const Token* tok, ArithmType* type,
+                        unsigned long val) {
+  return Constant::New(tok, type->Tag(), Normalize(val, type));
+}
+
+
+// 'val' must be representable in 'type' already
+static Constant* NewFloat(const Token* tok, ArithmType* type, double val) {
+  return Constant::New(tok, type->Tag(), val);
+}
+
+
+static Constant* NewBool(const Token* tok, bool val) {
+  return Constant::New(tok, T_INT, static_cast<long>(val));
+}
+
+
+static bool IsTrue(Constant* cons) {
+  if (cons->Type()->IsFloat())
+    return cons->FVal() != 0;
+  return cons->IVal() != 0;
+}
+
+
+// Computes in 'T', float or double, to round as the target does
+template<typename T>
+static Constant* FoldFloat(const Token* tok, int op,
+                           ArithmType* type, T lhs, T rhs) {
+  switch (op) {
+  case '+': return NewFloat(tok, type, lhs + rhs);
+  case '-': return NewFloat(tok, type, lhs - rhs);
+  case '*': return NewFloat(tok, type, lhs * rhs);
+  case '/': return NewFloat(tok, type, lhs / rhs);
+  case '<': return NewBool(tok, lhs < rhs);
+  case '>': return NewBool(tok, lhs > rhs);
+  case Token::LE: return NewBool(tok, lhs <= rhs);
+  case Token::GE: return NewBool(tok, lhs >= rhs);
+  case Token::EQ: return NewBool(tok, lhs == rhs);
+  case Token::NE: return NewBool(tok, lhs != rhs);
+  default: return nullptr;
+  }
+}
+
+
+/*
+ * 'type' is the type of the operands, except that the right operand
+ * of a shift has its own type. Returns nullptr if the operation is
+ * undefined, the expression is left for the target then.
+ */
+static Constant* FoldInt(const Token* tok, int op,
+                         ArithmType* type, long lhs, long rhs) {
+  unsigned long ulhs = lhs, urhs = rhs;
+  auto isUnsigned = type->IsUnsigned();
+  long bits = type->Width() * 8;
+
+  switch (op) {
+  case '+': return NewInt(tok, type, ulhs + urhs);
+  case '-': return NewInt(tok, type, ulhs - urhs);
+  case '*': return NewInt(tok, type, ulhs * urhs);
+  case '&': return NewInt(tok, type, ulhs & urhs);
+  case '|': return NewInt(tok, type, ulhs | urhs);
+  case '^': return NewInt(tok, type, ulhs ^ urhs);
+  case '/': case '%':
+    if (rhs == 0)
+      return nullptr;
+    if (isUnsigned)
+      return NewInt(tok, type, op == '/' ? ulhs / urhs: ulhs % urhs);
+    // The minimum value divided by -1 overflows
+    if (rhs == -1 && lhs == Normalize(1UL << (bits - 1), type))
+      return nullptr;
+    return NewInt(tok, type, op == '/' ? lhs / rhs: lhs % rhs);
+  case Token::LEFT: case Token::RIGHT:
+    if (rhs < 0 || rhs >= bits)
+      return nullptr;
+    if (op == Token::LEFT)
+      return NewInt(tok, type, ulhs << rhs);
+    return NewInt(tok, type, isUnsigned ? ulhs >> rhs: lhs >> rhs);
+  case '<':
+    return NewBool(tok, isUnsigned ? ulhs < urhs: lhs < rhs);
+  case '>':
+    return NewBool(tok, isUnsigned ? ulhs > urhs: lhs > rhs);
+  case Token::LE:
+    return NewBool(tok, isUnsigned ? ulhs <= urhs: lhs <= rhs);
+  case Token::GE:
+    return NewBool(tok, isUnsigned ? ulhs >= urhs: lhs >= rhs);
+  case Token::EQ: return NewBool(tok, lhs == rhs);
+  case Token::NE: return NewBool(tok, lhs != rhs);
+  default: return nullptr;
+  }
+}
+
+
+static Constant* FoldCast(const Token* tok, ArithmType* type,
+                          Constant* cons) {
+  auto srcType = cons->Type()->ToArithm();
+  if (srcType->IsFloat()) {
+    auto val = cons->FVal();
+    if (type->IsFloat()) {
+      if (type->Width() == 4)
+        return NewFloat(tok, type, static_cast<float>(val));
+      return NewFloat(tok, type, val);
+    }
+    if (type->IsBool())
+      return NewInt(tok, type, val != 0);
+    // Converting a value out of the range is undefined
+    auto bits = type->Width() * 8;
+    if (type->IsUnsigned()) {
+      if (!(val > -1 && val < std::ldexp(1.0, bits)))
+        return nullptr;
+      return NewInt(tok, type, static_cast<unsigned long>(val));
+    }
+    auto limit = std::ldexp(1.0, bits - 1);
+    if (!(val >= -limit && val < limit))
+      return nullptr;
+    return NewInt(tok, type, static_cast<long>(val));
+  }
+
+  auto val = cons->IVal();
+  if (type->IsFloat()) {
+    // Converted once, from the exact integer
+    if (srcType->IsUnsigned()) {
+      auto uval = static_cast<unsigned long>(val);
+      if (type->Width() == 4)
+        return NewFloat(tok, type, static_cast<float>(uval));
+      return NewFloat(tok, type, static_cast<double>(uval));
+    }
+    if (type->Width() == 4)
+      return NewFloat(tok, type, static_cast<float>(val));
+    return NewFloat(tok, type, static_cast<double>(val));
+  }
+  return NewInt(tok, type, val);
+}
+
+
+static bool IsZero(Constant* cons) {
+  if (cons->Type()->IsFloat())
+    return cons->FVal() == 0 && !std::signbit(cons->FVal());
+  return cons->IVal() == 0;
+}
+
+
+static bool IsOne(Constant* cons) {
+  if (cons->Type()->IsFloat())
+    return cons->FVal() == 1;
+  return cons->IVal() == 1;
+}
+
+
+// Whether evaluating 'expr' may do more than computing its value
+bool Folder::HasSideEffects(Expr* expr) {
+  if (expr->IsVolatileQualified())
+    return true;
+  if (auto binary = dynamic_cast<BinaryOp*>(expr)) {
+    if (binary->op_ == '=')
+      return true;
+    if (HasSideEffects(binary->lhs_))
+      return true;
+    return binary->op_ != '.' && HasSideEffects(binary->rhs_);
+  }
+  if (auto unary = dynamic_cast<UnaryOp*>(expr)) {
+    switch (unary->op_) {
+    case Token::PREFIX_INC: case Token::PREFIX_DEC:
+    case Token::POSTFIX_INC: case Token::POSTFIX_DEC:
+      return true;
+    default:
+      return HasSideEffects(unary->operand_);
+    }
+  }
+  if (auto cond = dynamic_cast<ConditionalOp*>(expr)) {
+    return HasSideEffects(cond->cond_) ||
+           HasSideEffects(cond->exprTrue_) ||
+           HasSideEffects(cond->exprFalse_);
+  }
+  return dynamic_cast<FuncCall*>(expr) != nullptr;
+}
+
+
+Expr* Folder::Simplify(BinaryOp* binary) {
+  auto op = binary->op_;
+  auto tok = binary->Tok();
+  auto lhs = ToArithmConstant(binary->lhs_);
+  auto rhs = ToArithmConstant(binary->rhs_);
+
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR) {
+    // The right operand is not evaluated
+    if (lhs && IsTrue(lhs) == (op == Token::LOGICAL_OR))
+      return NewBool(tok, IsTrue(lhs));
+    if (lhs && rhs)
+      return NewBool(tok, IsTrue(rhs));
+    return binary;
+  }
+
+  auto type = binary->Type()->ToArithm();
+  if (lhs && rhs) {
+    auto opType = lhs->Type()->ToArithm();
+    Constant* cons;
+    if (opType->IsFloat() && opType->Width() == 4) {
+      cons = FoldFloat<float>(tok, op, opType, lhs->FVal(), rhs->FVal());
+    } else if (opType->IsFloat()) {
+      cons = FoldFloat<double>(tok, op, opType, lhs->FVal(), rhs->FVal());
+    } else {
+      cons = FoldInt(tok, op, opType, lhs->IVal(), rhs->IVal());
+    }
+    if (cons)
+      return cons;
+    return binary;
+  }
+
+  // The constant operand of a commutative operation goes right
+  switch (op) {
+  case '+': case '*': case '&': case '|': case '^':
+    if (type && lhs && !rhs) {
+      std::swap(binary->lhs_, binary->rhs_);
+      std::swap(lhs, rhs);
+    }
+    break;
+  }
+  if (!rhs || binary->lhs_->Type() != binary->Type())
+    return binary;
+
+  auto flt = rhs->Type()->IsFloat();
+  auto noSideEffects = !HasSideEffects(binary->lhs_);
+  switch (op) {
+  case '+': case '|': case '^':
+  case Token::LEFT: case Token::RIGHT:
+    // x + 0.0 is not x if x is -0.0
+    if (!flt && IsZero(rhs))
+      return binary->lhs_;
+    break;
+  case '-':
+    if (IsZero(rhs))
+      return binary->lhs_;
+    break;
+  case '*':
+    if (IsOne(rhs))
+      return binary->lhs_;
+    if (!flt && IsZero(rhs) && noSideEffects)
+      return NewInt(tok, type, 0);
+    break;
+  case '/':
+    if (IsOne(rhs))
+      return binary->lhs_;
+    break;
+  case '%':
+    if (!flt && IsOne(rhs) && noSideEffects)
+      return NewInt(tok, type, 0);
+    break;
+  case '&':
+    if (IsZero(rhs) && noSideEffects)
+      return NewInt(tok, type, 0);
+    if (rhs->IVal() == Normalize(~0UL, type))
+      return binary->lhs_;
+    break;
+  }
+  return binary;
+}
+
+
+Expr* Folder::Simplify(UnaryOp* unary) {
+  auto op = unary->op_;
+  auto tok = unary->Tok();
+  auto type = unary->Type()->ToArithm();
+  auto cons = ToArithmConstant(unary->operand_);
+
+  if (cons) {
+    switch (op) {
+    case Token::PLUS:
+      return cons;
+    case Token::MINUS:
+      if (type->IsFloat())
+        return NewFloat(tok, type, -cons->FVal());
+      return NewInt(tok, type, 0UL - cons->IVal());
+    case '~':
+      return NewInt(tok, type, ~cons->IVal());
+    case '!':
+      return NewBool(tok, !IsTrue(cons));
+    case Token::CAST:
+      // Out of range conversions are left to the runtime
+      if (type && !type->IsComplex()) {
+        if (auto folded = FoldCast(tok, type, cons))
+          return folded;
+      }
+      break;
+    }
+    return unary;
+  }
+
+  switch (op) {
+  case Token::PLUS:
+    return unary->operand_;
+  case Token::MINUS: case '~': {
+    // -(-x) and ~(~x)
+    auto inner = dynamic_cast<UnaryOp*>(unary->operand_);
+    if (inner && inner->op_ == op &&
+        inner->operand_->Type() == unary->Type()) {
+      return inner->operand_;
+    }
+    break;
+  }
+  }
+  return unary;
+}
+
+
+void Folder::VisitBinaryOp(BinaryOp* binary) {
+  binary->lhs_ = Fold(binary->lhs_);
+  // The right operand of '.' is a member
+  if (binary->op_ != '.')
+    binary->rhs_ = Fold(binary->rhs_);
+  result_ = Simplify(binary);
+}
+
+
+void Folder::VisitUnaryOp(UnaryOp* unary) {
+  unary->operand_ = Fold(unary->operand_);
+  result_ = Simplify(unary);
+}
+
+
+void Folder::VisitConditionalOp(ConditionalOp* condOp) {
+  condOp->cond_ = Fold(condOp->cond_);
+  auto cond = ToArithmConstant(condOp->cond_);
+  if (cond) {
+    auto expr = IsTrue(cond) ? condOp->exprTrue_: condOp->exprFalse_;
+    // The arms of a pointer type may differ in qualification
+    if (expr->Type() == condOp->Type()) {
+      result_ = Fold(expr);
+      return;
+    }
+  }
+  condOp->exprTrue_ = Fold(condOp->exprTrue_);
+  condOp->exprFalse_ = Fold(condOp->exprFalse_);
+  result_ = condOp;
+}
+
+
+void Folder::VisitFuncCall(FuncCall* funcCall) {
+  funcCall->designator_ = Fold(funcCall->designator_);
+  for (auto& arg: funcCall->args_)
+    arg = Fold(arg);
+  result_ = funcCall;
+}
+
+
+void Folder::VisitEnumerator(Enumerator* enumer) {
+  result_ = Constant::New(enumer->Tok(), T_INT,
+                          static_cast<long>(enumer->Val()));
+}
+
+
+void Folder::FoldStmt(Stmt*& stmt) {
+  if (auto expr = dynamic_cast<Expr*>(stmt)) {
+    stmt = Fold(expr);
+  } else {
+    Visit(stmt);
+  }
+}
+
+
+void Folder::VisitDeclaration(Declaration* decl) {
+  // The set is ordered by offset, which the fold doesn't change
+  InitList inits;
+  for (auto init: decl->inits_) {
+    init.expr_ = Fold(init.expr_);
+    inits.insert(init);
+  }
+  decl->inits_.swap(inits);
+}
+
+
+void Folder::VisitIfStmt(IfStmt* ifStmt) {
+  ifStmt->cond_ = Fold(ifStmt->cond_);
+  FoldStmt(ifStmt->then_);
+  if (ifStmt->else_)
+    FoldStmt(ifStmt->else_);
+}
+
+
+void Folder::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  switchStmt->select_ = Fold(switchStmt->select_);
+  FoldStmt(switchStmt->body_);
+}
+
+
+void Folder::VisitReturnStmt(ReturnStmt* returnStmt) {
+  if (returnStmt->expr_)
+    returnStmt->expr_ = Fold(returnStmt->expr_);
+}
+
+
+void Folder::VisitCompoundStmt(CompoundStmt* compStmt) {
+  for (auto& stmt: compStmt->stmts_)
+    FoldStmt(stmt);
+}
+
+
+void Folder::VisitFuncDef(FuncDef* funcDef) {
+  Visit(funcDef->body_);
+}
@@ -0,0 +1,59 @@
+#ifndef _WGTCC_FOLD_H_
+#define _WGTCC_FOLD_H_
+
+#include "ast.h"
+#include "visitor.h"
+
+
+/*
+ * Constant folding and algebraic simplification of a function body,
+ * after it is parsed and type checked. A subexpression whose operands
+ * are arithmetic constants is replaced by its value, computed exactly
+ * in the type of the expression; the identities that hold for any
+ * operand (x + 0, x * 1, -(-x), x << 0, ...) drop the operation.
+ * A folded expression keeps its type, so both backends are unaware
+ * of the pass.
+ */
+class Folder: public Visitor {
+public:
+  Folder() {}
+  virtual ~Folder() {}
+
+  void Visit(ASTNode* node) { node->Accept(this); }
+  // Returns the folded 'expr', the children are folded in place
+  Expr* Fold(Expr* expr) {
+    expr->Accept(this);
+    return result_;
+  }
+
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* cond);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident) { result_ = ident; }
+  virtual void VisitObject(Object* obj) { result_ = obj; }
+  virtual void VisitConstant(Constant* cons) { result_ = cons; }
+  virtual void VisitTempVar(TempVar* tempVar) { result_ = tempVar; }
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+  virtual void VisitFuncDef(FuncDef* funcDef);
+  virtual void VisitTranslationUnit(TranslationUnit* unit) {}
+
+private:
+  void FoldStmt(Stmt*& stmt);
+  Expr* Simplify(BinaryOp* binary);
+  Expr* Simplify(UnaryOp* unary);
+  static bool HasSideEffects(Expr* expr);
+
+  Expr* result_ {nullptr};
+};
+
+#endif
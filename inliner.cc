@@ -0,0 +1,280 @@
+#include "inliner.h"
+
+#include "ast.h"
+
+#include <algorithm>
+#include <map>
+
+
+extern int inlineLimit;
+
+struct Candidate {
+  IRFunc* func_;
+  int cost_;
+  bool always_;
+};
+
+// By the names of the functions
+static std::map<std::string, Candidate> candidates;
+// A caller grows by no more than this times the limit
+static const int maxGrowth = 8;
+
+
+static int Cost(IRFunc* func) {
+  int cost = 0;
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->op_ != Opcode::PHI && inst->op_ != Opcode::JMP)
+        ++cost;
+    }
+  }
+  return cost;
+}
+
+
+/*
+ * Copies the blocks of 'from' to the new blocks of 'to', appended to
+ * its list. A register is renumbered by 'regs', -1 if not mapped yet;
+ * the slots are all new.
+ */
+static BlockList CopyBlocks(IRFunc* from, IRFunc* to,
+                            std::vector<int>& regs) {
+  auto mapReg = [&](int reg) {
+    if (regs[reg] < 0)
+      regs[reg] = to->NewReg(from->RegType(reg));
+    return regs[reg];
+  };
+  std::vector<int> slots;
+  for (const auto& slot: from->slots_)
+    slots.push_back(to->NewSlot(slot.size_, slot.align_));
+  std::map<BasicBlock*, BasicBlock*> blocks;
+  BlockList copies;
+  for (auto bb: from->blocks_) {
+    copies.push_back(to->NewBlock());
+    blocks[bb] = copies.back();
+  }
+
+  for (auto bb: from->blocks_) {
+    auto& insts = blocks[bb]->insts_;
+    for (auto inst: bb->insts_) {
+      auto copy = new Inst(inst->op_, inst->type_);
+      copy->srcType_ = inst->srcType_;
+      copy->cond_ = inst->cond_;
+      copy->volatile_ = inst->volatile_;
+      copy->size_ = inst->size_;
+      copy->tok_ = inst->tok_;
+      if (inst->HasDst())
+        copy->dst_ = mapReg(inst->dst_);
+      for (auto arg: inst->args_) {
+        if (arg.IsReg())
+          arg = Operand::Reg(mapReg(arg.Reg()));
+        copy->args_.push_back(arg);
+      }
+      copy->mem_ = inst->mem_;
+      if (copy->mem_.base_ == MemRef::REG)
+        copy->mem_.reg_ = mapReg(copy->mem_.reg_);
+      else if (copy->mem_.base_ == MemRef::SLOT)
+        copy->mem_.reg_ = slots[copy->mem_.reg_];
+      if (copy->mem_.index_ >= 0)
+        copy->mem_.index_ = mapReg(copy->mem_.index_);
+      for (int i = 0; i < 2; ++i) {
+        if (inst->targets_[i])
+          copy->targets_[i] = blocks[inst->targets_[i]];
+      }
+      for (auto target: inst->table_)
+        copy->table_.push_back(blocks[target]);
+      for (auto pred: inst->incoming_)
+        copy->incoming_.push_back(blocks[pred]);
+      if (inst->call_) {
+        copy->call_ = new CallInfo(*inst->call_);
+        if (copy->call_->callee_.IsReg()) {
+          auto reg = mapReg(copy->call_->callee_.Reg());
+          copy->call_->callee_ = Operand::Reg(reg);
+        }
+      }
+      insts.push_back(copy);
+    }
+  }
+  return copies;
+}
+
+
+static IRFunc* Copy(IRFunc* func) {
+  auto copy = new IRFunc(func->def_);
+  std::vector<int> regs(func->NumRegs(), -1);
+  for (const auto& param: func->params_) {
+    regs[param.reg_] = copy->NewReg(func->RegType(param.reg_));
+    copy->params_.push_back({regs[param.reg_], -1, 0});
+  }
+  CopyBlocks(func, copy, regs);
+  copy->retType_ = func->retType_;
+  copy->ssa_ = true;
+  copy->ComputePreds();
+  return copy;
+}
+
+
+void AddInlineCandidate(IRFunc* func) {
+  auto def = func->def_;
+  auto spec = def->FuncType()->FuncSpec();
+  auto always = (spec & F_ALWAYS_INLINE) != 0;
+  if (spec & F_NOINLINE)
+    return;
+  if (!always && !(spec & F_INLINE) && def->Linkage() != L_INTERNAL)
+    return;
+  // A struct/union returned, or passed in memory
+  if (func->retPtr_ >= 0 || func->retTypes_.size())
+    return;
+  for (const auto& param: func->params_) {
+    if (param.reg_ < 0)
+      return;
+  }
+  // The parameters are defined before the entry is jumped to
+  if (func->blocks_[0]->preds_.size())
+    return;
+  // The value of the call is defined by the returns
+  auto returns = std::any_of(func->blocks_.begin(), func->blocks_.end(),
+      [](BasicBlock* bb) { return bb->Terminator()->op_ == Opcode::RET; });
+  if (!returns)
+    return;
+
+  auto cost = Cost(func);
+  auto limit = spec & F_INLINE ? inlineLimit: inlineLimit / 4;
+  if (!always && cost > limit)
+    return;
+  candidates[def->Name()] = {Copy(func), cost, always};
+}
+
+
+// The arguments of the call are those of the parameters of 'callee'
+static bool Matches(Inst* call, IRFunc* callee) {
+  auto info = call->call_;
+  if (info->variadic_ || info->retStruct_ || call->type_ != callee->retType_)
+    return false;
+  if (info->args_.size() != callee->params_.size())
+    return false;
+  for (size_t i = 0; i < info->args_.size(); ++i) {
+    const auto& arg = info->args_[i];
+    auto type = callee->RegType(callee->params_[i].reg_);
+    if (arg.size_ || (arg.type_ != type &&
+        (IsFloat(type) || SizeOf(type) >= 4 || arg.type_ != IRType::I32))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/*
+ * Replaces the call at 'pos' of 'bb' by the body of 'callee'. The
+ * instructions after the call are moved to a new block, which the
+ * returns jump to, and the new block is returned.
+ */
+static BasicBlock* InlineCall(IRFunc* func, BasicBlock* bb,
+                              size_t pos, IRFunc* callee) {
+  auto call = bb->insts_[pos];
+  auto cont = func->NewBlock();
+  cont->insts_.assign(bb->insts_.begin() + pos + 1, bb->insts_.end());
+  bb->insts_.erase(bb->insts_.begin() + pos, bb->insts_.end());
+  for (auto succ: cont->Succs()) {
+    for (auto inst: succ->insts_) {
+      if (inst->op_ != Opcode::PHI)
+        break;
+      std::replace(inst->incoming_.begin(), inst->incoming_.end(), bb, cont);
+    }
+  }
+
+  // The parameters, narrow integers are passed extended to 32 bits
+  std::vector<int> regs(callee->NumRegs(), -1);
+  for (size_t i = 0; i < callee->params_.size(); ++i) {
+    auto reg = callee->params_[i].reg_;
+    auto type = callee->RegType(reg);
+    auto argType = call->call_->args_[i].type_;
+    auto arg = call->args_[i];
+    Inst* inst;
+    if (argType != type && arg.IsReg()) {
+      inst = new Inst(Opcode::TRUNC, type);
+      inst->srcType_ = argType;
+    } else {
+      inst = new Inst(Opcode::MOV, type);
+    }
+    regs[reg] = inst->dst_ = func->NewReg(type);
+    inst->args_.push_back(arg);
+    inst->tok_ = call->tok_;
+    bb->insts_.push_back(inst);
+  }
+  auto blocks = CopyBlocks(callee, func, regs);
+  auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+  jmp->targets_[0] = blocks[0];
+  jmp->tok_ = call->tok_;
+  bb->insts_.push_back(jmp);
+
+  Inst* phi = nullptr;
+  if (call->HasDst()) {
+    phi = new Inst(Opcode::PHI, call->type_);
+    phi->dst_ = call->dst_;
+    cont->insts_.insert(cont->insts_.begin(), phi);
+  }
+  for (auto copy: blocks) {
+    auto ret = copy->Terminator();
+    if (ret->op_ != Opcode::RET)
+      continue;
+    if (phi) {
+      // Falling off the end of a function returns an undefined value
+      phi->args_.push_back(ret->args_.size() ? ret->args_[0]:
+                                               Operand::Imm(0));
+      phi->incoming_.push_back(copy);
+    }
+    auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+    jmp->targets_[0] = cont;
+    jmp->tok_ = ret->tok_;
+    copy->insts_.back() = jmp;
+    delete ret;
+  }
+  delete call;
+
+  // The body and 'cont' follow 'bb'
+  auto& list = func->blocks_;
+  list.resize(list.size() - blocks.size() - 1);
+  auto iter = std::find(list.begin(), list.end(), bb) + 1;
+  iter = list.insert(iter, blocks.begin(), blocks.end());
+  list.insert(iter + blocks.size(), cont);
+  return cont;
+}
+
+
+void InlineCalls(IRFunc* func) {
+  if (candidates.empty())
+    return;
+  auto budget = maxGrowth * inlineLimit;
+  bool changed = false;
+  BlockList work(func->blocks_.rbegin(), func->blocks_.rend());
+  while (work.size()) {
+    auto bb = work.back();
+    work.pop_back();
+    for (size_t i = 0; i < bb->insts_.size(); ++i) {
+      auto inst = bb->insts_[i];
+      if (inst->op_ != Opcode::CALL)
+        continue;
+      auto iter = candidates.find(inst->call_->sym_);
+      if (iter == candidates.end())
+        continue;
+      const auto& candidate = iter->second;
+      if (!Matches(inst, candidate.func_))
+        continue;
+      if (!candidate.always_) {
+        if (candidate.cost_ > budget)
+          continue;
+        budget -= candidate.cost_;
+      }
+      // The copied body has been inlined into already
+      work.push_back(InlineCall(func, bb, i, candidate.func_));
+      changed = true;
+      break;
+    }
+  }
+  if (changed) {
+    func->ComputePreds();
+    func->SortIncoming();
+  }
+}
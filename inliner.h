@@ -0,0 +1,22 @@
+#ifndef _WGTCC_INLINER_H_
+#define _WGTCC_INLINER_H_
+
+#include "ir.h"
+
+
+/*
+ * Inlining of the direct calls at -O1. After a function is optimized,
+ * a copy of it is kept if it may be inlined: it is 'inline' or of
+ * internal linkage, not 'noinline', and its cost, the number of its
+ * instructions, is within the limit ('-inline-limit', a quarter of it
+ * for a function that is not 'inline'; no limit for 'always_inline').
+ * Only the functions defined before the caller are inlined, so
+ * a recursion is never expanded. A callee of internal linkage is
+ * emitted only if a call or a reference to it is left (see HeldCode).
+ */
+void AddInlineCandidate(IRFunc* func);
+
+// Inlines the calls to the candidates, the function is in SSA form
+void InlineCalls(IRFunc* func);
+
+#endif
@@ -0,0 +1,481 @@
+#include "ir.h"
+
+#include "ast.h"
+#include "ssa.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstring>
+#include <set>
+
+
+Operand Operand::Float(double val, IRType type) {
+  long bits = 0;
+  if (type == IRType::F32) {
+    float fval = val;
+    int32_t ival;
+    memcpy(&ival, &fval, sizeof(ival));
+    bits = static_cast<uint32_t>(ival);
+  } else {
+    memcpy(&bits, &val, sizeof(bits));
+  }
+  return Imm(bits);
+}
+
+
+std::vector<int> Inst::Uses() const {
+  std::vector<int> uses;
+  for (const auto& arg: args_) {
+    if (arg.IsReg())
+      uses.push_back(arg.Reg());
+  }
+  if (mem_.base_ == MemRef::REG)
+    uses.push_back(mem_.reg_);
+  if (mem_.index_ >= 0)
+    uses.push_back(mem_.index_);
+  if (call_ && call_->callee_.IsReg())
+    uses.push_back(call_->callee_.Reg());
+  return uses;
+}
+
+
+BasicBlock::~BasicBlock() {
+  for (auto inst: insts_)
+    delete inst;
+}
+
+
+std::vector<BasicBlock*> BasicBlock::Succs() {
+  std::vector<BasicBlock*> succs;
+  auto term = Terminator();
+  if (term == nullptr)
+    return succs;
+  if (term->op_ == Opcode::JMP) {
+    succs.push_back(term->targets_[0]);
+  } else if (term->op_ == Opcode::BR) {
+    succs.push_back(term->targets_[0]);
+    if (term->targets_[1] != term->targets_[0])
+      succs.push_back(term->targets_[1]);
+  } else if (term->op_ == Opcode::SWITCH) {
+    succs.push_back(term->targets_[0]);
+    for (auto target: term->table_) {
+      if (std::find(succs.begin(), succs.end(), target) == succs.end())
+        succs.push_back(target);
+    }
+  }
+  return succs;
+}
+
+
+IRFunc::~IRFunc() {
+  for (auto bb: blocks_)
+    delete bb;
+}
+
+
+void IRFunc::ComputePreds() {
+  for (auto bb: blocks_)
+    bb->preds_.clear();
+  for (auto bb: blocks_) {
+    for (auto succ: bb->Succs())
+      succ->preds_.push_back(bb);
+  }
+}
+
+
+void IRFunc::SortIncoming() {
+  for (auto bb: blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->op_ != Opcode::PHI)
+        break;
+      std::vector<Operand> args;
+      for (auto pred: bb->preds_) {
+        auto iter = std::find(inst->incoming_.begin(),
+                              inst->incoming_.end(), pred);
+        assert(iter != inst->incoming_.end());
+        args.push_back(inst->args_[iter - inst->incoming_.begin()]);
+      }
+      inst->args_ = args;
+      inst->incoming_ = bb->preds_;
+    }
+  }
+}
+
+
+// The block that 'bb' eventually jumps to, if it does nothing else
+static BasicBlock* JumpTarget(BasicBlock* bb) {
+  for (int i = 0; i < 16; ++i) {
+    if (bb->insts_.size() != 1 || bb->insts_[0]->op_ != Opcode::JMP)
+      break;
+    auto target = bb->insts_[0]->targets_[0];
+    if (target == bb)
+      break;
+    bb = target;
+  }
+  return bb;
+}
+
+
+void IRFunc::SimplifyCFG() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto bb: blocks_) {
+      auto term = bb->Terminator();
+      assert(term);
+      for (auto& target: term->targets_) {
+        if (target && JumpTarget(target) != target) {
+          target = JumpTarget(target);
+          changed = true;
+        }
+      }
+      for (auto& target: term->table_) {
+        if (JumpTarget(target) != target) {
+          target = JumpTarget(target);
+          changed = true;
+        }
+      }
+      if (term->op_ == Opcode::BR && term->targets_[0] == term->targets_[1]) {
+        auto target = term->targets_[0];
+        bb->insts_.back() = new Inst(Opcode::JMP, IRType::VOID);
+        bb->insts_.back()->targets_[0] = target;
+        bb->insts_.back()->tok_ = term->tok_;
+        delete term;
+        changed = true;
+      }
+    }
+
+    // Reachable blocks, in the original order
+    std::set<BasicBlock*> reachable;
+    std::vector<BasicBlock*> stack {blocks_[0]};
+    while (stack.size()) {
+      auto bb = stack.back();
+      stack.pop_back();
+      if (!reachable.insert(bb).second)
+        continue;
+      for (auto succ: bb->Succs())
+        stack.push_back(succ);
+    }
+    BlockList blocks;
+    for (auto bb: blocks_) {
+      if (reachable.count(bb))
+        blocks.push_back(bb);
+      else
+        delete bb;
+    }
+    changed = changed || blocks.size() != blocks_.size();
+    blocks_ = blocks;
+
+    ComputePreds();
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      auto bb = blocks_[i];
+      auto term = bb->Terminator();
+      if (term->op_ != Opcode::JMP)
+        continue;
+      auto succ = term->targets_[0];
+      if (succ == bb || succ == blocks_[0] || succ->preds_.size() != 1)
+        continue;
+      bb->insts_.pop_back();
+      delete term;
+      bb->insts_.insert(bb->insts_.end(),
+                        succ->insts_.begin(), succ->insts_.end());
+      succ->insts_.clear();
+      // 'succ' jumps to itself, as it is dropped at next iteration
+      auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+      jmp->targets_[0] = succ;
+      succ->insts_.push_back(jmp);
+      succ->preds_.clear();
+      changed = true;
+      // 'bb' may be merged with its new successor
+      --i;
+      for (auto s: bb->Succs()) {
+        for (auto& pred: s->preds_) {
+          if (pred == succ)
+            pred = bb;
+        }
+      }
+    }
+  }
+}
+
+
+/*
+ * Textual form
+ */
+
+static const char* TypeName(IRType type) {
+  static const char* names[] = {"void", "i8", "i16", "i32", "i64",
+                                "f32", "f64"};
+  return names[static_cast<int>(type)];
+}
+
+
+static const char* OpName(Opcode op) {
+  static const char* names[] = {
+    "mov", "add", "sub", "mul", "div", "udiv", "mod", "umod",
+    "and", "or", "xor", "shl", "shr", "sar", "neg", "not", "set",
+    "sext", "zext", "trunc", "itof", "utof", "ftoi", "ftou", "fcvt",
+    "load", "store", "lea", "copy", "zero", "call", "jmp", "br", "ret",
+    "switch", "phi",
+  };
+  return names[static_cast<int>(op)];
+}
+
+
+static const char* CondName(Cond cond) {
+  static const char* names[] = {"eq", "ne", "lt", "le", "gt", "ge",
+                                "ult", "ule", "ugt", "uge"};
+  return names[static_cast<int>(cond)];
+}
+
+
+static std::string OperandStr(const Operand& opd, IRType type) {
+  if (opd.IsReg())
+    return "%" + std::to_string(opd.Reg());
+  if (opd.IsNone())
+    return "_";
+  if (IsFloat(type)) {
+    double val;
+    if (type == IRType::F32) {
+      float fval;
+      int32_t bits = opd.Imm();
+      memcpy(&fval, &bits, sizeof(fval));
+      val = fval;
+    } else {
+      long bits = opd.Imm();
+      memcpy(&val, &bits, sizeof(val));
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", val);
+    return buf;
+  }
+  return std::to_string(opd.Imm());
+}
+
+
+static std::string MemStr(const MemRef& mem) {
+  std::string str = "[";
+  switch (mem.base_) {
+  case MemRef::REG: str += "%" + std::to_string(mem.reg_); break;
+  case MemRef::SLOT: str += "slot" + std::to_string(mem.reg_); break;
+  case MemRef::SYM: str += mem.sym_; break;
+  default: break;
+  }
+  if (mem.index_ >= 0) {
+    str += " + %" + std::to_string(mem.index_);
+    if (mem.scale_ != 1)
+      str += " * " + std::to_string(mem.scale_);
+  }
+  if (mem.disp_)
+    str += (mem.disp_ > 0 ? " + ": " - ") + std::to_string(labs(mem.disp_));
+  return str + "]";
+}
+
+
+void IRFunc::Print(FILE* fp) const {
+  fprintf(fp, "function %s(", def_->Name().c_str());
+  for (size_t i = 0; i < params_.size(); ++i) {
+    if (i) fprintf(fp, ", ");
+    if (params_[i].reg_ >= 0) {
+      auto reg = params_[i].reg_;
+      fprintf(fp, "%s %%%d", TypeName(RegType(reg)), reg);
+    } else {
+      fprintf(fp, "slot%d", params_[i].slot_);
+    }
+  }
+  fprintf(fp, "): %s {\n", TypeName(retType_));
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    fprintf(fp, "  slot%zu: size %d, align %d%s\n", i, slots_[i].size_,
+            slots_[i].align_, slots_[i].incoming_ ? ", incoming": "");
+  }
+
+  for (auto bb: blocks_) {
+    fprintf(fp, ".B%d:", bb->id_);
+    if (bb->preds_.size()) {
+      fprintf(fp, "\t\t; preds");
+      for (auto pred: bb->preds_)
+        fprintf(fp, " .B%d", pred->id_);
+    }
+    fprintf(fp, "\n");
+    for (auto inst: bb->insts_) {
+      std::string line = "  ";
+      if (inst->HasDst())
+        line += "%" + std::to_string(inst->dst_) + " = ";
+      line += OpName(inst->op_);
+      if (inst->op_ == Opcode::SET || inst->op_ == Opcode::BR)
+        line += std::string(".") + CondName(inst->cond_);
+      line += std::string(".") + TypeName(inst->type_);
+      if (inst->srcType_ != IRType::VOID)
+        line += std::string(".") + TypeName(inst->srcType_);
+      if (inst->volatile_)
+        line += " volatile";
+
+      std::vector<std::string> opds;
+      auto argType = inst->srcType_ != IRType::VOID &&
+                     inst->op_ != Opcode::STORE ?
+                     inst->srcType_: inst->type_;
+      if (inst->op_ == Opcode::CALL) {
+        auto call = inst->call_;
+        opds.push_back(call->sym_.size() ? call->sym_:
+                       OperandStr(call->callee_, IRType::I64));
+        for (size_t i = 0; i < inst->args_.size(); ++i) {
+          auto str = OperandStr(inst->args_[i], call->args_[i].type_);
+          if (call->args_[i].size_)
+            str = "byval " + std::to_string(call->args_[i].size_) + " " + str;
+          opds.push_back(str);
+        }
+        if (inst->mem_.base_ != MemRef::NONE)
+          opds.push_back("ret " + MemStr(inst->mem_));
+      } else if (inst->op_ == Opcode::RET && retTypes_.size()) {
+        for (size_t i = 0; i < inst->args_.size(); ++i)
+          opds.push_back(OperandStr(inst->args_[i], retTypes_[i]));
+      } else if (inst->op_ == Opcode::PHI) {
+        for (size_t i = 0; i < inst->args_.size(); ++i) {
+          opds.push_back("[" + OperandStr(inst->args_[i], argType) +
+                         ", .B" + std::to_string(inst->incoming_[i]->id_) +
+                         "]");
+        }
+      } else {
+        if (inst->mem_.base_ != MemRef::NONE)
+          opds.push_back(MemStr(inst->mem_));
+        for (const auto& arg: inst->args_)
+          opds.push_back(OperandStr(arg, argType));
+      }
+      if (inst->size_)
+        opds.push_back(std::to_string(inst->size_));
+      for (auto target: inst->targets_) {
+        if (target)
+          opds.push_back(".B" + std::to_string(target->id_));
+      }
+      if (inst->table_.size()) {
+        std::string table;
+        for (auto target: inst->table_) {
+          table += table.empty() ? "[.B": ", .B";
+          table += std::to_string(target->id_);
+        }
+        opds.push_back(table + "]");
+      }
+      for (size_t i = 0; i < opds.size(); ++i)
+        line += (i ? ", ": " ") + opds[i];
+      fprintf(fp, "%s\n", line.c_str());
+    }
+  }
+  fprintf(fp, "}\n\n");
+}
+
+
+/*
+ * Verifier
+ */
+
+bool IRFunc::Verify(std::string& msg) {
+  auto fail = [&msg](const BasicBlock* bb, const std::string& what) {
+    msg = ".B" + std::to_string(bb->id_) + ": " + what;
+    return false;
+  };
+  if (blocks_.empty()) {
+    msg = "no entry block";
+    return false;
+  }
+  std::set<BasicBlock*> blocks(blocks_.begin(), blocks_.end());
+  ComputePreds();
+  if (ssa_ && blocks_[0]->preds_.size())
+    return fail(blocks_[0], "entry block has predecessors");
+
+  auto numRegs = static_cast<int>(NumRegs());
+  auto validReg = [numRegs](int reg) { return reg >= 0 && reg < numRegs; };
+  // The defining block of each register in SSA form, and the position
+  // after the definition, parameters are defined before the entry
+  std::vector<BasicBlock*> defBlocks(numRegs, nullptr);
+  std::vector<size_t> defPos(numRegs, 0);
+  if (retPtr_ >= 0)
+    defBlocks[retPtr_] = blocks_[0];
+  for (const auto& param: params_) {
+    if (param.reg_ >= 0)
+      defBlocks[param.reg_] = blocks_[0];
+  }
+
+  for (auto bb: blocks_) {
+    if (bb->insts_.empty() || !bb->insts_.back()->IsTerminator())
+      return fail(bb, "missing terminator");
+    bool inPhis = true;
+    for (size_t i = 0; i < bb->insts_.size(); ++i) {
+      auto inst = bb->insts_[i];
+      auto name = std::string(OpName(inst->op_));
+      if (inst->IsTerminator() && i + 1 != bb->insts_.size())
+        return fail(bb, name + " in the middle of the block");
+      for (auto target: inst->targets_) {
+        if (target && !blocks.count(target))
+          return fail(bb, name + " to a block not in the function");
+      }
+      for (auto target: inst->table_) {
+        if (!blocks.count(target))
+          return fail(bb, name + " to a block not in the function");
+      }
+      if (inst->op_ == Opcode::PHI) {
+        if (!ssa_ || !inPhis)
+          return fail(bb, "misplaced phi");
+        if (inst->incoming_ != bb->preds_ ||
+            inst->args_.size() != inst->incoming_.size())
+          return fail(bb, "phi does not match the predecessors");
+      } else {
+        inPhis = false;
+      }
+      for (auto reg: inst->Uses()) {
+        if (!validReg(reg))
+          return fail(bb, name + " uses bad register %" +
+                      std::to_string(reg));
+      }
+      if (inst->HasDst()) {
+        auto dst = inst->dst_;
+        if (!validReg(dst) || RegType(dst) != inst->type_) {
+          return fail(bb, name + " defines bad register %" +
+                      std::to_string(dst));
+        }
+        if (ssa_) {
+          if (defBlocks[dst])
+            return fail(bb, "%" + std::to_string(dst) + " redefined");
+          defBlocks[dst] = bb;
+          defPos[dst] = i + 1;
+        }
+      }
+    }
+  }
+  if (!ssa_)
+    return true;
+
+  // Definitions dominate the uses
+  DomTree dom(this);
+  auto dominated = [&](int reg, BasicBlock* bb, size_t pos) {
+    auto defBlock = defBlocks[reg];
+    if (!defBlock || !dom.Reachable(bb))
+      return defBlock != nullptr;
+    if (defBlock == bb)
+      return defPos[reg] <= pos;
+    return dom.Reachable(defBlock) && dom.Dominates(defBlock, bb);
+  };
+  for (auto bb: blocks_) {
+    for (size_t i = 0; i < bb->insts_.size(); ++i) {
+      auto inst = bb->insts_[i];
+      if (inst->op_ == Opcode::PHI) {
+        for (size_t k = 0; k < inst->args_.size(); ++k) {
+          auto pred = inst->incoming_[k];
+          const auto& arg = inst->args_[k];
+          if (arg.IsReg() &&
+              !dominated(arg.Reg(), pred, pred->insts_.size()))
+            return fail(bb, "phi operand %" + std::to_string(arg.Reg()) +
+                        " not available from .B" +
+                        std::to_string(pred->id_));
+        }
+        continue;
+      }
+      for (auto reg: inst->Uses()) {
+        if (!dominated(reg, bb, i))
+          return fail(bb, std::string(OpName(inst->op_)) + " of %" +
+                      std::to_string(reg) + " not dominated by its def");
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,286 @@
+#ifndef _WGTCC_IR_H_
+#define _WGTCC_IR_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+class Declaration;
+class FuncDef;
+class Token;
+class BasicBlock;
+
+
+/*
+ * The intermediate representation of the optimizing backend (-O1).
+ * A function is a list of basic blocks, each of them ends with exactly
+ * one terminator (JMP, BR, SWITCH or RET). Instructions are
+ * three-address, their values live in an unlimited number of typed
+ * virtual registers.
+ * Like the code of Generator, an integer narrower than 32 bits keeps
+ * its value in the low bits of a register, the upper bits are undefined.
+ * Signedness is a property of the operations, not of the types.
+ * The builder defines a promoted local at each assignment, BuildSSA
+ * (ssa.h) puts the function in SSA form, where each virtual register
+ * is defined once, and DestroySSA replaces the phis with moves.
+ */
+enum class IRType: uint8_t {
+  VOID, I8, I16, I32, I64, F32, F64,
+};
+
+inline int SizeOf(IRType type) {
+  static const int sizes[] = {0, 1, 2, 4, 8, 4, 8};
+  return sizes[static_cast<int>(type)];
+}
+
+inline bool IsFloat(IRType type) {
+  return type == IRType::F32 || type == IRType::F64;
+}
+
+
+enum class Opcode: uint8_t {
+  MOV,      // dst = a
+  ADD, SUB, MUL, DIV, UDIV, MOD, UMOD,
+  AND, OR, XOR, SHL, SHR, SAR,
+  NEG, NOT,
+  SET,      // dst = a cond b, the operands are of 'srcType_'
+  // Conversions from 'srcType_' to 'type_'
+  SEXT, ZEXT, TRUNC, ITOF, UTOF, FTOI, FTOU, FCVT,
+  LOAD,     // dst = mem
+  STORE,    // mem = a
+  LEA,      // dst = &mem
+  COPY,     // copy 'size_' bytes from address a to mem
+  ZERO,     // zero 'size_' bytes at mem
+  CALL,     // dst = call(args), see CallInfo
+  JMP,      // goto targets[0]
+  BR,       // if (a cond b) goto targets[0] else goto targets[1]
+  RET,      // return [a]
+  // goto table_[a - b] if a - b < size of table_ (unsigned),
+  // else goto targets[0]
+  SWITCH,
+  PHI,      // dst = a_i if reached from incoming_[i]
+};
+
+
+enum class Cond: uint8_t {
+  EQ, NE, LT, LE, GT, GE, ULT, ULE, UGT, UGE,
+};
+
+
+struct Operand {
+  enum Kind: uint8_t {
+    NONE, REG, IMM,
+  };
+
+  Operand(): kind_(NONE), val_(0) {}
+  static Operand Reg(int reg) { return Operand(REG, reg); }
+  // The bits of a floating constant are taken as is
+  static Operand Imm(long val) { return Operand(IMM, val); }
+  static Operand Float(double val, IRType type);
+
+  bool IsNone() const { return kind_ == NONE; }
+  bool IsReg() const { return kind_ == REG; }
+  bool IsImm() const { return kind_ == IMM; }
+  int Reg() const { return val_; }
+  long Imm() const { return val_; }
+  bool operator==(const Operand& other) const {
+    return kind_ == other.kind_ && val_ == other.val_;
+  }
+  bool operator!=(const Operand& other) const { return !(*this == other); }
+
+  Kind kind_;
+  long val_;
+
+private:
+  Operand(Kind kind, long val): kind_(kind), val_(val) {}
+};
+
+
+/*
+ * base + index * scale + disp, the base is a virtual register,
+ * a stack slot or a symbol. A symbol has no index.
+ */
+struct MemRef {
+  enum Base: uint8_t {
+    NONE, REG, SLOT, SYM,
+  };
+
+  MemRef(): base_(NONE), reg_(-1), index_(-1), scale_(1), disp_(0) {}
+  static MemRef Reg(int reg, long disp=0) {
+    MemRef mem; mem.base_ = REG; mem.reg_ = reg; mem.disp_ = disp;
+    return mem;
+  }
+  static MemRef Slot(int slot, long disp=0) {
+    MemRef mem; mem.base_ = SLOT; mem.reg_ = slot; mem.disp_ = disp;
+    return mem;
+  }
+  static MemRef Sym(const std::string& sym, long disp=0) {
+    MemRef mem; mem.base_ = SYM; mem.sym_ = sym; mem.disp_ = disp;
+    return mem;
+  }
+
+  Base base_;
+  int reg_;     // Virtual register or slot
+  int index_;   // Virtual register or -1
+  int scale_;
+  long disp_;
+  std::string sym_;
+};
+
+
+/*
+ * Arguments are passed as the ABI says. An argument of 'size_' > 0 is
+ * a struct/union passed in memory, the operand is its address; one
+ * passed in registers is split into its eightbytes, as i64 or f64.
+ * If the callee returns a struct/union in memory, the first argument is
+ * the address of the result. One returned in registers is stored to
+ * 'mem_' of the call, a slot, with the types of its eightbytes in
+ * 'retTypes_'.
+ */
+struct CallInfo {
+  struct Arg {
+    IRType type_;
+    int size_;
+  };
+
+  std::string sym_;     // Direct call
+  Operand callee_;      // Indirect call, the address of the function
+  std::vector<Arg> args_;
+  bool variadic_ {false};
+  bool retStruct_ {false};
+  std::vector<IRType> retTypes_;
+};
+
+
+class Inst {
+public:
+  Inst(Opcode op, IRType type): op_(op), type_(type) {}
+  ~Inst() { delete call_; }
+  Inst(const Inst&) = delete;
+  Inst& operator=(const Inst&) = delete;
+
+  bool IsTerminator() const {
+    return op_ == Opcode::JMP || op_ == Opcode::BR || op_ == Opcode::RET ||
+           op_ == Opcode::SWITCH;
+  }
+  bool HasDst() const { return dst_ >= 0; }
+  // The virtual registers read by the instruction
+  std::vector<int> Uses() const;
+
+  Opcode op_;
+  IRType type_;
+  IRType srcType_ {IRType::VOID};
+  Cond cond_ {Cond::EQ};
+  bool volatile_ {false};
+  int dst_ {-1};
+  std::vector<Operand> args_;
+  MemRef mem_;
+  long size_ {0};
+  BasicBlock* targets_[2] {nullptr, nullptr};
+  std::vector<BasicBlock*> table_;
+  std::vector<BasicBlock*> incoming_;
+  CallInfo* call_ {nullptr};
+  const Token* tok_ {nullptr};
+};
+
+typedef std::vector<Inst*> InstList;
+
+
+class BasicBlock {
+public:
+  explicit BasicBlock(int id): id_(id) {}
+  ~BasicBlock();
+  BasicBlock(const BasicBlock&) = delete;
+  BasicBlock& operator=(const BasicBlock&) = delete;
+
+  Inst* Terminator() {
+    return insts_.size() && insts_.back()->IsTerminator() ?
+           insts_.back(): nullptr;
+  }
+  std::vector<BasicBlock*> Succs();
+
+  int id_;
+  InstList insts_;
+  std::vector<BasicBlock*> preds_;
+};
+
+typedef std::vector<BasicBlock*> BlockList;
+
+
+// Stack memory of the locals that are not kept in registers
+struct Slot {
+  int size_;
+  int align_;
+  // Struct/union passed in memory, at 'offset_' of the caller's frame
+  bool incoming_;
+  int offset_;
+};
+
+
+class IRFunc {
+public:
+  explicit IRFunc(FuncDef* def): def_(def) {}
+  ~IRFunc();
+  IRFunc(const IRFunc&) = delete;
+  IRFunc& operator=(const IRFunc&) = delete;
+
+  int NewReg(IRType type) {
+    regTypes_.push_back(type);
+    return regTypes_.size() - 1;
+  }
+  int NewSlot(int size, int align) {
+    slots_.push_back({size, align, false, 0});
+    return slots_.size() - 1;
+  }
+  BasicBlock* NewBlock() {
+    blocks_.push_back(new BasicBlock(nextBlockId_++));
+    return blocks_.back();
+  }
+  IRType RegType(int reg) const { return regTypes_[reg]; }
+  size_t NumRegs() const { return regTypes_.size(); }
+
+  // Recomputes the predecessors
+  void ComputePreds();
+  // Puts the operands of the phis in the order of the predecessors
+  void SortIncoming();
+  // Removes the unreachable blocks, threads the jumps to jumps
+  // and merges the straight-line blocks, not for SSA form
+  void SimplifyCFG();
+  void Print(FILE* fp) const;
+  // Checks the structure, and the SSA properties if in SSA form.
+  // Returns false with the first violation in 'msg'.
+  bool Verify(std::string& msg);
+
+  FuncDef* def_;
+  BlockList blocks_;          // The first one is the entry
+  std::vector<IRType> regTypes_;
+  std::vector<Slot> slots_;
+  // In the order of parameters, a scalar is defined in 'reg_' at the
+  // entry, a struct/union passed in memory is the incoming 'slot_'.
+  // A scalar passed by stack is at 'offset_' of the caller's frame.
+  // A struct/union passed in registers is a scalar for each eightbyte.
+  struct Param {
+    int reg_;
+    int slot_;
+    int offset_;
+  };
+  std::vector<Param> params_;
+  // The address of the struct/union to return, or -1
+  int retPtr_ {-1};
+  IRType retType_ {IRType::VOID};
+  // The eightbytes of a struct/union returned in registers, the
+  // arguments of a return; 'retType_' is the first one.
+  std::vector<IRType> retTypes_;
+  // String literals as {label, escaped string}
+  std::vector<std::pair<std::string, std::string>> strings_;
+  // Static objects of block scope, emitted after the function
+  std::vector<Declaration*> staticDecls_;
+  bool ssa_ {false};
+
+private:
+  int nextBlockId_ {0};
+};
+
+#endif
@@ -0,0 +1,1382 @@
+#include "ir_builder.h"
+
+#include "code_gen.h"
+#include "parser.h"
+#include "token.h"
+
+#include <cstring>
+
+
+static int stringTag = 0;
+
+
+// The eightbytes of a struct/union passed in registers, or none
+static std::vector<IRType> Eightbytes(Type* type) {
+  std::vector<IRType> types;
+  if (!type->ToStruct())
+    return types;
+  auto classes = Classify(type);
+  if (classes[0] == ParamClass::MEMORY)
+    return types;
+  for (auto cls: classes)
+    types.push_back(cls == ParamClass::SSE ? IRType::F64: IRType::I64);
+  return types;
+}
+
+
+// Whether the eightbytes fit in the argument registers left
+static bool FitInRegs(const std::vector<IRType>& types, int gp, int fp) {
+  for (auto type: types)
+    ++(IsFloat(type) ? fp: gp);
+  return types.size() && gp <= 6 && fp <= 8;
+}
+
+
+/*
+ * The dispatchers tell the kinds of expressions apart,
+ * those not interested in are taken as values.
+ */
+class IRBuilder::Dispatcher: public Visitor {
+public:
+  explicit Dispatcher(IRBuilder* builder): builder_(builder) {}
+  virtual ~Dispatcher() {}
+
+  virtual void VisitBinaryOp(BinaryOp* binary) { Default(binary); }
+  virtual void VisitUnaryOp(UnaryOp* unary) { Default(unary); }
+  virtual void VisitConditionalOp(ConditionalOp* condOp) { Default(condOp); }
+  virtual void VisitFuncCall(FuncCall* funcCall) { Default(funcCall); }
+  virtual void VisitEnumerator(Enumerator* enumer) { Default(enumer); }
+  virtual void VisitIdentifier(Identifier* ident) { Default(ident); }
+  virtual void VisitObject(Object* obj) { Default(obj); }
+  virtual void VisitConstant(Constant* cons) { Default(cons); }
+  virtual void VisitTempVar(TempVar* tempVar) { Default(tempVar); }
+
+  virtual void VisitDeclaration(Declaration* decl) { assert(false); }
+  virtual void VisitIfStmt(IfStmt* ifStmt) { assert(false); }
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt) { assert(false); }
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) { assert(false); }
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt) { assert(false); }
+  virtual void VisitLabelStmt(LabelStmt* labelStmt) { assert(false); }
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) { assert(false); }
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt) { assert(false); }
+  virtual void VisitFuncDef(FuncDef* funcDef) { assert(false); }
+  virtual void VisitTranslationUnit(TranslationUnit* unit) { assert(false); }
+
+protected:
+  virtual void Default(Expr* expr) = 0;
+
+  IRBuilder* builder_;
+};
+
+
+class IRBuilder::LValDispatcher: public IRBuilder::Dispatcher {
+public:
+  explicit LValDispatcher(IRBuilder* builder): Dispatcher(builder) {}
+
+  virtual void VisitBinaryOp(BinaryOp* binary) {
+    lval_ = builder_->LValBinaryOp(binary);
+  }
+  virtual void VisitUnaryOp(UnaryOp* unary) {
+    lval_ = builder_->LValUnaryOp(unary);
+  }
+  virtual void VisitIdentifier(Identifier* ident) {
+    lval_ = builder_->LValIdentifier(ident);
+  }
+  virtual void VisitObject(Object* obj) {
+    lval_ = builder_->LValObject(obj);
+  }
+  virtual void VisitTempVar(TempVar* tempVar) {
+    lval_ = builder_->LValTempVar(tempVar);
+  }
+
+  LVal lval_;
+
+protected:
+  virtual void Default(Expr* expr) { lval_ = builder_->LValValue(expr); }
+};
+
+
+class IRBuilder::CondDispatcher: public IRBuilder::Dispatcher {
+public:
+  CondDispatcher(IRBuilder* builder, BasicBlock* then, BasicBlock* els)
+      : Dispatcher(builder), then_(then), else_(els) {}
+
+  virtual void VisitBinaryOp(BinaryOp* binary) {
+    builder_->CondBinaryOp(binary, then_, else_);
+  }
+  virtual void VisitUnaryOp(UnaryOp* unary) {
+    builder_->CondUnaryOp(unary, then_, else_);
+  }
+  virtual void VisitConstant(Constant* cons) {
+    builder_->CondConstant(cons, then_, else_);
+  }
+
+protected:
+  virtual void Default(Expr* expr) {
+    builder_->CondValue(expr, then_, else_);
+  }
+
+private:
+  BasicBlock* then_;
+  BasicBlock* else_;
+};
+
+
+class IRBuilder::PtrDispatcher: public IRBuilder::Dispatcher {
+public:
+  explicit PtrDispatcher(IRBuilder* builder): Dispatcher(builder) {}
+
+  virtual void VisitBinaryOp(BinaryOp* binary) {
+    mem_ = builder_->PtrBinaryOp(binary);
+  }
+  virtual void VisitUnaryOp(UnaryOp* unary) {
+    mem_ = builder_->PtrUnaryOp(unary);
+  }
+
+  MemRef mem_;
+
+protected:
+  virtual void Default(Expr* expr) { mem_ = builder_->PtrValue(expr); }
+};
+
+
+IRType IRBuilder::TypeOf(Type* type) {
+  if (type->ToVoid())
+    return IRType::VOID;
+  if (!type->IsScalar())
+    return IRType::I64;
+  if (type->IsFloat())
+    return type->Width() == 4 ? IRType::F32: IRType::F64;
+  switch (type->Width()) {
+  case 1: return IRType::I8;
+  case 2: return IRType::I16;
+  case 4: return IRType::I32;
+  default: return IRType::I64;
+  }
+}
+
+
+static bool IsUnsigned(Type* type) {
+  return type->IsUnsigned() || !type->ToArithm();
+}
+
+
+static Cond ToCond(int op, bool isUnsigned) {
+  switch (op) {
+  case '<': return isUnsigned ? Cond::ULT: Cond::LT;
+  case '>': return isUnsigned ? Cond::UGT: Cond::GT;
+  case Token::LE: return isUnsigned ? Cond::ULE: Cond::LE;
+  case Token::GE: return isUnsigned ? Cond::UGE: Cond::GE;
+  case Token::EQ: return Cond::EQ;
+  case Token::NE: return Cond::NE;
+  default: assert(false); return Cond::EQ;
+  }
+}
+
+
+static bool IsRelational(int op) {
+  switch (op) {
+  case '<': case '>': case Token::LE: case Token::GE:
+  case Token::EQ: case Token::NE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+
+static int Log2(long val) {
+  if (val <= 0 || (val & (val - 1)))
+    return -1;
+  int ret = 0;
+  while (val > 1) {
+    val >>= 1;
+    ++ret;
+  }
+  return ret;
+}
+
+
+IRFunc* IRBuilder::Build() {
+  if (def_->FuncType()->Variadic())
+    return nullptr;
+  while (true) {
+    func_ = new IRFunc(def_);
+    unsupported_ = retry_ = false;
+    regs_.clear();
+    slots_.clear();
+    temps_.clear();
+    labels_.clear();
+    anonys_.clear();
+    lvals_.clear();
+    BuildFunc();
+    if (!unsupported_ && !retry_)
+      break;
+    delete func_;
+    if (unsupported_)
+      return nullptr;
+  }
+  func_->SimplifyCFG();
+  return func_;
+}
+
+
+void IRBuilder::BuildFunc() {
+  cur_ = func_->NewBlock();
+  tok_ = nullptr;
+
+  auto funcType = def_->FuncType();
+  auto retType = funcType->Derived();
+  int regCnt = 0, xregCnt = 0;
+  func_->retTypes_ = Eightbytes(retType.GetPtr());
+  if (func_->retTypes_.size()) {
+    func_->retType_ = func_->retTypes_[0];
+  } else if (retType->ToStruct()) {
+    func_->retPtr_ = func_->NewReg(IRType::I64);
+    func_->retType_ = IRType::I64;
+    ++regCnt;
+  } else {
+    func_->retType_ = TypeOf(retType.GetPtr());
+  }
+
+  // Parameters passed by stack begin at 16(%rbp)
+  int byMemOffset = 16;
+  for (auto param: funcType->Params()) {
+    auto type = param->Type();
+    auto eightbytes = Eightbytes(type);
+    if (FitInRegs(eightbytes, regCnt, xregCnt)) {
+      // Stored whole eightbytes
+      auto slot = SlotOf(param);
+      func_->slots_[slot].size_ = Type::MakeAlign(type->Width(), 8);
+      for (size_t i = 0; i < eightbytes.size(); ++i) {
+        auto irType = eightbytes[i];
+        ++(IsFloat(irType) ? xregCnt: regCnt);
+        auto reg = func_->NewReg(irType);
+        func_->params_.push_back({reg, -1, 0});
+        auto store = Emit(Opcode::STORE, irType);
+        store->mem_ = MemRef::Slot(slot, 8 * i);
+        store->args_.push_back(Operand::Reg(reg));
+      }
+      continue;
+    }
+    if (type->ToStruct()) {
+      auto slot = SlotOf(param);
+      func_->slots_[slot].incoming_ = true;
+      func_->slots_[slot].offset_ = byMemOffset;
+      byMemOffset = Type::MakeAlign(byMemOffset + type->Width(), 8);
+      func_->params_.push_back({-1, slot, 0});
+      continue;
+    }
+
+    auto irType = TypeOf(type);
+    int offset = 0;
+    if (IsFloat(irType) ? xregCnt++ >= 8: regCnt++ >= 6) {
+      offset = byMemOffset;
+      byMemOffset += 8;
+    }
+    if (Promoted(param)) {
+      func_->params_.push_back({RegOf(param), -1, offset});
+    } else {
+      auto reg = func_->NewReg(irType);
+      func_->params_.push_back({reg, -1, offset});
+      auto store = Emit(Opcode::STORE, irType);
+      store->mem_ = MemRef::Slot(SlotOf(param));
+      store->args_.push_back(Operand::Reg(reg));
+    }
+  }
+
+  for (auto stmt: def_->Body()->Stmts())
+    Visit(stmt);
+
+  if (!cur_->Terminator()) {
+    if (def_->Name() == "main" && func_->retType_ == IRType::I32)
+      EmitRet(Operand::Imm(0));
+    else
+      EmitRet(Operand());
+  }
+}
+
+
+bool IRBuilder::Promoted(Object* obj) {
+  return !obj->IsStatic() && !obj->Anonymous() &&
+         obj->Type()->IsScalar() && !obj->IsVolatileQualified() &&
+         !addrTaken_.count(obj);
+}
+
+
+int IRBuilder::RegOf(Object* obj) {
+  auto iter = regs_.find(obj);
+  if (iter != regs_.end())
+    return iter->second;
+  return regs_[obj] = func_->NewReg(TypeOf(obj->Type()));
+}
+
+
+int IRBuilder::SlotOf(Object* obj) {
+  auto iter = slots_.find(obj);
+  if (iter != slots_.end())
+    return iter->second;
+  auto align = obj->Align();
+  if (obj->Type()->ToArray())
+    align = std::max(align, 8);
+  return slots_[obj] = func_->NewSlot(obj->Type()->Width(), align);
+}
+
+
+BasicBlock* IRBuilder::BlockOf(LabelStmt* label) {
+  auto iter = labels_.find(label);
+  if (iter != labels_.end())
+    return iter->second;
+  return labels_[label] = func_->NewBlock();
+}
+
+
+/*
+ * Emitting instructions
+ */
+
+Inst* IRBuilder::Emit(Opcode op, IRType type) {
+  // Code after a jump is unreachable
+  if (cur_->Terminator())
+    cur_ = func_->NewBlock();
+  auto inst = new Inst(op, type);
+  inst->tok_ = tok_;
+  cur_->insts_.push_back(inst);
+  return inst;
+}
+
+
+Operand IRBuilder::EmitOp(Opcode op, IRType type, Operand lhs, Operand rhs) {
+  auto inst = Emit(op, type);
+  inst->dst_ = func_->NewReg(type);
+  inst->args_.push_back(lhs);
+  if (!rhs.IsNone())
+    inst->args_.push_back(rhs);
+  return Operand::Reg(inst->dst_);
+}
+
+
+Operand IRBuilder::EmitConv(Opcode op, IRType type,
+                            IRType srcType, Operand val) {
+  auto inst = Emit(op, type);
+  inst->srcType_ = srcType;
+  inst->dst_ = func_->NewReg(type);
+  inst->args_.push_back(val);
+  return Operand::Reg(inst->dst_);
+}
+
+
+Operand IRBuilder::EmitSet(Cond cond, IRType srcType,
+                           Operand lhs, Operand rhs, IRType type) {
+  auto inst = Emit(Opcode::SET, type);
+  inst->cond_ = cond;
+  inst->srcType_ = srcType;
+  inst->dst_ = func_->NewReg(type);
+  inst->args_ = {lhs, rhs};
+  return Operand::Reg(inst->dst_);
+}
+
+
+void IRBuilder::EmitMov(int dst, IRType type, Operand val) {
+  auto inst = Emit(Opcode::MOV, type);
+  inst->dst_ = dst;
+  inst->args_.push_back(val);
+}
+
+
+void IRBuilder::EmitJmp(BasicBlock* target) {
+  auto inst = Emit(Opcode::JMP, IRType::VOID);
+  inst->targets_[0] = target;
+}
+
+
+void IRBuilder::EmitBr(Cond cond, IRType srcType, Operand lhs, Operand rhs,
+                       BasicBlock* then, BasicBlock* els) {
+  auto inst = Emit(Opcode::BR, IRType::VOID);
+  inst->cond_ = cond;
+  inst->srcType_ = srcType;
+  inst->args_ = {lhs, rhs};
+  inst->targets_[0] = then;
+  inst->targets_[1] = els;
+}
+
+
+void IRBuilder::EmitRet(Operand val) {
+  auto inst = Emit(Opcode::RET, func_->retType_);
+  if (!val.IsNone())
+    inst->args_.push_back(val);
+}
+
+
+// Falls through to 'bb'
+void IRBuilder::StartBlock(BasicBlock* bb) {
+  if (!cur_->Terminator())
+    EmitJmp(bb);
+  cur_ = bb;
+}
+
+
+int IRBuilder::ToReg(Operand val, IRType type) {
+  if (val.IsReg())
+    return val.Reg();
+  auto reg = func_->NewReg(type);
+  EmitMov(reg, type, val);
+  return reg;
+}
+
+
+/*
+ * Expressions
+ */
+
+Operand IRBuilder::Gen(Expr* expr) {
+  auto iter = lvals_.find(expr);
+  if (iter != lvals_.end())
+    return Load(iter->second, expr->Type());
+  result_ = Operand();
+  expr->Accept(this);
+  return result_;
+}
+
+
+IRBuilder::LVal IRBuilder::GenLVal(Expr* expr) {
+  auto iter = lvals_.find(expr);
+  if (iter != lvals_.end())
+    return iter->second;
+  LValDispatcher dispatcher(this);
+  expr->Accept(&dispatcher);
+  return dispatcher.lval_;
+}
+
+
+MemRef IRBuilder::GenPtr(Expr* expr) {
+  PtrDispatcher dispatcher(this);
+  expr->Accept(&dispatcher);
+  return dispatcher.mem_;
+}
+
+
+void IRBuilder::GenCond(Expr* expr, BasicBlock* then, BasicBlock* els) {
+  CondDispatcher dispatcher(this, then, els);
+  expr->Accept(&dispatcher);
+}
+
+
+Operand IRBuilder::GenCondValue(Expr* expr) {
+  auto then = func_->NewBlock();
+  auto els = func_->NewBlock();
+  auto end = func_->NewBlock();
+  auto reg = func_->NewReg(IRType::I32);
+  GenCond(expr, then, els);
+  StartBlock(then);
+  EmitMov(reg, IRType::I32, Operand::Imm(1));
+  EmitJmp(end);
+  StartBlock(els);
+  EmitMov(reg, IRType::I32, Operand::Imm(0));
+  StartBlock(end);
+  return Operand::Reg(reg);
+}
+
+
+void IRBuilder::VisitBinaryOp(BinaryOp* binary) {
+  SetTok(binary);
+  auto op = binary->op_;
+  switch (op) {
+  case '=':
+    result_ = GenAssign(binary);
+    return;
+  case Token::LOGICAL_AND:
+  case Token::LOGICAL_OR:
+    result_ = GenCondValue(binary);
+    return;
+  case '.':
+    result_ = Load(GenLVal(binary), binary->Type());
+    return;
+  case ',':
+    Gen(binary->lhs_);
+    result_ = Gen(binary->rhs_);
+    return;
+  }
+  if (binary->lhs_->Type()->ToPointer() && (op == '+' || op == '-')) {
+    result_ = GenPointerArithm(binary);
+    return;
+  }
+
+  // For comparison, the operands have the same type
+  // while the type of the result is int.
+  auto type = binary->lhs_->Type();
+  auto isUnsigned = IsUnsigned(type);
+  auto lhs = Gen(binary->lhs_);
+  auto rhs = Gen(binary->rhs_);
+  if (IsRelational(op)) {
+    result_ = EmitSet(ToCond(op, isUnsigned), TypeOf(type), lhs, rhs);
+    return;
+  }
+
+  Opcode opcode;
+  switch (op) {
+  case '+': opcode = Opcode::ADD; break;
+  case '-': opcode = Opcode::SUB; break;
+  case '*': opcode = Opcode::MUL; break;
+  case '/': opcode = isUnsigned ? Opcode::UDIV: Opcode::DIV; break;
+  case '%': opcode = isUnsigned ? Opcode::UMOD: Opcode::MOD; break;
+  case '&': opcode = Opcode::AND; break;
+  case '|': opcode = Opcode::OR; break;
+  case '^': opcode = Opcode::XOR; break;
+  case Token::LEFT: opcode = Opcode::SHL; break;
+  case Token::RIGHT: opcode = isUnsigned ? Opcode::SHR: Opcode::SAR; break;
+  default: assert(false); return;
+  }
+  result_ = EmitOp(opcode, TypeOf(binary->Type()), lhs, rhs);
+}
+
+
+Operand IRBuilder::GenAssign(BinaryOp* assign) {
+  auto lval = GenLVal(assign->lhs_);
+  lvals_[assign->lhs_] = lval;
+  auto val = Gen(assign->rhs_);
+  lvals_.erase(assign->lhs_);
+
+  auto type = assign->Type();
+  if (!type->IsScalar()) {
+    auto copy = Emit(Opcode::COPY, IRType::VOID);
+    copy->mem_ = lval.mem_;
+    copy->args_.push_back(val);
+    copy->size_ = type->Width();
+    copy->volatile_ = lval.volatile_;
+    return AddrOf(lval);
+  }
+  Store(lval, type, val);
+  return lval.reg_ >= 0 ? Operand::Reg(lval.reg_): val;
+}
+
+
+Operand IRBuilder::GenPointerArithm(BinaryOp* binary) {
+  // For '+', the pointer is always the lhs
+  auto op = binary->op_;
+  auto size = binary->lhs_->Type()->ToPointer()->Derived()->Width();
+  auto lhs = Gen(binary->lhs_);
+  auto rhs = Gen(binary->rhs_);
+
+  if (binary->rhs_->Type()->ToPointer()) {
+    auto diff = EmitOp(Opcode::SUB, IRType::I64, lhs, rhs);
+    if (size == 1)
+      return diff;
+    auto shift = Log2(size);
+    if (shift >= 0)
+      return EmitOp(Opcode::SAR, IRType::I64, diff, Operand::Imm(shift));
+    return EmitOp(Opcode::DIV, IRType::I64, diff, Operand::Imm(size));
+  }
+
+  auto offset = Extend(rhs, binary->rhs_->Type(), IRType::I64);
+  if (offset.IsImm()) {
+    offset = Operand::Imm(offset.Imm() * size);
+  } else if (size > 1) {
+    auto shift = Log2(size);
+    if (shift >= 0)
+      offset = EmitOp(Opcode::SHL, IRType::I64, offset, Operand::Imm(shift));
+    else
+      offset = EmitOp(Opcode::MUL, IRType::I64, offset, Operand::Imm(size));
+  }
+  return EmitOp(op == '+' ? Opcode::ADD: Opcode::SUB,
+                IRType::I64, lhs, offset);
+}
+
+
+void IRBuilder::VisitUnaryOp(UnaryOp* unary) {
+  SetTok(unary);
+  auto type = TypeOf(unary->Type());
+  switch (unary->op_) {
+  case Token::PREFIX_INC:
+    result_ = GenIncDec(unary, false, Opcode::ADD);
+    return;
+  case Token::PREFIX_DEC:
+    result_ = GenIncDec(unary, false, Opcode::SUB);
+    return;
+  case Token::POSTFIX_INC:
+    result_ = GenIncDec(unary, true, Opcode::ADD);
+    return;
+  case Token::POSTFIX_DEC:
+    result_ = GenIncDec(unary, true, Opcode::SUB);
+    return;
+  case Token::ADDR: {
+    auto lval = GenLVal(unary->operand_);
+    if (lval.reg_ >= 0) {
+      // Promoted by mistake
+      assert(lval.obj_);
+      addrTaken_.insert(lval.obj_);
+      retry_ = true;
+      result_ = Operand::Imm(0);
+    } else {
+      result_ = AddrOf(lval);
+    }
+  } return;
+  case Token::DEREF:
+    if (unary->Type()->IsScalar())
+      result_ = Load(GenLVal(unary), unary->Type());
+    else
+      result_ = Gen(unary->operand_);
+    return;
+  case Token::PLUS:
+    result_ = Gen(unary->operand_);
+    return;
+  case Token::MINUS:
+    result_ = EmitOp(Opcode::NEG, type, Gen(unary->operand_), Operand());
+    return;
+  case '~':
+    result_ = EmitOp(Opcode::NOT, type, Gen(unary->operand_), Operand());
+    return;
+  case '!': {
+    auto operandType = TypeOf(unary->operand_->Type());
+    auto val = Gen(unary->operand_);
+    result_ = EmitSet(Cond::EQ, operandType, val, Operand::Imm(0));
+  } return;
+  case Token::CAST:
+    result_ = GenCast(Gen(unary->operand_),
+                      unary->operand_->Type(), unary->Type());
+    return;
+  default: assert(false);
+  }
+}
+
+
+Operand IRBuilder::GenIncDec(UnaryOp* unary, bool postfix, Opcode op) {
+  auto operand = unary->operand_;
+  auto type = operand->Type();
+  auto irType = TypeOf(type);
+  auto lval = GenLVal(operand);
+  auto val = Load(lval, type);
+
+  Operand step;
+  if (type->ToPointer())
+    step = Operand::Imm(type->ToPointer()->Derived()->Width());
+  else if (type->IsFloat())
+    step = Operand::Float(1.0, irType);
+  else
+    step = Operand::Imm(1);
+
+  if (lval.reg_ >= 0) {
+    Operand old;
+    if (postfix) {
+      old = Operand::Reg(func_->NewReg(irType));
+      EmitMov(old.Reg(), irType, val);
+    }
+    auto inst = Emit(op, irType);
+    inst->dst_ = lval.reg_;
+    inst->args_ = {val, step};
+    return postfix ? old: Operand::Reg(lval.reg_);
+  }
+  auto res = EmitOp(op, irType, val, step);
+  Store(lval, type, res);
+  return postfix ? val: res;
+}
+
+
+Operand IRBuilder::Extend(Operand val, Type* from, IRType to) {
+  auto srcType = TypeOf(from);
+  if (srcType == to)
+    return val;
+  auto isUnsigned = IsUnsigned(from);
+  if (val.IsImm()) {
+    long imm = val.Imm();
+    switch (srcType) {
+    case IRType::I8: imm = isUnsigned ? (uint8_t)imm: (int8_t)imm; break;
+    case IRType::I16: imm = isUnsigned ? (uint16_t)imm: (int16_t)imm; break;
+    case IRType::I32: imm = isUnsigned ? (uint32_t)imm: (int32_t)imm; break;
+    default: break;
+    }
+    return Operand::Imm(imm);
+  }
+  return EmitConv(isUnsigned ? Opcode::ZEXT: Opcode::SEXT, to, srcType, val);
+}
+
+
+Operand IRBuilder::GenCast(Operand val, Type* from, Type* to) {
+  if (to->ToVoid())
+    return Operand();
+  // Arrays and functions decay to pointers
+  if (!from->IsScalar() || !to->IsScalar())
+    return val;
+  if (from->ToArithm() && from->ToArithm()->IsComplex())
+    unsupported_ = true;
+  if (to->ToArithm() && to->ToArithm()->IsComplex())
+    unsupported_ = true;
+
+  auto srcType = TypeOf(from);
+  auto desType = TypeOf(to);
+  if (to->IsBool()) {
+    if (from->IsBool())
+      return val;
+    if (val.IsImm() && !from->IsFloat())
+      return Operand::Imm(Extend(val, from, IRType::I64).Imm() != 0);
+    return EmitSet(Cond::NE, srcType, val, Operand::Imm(0), IRType::I8);
+  }
+
+  if (from->IsFloat() && to->IsFloat()) {
+    if (srcType == desType)
+      return val;
+    if (val.IsImm()) {
+      double fval;
+      if (srcType == IRType::F32) {
+        float f;
+        int32_t bits = val.Imm();
+        memcpy(&f, &bits, sizeof(f));
+        fval = f;
+      } else {
+        long bits = val.Imm();
+        memcpy(&fval, &bits, sizeof(fval));
+      }
+      return Operand::Float(fval, desType);
+    }
+    return EmitConv(Opcode::FCVT, desType, srcType, val);
+  }
+
+  if (to->IsFloat()) {
+    if (val.IsImm()) {
+      auto imm = Extend(val, from, IRType::I64).Imm();
+      if (IsUnsigned(from))
+        return Operand::Float(static_cast<unsigned long>(imm), desType);
+      return Operand::Float(imm, desType);
+    }
+    auto isUnsigned = IsUnsigned(from);
+    if (SizeOf(srcType) < 4 || (isUnsigned && srcType == IRType::I32)) {
+      // Values of the extended type are all positive
+      auto extType = SizeOf(srcType) < 4 ? IRType::I32: IRType::I64;
+      val = EmitConv(isUnsigned ? Opcode::ZEXT: Opcode::SEXT,
+                     extType, srcType, val);
+      srcType = extType;
+      isUnsigned = false;
+    }
+    return EmitConv(isUnsigned ? Opcode::UTOF: Opcode::ITOF,
+                    desType, srcType, val);
+  }
+
+  if (from->IsFloat()) {
+    auto isUnsigned = IsUnsigned(to);
+    if (desType == IRType::I64) {
+      return EmitConv(isUnsigned ? Opcode::FTOU: Opcode::FTOI,
+                      desType, srcType, val);
+    }
+    auto tmpType = isUnsigned && desType == IRType::I32 ?
+                   IRType::I64: IRType::I32;
+    val = EmitConv(Opcode::FTOI, tmpType, srcType, val);
+    if (tmpType != desType)
+      val = EmitConv(Opcode::TRUNC, desType, tmpType, val);
+    return val;
+  }
+
+  // Integers and pointers
+  if (SizeOf(srcType) < SizeOf(desType))
+    return Extend(val, from, desType);
+  if (SizeOf(srcType) > SizeOf(desType) && !val.IsImm())
+    return EmitConv(Opcode::TRUNC, desType, srcType, val);
+  return val;
+}
+
+
+void IRBuilder::VisitConditionalOp(ConditionalOp* condOp) {
+  SetTok(condOp);
+  auto type = TypeOf(condOp->Type());
+  auto then = func_->NewBlock();
+  auto els = func_->NewBlock();
+  auto end = func_->NewBlock();
+  int reg = type == IRType::VOID ? -1: func_->NewReg(type);
+
+  GenCond(condOp->cond_, then, els);
+  StartBlock(then);
+  auto val = Gen(condOp->exprTrue_);
+  if (reg >= 0)
+    EmitMov(reg, type, val);
+  EmitJmp(end);
+  StartBlock(els);
+  val = Gen(condOp->exprFalse_);
+  if (reg >= 0)
+    EmitMov(reg, type, val);
+  StartBlock(end);
+  result_ = reg >= 0 ? Operand::Reg(reg): Operand();
+}
+
+
+void IRBuilder::VisitFuncCall(FuncCall* funcCall) {
+  SetTok(funcCall);
+  auto funcType = funcCall->FuncType();
+  if (Parser::IsBuiltin(funcType)) {
+    unsupported_ = true;
+    return;
+  }
+
+  auto call = new CallInfo;
+  call->variadic_ = funcType->Variadic();
+  auto callee = GenLVal(funcCall->designator_);
+  if (callee.mem_.base_ == MemRef::SYM && callee.mem_.disp_ == 0)
+    call->sym_ = callee.mem_.sym_;
+  else
+    call->callee_ = AddrOf(callee);
+
+  std::vector<Operand> args;
+  Operand retAddr;
+  auto retType = funcCall->Type();
+  call->retTypes_ = Eightbytes(retType);
+  int gp = 0, fp = 0;
+  if (retType->ToStruct() && call->retTypes_.empty()) {
+    auto slot = func_->NewSlot(retType->Width(), retType->Align());
+    LVal lval;
+    lval.mem_ = MemRef::Slot(slot);
+    retAddr = AddrOf(lval);
+    args.push_back(retAddr);
+    call->args_.push_back({IRType::I64, 0});
+    call->retStruct_ = true;
+    ++gp;
+  }
+  for (auto arg: funcCall->args_) {
+    auto type = arg->Type();
+    auto val = Gen(arg);
+    auto eightbytes = Eightbytes(type);
+    if (FitInRegs(eightbytes, gp, fp)) {
+      for (size_t i = 0; i < eightbytes.size(); ++i) {
+        auto argType = eightbytes[i];
+        ++(IsFloat(argType) ? fp: gp);
+        args.push_back(LoadEightbyte(val, i, argType));
+        call->args_.push_back({argType, 0});
+      }
+      continue;
+    }
+    auto argType = TypeOf(type);
+    // Like Generator, narrow integers are passed extended to 32 bits,
+    // as the variable arguments are not promoted by the parser.
+    if (type->IsInteger() && SizeOf(argType) < 4) {
+      argType = IRType::I32;
+      val = Extend(val, type, argType);
+    }
+    args.push_back(val);
+    if (type->ToStruct()) {
+      call->args_.push_back({IRType::I64, type->Width()});
+    } else {
+      ++(IsFloat(argType) ? fp: gp);
+      call->args_.push_back({argType, 0});
+    }
+  }
+  SetTok(funcCall);
+
+  auto type = retType->ToStruct() ? IRType::VOID: TypeOf(retType);
+  auto inst = Emit(Opcode::CALL, type);
+  inst->args_ = args;
+  inst->call_ = call;
+  if (type != IRType::VOID) {
+    inst->dst_ = func_->NewReg(type);
+    result_ = Operand::Reg(inst->dst_);
+  } else if (call->retTypes_.size()) {
+    auto size = Type::MakeAlign(retType->Width(), 8);
+    auto slot = func_->NewSlot(size, std::max(retType->Align(), 8));
+    inst->mem_ = MemRef::Slot(slot);
+    LVal lval;
+    lval.mem_ = inst->mem_;
+    result_ = AddrOf(lval);
+  } else {
+    result_ = retAddr;
+  }
+}
+
+
+// The 'idx'th eightbyte of the struct/union at 'addr'
+Operand IRBuilder::LoadEightbyte(Operand addr, size_t idx, IRType type) {
+  assert(addr.IsReg());
+  auto load = Emit(Opcode::LOAD, type);
+  load->dst_ = func_->NewReg(type);
+  load->mem_ = MemRef::Reg(addr.Reg(), 8 * idx);
+  return Operand::Reg(load->dst_);
+}
+
+
+void IRBuilder::VisitEnumerator(Enumerator* enumer) {
+  result_ = Operand::Imm(enumer->Val());
+}
+
+
+// The identifier must be a function
+void IRBuilder::VisitIdentifier(Identifier* ident) {
+  SetTok(ident);
+  result_ = AddrOf(LValIdentifier(ident));
+}
+
+
+void IRBuilder::VisitObject(Object* obj) {
+  SetTok(obj);
+  result_ = Load(LValObject(obj), obj->Type());
+}
+
+
+void IRBuilder::VisitConstant(Constant* cons) {
+  SetTok(cons);
+  auto type = cons->Type();
+  if (type->IsInteger()) {
+    result_ = Operand::Imm(cons->IVal());
+  } else if (type->IsFloat()) {
+    result_ = Operand::Float(cons->FVal(), TypeOf(type));
+  } else {
+    auto label = ".LS" + std::to_string(stringTag++);
+    func_->strings_.push_back({label, cons->SValRepr()});
+    LVal lval;
+    lval.mem_ = MemRef::Sym(label);
+    result_ = AddrOf(lval);
+  }
+}
+
+
+void IRBuilder::VisitTempVar(TempVar* tempVar) {
+  result_ = Operand::Reg(LValTempVar(tempVar).reg_);
+}
+
+
+Operand IRBuilder::AddrOf(const LVal& lval) {
+  assert(lval.reg_ < 0);
+  const auto& mem = lval.mem_;
+  if (mem.base_ == MemRef::REG && mem.index_ < 0 && mem.disp_ == 0)
+    return Operand::Reg(mem.reg_);
+  auto lea = Emit(Opcode::LEA, IRType::I64);
+  lea->dst_ = func_->NewReg(IRType::I64);
+  lea->mem_ = mem;
+  return Operand::Reg(lea->dst_);
+}
+
+
+Operand IRBuilder::Load(const LVal& lval, Type* type) {
+  if (lval.reg_ >= 0)
+    return Operand::Reg(lval.reg_);
+  if (!type->IsScalar())
+    return AddrOf(lval);
+
+  auto irType = TypeOf(type);
+  auto load = Emit(Opcode::LOAD, irType);
+  load->dst_ = func_->NewReg(irType);
+  load->mem_ = lval.mem_;
+  load->volatile_ = lval.volatile_;
+  auto val = Operand::Reg(load->dst_);
+  if (lval.bitFieldWidth_ == 0)
+    return val;
+
+  // Shifts the field to the most significant bits, and then back
+  auto opType = irType == IRType::I64 ? IRType::I64: IRType::I32;
+  auto bits = SizeOf(opType) * 8;
+  if (opType != irType)
+    val = EmitConv(Opcode::ZEXT, opType, irType, val);
+  auto end = lval.bitFieldBegin_ + lval.bitFieldWidth_;
+  if (bits != end)
+    val = EmitOp(Opcode::SHL, opType, val, Operand::Imm(bits - end));
+  val = EmitOp(type->IsUnsigned() ? Opcode::SHR: Opcode::SAR, opType,
+               val, Operand::Imm(bits - lval.bitFieldWidth_));
+  if (opType != irType)
+    val = EmitConv(Opcode::TRUNC, irType, opType, val);
+  return val;
+}
+
+
+void IRBuilder::Store(const LVal& lval, Type* type, Operand val) {
+  auto irType = TypeOf(type);
+  if (lval.reg_ >= 0) {
+    EmitMov(lval.reg_, irType, val);
+    return;
+  }
+
+  if (lval.bitFieldWidth_) {
+    auto opType = irType == IRType::I64 ? IRType::I64: IRType::I32;
+    auto mask = Object::BitFieldMask(lval.bitFieldBegin_,
+                                     lval.bitFieldWidth_);
+    auto load = Emit(Opcode::LOAD, irType);
+    load->dst_ = func_->NewReg(irType);
+    load->mem_ = lval.mem_;
+    load->volatile_ = lval.volatile_;
+    auto old = Operand::Reg(load->dst_);
+    if (opType != irType) {
+      old = EmitConv(Opcode::ZEXT, opType, irType, old);
+      if (!val.IsImm())
+        val = EmitConv(Opcode::ZEXT, opType, irType, val);
+    }
+    if (val.IsImm()) {
+      val = Operand::Imm((val.Imm() << lval.bitFieldBegin_) & mask);
+    } else {
+      if (lval.bitFieldBegin_) {
+        val = EmitOp(Opcode::SHL, opType, val,
+                     Operand::Imm(lval.bitFieldBegin_));
+      }
+      val = EmitOp(Opcode::AND, opType, val, Operand::Imm(mask));
+    }
+    old = EmitOp(Opcode::AND, opType, old, Operand::Imm(~mask));
+    val = EmitOp(Opcode::OR, opType, old, val);
+    if (opType != irType)
+      val = EmitConv(Opcode::TRUNC, irType, opType, val);
+  }
+
+  auto store = Emit(Opcode::STORE, irType);
+  store->mem_ = lval.mem_;
+  store->args_.push_back(val);
+  store->volatile_ = lval.volatile_;
+}
+
+
+/*
+ * Lvalues
+ */
+
+IRBuilder::LVal IRBuilder::LValObject(Object* obj) {
+  SetTok(obj);
+  LVal lval;
+  lval.volatile_ = obj->IsVolatileQualified();
+  if (obj->IsStatic()) {
+    lval.mem_ = MemRef::Sym(obj->Repr());
+    return lval;
+  }
+  if (obj->Anonymous() && anonys_.insert(obj).second) {
+    // The compound literal is initialized where it first appears
+    assert(obj->Decl());
+    InitObject(obj->Decl(), MemRef::Slot(SlotOf(obj)));
+  }
+  if (Promoted(obj)) {
+    lval.reg_ = RegOf(obj);
+    lval.obj_ = obj;
+  } else {
+    lval.mem_ = MemRef::Slot(SlotOf(obj));
+  }
+  return lval;
+}
+
+
+IRBuilder::LVal IRBuilder::LValIdentifier(Identifier* ident) {
+  LVal lval;
+  lval.mem_ = MemRef::Sym(ident->Name());
+  return lval;
+}
+
+
+IRBuilder::LVal IRBuilder::LValBinaryOp(BinaryOp* binary) {
+  if (binary->op_ != '.')
+    return LValValue(binary);
+  SetTok(binary);
+  auto lval = GenLVal(binary->lhs_);
+  auto name = binary->rhs_->Tok()->str_;
+  auto member = binary->lhs_->Type()->ToStruct()->GetMember(name);
+  lval.mem_.disp_ += member->Offset();
+  lval.bitFieldBegin_ = member->BitFieldBegin();
+  lval.bitFieldWidth_ = member->BitFieldWidth();
+  lval.volatile_ = lval.volatile_ || binary->IsVolatileQualified();
+  return lval;
+}
+
+
+IRBuilder::LVal IRBuilder::LValUnaryOp(UnaryOp* unary) {
+  if (unary->op_ != Token::DEREF)
+    return LValValue(unary);
+  SetTok(unary);
+  LVal lval;
+  lval.mem_ = GenPtr(unary->operand_);
+  lval.volatile_ = unary->IsVolatileQualified();
+  return lval;
+}
+
+
+IRBuilder::LVal IRBuilder::LValTempVar(TempVar* tempVar) {
+  LVal lval;
+  auto iter = temps_.find(tempVar);
+  if (iter != temps_.end())
+    lval.reg_ = iter->second;
+  else
+    lval.reg_ = temps_[tempVar] = func_->NewReg(TypeOf(tempVar->Type()));
+  return lval;
+}
+
+
+// Struct/union values, like the result of function calls
+IRBuilder::LVal IRBuilder::LValValue(Expr* expr) {
+  LVal lval;
+  lval.mem_ = MemRef::Reg(ToReg(Gen(expr), IRType::I64));
+  return lval;
+}
+
+
+/*
+ * Addresses
+ */
+
+MemRef IRBuilder::PtrBinaryOp(BinaryOp* binary) {
+  auto op = binary->op_;
+  if ((op != '+' && op != '-') || !binary->lhs_->Type()->ToPointer() ||
+      binary->rhs_->Type()->ToPointer()) {
+    return PtrValue(binary);
+  }
+  SetTok(binary);
+  auto size = binary->lhs_->Type()->ToPointer()->Derived()->Width();
+  auto mem = GenPtr(binary->lhs_);
+  auto offset = Extend(Gen(binary->rhs_), binary->rhs_->Type(), IRType::I64);
+  if (offset.IsImm()) {
+    mem.disp_ += (op == '+' ? 1: -1) * offset.Imm() * size;
+    return mem;
+  }
+
+  if (mem.index_ >= 0 || mem.base_ == MemRef::SYM) {
+    LVal lval;
+    lval.mem_ = mem;
+    mem = MemRef::Reg(AddrOf(lval).Reg());
+  }
+  if (op == '-')
+    offset = EmitOp(Opcode::NEG, IRType::I64, offset, Operand());
+  if (size == 1 || size == 2 || size == 4 || size == 8) {
+    mem.index_ = ToReg(offset, IRType::I64);
+    mem.scale_ = size;
+    return mem;
+  }
+  offset = EmitOp(Opcode::MUL, IRType::I64, offset, Operand::Imm(size));
+  mem.index_ = offset.Reg();
+  return mem;
+}
+
+
+MemRef IRBuilder::PtrUnaryOp(UnaryOp* unary) {
+  auto operandType = unary->operand_->Type();
+  if (unary->op_ == Token::CAST && operandType->ToArray())
+    return GenLVal(unary->operand_).mem_;
+  if (unary->op_ == Token::CAST && operandType->ToPointer() &&
+      unary->Type()->ToPointer()) {
+    return GenPtr(unary->operand_);
+  }
+  return PtrValue(unary);
+}
+
+
+MemRef IRBuilder::PtrValue(Expr* expr) {
+  return MemRef::Reg(ToReg(Gen(expr), IRType::I64));
+}
+
+
+/*
+ * Conditions
+ */
+
+void IRBuilder::CondBinaryOp(BinaryOp* binary,
+                             BasicBlock* then, BasicBlock* els) {
+  SetTok(binary);
+  auto op = binary->op_;
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR) {
+    auto mid = func_->NewBlock();
+    if (op == Token::LOGICAL_AND)
+      GenCond(binary->lhs_, mid, els);
+    else
+      GenCond(binary->lhs_, then, mid);
+    StartBlock(mid);
+    GenCond(binary->rhs_, then, els);
+  } else if (op == ',') {
+    Gen(binary->lhs_);
+    GenCond(binary->rhs_, then, els);
+  } else if (IsRelational(op)) {
+    auto type = binary->lhs_->Type();
+    auto lhs = Gen(binary->lhs_);
+    auto rhs = Gen(binary->rhs_);
+    EmitBr(ToCond(op, IsUnsigned(type)), TypeOf(type), lhs, rhs, then, els);
+  } else {
+    CondValue(binary, then, els);
+  }
+}
+
+
+void IRBuilder::CondUnaryOp(UnaryOp* unary,
+                            BasicBlock* then, BasicBlock* els) {
+  if (unary->op_ == '!')
+    GenCond(unary->operand_, els, then);
+  else
+    CondValue(unary, then, els);
+}
+
+
+void IRBuilder::CondConstant(Constant* cons,
+                             BasicBlock* then, BasicBlock* els) {
+  auto type = cons->Type();
+  if (type->IsInteger())
+    EmitJmp(cons->IVal() ? then: els);
+  else if (type->IsFloat())
+    EmitJmp(cons->FVal() ? then: els);
+  else
+    EmitJmp(then);
+}
+
+
+void IRBuilder::CondValue(Expr* expr, BasicBlock* then, BasicBlock* els) {
+  auto val = Gen(expr);
+  EmitBr(Cond::NE, TypeOf(expr->Type()), val, Operand::Imm(0), then, els);
+}
+
+
+/*
+ * Statements
+ */
+
+void IRBuilder::VisitDeclaration(Declaration* decl) {
+  auto obj = decl->obj_;
+  if (obj->IsStatic()) {
+    func_->staticDecls_.push_back(decl);
+    return;
+  }
+  if (!obj->HasInit())
+    return;
+  SetTok(obj);
+  if (Promoted(obj)) {
+    assert(decl->Inits().size() == 1);
+    auto val = Gen(decl->Inits().begin()->expr_);
+    EmitMov(RegOf(obj), TypeOf(obj->Type()), val);
+  } else {
+    InitObject(decl, MemRef::Slot(SlotOf(obj)));
+  }
+}
+
+
+// The bytes not initialized explicitly are zeroed
+void IRBuilder::InitObject(Declaration* decl, const MemRef& mem) {
+  auto zero = [this, &mem](int begin, int end) {
+    auto inst = Emit(Opcode::ZERO, IRType::VOID);
+    inst->mem_ = mem;
+    inst->mem_.disp_ += begin;
+    inst->size_ = end - begin;
+  };
+
+  int lastEnd = 0;
+  for (const auto& init: decl->Inits()) {
+    auto width = init.type_->Width();
+    // The storage unit of a bit field is zeroed before it is stored
+    auto zeroEnd = init.offset_ + (init.bitFieldWidth_ ? width: 0);
+    if (lastEnd < zeroEnd)
+      zero(lastEnd, zeroEnd);
+    auto val = Gen(init.expr_);
+
+    LVal lval;
+    lval.mem_ = mem;
+    lval.mem_.disp_ += init.offset_;
+    lval.bitFieldBegin_ = init.bitFieldBegin_;
+    lval.bitFieldWidth_ = init.bitFieldWidth_;
+    if (init.type_->IsScalar()) {
+      Store(lval, init.type_, val);
+    } else {
+      assert(init.type_->ToStruct());
+      auto copy = Emit(Opcode::COPY, IRType::VOID);
+      copy->mem_ = lval.mem_;
+      copy->args_.push_back(val);
+      copy->size_ = width;
+    }
+    lastEnd = std::max(lastEnd, init.offset_ + width);
+  }
+  auto objEnd = decl->obj_->Type()->Width();
+  if (lastEnd < objEnd)
+    zero(lastEnd, objEnd);
+}
+
+
+void IRBuilder::VisitIfStmt(IfStmt* ifStmt) {
+  auto then = func_->NewBlock();
+  auto els = ifStmt->else_ ? func_->NewBlock(): nullptr;
+  auto end = func_->NewBlock();
+
+  GenCond(ifStmt->cond_, then, els ? els: end);
+  StartBlock(then);
+  Visit(ifStmt->then_);
+  if (els) {
+    EmitJmp(end);
+    StartBlock(els);
+    Visit(ifStmt->else_);
+  }
+  StartBlock(end);
+}
+
+
+void IRBuilder::VisitJumpStmt(JumpStmt* jumpStmt) {
+  EmitJmp(BlockOf(jumpStmt->label_));
+}
+
+
+void IRBuilder::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  auto select = switchStmt->select_;
+  SetTok(select);
+  auto val = Gen(select);
+  auto clusters = ClusterCases(switchStmt);
+  auto dflt = BlockOf(switchStmt->default_ ? switchStmt->default_:
+                                             switchStmt->end_);
+  GenSwitch(switchStmt, val, clusters, 0, clusters.size(), dflt);
+  Visit(switchStmt->body_);
+  StartBlock(BlockOf(switchStmt->end_));
+}
+
+
+void IRBuilder::GenSwitch(SwitchStmt* switchStmt, Operand val,
+                          const ClusterList& clusters,
+                          size_t first, size_t last, BasicBlock* dflt) {
+  auto type = TypeOf(switchStmt->select_->Type());
+  if (last - first > maxLinearClusters) {
+    auto mid = (first + last) / 2;
+    auto left = func_->NewBlock();
+    auto right = func_->NewBlock();
+    auto cond = switchStmt->IsUnsigned() ? Cond::ULT: Cond::LT;
+    EmitBr(cond, type, val, Operand::Imm(clusters[mid].low_), left, right);
+    StartBlock(left);
+    GenSwitch(switchStmt, val, clusters, first, mid, dflt);
+    StartBlock(right);
+    GenSwitch(switchStmt, val, clusters, mid, last, dflt);
+    return;
+  }
+
+  if (first == last)
+    EmitJmp(dflt);
+  for (auto i = first; i < last; ++i) {
+    const auto& cluster = clusters[i];
+    auto next = i + 1 < last ? func_->NewBlock(): dflt;
+    auto low = Operand::Imm(cluster.low_);
+    if (cluster.IsTable()) {
+      auto inst = Emit(Opcode::SWITCH, type);
+      inst->args_ = {val, low};
+      inst->targets_[0] = next;
+      for (auto label: cluster.table_)
+        inst->table_.push_back(label ? BlockOf(label): dflt);
+    } else if (cluster.low_ == cluster.high_) {
+      EmitBr(Cond::EQ, type, val, low, BlockOf(cluster.label_), next);
+    } else {
+      // Unsigned 'val - low <= high - low'
+      auto diff = EmitOp(Opcode::SUB, type, val, low);
+      auto size = Operand::Imm(cluster.high_ - cluster.low_);
+      EmitBr(Cond::ULE, type, diff, size, BlockOf(cluster.label_), next);
+    }
+    if (next != dflt)
+      StartBlock(next);
+  }
+}
+
+
+void IRBuilder::VisitLabelStmt(LabelStmt* labelStmt) {
+  StartBlock(BlockOf(labelStmt));
+}
+
+
+void IRBuilder::VisitReturnStmt(ReturnStmt* returnStmt) {
+  auto expr = returnStmt->expr_;
+  if (!expr) {
+    EmitRet(Operand());
+    return;
+  }
+  auto val = Gen(expr);
+  if (func_->retTypes_.size()) {
+    std::vector<Operand> vals;
+    for (size_t i = 0; i < func_->retTypes_.size(); ++i)
+      vals.push_back(LoadEightbyte(val, i, func_->retTypes_[i]));
+    Emit(Opcode::RET, func_->retType_)->args_ = vals;
+    return;
+  } else if (expr->Type()->ToStruct()) {
+    auto copy = Emit(Opcode::COPY, IRType::VOID);
+    copy->mem_ = MemRef::Reg(func_->retPtr_);
+    copy->args_.push_back(val);
+    copy->size_ = expr->Type()->Width();
+    val = Operand::Reg(func_->retPtr_);
+  } else if (expr->Type()->IsInteger() && SizeOf(func_->retType_) < 4) {
+    val = Extend(val, expr->Type(), IRType::I32);
+  }
+  EmitRet(val);
+}
+
+
+void IRBuilder::VisitCompoundStmt(CompoundStmt* compStmt) {
+  for (auto stmt: compStmt->stmts_)
+    Visit(stmt);
+}
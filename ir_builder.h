@@ -0,0 +1,149 @@
+#ifndef _WGTCC_IR_BUILDER_H_
+#define _WGTCC_IR_BUILDER_H_
+
+#include "ast.h"
+#include "ir.h"
+#include "switch_lowering.h"
+#include "visitor.h"
+
+#include <map>
+#include <set>
+
+
+/*
+ * Translates a function definition to IR.
+ * The scalar locals that are neither volatile nor address taken are
+ * promoted to virtual registers, the other locals live in stack slots.
+ * An expression of scalar type evaluates to an operand, an expression
+ * of aggregate type (struct/union, array or function) evaluates to
+ * its address.
+ */
+class IRBuilder: public Visitor {
+public:
+  explicit IRBuilder(FuncDef* def): def_(def) {}
+
+  // Returns nullptr if the function uses what the backend doesn't
+  // support, like variable arguments.
+  IRFunc* Build();
+
+  void Visit(ASTNode* node) { node->Accept(this); }
+
+  //Expression
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar);
+
+  //statement
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+  virtual void VisitFuncDef(FuncDef* funcDef) { assert(false); }
+  virtual void VisitTranslationUnit(TranslationUnit* unit) { assert(false); }
+
+  static IRType TypeOf(Type* type);
+
+private:
+  // A virtual register or a memory location
+  struct LVal {
+    int reg_ {-1};
+    Object* obj_ {nullptr};   // The promoted object of 'reg_'
+    MemRef mem_;
+    unsigned char bitFieldBegin_ {0};
+    unsigned char bitFieldWidth_ {0};
+    bool volatile_ {false};
+  };
+
+  class Dispatcher;
+  class LValDispatcher;
+  class CondDispatcher;
+  class PtrDispatcher;
+
+  void BuildFunc();
+  bool Promoted(Object* obj);
+  int RegOf(Object* obj);
+  int SlotOf(Object* obj);
+  BasicBlock* BlockOf(LabelStmt* label);
+  void SetTok(Expr* expr) { if (expr->Tok()) tok_ = expr->Tok(); }
+
+  Inst* Emit(Opcode op, IRType type);
+  Operand EmitOp(Opcode op, IRType type, Operand lhs, Operand rhs);
+  Operand EmitConv(Opcode op, IRType type, IRType srcType, Operand val);
+  Operand EmitSet(Cond cond, IRType srcType, Operand lhs, Operand rhs,
+                  IRType type=IRType::I32);
+  void EmitMov(int dst, IRType type, Operand val);
+  void EmitJmp(BasicBlock* target);
+  void EmitBr(Cond cond, IRType srcType, Operand lhs, Operand rhs,
+              BasicBlock* then, BasicBlock* els);
+  void EmitRet(Operand val);
+  void StartBlock(BasicBlock* bb);
+  int ToReg(Operand val, IRType type);
+
+  Operand Gen(Expr* expr);
+  LVal GenLVal(Expr* expr);
+  MemRef GenPtr(Expr* expr);
+  void GenCond(Expr* expr, BasicBlock* then, BasicBlock* els);
+  Operand GenCondValue(Expr* expr);
+
+  void GenSwitch(SwitchStmt* switchStmt, Operand val,
+                 const ClusterList& clusters, size_t first, size_t last,
+                 BasicBlock* dflt);
+  Operand GenAssign(BinaryOp* assign);
+  Operand GenPointerArithm(BinaryOp* binary);
+  Operand GenIncDec(UnaryOp* unary, bool postfix, Opcode op);
+  Operand GenCast(Operand val, Type* from, Type* to);
+  Operand Extend(Operand val, Type* from, IRType to);
+  Operand AddrOf(const LVal& lval);
+  Operand Load(const LVal& lval, Type* type);
+  Operand LoadEightbyte(Operand addr, size_t idx, IRType type);
+  void Store(const LVal& lval, Type* type, Operand val);
+  void InitObject(Declaration* decl, const MemRef& mem);
+
+  // Called by the dispatchers
+  LVal LValObject(Object* obj);
+  LVal LValIdentifier(Identifier* ident);
+  LVal LValBinaryOp(BinaryOp* binary);
+  LVal LValUnaryOp(UnaryOp* unary);
+  LVal LValTempVar(TempVar* tempVar);
+  LVal LValValue(Expr* expr);
+  void CondBinaryOp(BinaryOp* binary, BasicBlock* then, BasicBlock* els);
+  void CondUnaryOp(UnaryOp* unary, BasicBlock* then, BasicBlock* els);
+  void CondConstant(Constant* cons, BasicBlock* then, BasicBlock* els);
+  void CondValue(Expr* expr, BasicBlock* then, BasicBlock* els);
+  MemRef PtrBinaryOp(BinaryOp* binary);
+  MemRef PtrUnaryOp(UnaryOp* unary);
+  MemRef PtrValue(Expr* expr);
+
+  FuncDef* def_;
+  IRFunc* func_ {nullptr};
+  BasicBlock* cur_ {nullptr};
+  Operand result_;
+  const Token* tok_ {nullptr};
+  // Met something unsupported
+  bool unsupported_ {false};
+  // Found more objects whose address is taken, build again
+  bool retry_ {false};
+  std::set<Object*> addrTaken_;
+
+  std::map<Object*, int> regs_;
+  std::map<Object*, int> slots_;
+  std::map<TempVar*, int> temps_;
+  std::map<LabelStmt*, BasicBlock*> labels_;
+  // Compound literals those have been initialized
+  std::set<Object*> anonys_;
+  // The lhs of the assignments being built, as the lhs of a compound
+  // assignment is shared by its rhs and must be evaluated once.
+  std::map<Expr*, LVal> lvals_;
+};
+
+#endif
@@ -0,0 +1,1144 @@
+#include "ir_code_gen.h"
+
+#include "ir_opt.h"
+#include "ssa.h"
+#include "token.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+extern bool debug;
+extern bool framePointer;
+extern int copyInlineMax;
+
+
+static const char* regNames[4][16] = {
+  {"%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+   "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"},
+  {"%ax", "%cx", "%dx", "%bx", "%sp", "%bp", "%si", "%di",
+   "%r8w", "%r9w", "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w"},
+  {"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+   "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"},
+  {"%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+   "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"},
+};
+
+
+static std::string RegName(int phys, int size) {
+  if (phys >= XMM0)
+    return "%xmm" + std::to_string(phys - XMM0);
+  auto idx = size == 1 ? 0: size == 2 ? 1: size == 4 ? 2: 3;
+  return regNames[idx][phys];
+}
+
+
+static std::string Suffix(int size) {
+  return size == 1 ? "b": size == 2 ? "w": size == 4 ? "l": "q";
+}
+
+
+// Integers narrower than 32 bits are computed in 32 bits
+static int OpSize(IRType type) {
+  return type == IRType::I64 ? 8: 4;
+}
+
+
+static std::string FltSuffix(IRType type) {
+  return type == IRType::F32 ? "ss": "sd";
+}
+
+
+static bool IsImm32(long val) {
+  return val == static_cast<int>(val);
+}
+
+
+static long Truncate(long val, int size) {
+  switch (size) {
+  case 1: return static_cast<signed char>(val);
+  case 2: return static_cast<short>(val);
+  case 4: return static_cast<int>(val);
+  default: return val;
+  }
+}
+
+
+static std::string ImmStr(long val) {
+  return "$" + std::to_string(val);
+}
+
+
+static std::string Invert(const std::string& cc) {
+  static const char* pairs[][2] = {
+    {"e", "ne"}, {"l", "ge"}, {"le", "g"}, {"b", "ae"}, {"be", "a"},
+  };
+  for (auto pair: pairs) {
+    if (cc == pair[0]) return pair[1];
+    if (cc == pair[1]) return pair[0];
+  }
+  assert(false);
+  return "";
+}
+
+
+// The registers of the eightbytes of a struct/union returned
+static std::vector<int> RetRegs(const std::vector<IRType>& types) {
+  std::vector<int> regs;
+  int gp = 0, fp = 0;
+  for (auto type: types)
+    regs.push_back(IsFloat(type) ? XMM0 + fp++: (gp++ ? RDX: RAX));
+  return regs;
+}
+
+
+bool IRCodeGen::GenFuncDef(FuncDef* def) {
+  auto func = BuildIR(def);
+  if (func == nullptr)
+    return false;
+  DestroySSA(func);
+  func->SimplifyCFG();
+  IRCodeGen(func).GenFunc();
+
+  for (const auto& str: func->strings_) {
+    ROData rodata(str.second);
+    rodata.label_ = str.first;
+    rodatas_.push_back(rodata);
+  }
+  for (auto decl: func->staticDecls_)
+    staticDecls_.push_back(decl);
+  delete func;
+  return true;
+}
+
+
+void IRCodeGen::GenFunc() {
+  static int funcNo = 0;
+  funcNo_ = funcNo++;
+  alloc_.Run();
+
+  // Frame layout
+  int offset = 0;
+  for (auto reg: {RBX, R12, R13, R14, R15}) {
+    if (alloc_.Used() & MaskOf(reg)) {
+      offset -= 8;
+      saved_.push_back({reg, offset});
+    }
+  }
+  for (const auto& slot: func_->slots_) {
+    if (slot.incoming_) {
+      slotOffsets_.push_back(slot.offset_);
+      incomingSlots_ = true;
+      incoming_ = std::max(incoming_, slot.offset_ - 16 +
+                           Type::MakeAlign(slot.size_, 8));
+    } else {
+      auto align = std::max(slot.align_, 1);
+      offset = -Type::MakeAlign(-offset + slot.size_, align);
+      slotOffsets_.push_back(offset);
+    }
+  }
+  for (const auto& param: func_->params_) {
+    if (param.offset_)
+      incoming_ = std::max(incoming_, param.offset_ - 8);
+  }
+  slotsPrivate_ = EscapedSlots(func_).empty();
+  spillBase_ = offset;
+  offset -= 8 * alloc_.NumSpillSlots();
+  int outgoing = 0;
+  bool leaf = true;
+  for (auto bb: func_->blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->op_ != Opcode::CALL)
+        continue;
+      leaf = false;
+      int size = 0, gp = 0, fp = 0;
+      for (const auto& arg: inst->call_->args_) {
+        if (arg.size_)
+          size += Type::MakeAlign(arg.size_, 8);
+        else if (IsFloat(arg.type_) ? fp++ >= 8: gp++ >= 6)
+          size += 8;
+      }
+      outgoing = std::max(outgoing, size);
+    }
+  }
+  auto frameSize = Type::MakeAlign(-offset + outgoing, 16);
+  // A leaf function has no frame pointer, the frame is below the return
+  // address; in the red zone, the 128 bytes below %rsp, if it fits.
+  // Not if the address of a slot is taken, the slot must stay above %rsp.
+  frameless_ = leaf && slotsPrivate_ && !debug && !framePointer;
+  if (frameless_) {
+    frameSize = -offset + 8 <= 128 ? 0: Type::MakeAlign(-offset + 8, 16);
+    frameSize_ = frameSize;
+  }
+
+  auto def = func_->def_;
+  auto name = def->Name();
+  Emit(".text");
+  if (def->Linkage() == L_INTERNAL) {
+    Emit(".local", name);
+  } else {
+    Emit(".globl", name);
+  }
+  Emit(".type", name, "@function");
+  EmitLabel(name);
+  if (!frameless_) {
+    Emit("pushq", "%rbp");
+    Emit("movq", "%rsp", "%rbp");
+  }
+  if (frameSize)
+    Emit("subq", frameSize, "%rsp");
+  for (const auto& save: saved_)
+    Emit("movq", RegName(save.first, 8), FrameAddr(save.second));
+
+  // Parameters to their registers
+  std::vector<Move> moves;
+  int gp = 0, fp = 0;
+  auto addMove = [&](int reg, IRType type, int src,
+                     const std::string& srcStr) {
+    if (alloc_.Phys(reg) < 0 && alloc_.SpillSlot(reg) < 0)
+      return;   // Never used
+    auto dst = alloc_.Phys(reg);
+    moves.push_back({type, src, srcStr, dst, dst < 0 ? SpillAddr(reg): ""});
+  };
+  if (func_->retPtr_ >= 0)
+    addMove(func_->retPtr_, IRType::I64, RegAlloc::IntArgReg(gp++), "");
+  for (const auto& param: func_->params_) {
+    if (param.reg_ < 0)
+      continue;
+    auto type = func_->RegType(param.reg_);
+    if (param.offset_) {
+      addMove(param.reg_, type, -1, FrameAddr(param.offset_));
+    } else {
+      auto src = RegAlloc::ArgReg(type, IsFloat(type) ? fp++: gp++);
+      addMove(param.reg_, type, src, "");
+    }
+  }
+  GenParallelMove(moves);
+
+  auto& blocks = func_->blocks_;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    next_ = i + 1 < blocks.size() ? blocks[i + 1]: nullptr;
+    EmitLabel(Label(blocks[i]));
+    auto& insts = blocks[i]->insts_;
+    for (size_t j = 0; j < insts.size(); ++j) {
+      EmitInstLoc(insts[j]);
+      if (SiblingCall(blocks[i], j)) {
+        GenCall(insts[j], true);
+        break;
+      }
+      volatile_ = insts[j]->volatile_;
+      GenInst(insts[j]);
+      volatile_ = false;
+    }
+  }
+}
+
+
+void IRCodeGen::GenInst(Inst* inst) {
+  auto type = inst->type_;
+  switch (inst->op_) {
+  case Opcode::MOV: {
+    auto phys = DstPhys(inst);
+    LoadTo(inst->args_[0], type, phys);
+    WriteBack(inst, phys);
+  } break;
+  case Opcode::ADD: case Opcode::SUB: case Opcode::MUL:
+  case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+    if (IsFloat(type))
+      GenFloatBinary(inst);
+    else
+      GenBinary(inst);
+    break;
+  case Opcode::DIV: case Opcode::UDIV: case Opcode::MOD: case Opcode::UMOD:
+    if (IsFloat(type))
+      GenFloatBinary(inst);
+    else
+      GenDivMod(inst);
+    break;
+  case Opcode::SHL: case Opcode::SHR: case Opcode::SAR:
+    GenShift(inst);
+    break;
+  case Opcode::NEG: case Opcode::NOT:
+    GenNeg(inst);
+    break;
+  case Opcode::SET:
+    GenSet(inst);
+    break;
+  case Opcode::SEXT: case Opcode::ZEXT: case Opcode::TRUNC:
+  case Opcode::ITOF: case Opcode::UTOF: case Opcode::FTOI:
+  case Opcode::FTOU: case Opcode::FCVT:
+    GenConv(inst);
+    break;
+  case Opcode::LOAD: {
+    auto mem = MemStr(inst->mem_);
+    auto phys = DstPhys(inst);
+    switch (type) {
+    case IRType::I8: Emit("movzbl", mem, RegName(phys, 4)); break;
+    case IRType::I16: Emit("movzwl", mem, RegName(phys, 4)); break;
+    case IRType::I32: Emit("movl", mem, RegName(phys, 4)); break;
+    case IRType::I64: Emit("movq", mem, RegName(phys, 8)); break;
+    default: Emit("mov" + FltSuffix(type), mem, RegName(phys, 8)); break;
+    }
+    WriteBack(inst, phys);
+  } break;
+  case Opcode::STORE:
+    StoreTo(inst->args_[0], type, MemStr(inst->mem_));
+    break;
+  case Opcode::LEA: {
+    auto mem = MemStr(inst->mem_);
+    auto phys = DstPhys(inst);
+    Emit("leaq", mem, RegName(phys, 8));
+    WriteBack(inst, phys);
+  } break;
+  case Opcode::COPY:
+    Emit("leaq", MemStr(inst->mem_), "%r10");
+    LoadTo(inst->args_[0], IRType::I64, R11);
+    GenCopy("%r11", "%r10", inst->size_, RCX);
+    break;
+  case Opcode::ZERO: {
+    Emit("leaq", MemStr(inst->mem_), "%r10");
+    long offset = 0;
+    if (inst->size_ >= 16)
+      Emit("xorps", "%xmm15", "%xmm15");
+    if (inst->size_ > copyInlineMax && inst->size_ >= 32)
+      offset = GenBlockLoop("", "%r10", inst->size_, "%r11");
+    for (int width = 16; width; width /= 2) {
+      for (; inst->size_ - offset >= width; offset += width) {
+        auto des = std::to_string(offset) + "(%r10)";
+        if (width == 16)
+          Emit("movups", "%xmm15", des);
+        else
+          Emit("mov" + Suffix(width), ImmStr(0), des);
+      }
+    }
+  } break;
+  case Opcode::CALL:
+    GenCall(inst, false);
+    break;
+  case Opcode::JMP:
+    if (inst->targets_[0] != next_)
+      Emit("jmp", Label(inst->targets_[0]));
+    break;
+  case Opcode::BR:
+    GenBr(inst);
+    break;
+  case Opcode::SWITCH:
+    GenSwitch(inst);
+    break;
+  case Opcode::RET:
+    GenRet(inst);
+    break;
+  case Opcode::PHI:
+    // Replaced by DestroySSA
+    assert(false);
+    break;
+  }
+}
+
+
+void IRCodeGen::GenBinary(Inst* inst) {
+  static const char* names[] = {
+    nullptr, "add", "sub", "imul", nullptr, nullptr, nullptr, nullptr,
+    "and", "or", "xor",
+  };
+  auto type = inst->type_;
+  auto size = OpSize(type);
+  auto op = std::string(names[static_cast<int>(inst->op_)]) + Suffix(size);
+  auto lhs = inst->args_[0], rhs = inst->args_[1];
+  auto phys = DstPhys(inst);
+  auto des = RegName(phys, size);
+  bool commutative = inst->op_ != Opcode::SUB;
+
+  // Three-address forms
+  auto lhsPhys = Phys(lhs), rhsPhys = Phys(rhs);
+  if (lhsPhys >= 0 && lhsPhys != phys) {
+    auto base = RegName(lhsPhys, 8);
+    if (inst->op_ == Opcode::ADD && rhsPhys >= 0 && rhsPhys != phys) {
+      Emit("lea" + Suffix(size), "(" + base + "," + RegName(rhsPhys, 8) + ")",
+           des);
+      return WriteBack(inst, phys);
+    }
+    if ((inst->op_ == Opcode::ADD || inst->op_ == Opcode::SUB) &&
+        rhs.IsImm() && IsImm32(rhs.Imm()) && IsImm32(-rhs.Imm())) {
+      auto disp = inst->op_ == Opcode::ADD ? rhs.Imm(): -rhs.Imm();
+      Emit("lea" + Suffix(size), std::to_string(Truncate(disp, size)) +
+           "(" + base + ")", des);
+      return WriteBack(inst, phys);
+    }
+  }
+  if (inst->op_ == Opcode::MUL && rhs.IsImm() &&
+      IsImm32(Truncate(rhs.Imm(), size)) && !lhs.IsImm()) {
+    Emit(op, ImmStr(Truncate(rhs.Imm(), size)) + ", " +
+         Src(lhs, type, R11), des);
+    return WriteBack(inst, phys);
+  }
+
+  if (rhsPhys >= 0 && rhsPhys == phys && lhsPhys != phys) {
+    if (commutative) {
+      std::swap(lhs, rhs);
+    } else {
+      LoadTo(lhs, type, R11);
+      Emit(op, RegName(rhsPhys, size), RegName(R11, size));
+      Emit("mov" + Suffix(size), RegName(R11, size), des);
+      return;
+    }
+  }
+  LoadTo(lhs, type, phys);
+  Emit(op, Src(rhs, type, R10), des);
+  WriteBack(inst, phys);
+}
+
+
+void IRCodeGen::GenFloatBinary(Inst* inst) {
+  static const char* names[] = {
+    nullptr, "add", "sub", "mul", "div",
+  };
+  auto type = inst->type_;
+  auto op = std::string(names[static_cast<int>(inst->op_)]) + FltSuffix(type);
+  auto lhs = inst->args_[0], rhs = inst->args_[1];
+  auto phys = DstPhys(inst);
+  auto des = RegName(phys, 8);
+  std::string src;
+  if (Phys(rhs) == phys && Phys(lhs) != phys) {
+    if (inst->op_ == Opcode::ADD || inst->op_ == Opcode::MUL) {
+      std::swap(lhs, rhs);
+    } else {
+      Emit("movaps", des, "%xmm14");
+      src = "%xmm14";
+    }
+  }
+  LoadTo(lhs, type, phys);
+  Emit(op, src.size() ? src: Src(rhs, type, XMM14), des);
+  WriteBack(inst, phys);
+}
+
+
+void IRCodeGen::GenDivMod(Inst* inst) {
+  auto type = inst->type_;
+  auto size = OpSize(type);
+  auto rhs = inst->args_[1];
+  std::string src;
+  if (rhs.IsImm() || Phys(rhs) == RAX || Phys(rhs) == RDX) {
+    LoadTo(rhs, type, R11);
+    src = RegName(R11, size);
+  } else {
+    src = Src(rhs, type, R11);
+  }
+  LoadTo(inst->args_[0], type, RAX);
+  if (inst->op_ == Opcode::DIV || inst->op_ == Opcode::MOD) {
+    Emit(size == 8 ? "cqto": "cltd");
+    Emit("idiv" + Suffix(size), src);
+  } else {
+    Emit("xorl", "%edx", "%edx");
+    Emit("div" + Suffix(size), src);
+  }
+  auto res = inst->op_ == Opcode::DIV || inst->op_ == Opcode::UDIV ? RAX: RDX;
+  auto phys = alloc_.Phys(inst->dst_);
+  if (phys < 0)
+    Emit("movq", RegName(res, 8), SpillAddr(inst->dst_));
+  else if (phys != res)
+    Emit("mov" + Suffix(size), RegName(res, size), RegName(phys, size));
+}
+
+
+void IRCodeGen::GenShift(Inst* inst) {
+  auto op = inst->op_ == Opcode::SHL ? "shl": inst->op_ == Opcode::SHR ?
+            "shr": "sar";
+  auto type = inst->type_;
+  auto size = OpSize(type);
+  auto rhs = inst->args_[1];
+  auto phys = DstPhys(inst);
+  if (rhs.IsImm()) {
+    LoadTo(inst->args_[0], type, phys);
+    Emit(op + Suffix(size), ImmStr(rhs.Imm() & (size * 8 - 1)),
+         RegName(phys, size));
+    return WriteBack(inst, phys);
+  }
+  LoadTo(inst->args_[0], type, R11);
+  if (Phys(rhs) != RCX)
+    Emit("movl", Src(rhs, IRType::I32, R10), "%ecx");
+  Emit(op + Suffix(size), "%cl", RegName(R11, size));
+  if (phys != R11)
+    Emit("mov" + Suffix(size), RegName(R11, size), RegName(phys, size));
+  WriteBack(inst, phys);
+}
+
+
+void IRCodeGen::GenNeg(Inst* inst) {
+  auto type = inst->type_;
+  auto phys = DstPhys(inst);
+  LoadTo(inst->args_[0], type, phys);
+  if (!IsFloat(type)) {
+    auto size = OpSize(type);
+    auto op = inst->op_ == Opcode::NEG ? "neg": "not";
+    Emit(op + Suffix(size), RegName(phys, size));
+  } else if (type == IRType::F32) {
+    Emit("movl", ImmStr(static_cast<int>(0x80000000)), "%r11d");
+    Emit("movd", "%r11d", "%xmm14");
+    Emit("xorps", "%xmm14", RegName(phys, 8));
+  } else {
+    Emit("movabsq", ImmStr(0x8000000000000000L), "%r11");
+    Emit("movq", "%r11", "%xmm14");
+    Emit("xorpd", "%xmm14", RegName(phys, 8));
+  }
+  WriteBack(inst, phys);
+}
+
+
+void IRCodeGen::GenConv(Inst* inst) {
+  auto type = inst->type_;
+  auto srcType = inst->srcType_;
+  auto val = inst->args_[0];
+  auto phys = DstPhys(inst);
+  auto des = RegName(phys, IsFloat(type) ? 8: OpSize(type));
+  std::string src;
+  if (val.IsImm())
+    src = InReg(val, srcType, IsFloat(srcType) ? XMM15: R11, SizeOf(srcType));
+  else
+    src = Src(val, srcType, R11, SizeOf(srcType));
+
+  switch (inst->op_) {
+  case Opcode::SEXT:
+    if (srcType == IRType::I32)
+      Emit("movslq", src, des);
+    else
+      Emit("movs" + Suffix(SizeOf(srcType)) + Suffix(OpSize(type)), src, des);
+    break;
+  case Opcode::ZEXT:
+    if (srcType == IRType::I32)
+      Emit("movl", src, RegName(phys, 4));
+    else
+      Emit("movz" + Suffix(SizeOf(srcType)) + "l", src, RegName(phys, 4));
+    break;
+  case Opcode::TRUNC:
+    src = val.IsImm() ? RegName(R11, 4): Src(val, srcType, R11, 4);
+    if (src != RegName(phys, 4))
+      Emit("movl", src, RegName(phys, 4));
+    break;
+  case Opcode::ITOF:
+    Emit("pxor", des, des);
+    Emit("cvtsi2" + FltSuffix(type) + Suffix(SizeOf(srcType)), src, des);
+    break;
+  case Opcode::UTOF: {
+    // Halves the values not representable as signed, keeping
+    // the lowest bit for rounding, then doubles the result.
+    assert(srcType == IRType::I64);
+    auto big = NewLabel();
+    auto end = NewLabel();
+    auto cvt = "cvtsi2" + FltSuffix(type) + "q";
+    if (src != "%r11")
+      Emit("movq", src, "%r11");
+    Emit("pxor", des, des);
+    Emit("testq", "%r11", "%r11");
+    Emit("js", big);
+    Emit(cvt, "%r11", des);
+    Emit("jmp", end);
+    EmitLabel(big);
+    Emit("movq", "%r11", "%r10");
+    Emit("shrq", "%r10");
+    Emit("andl", ImmStr(1), "%r11d");
+    Emit("orq", "%r11", "%r10");
+    Emit(cvt, "%r10", des);
+    Emit("add" + FltSuffix(type), des, des);
+    EmitLabel(end);
+  } break;
+  case Opcode::FTOI:
+    Emit("cvtt" + FltSuffix(srcType) + "2si" + Suffix(OpSize(type)),
+         src, des);
+    break;
+  case Opcode::FTOU: {
+    // Values not less than 2^63 are subtracted by 2^63 before conversion
+    assert(type == IRType::I64);
+    auto big = NewLabel();
+    auto end = NewLabel();
+    auto cvt = "cvtt" + FltSuffix(srcType) + "2siq";
+    auto bound = srcType == IRType::F32 ? 0x5f000000L: 0x43e0000000000000L;
+    if (src.compare(0, 4, "%xmm")) {
+      Emit("mov" + FltSuffix(srcType), src, "%xmm15");
+      src = "%xmm15";
+    }
+    Emit("mov" + FltSuffix(srcType), FloatConst(bound, srcType), "%xmm14");
+    Emit("ucomi" + FltSuffix(srcType), "%xmm14", src);
+    Emit("jae", big);
+    Emit(cvt, src, des);
+    Emit("jmp", end);
+    EmitLabel(big);
+    Emit("movaps", src, "%xmm15");
+    Emit("sub" + FltSuffix(srcType), "%xmm14", "%xmm15");
+    Emit(cvt, "%xmm15", des);
+    Emit("btcq", ImmStr(63), des);
+    EmitLabel(end);
+  } break;
+  case Opcode::FCVT:
+    Emit("cvt" + FltSuffix(srcType) + "2" + FltSuffix(type), src, des);
+    break;
+  default:
+    assert(false);
+  }
+  WriteBack(inst, phys);
+}
+
+
+// Returns the condition code of the flags
+std::string IRCodeGen::GenCompare(Inst* inst) {
+  static const char* intCodes[] = {
+    "e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae",
+  };
+  auto type = inst->srcType_;
+  auto lhs = inst->args_[0], rhs = inst->args_[1];
+  auto cond = inst->cond_;
+  if (IsFloat(type)) {
+    auto op = "ucomi" + FltSuffix(type);
+    if (cond == Cond::LT || cond == Cond::LE) {
+      Emit(op, Src(lhs, type, XMM15), InReg(rhs, type, XMM14));
+      return cond == Cond::LT ? "a": "ae";
+    }
+    Emit(op, Src(rhs, type, XMM15), InReg(lhs, type, XMM14));
+    switch (cond) {
+    case Cond::GT: return "a";
+    case Cond::GE: return "ae";
+    case Cond::EQ: return "e";
+    default: return "ne";
+    }
+  }
+
+  auto size = SizeOf(type);
+  auto code = intCodes[static_cast<int>(cond)];
+  if (!lhs.IsImm() && rhs.IsImm() && Truncate(rhs.Imm(), size) == 0) {
+    auto reg = InReg(lhs, type, R11, size);
+    Emit("test" + Suffix(size), reg, reg);
+    return code;
+  }
+  std::string des;
+  if (lhs.IsImm() || (Phys(lhs) < 0 && rhs.IsReg() && Phys(rhs) < 0))
+    des = InReg(lhs, type, R11, size);
+  else
+    des = Src(lhs, type, R11, size);
+  Emit("cmp" + Suffix(size), Src(rhs, type, R10, size), des);
+  return code;
+}
+
+
+void IRCodeGen::GenSet(Inst* inst) {
+  auto cc = GenCompare(inst);
+  auto phys = DstPhys(inst);
+  auto des = RegName(phys, 1);
+  Emit("set" + cc, des);
+  if (IsFloat(inst->srcType_)) {
+    // Unordered if PF is set
+    if (inst->cond_ == Cond::EQ) {
+      Emit("setnp", "%r10b");
+      Emit("andb", "%r10b", des);
+    } else if (inst->cond_ == Cond::NE) {
+      Emit("setp", "%r10b");
+      Emit("orb", "%r10b", des);
+    }
+  }
+  Emit("movzbl", des, RegName(phys, 4));
+  WriteBack(inst, phys);
+}
+
+
+void IRCodeGen::GenBr(Inst* inst) {
+  auto cc = GenCompare(inst);
+  auto then = inst->targets_[0];
+  auto els = inst->targets_[1];
+  if (IsFloat(inst->srcType_) &&
+      (inst->cond_ == Cond::EQ || inst->cond_ == Cond::NE)) {
+    if (inst->cond_ == Cond::EQ) {
+      Emit("jne", Label(els));
+      Emit("jp", Label(els));
+      if (then != next_)
+        Emit("jmp", Label(then));
+    } else {
+      Emit("jne", Label(then));
+      Emit("jp", Label(then));
+      if (els != next_)
+        Emit("jmp", Label(els));
+    }
+    return;
+  }
+  if (then == next_) {
+    Emit("j" + Invert(cc), Label(els));
+  } else {
+    Emit("j" + cc, Label(then));
+    if (els != next_)
+      Emit("jmp", Label(els));
+  }
+}
+
+
+// The entries of the table in .rodata are offsets from the table
+void IRCodeGen::GenSwitch(Inst* inst) {
+  auto type = inst->type_;
+  auto size = SizeOf(type);
+  auto low = Truncate(inst->args_[1].Imm(), size);
+  auto idx = RegName(R11, size);
+  LoadTo(inst->args_[0], type, R11);
+  if (IsImm32(low)) {
+    if (low)
+      Emit("sub" + Suffix(size), ImmStr(low), idx);
+  } else {
+    Emit("movabsq", ImmStr(low), "%r10");
+    Emit("subq", "%r10", idx);
+  }
+  Emit("cmp" + Suffix(size), ImmStr(inst->table_.size() - 1), idx);
+  Emit("ja", Label(inst->targets_[0]));
+
+  auto table = NewLabel();
+  Emit("leaq", table + "(%rip)", "%r10");
+  Emit("movslq", "(%r10,%r11,4)", "%r11");
+  Emit("addq", "%r10", "%r11");
+  Emit("jmp", "*%r11");
+  Emit(".section", ".rodata");
+  Emit(".align", "4");
+  EmitLabel(table);
+  for (auto target: inst->table_)
+    Emit(".long", Label(target) + " - " + table);
+  Emit(".text");
+}
+
+
+/*
+ * Whether the call at 'pos' of 'bb' is a tail call that may jump to
+ * the callee, which returns to our caller then. The callee must not
+ * see the frame: no address of a slot is taken. Its arguments passed
+ * by stack take the place of ours, they must fit and none of ours
+ * may be read later.
+ */
+bool IRCodeGen::SiblingCall(BasicBlock* bb, size_t pos) const {
+  auto inst = bb->insts_[pos];
+  if (inst->op_ != Opcode::CALL || !IsTailCall(bb, pos))
+    return false;
+  auto call = inst->call_;
+  if (call->retStruct_ || func_->retPtr_ >= 0 || !slotsPrivate_)
+    return false;
+  int size = 0, gp = 0, fp = 0;
+  for (const auto& arg: call->args_) {
+    if (arg.size_)
+      return false;
+    if (IsFloat(arg.type_) ? fp++ >= 8: gp++ >= 6)
+      size += 8;
+  }
+  return size == 0 || (size <= incoming_ && !incomingSlots_);
+}
+
+
+// The callee returns to our caller if 'tail'
+void IRCodeGen::GenCall(Inst* inst, bool tail) {
+  auto call = inst->call_;
+  auto& args = inst->args_;
+
+  // Arguments passed by stack
+  std::vector<Move> moves;
+  int gp = 0, fp = 0, offset = 0;
+  for (size_t i = 0; i < args.size(); ++i) {
+    auto type = call->args_[i].type_;
+    auto size = call->args_[i].size_;
+    auto des = tail ? std::to_string(16 + offset) + "(%rbp)":
+                      std::to_string(offset) + "(%rsp)";
+    if (size) {
+      LoadTo(args[i], IRType::I64, R11);
+      GenCopy("%r11", des, size, R10);
+      offset += Type::MakeAlign(size, 8);
+    } else if (IsFloat(type) ? fp < 8: gp < 6) {
+      auto reg = RegAlloc::ArgReg(type, IsFloat(type) ? fp++: gp++);
+      auto src = Phys(args[i]);
+      moves.push_back({type, src, src < 0 ? Src(args[i], type, -1): "",
+                       reg, ""});
+    } else {
+      StoreTo(args[i], type, des);
+      offset += 8;
+    }
+  }
+  if (call->sym_.empty())
+    LoadTo(call->callee_, IRType::I64, R10);
+  GenParallelMove(moves);
+
+  if (call->variadic_)
+    Emit("movl", ImmStr(fp), "%eax");
+  if (tail) {
+    GenEpilogue();
+    Emit("jmp", call->sym_.size() ? call->sym_: "*%r10");
+    return;
+  }
+  if (call->sym_.size())
+    Emit("call", call->sym_);
+  else
+    Emit("call", "*%r10");
+
+  if (inst->HasDst()) {
+    auto type = inst->type_;
+    auto res = RegName(RegAlloc::RetReg(type), 8);
+    auto phys = alloc_.Phys(inst->dst_);
+    if (phys >= 0)
+      EmitMove(type, res, RegName(phys, 8));
+    else
+      EmitMove(type, res, SpillAddr(inst->dst_));
+  }
+  auto regs = RetRegs(call->retTypes_);
+  for (size_t i = 0; i < regs.size(); ++i) {
+    auto mem = inst->mem_;
+    mem.disp_ += 8 * i;
+    EmitMove(call->retTypes_[i], RegName(regs[i], 8), MemStr(mem));
+  }
+}
+
+
+void IRCodeGen::GenRet(Inst* inst) {
+  auto& args = inst->args_;
+  if (args.size() > 1) {
+    std::vector<Move> moves;
+    auto regs = RetRegs(func_->retTypes_);
+    for (size_t i = 0; i < args.size(); ++i) {
+      auto type = func_->retTypes_[i];
+      auto src = Phys(args[i]);
+      moves.push_back({type, src, src < 0 ? Src(args[i], type, -1): "",
+                       regs[i], ""});
+    }
+    GenParallelMove(moves);
+  } else if (args.size()) {
+    LoadTo(args[0], inst->type_, RegAlloc::RetReg(inst->type_));
+  }
+  GenEpilogue();
+  Emit("retq");
+}
+
+
+// Restores the callee-saved registers and tears down the frame
+void IRCodeGen::GenEpilogue() {
+  for (const auto& save: saved_)
+    Emit("movq", FrameAddr(save.second), RegName(save.first, 8));
+  if (!frameless_)
+    Emit("leaveq");
+  else if (frameSize_)
+    Emit("addq", frameSize_, "%rsp");
+}
+
+
+// Copies 'size' bytes from the address in register 'src' to 'des',
+// 'des' is a register or a memory operand.
+void IRCodeGen::GenCopy(const std::string& src, const std::string& des,
+                        long size, int scratch) {
+  auto isReg = des.find('(') == std::string::npos;
+  long desOffset = isReg ? 0: std::stol(des);
+  auto desBase = isReg ? des: des.substr(des.find('('));
+  long offset = 0;
+  if (size > copyInlineMax && size >= 32) {
+    auto base = isReg ? des: desBase.substr(1, desBase.size() - 2);
+    offset = GenBlockLoop(src, base, size, RegName(scratch, 8), desOffset);
+  }
+  for (int width = 16; width; width /= 2) {
+    for (; size - offset >= width; offset += width) {
+      auto from = std::to_string(offset) + "(" + src + ")";
+      auto to = std::to_string(desOffset + offset) +
+                (isReg ? "(" + desBase + ")": desBase);
+      if (width == 16) {
+        Emit("movups", from, "%xmm15");
+        Emit("movups", "%xmm15", to);
+      } else {
+        auto reg = RegName(scratch, width);
+        Emit("mov" + Suffix(width), from, reg);
+        Emit("mov" + Suffix(width), reg, to);
+      }
+    }
+  }
+}
+
+
+/*
+ * The 16 bytes blocks of a large copy from the address in 'src', or of
+ * a fill with %xmm15 if 'src' is empty, are moved by a loop instead of
+ * being unrolled. 'idx' counts up from minus the length to 0, so the
+ * registers of the addresses are kept. Returns the length copied.
+ */
+long IRCodeGen::GenBlockLoop(const std::string& src, const std::string& des,
+                             long size, const std::string& idx,
+                             long desOffset) {
+  auto len = size / 16 * 16;
+  auto loop = NewLabel();
+  Emit("movq", ImmStr(-len), idx);
+  EmitLabel(loop);
+  if (src.size()) {
+    Emit("movups", std::to_string(len) + "(" + src + "," + idx + ")",
+         "%xmm15");
+  }
+  Emit("movups", "%xmm15",
+       std::to_string(desOffset + len) + "(" + des + "," + idx + ")");
+  Emit("addq", ImmStr(16), idx);
+  Emit("jnz", loop);
+  return len;
+}
+
+
+/*
+ * Parallel moves: the moves to memory read the registers first,
+ * then the moves between registers are sequentialized, the cycles
+ * are broken with the scratch registers, the moves from memory and
+ * immediates are the last.
+ */
+void IRCodeGen::GenParallelMove(std::vector<Move>& moves) {
+  auto srcStr = [](const Move& move) {
+    return move.src_ >= 0 ? RegName(move.src_, 8): move.srcStr_;
+  };
+  for (const auto& move: moves) {
+    if (move.dst_ >= 0)
+      continue;
+    if (move.src_ >= 0) {
+      EmitMove(move.type_, srcStr(move), move.dstStr_);
+    } else {
+      auto tmp = IsFloat(move.type_) ? "%xmm15": "%r11";
+      EmitMove(move.type_, move.srcStr_, tmp);
+      EmitMove(move.type_, tmp, move.dstStr_);
+    }
+  }
+
+  std::vector<Move*> pending;
+  for (auto& move: moves) {
+    if (move.dst_ >= 0 && move.src_ >= 0 && move.src_ != move.dst_)
+      pending.push_back(&move);
+  }
+  while (pending.size()) {
+    auto iter = std::find_if(pending.begin(), pending.end(),
+                             [&pending](const Move* move) {
+      for (auto other: pending) {
+        if (other->src_ == move->dst_)
+          return false;
+      }
+      return true;
+    });
+    if (iter != pending.end()) {
+      EmitMove((*iter)->type_, srcStr(**iter), RegName((*iter)->dst_, 8));
+      pending.erase(iter);
+      continue;
+    }
+    // A cycle, saves the destination of the first one
+    auto blocked = pending[0]->dst_;
+    auto tmp = blocked >= XMM0 ? XMM15: R11;
+    EmitMove(pending[0]->type_, RegName(blocked, 8), RegName(tmp, 8));
+    for (auto move: pending) {
+      if (move->src_ == blocked)
+        move->src_ = tmp;
+    }
+  }
+
+  for (const auto& move: moves) {
+    if (move.dst_ >= 0 && move.src_ < 0)
+      EmitMove(move.type_, move.srcStr_, RegName(move.dst_, 8));
+  }
+}
+
+
+// A move of 8 bytes, or of the size of the floating type
+void IRCodeGen::EmitMove(IRType type, const std::string& src,
+                         const std::string& des) {
+  if (src == des)
+    return;
+  if (IsFloat(type)) {
+    if (src.compare(0, 4, "%xmm") == 0 && des.compare(0, 4, "%xmm") == 0)
+      Emit("movaps", src, des);
+    else
+      Emit("mov" + FltSuffix(type), src, des);
+  } else if (src[0] == '$' && !IsImm32(std::stol(src.substr(1)))) {
+    Emit("movabsq", src, des);
+  } else {
+    Emit("movq", src, des);
+  }
+}
+
+
+std::string IRCodeGen::Label(BasicBlock* bb) const {
+  return ".LBB" + std::to_string(funcNo_) + "_" + std::to_string(bb->id_);
+}
+
+
+std::string IRCodeGen::NewLabel() {
+  static int tag = 0;
+  return ".LIR" + std::to_string(tag++);
+}
+
+
+std::string IRCodeGen::SpillAddr(int reg) const {
+  auto slot = alloc_.SpillSlot(reg);
+  assert(slot >= 0);
+  return FrameAddr(spillBase_ - 8 * (slot + 1));
+}
+
+
+// 'offset' is from where %rbp points if the frame pointer is set up
+std::string IRCodeGen::FrameAddr(long offset) const {
+  if (frameless_)
+    return std::to_string(offset - 8 + frameSize_) + "(%rsp)";
+  return std::to_string(offset) + "(%rbp)";
+}
+
+
+std::string IRCodeGen::FloatConst(long bits, IRType type) {
+  ROData rodata(bits, SizeOf(type));
+  rodatas_.push_back(rodata);
+  return rodata.label_ + "(%rip)";
+}
+
+
+// The operand may use %r10, %r11 is not changed
+std::string IRCodeGen::MemStr(const MemRef& mem) {
+  auto disp = mem.disp_;
+  if (mem.base_ == MemRef::SYM) {
+    auto str = mem.sym_;
+    if (disp)
+      str += (disp > 0 ? "+": "") + std::to_string(disp);
+    return str + "(%rip)";
+  }
+
+  std::string base;
+  auto index = mem.index_;
+  if (mem.base_ == MemRef::SLOT) {
+    disp += slotOffsets_[mem.reg_];
+    base = "%rbp";
+    if (frameless_) {
+      disp += frameSize_ - 8;
+      base = "%rsp";
+    }
+  } else if (alloc_.Phys(mem.reg_) >= 0) {
+    base = RegName(alloc_.Phys(mem.reg_), 8);
+  } else if (index >= 0 && alloc_.Phys(index) < 0) {
+    // Both are spilled, folds the index into the base
+    Emit("movq", SpillAddr(index), "%r10");
+    if (mem.scale_ > 1)
+      Emit("shlq", ImmStr(__builtin_ctz(mem.scale_)), "%r10");
+    Emit("addq", SpillAddr(mem.reg_), "%r10");
+    base = "%r10";
+    index = -1;
+  } else {
+    Emit("movq", SpillAddr(mem.reg_), "%r10");
+    base = "%r10";
+  }
+  std::string indexStr;
+  if (index >= 0) {
+    auto phys = alloc_.Phys(index);
+    if (phys < 0)
+      Emit("movq", SpillAddr(index), "%r10");
+    indexStr = "," + (phys < 0 ? "%r10": RegName(phys, 8)) + "," +
+               std::to_string(mem.scale_);
+  }
+  assert(IsImm32(disp));
+  return (disp ? std::to_string(disp): "") + "(" + base + indexStr + ")";
+}
+
+
+// A register, memory or immediate operand of 'size', big immediates
+// are loaded to 'scratch'.
+std::string IRCodeGen::Src(const Operand& opd, IRType type,
+                           int scratch, int size) {
+  if (size == 0)
+    size = IsFloat(type) ? 8: OpSize(type);
+  if (opd.IsReg()) {
+    auto phys = alloc_.Phys(opd.Reg());
+    return phys >= 0 ? RegName(phys, size): SpillAddr(opd.Reg());
+  }
+  assert(opd.IsImm());
+  if (IsFloat(type))
+    return FloatConst(opd.Imm(), type);
+  auto val = Truncate(opd.Imm(), size);
+  if (IsImm32(val) || scratch < 0)
+    return ImmStr(val);
+  Emit("movabsq", ImmStr(val), RegName(scratch, 8));
+  return RegName(scratch, 8);
+}
+
+
+// A register holding the operand, loaded to 'scratch' if necessary
+std::string IRCodeGen::InReg(const Operand& opd, IRType type,
+                             int scratch, int size) {
+  if (size == 0)
+    size = IsFloat(type) ? 8: OpSize(type);
+  auto phys = Phys(opd);
+  if (phys < 0) {
+    LoadTo(opd, type, scratch);
+    phys = scratch;
+  }
+  return RegName(phys, size);
+}
+
+
+void IRCodeGen::LoadTo(const Operand& opd, IRType type, int phys) {
+  auto des = RegName(phys, IsFloat(type) ? 8: OpSize(type));
+  if (opd.IsReg()) {
+    auto src = Phys(opd);
+    if (src == phys)
+      return;
+    if (IsFloat(type)) {
+      EmitMove(type, src >= 0 ? RegName(src, 8): SpillAddr(opd.Reg()), des);
+    } else {
+      auto size = OpSize(type);
+      Emit("mov" + Suffix(size),
+           src >= 0 ? RegName(src, size): SpillAddr(opd.Reg()), des);
+    }
+    return;
+  }
+  assert(opd.IsImm());
+  if (IsFloat(type)) {
+    if (opd.Imm() == 0)
+      Emit("xorps", des, des);
+    else
+      Emit("mov" + FltSuffix(type), FloatConst(opd.Imm(), type), des);
+    return;
+  }
+  auto size = OpSize(type);
+  auto val = Truncate(opd.Imm(), size);
+  if (val == 0)
+    Emit("xorl", RegName(phys, 4), RegName(phys, 4));
+  else if (!IsImm32(val))
+    Emit("movabsq", ImmStr(val), des);
+  else
+    Emit("mov" + Suffix(size), ImmStr(val), des);
+}
+
+
+// Stores the operand of 'type' to the memory operand, using %r11
+void IRCodeGen::StoreTo(const Operand& opd, IRType type,
+                        const std::string& des) {
+  auto size = SizeOf(type);
+  if (opd.IsImm()) {
+    auto val = Truncate(opd.Imm(), size);
+    if (IsImm32(val)) {
+      Emit("mov" + Suffix(size), ImmStr(val), des);
+    } else {
+      Emit("movabsq", ImmStr(val), "%r11");
+      Emit("movq", "%r11", des);
+    }
+  } else if (IsFloat(type)) {
+    Emit("mov" + FltSuffix(type), InReg(opd, type, XMM15), des);
+  } else {
+    Emit("mov" + Suffix(size), InReg(opd, type, R11, size), des);
+  }
+}
+
+
+// The register to compute the result in
+int IRCodeGen::DstPhys(const Inst* inst) const {
+  auto phys = alloc_.Phys(inst->dst_);
+  if (phys >= 0)
+    return phys;
+  return IsFloat(inst->type_) ? XMM15: R11;
+}
+
+
+void IRCodeGen::WriteBack(const Inst* inst, int phys) {
+  if (alloc_.Phys(inst->dst_) >= 0)
+    return;
+  if (IsFloat(inst->type_))
+    EmitMove(inst->type_, RegName(phys, 8), SpillAddr(inst->dst_));
+  else
+    Emit("movq", RegName(phys, 8), SpillAddr(inst->dst_));
+}
+
+
+void IRCodeGen::EmitInstLoc(const Inst* inst) {
+  if (!debug || inst->tok_ == nullptr ||
+      inst->tok_->loc_.line_ == lastLine_) {
+    return;
+  }
+  lastLine_ = inst->tok_->loc_.line_;
+  EmitLoc(inst->tok_);
+}
@@ -0,0 +1,95 @@
+#ifndef _WGTCC_IR_CODE_GEN_H_
+#define _WGTCC_IR_CODE_GEN_H_
+
+#include "code_gen.h"
+#include "ir.h"
+#include "reg_alloc.h"
+
+
+/*
+ * Emits the assembly of an IR function with the registers assigned
+ * by RegAlloc (-O1). %r10, %r11, %xmm14 and %xmm15 are never assigned,
+ * they are the scratch registers to access the spilled virtual registers.
+ * The frame, from %rbp downwards: the saved callee-saved registers,
+ * the stack slots, the spill slots and the outgoing arguments.
+ * A function that makes no calls sets up no frame pointer unless
+ * debugging or '-fno-omit-frame-pointer', its frame is addressed from
+ * %rsp, as if %rbp was pushed.
+ * A call whose value is returned tears down the frame and jumps to the
+ * callee, when it is safe (SiblingCall).
+ */
+class IRCodeGen: public Generator {
+public:
+  // Returns false if the function is left to Generator
+  static bool GenFuncDef(FuncDef* def);
+
+private:
+  // A move of the parallel moves at the entry and the calls,
+  // the source/destination is a physical register or a memory operand.
+  struct Move {
+    IRType type_;
+    int src_;
+    std::string srcStr_;
+    int dst_;
+    std::string dstStr_;
+  };
+
+  explicit IRCodeGen(IRFunc* func): func_(func), alloc_(func) {}
+  void GenFunc();
+  void GenInst(Inst* inst);
+  void GenBinary(Inst* inst);
+  void GenFloatBinary(Inst* inst);
+  void GenDivMod(Inst* inst);
+  void GenShift(Inst* inst);
+  void GenNeg(Inst* inst);
+  void GenConv(Inst* inst);
+  std::string GenCompare(Inst* inst);
+  void GenSet(Inst* inst);
+  void GenBr(Inst* inst);
+  void GenSwitch(Inst* inst);
+  bool SiblingCall(BasicBlock* bb, size_t pos) const;
+  void GenCall(Inst* inst, bool tail);
+  void GenRet(Inst* inst);
+  void GenEpilogue();
+  void GenCopy(const std::string& src, const std::string& des,
+               long size, int scratch);
+  long GenBlockLoop(const std::string& src, const std::string& des,
+                    long size, const std::string& idx, long desOffset=0);
+  void GenParallelMove(std::vector<Move>& moves);
+  void EmitMove(IRType type, const std::string& src, const std::string& des);
+
+  std::string Label(BasicBlock* bb) const;
+  static std::string NewLabel();
+  int Phys(const Operand& opd) const {
+    return opd.IsReg() ? alloc_.Phys(opd.Reg()): -1;
+  }
+  std::string SpillAddr(int reg) const;
+  std::string FrameAddr(long offset) const;
+  std::string FloatConst(long bits, IRType type);
+  std::string MemStr(const MemRef& mem);
+  std::string Src(const Operand& opd, IRType type, int scratch, int size=0);
+  std::string InReg(const Operand& opd, IRType type, int scratch, int size=0);
+  void LoadTo(const Operand& opd, IRType type, int phys);
+  void StoreTo(const Operand& opd, IRType type, const std::string& des);
+  int DstPhys(const Inst* inst) const;
+  void WriteBack(const Inst* inst, int phys);
+  void EmitInstLoc(const Inst* inst);
+
+  IRFunc* func_;
+  RegAlloc alloc_;
+  int funcNo_ {0};
+  std::vector<int> slotOffsets_;
+  std::vector<std::pair<int, int>> saved_;
+  int spillBase_ {0};
+  bool frameless_ {false};
+  int frameSize_ {0};
+  // The bytes of the arguments passed to us by stack
+  int incoming_ {0};
+  bool incomingSlots_ {false};
+  // No address of a slot is taken
+  bool slotsPrivate_ {false};
+  BasicBlock* next_ {nullptr};
+  unsigned lastLine_ {0};
+};
+
+#endif
@@ -0,0 +1,888 @@
+#include "ir_opt.h"
+
+#include "ast.h"
+#include "error.h"
+#include "inliner.h"
+#include "ir_builder.h"
+#include "ssa.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+
+extern int optLevel;
+
+
+// Stops at the first pass that breaks the IR
+static void Check(IRFunc* func, const char* pass) {
+#ifdef DEBUG
+  std::string msg;
+  if (!func->Verify(msg)) {
+    func->Print(stderr);
+    Error("invalid IR after %s: %s", pass, msg.c_str());
+  }
+#endif
+}
+
+
+IRFunc* BuildIR(FuncDef* def) {
+  auto func = IRBuilder(def).Build();
+  if (func == nullptr)
+    return nullptr;
+  BuildSSA(func);
+  Check(func, "BuildSSA");
+  if (optLevel > 0) {
+    InlineCalls(func);
+    Check(func, "InlineCalls");
+    PropagateValues(func);
+    Check(func, "PropagateValues");
+    EliminateDeadCode(func);
+    Check(func, "EliminateDeadCode");
+    EliminateTailCalls(func);
+    Check(func, "EliminateTailCalls");
+    NumberValues(func);
+    Check(func, "NumberValues");
+    PropagateValues(func);
+    OptimizeLoops(func);
+    Check(func, "OptimizeLoops");
+    PropagateValues(func);
+    EliminateDeadCode(func);
+    Check(func, "EliminateDeadCode");
+    AddInlineCandidate(func);
+  }
+  return func;
+}
+
+
+void EmitIR(TranslationUnit* unit, FILE* fp) {
+  for (auto extDecl: unit->ExtDecls()) {
+    auto def = dynamic_cast<FuncDef*>(extDecl);
+    if (def == nullptr)
+      continue;
+    auto func = BuildIR(def);
+    if (func == nullptr) {
+      fprintf(fp, "; function %s: not supported\n\n", def->Name().c_str());
+      continue;
+    }
+    func->Print(fp);
+    delete func;
+  }
+}
+
+
+/*
+ * Constant folding, the value of an integer immediate is sign extended
+ * from the size of its type, like the code generator truncates it.
+ */
+
+static long Truncate(long val, int size) {
+  switch (size) {
+  case 1: return static_cast<signed char>(val);
+  case 2: return static_cast<short>(val);
+  case 4: return static_cast<int>(val);
+  default: return val;
+  }
+}
+
+
+static unsigned long ZeroExtend(long val, int size) {
+  if (size >= 8)
+    return val;
+  return static_cast<unsigned long>(val) & ((1UL << size * 8) - 1);
+}
+
+
+static double FloatVal(long bits, IRType type) {
+  if (type == IRType::F32) {
+    int32_t ival = bits;
+    float fval;
+    memcpy(&fval, &ival, sizeof(fval));
+    return fval;
+  }
+  double dval;
+  memcpy(&dval, &bits, sizeof(dval));
+  return dval;
+}
+
+
+static bool Compare(Cond cond, IRType type, long lhs, long rhs) {
+  if (IsFloat(type)) {
+    auto l = FloatVal(lhs, type), r = FloatVal(rhs, type);
+    switch (cond) {
+    case Cond::EQ: return l == r;
+    case Cond::NE: return l != r;
+    case Cond::LT: case Cond::ULT: return l < r;
+    case Cond::LE: case Cond::ULE: return l <= r;
+    case Cond::GT: case Cond::UGT: return l > r;
+    case Cond::GE: case Cond::UGE: return l >= r;
+    }
+  }
+  auto size = SizeOf(type);
+  auto sl = Truncate(lhs, size), sr = Truncate(rhs, size);
+  auto ul = ZeroExtend(lhs, size), ur = ZeroExtend(rhs, size);
+  switch (cond) {
+  case Cond::EQ: return sl == sr;
+  case Cond::NE: return sl != sr;
+  case Cond::LT: return sl < sr;
+  case Cond::LE: return sl <= sr;
+  case Cond::GT: return sl > sr;
+  case Cond::GE: return sl >= sr;
+  case Cond::ULT: return ul < ur;
+  case Cond::ULE: return ul <= ur;
+  case Cond::UGT: return ul > ur;
+  case Cond::UGE: return ul >= ur;
+  }
+  return false;
+}
+
+
+static bool FoldFloat(const Inst* inst, Operand& result) {
+  auto type = inst->type_;
+  auto lhs = FloatVal(inst->args_[0].Imm(), type);
+  auto rhs = inst->args_.size() > 1 ?
+             FloatVal(inst->args_[1].Imm(), type): 0.0;
+  if (type == IRType::F32) {
+    float l = lhs, r = rhs, val;
+    switch (inst->op_) {
+    case Opcode::ADD: val = l + r; break;
+    case Opcode::SUB: val = l - r; break;
+    case Opcode::MUL: val = l * r; break;
+    case Opcode::DIV: val = l / r; break;
+    case Opcode::NEG: val = -l; break;
+    default: return false;
+    }
+    result = Operand::Float(val, type);
+    return true;
+  }
+  double val;
+  switch (inst->op_) {
+  case Opcode::ADD: val = lhs + rhs; break;
+  case Opcode::SUB: val = lhs - rhs; break;
+  case Opcode::MUL: val = lhs * rhs; break;
+  case Opcode::DIV: val = lhs / rhs; break;
+  case Opcode::NEG: val = -lhs; break;
+  default: return false;
+  }
+  result = Operand::Float(val, type);
+  return true;
+}
+
+
+static bool FoldInt(const Inst* inst, Operand& result) {
+  auto size = SizeOf(inst->type_);
+  auto lhs = Truncate(inst->args_[0].Imm(), size);
+  auto rhs = inst->args_.size() > 1 ?
+             Truncate(inst->args_[1].Imm(), size): 0;
+  auto ul = ZeroExtend(lhs, size), ur = ZeroExtend(rhs, size);
+  unsigned long val;
+  switch (inst->op_) {
+  case Opcode::ADD: val = ul + ur; break;
+  case Opcode::SUB: val = ul - ur; break;
+  case Opcode::MUL: val = ul * ur; break;
+  case Opcode::AND: val = ul & ur; break;
+  case Opcode::OR: val = ul | ur; break;
+  case Opcode::XOR: val = ul ^ ur; break;
+  case Opcode::NEG: val = -ul; break;
+  case Opcode::NOT: val = ~ul; break;
+  case Opcode::DIV: case Opcode::MOD:
+    // Traps at runtime
+    if (rhs == 0 || (rhs == -1 && lhs == Truncate(1UL << (size * 8 - 1),
+                                                  size)))
+      return false;
+    val = inst->op_ == Opcode::DIV ? lhs / rhs: lhs % rhs;
+    break;
+  case Opcode::UDIV: case Opcode::UMOD:
+    if (ur == 0)
+      return false;
+    val = inst->op_ == Opcode::UDIV ? ul / ur: ul % ur;
+    break;
+  case Opcode::SHL: case Opcode::SHR: case Opcode::SAR: {
+    // Narrow shifts don't see the upper bits
+    if (size < 4)
+      return false;
+    auto count = rhs & (size * 8 - 1);
+    if (inst->op_ == Opcode::SHL)
+      val = ul << count;
+    else if (inst->op_ == Opcode::SHR)
+      val = ul >> count;
+    else
+      val = lhs >> count;
+  } break;
+  default: return false;
+  }
+  result = Operand::Imm(Truncate(val, size));
+  return true;
+}
+
+
+static bool FoldConv(const Inst* inst, Operand& result) {
+  auto type = inst->type_;
+  auto srcType = inst->srcType_;
+  auto size = SizeOf(type), srcSize = SizeOf(srcType);
+  auto val = inst->args_[0].Imm();
+  switch (inst->op_) {
+  case Opcode::SEXT:
+    result = Operand::Imm(Truncate(Truncate(val, srcSize), size));
+    return true;
+  case Opcode::ZEXT:
+    result = Operand::Imm(Truncate(ZeroExtend(val, srcSize), size));
+    return true;
+  case Opcode::TRUNC:
+    result = Operand::Imm(Truncate(val, size));
+    return true;
+  case Opcode::ITOF: {
+    auto ival = Truncate(val, srcSize);
+    result = type == IRType::F32 ?
+             Operand::Float(static_cast<float>(ival), type):
+             Operand::Float(static_cast<double>(ival), type);
+  } return true;
+  case Opcode::UTOF: {
+    auto uval = ZeroExtend(val, srcSize);
+    result = type == IRType::F32 ?
+             Operand::Float(static_cast<float>(uval), type):
+             Operand::Float(static_cast<double>(uval), type);
+  } return true;
+  case Opcode::FCVT:
+    result = Operand::Float(FloatVal(val, srcType), type);
+    return true;
+  case Opcode::FTOI: case Opcode::FTOU: {
+    // Only what is in range, the others are undefined
+    auto fval = std::trunc(FloatVal(val, srcType));
+    auto bits = size * 8;
+    if (inst->op_ == Opcode::FTOI) {
+      auto limit = std::ldexp(1.0, bits - 1);
+      if (!(fval >= -limit && fval < limit))
+        return false;
+      result = Operand::Imm(static_cast<long>(fval));
+    } else {
+      if (!(fval >= 0 && fval < std::ldexp(1.0, bits)))
+        return false;
+      auto uval = static_cast<unsigned long>(fval);
+      result = Operand::Imm(Truncate(uval, size));
+    }
+  } return true;
+  default: return false;
+  }
+}
+
+
+static bool Fold(const Inst* inst, Operand& result) {
+  if (inst->args_.empty())
+    return false;
+  for (const auto& arg: inst->args_) {
+    if (!arg.IsImm())
+      return false;
+  }
+  switch (inst->op_) {
+  case Opcode::ADD: case Opcode::SUB: case Opcode::MUL: case Opcode::DIV:
+  case Opcode::UDIV: case Opcode::MOD: case Opcode::UMOD:
+  case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+  case Opcode::SHL: case Opcode::SHR: case Opcode::SAR:
+  case Opcode::NEG: case Opcode::NOT:
+    return IsFloat(inst->type_) ? FoldFloat(inst, result):
+                                  FoldInt(inst, result);
+  case Opcode::SET:
+    result = Operand::Imm(Compare(inst->cond_, inst->srcType_,
+                                  inst->args_[0].Imm(),
+                                  inst->args_[1].Imm()));
+    return true;
+  case Opcode::SEXT: case Opcode::ZEXT: case Opcode::TRUNC:
+  case Opcode::ITOF: case Opcode::UTOF: case Opcode::FTOI:
+  case Opcode::FTOU: case Opcode::FCVT:
+    return FoldConv(inst, result);
+  default: return false;
+  }
+}
+
+
+/*
+ * Propagation
+ */
+
+// Drops the phi operands that come from 'pred'
+static void RemoveIncoming(BasicBlock* bb, BasicBlock* pred) {
+  for (auto inst: bb->insts_) {
+    if (inst->op_ != Opcode::PHI)
+      break;
+    for (size_t i = 0; i < inst->incoming_.size(); ++i) {
+      if (inst->incoming_[i] == pred) {
+        inst->incoming_.erase(inst->incoming_.begin() + i);
+        inst->args_.erase(inst->args_.begin() + i);
+        break;
+      }
+    }
+  }
+}
+
+
+static bool RemoveUnreachable(IRFunc* func) {
+  std::set<BasicBlock*> reachable;
+  BlockList stack {func->blocks_[0]};
+  while (stack.size()) {
+    auto bb = stack.back();
+    stack.pop_back();
+    if (!reachable.insert(bb).second)
+      continue;
+    for (auto succ: bb->Succs())
+      stack.push_back(succ);
+  }
+  if (reachable.size() == func->blocks_.size())
+    return false;
+  BlockList blocks;
+  for (auto bb: func->blocks_) {
+    if (reachable.count(bb)) {
+      blocks.push_back(bb);
+      continue;
+    }
+    for (auto succ: bb->Succs()) {
+      if (reachable.count(succ))
+        RemoveIncoming(succ, bb);
+    }
+  }
+  for (auto bb: func->blocks_) {
+    if (!reachable.count(bb))
+      delete bb;
+  }
+  func->blocks_ = blocks;
+  func->ComputePreds();
+  return true;
+}
+
+
+void PropagateValues(IRFunc* func) {
+  // The value a register is known to hold
+  std::unordered_map<int, Operand> values;
+  auto lookup = [&values](Operand opd) {
+    while (opd.IsReg()) {
+      auto iter = values.find(opd.Reg());
+      if (iter == values.end())
+        break;
+      opd = iter->second;
+    }
+    return opd;
+  };
+  auto lookupReg = [&lookup](int reg) {
+    auto opd = lookup(Operand::Reg(reg));
+    return opd.IsReg() ? opd.Reg(): reg;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    func->ComputePreds();
+    DomTree dom(func);
+    for (auto bb: dom.RPO()) {
+      for (auto inst: bb->insts_) {
+        for (size_t i = 0; i < inst->args_.size(); ++i) {
+          auto& arg = inst->args_[i];
+          if (!arg.IsReg())
+            continue;
+          // Struct/union addresses stay in registers
+          bool byAddr = inst->op_ == Opcode::COPY ||
+                        (inst->call_ && inst->call_->args_[i].size_);
+          auto val = byAddr ? Operand::Reg(lookupReg(arg.Reg())):
+                              lookup(arg);
+          if (val != arg) {
+            arg = val;
+            changed = true;
+          }
+        }
+        if (inst->mem_.base_ == MemRef::REG)
+          inst->mem_.reg_ = lookupReg(inst->mem_.reg_);
+        if (inst->mem_.index_ >= 0)
+          inst->mem_.index_ = lookupReg(inst->mem_.index_);
+        if (inst->call_ && inst->call_->callee_.IsReg())
+          inst->call_->callee_ = Operand::Reg(
+              lookupReg(inst->call_->callee_.Reg()));
+
+        if (!inst->HasDst() || values.count(inst->dst_))
+          continue;
+        Operand val;
+        if (inst->op_ == Opcode::MOV) {
+          auto arg = inst->args_[0];
+          if (arg.IsImm() ||
+              func->RegType(arg.Reg()) == func->RegType(inst->dst_))
+            val = arg;
+        } else if (inst->op_ == Opcode::PHI) {
+          // All the operands are the same, except the phi itself
+          for (const auto& arg: inst->args_) {
+            if (arg.IsReg() && arg.Reg() == inst->dst_)
+              continue;
+            if (val.IsNone()) {
+              val = arg;
+            } else if (val != arg) {
+              val = Operand();
+              break;
+            }
+          }
+        } else {
+          Fold(inst, val);
+        }
+        if (!val.IsNone()) {
+          values[inst->dst_] = val;
+          changed = true;
+        }
+      }
+
+      // A branch on constants
+      auto term = bb->Terminator();
+      BasicBlock* target = nullptr;
+      if (term->op_ == Opcode::BR && term->args_[0].IsImm() &&
+          term->args_[1].IsImm()) {
+        auto taken = Compare(term->cond_, term->srcType_,
+                             term->args_[0].Imm(), term->args_[1].Imm());
+        target = term->targets_[taken ? 0: 1];
+      } else if (term->op_ == Opcode::SWITCH && term->args_[0].IsImm()) {
+        auto size = SizeOf(term->type_);
+        auto idx = ZeroExtend(term->args_[0].Imm() - term->args_[1].Imm(),
+                              size);
+        target = idx < term->table_.size() ? term->table_[idx]:
+                                             term->targets_[0];
+      }
+      if (target) {
+        for (auto succ: bb->Succs()) {
+          if (succ != target)
+            RemoveIncoming(succ, bb);
+        }
+        auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+        jmp->targets_[0] = target;
+        jmp->tok_ = term->tok_;
+        bb->insts_.back() = jmp;
+        delete term;
+        changed = true;
+      }
+    }
+    changed = RemoveUnreachable(func) || changed;
+  }
+  func->ComputePreds();
+}
+
+
+void EliminateDeadCode(IRFunc* func) {
+  std::unordered_map<int, Inst*> defs;
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->HasDst())
+        defs[inst->dst_] = inst;
+    }
+  }
+
+  std::set<Inst*> live;
+  InstList work;
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      switch (inst->op_) {
+      case Opcode::STORE: case Opcode::COPY: case Opcode::ZERO:
+      case Opcode::CALL: case Opcode::JMP: case Opcode::BR:
+      case Opcode::SWITCH: case Opcode::RET:
+        break;
+      case Opcode::LOAD:
+        if (inst->volatile_)
+          break;
+        continue;
+      default: continue;
+      }
+      live.insert(inst);
+      work.push_back(inst);
+    }
+  }
+  while (work.size()) {
+    auto inst = work.back();
+    work.pop_back();
+    for (auto reg: inst->Uses()) {
+      auto iter = defs.find(reg);
+      if (iter != defs.end() && live.insert(iter->second).second)
+        work.push_back(iter->second);
+    }
+  }
+
+  for (auto bb: func->blocks_) {
+    InstList insts;
+    for (auto inst: bb->insts_) {
+      if (live.count(inst))
+        insts.push_back(inst);
+      else
+        delete inst;
+    }
+    bb->insts_ = insts;
+  }
+}
+
+
+/*
+ * Value numbering
+ */
+
+std::set<int> EscapedSlots(IRFunc* func) {
+  std::set<int> escaped;
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->op_ == Opcode::LEA && inst->mem_.base_ == MemRef::SLOT)
+        escaped.insert(inst->mem_.reg_);
+    }
+  }
+  return escaped;
+}
+
+
+bool MayAlias(const MemRef& lhs, long lsize, const MemRef& rhs,
+              long rsize, const std::set<int>& escaped) {
+  if (lhs.base_ != rhs.base_) {
+    if (lhs.base_ == MemRef::REG && rhs.base_ == MemRef::SLOT)
+      return escaped.count(rhs.reg_);
+    if (lhs.base_ == MemRef::SLOT && rhs.base_ == MemRef::REG)
+      return escaped.count(lhs.reg_);
+    return lhs.base_ == MemRef::REG || rhs.base_ == MemRef::REG;
+  }
+  if (lhs.base_ == MemRef::SYM ? lhs.sym_ != rhs.sym_: lhs.reg_ != rhs.reg_)
+    return lhs.base_ == MemRef::REG;
+  if (lhs.index_ >= 0 || rhs.index_ >= 0)
+    return true;
+  return lhs.disp_ < rhs.disp_ + rsize && rhs.disp_ < lhs.disp_ + lsize;
+}
+
+
+// The opcode, the types and the operands, the symbol of the memory
+typedef std::pair<std::vector<long>, std::string> ValueKey;
+
+/*
+ * What 'inst' computes if it is 'op' of 'type', a load reads the
+ * memory of 'inst'. A register is numbered by its first equal in
+ * 'same'; the operands of a commutative operation are ordered.
+ */
+static ValueKey KeyOf(Opcode op, IRType type, const Inst* inst,
+                      const std::unordered_map<int, int>& same) {
+  auto number = [&same](int reg) {
+    auto iter = same.find(reg);
+    return iter == same.end() ? reg: iter->second;
+  };
+  ValueKey key;
+  auto& vals = key.first;
+  vals = {static_cast<long>(op), static_cast<long>(type)};
+  if (op != Opcode::LOAD) {
+    vals.push_back(static_cast<long>(inst->srcType_));
+    vals.push_back(static_cast<long>(inst->cond_));
+    auto args = inst->args_;
+    for (auto& arg: args) {
+      if (arg.IsReg())
+        arg = Operand::Reg(number(arg.Reg()));
+    }
+    switch (op) {
+    case Opcode::ADD: case Opcode::MUL: case Opcode::AND: case Opcode::OR:
+    case Opcode::XOR:
+      if (args[0].kind_ > args[1].kind_ ||
+          (args[0].kind_ == args[1].kind_ && args[0].val_ > args[1].val_)) {
+        std::swap(args[0], args[1]);
+      }
+      break;
+    default: break;
+    }
+    for (const auto& arg: args) {
+      vals.push_back(arg.kind_);
+      vals.push_back(arg.val_);
+    }
+  }
+  const auto& mem = inst->mem_;
+  if (mem.base_ != MemRef::NONE) {
+    vals.push_back(mem.base_);
+    vals.push_back(mem.base_ == MemRef::REG ? number(mem.reg_): mem.reg_);
+    vals.push_back(mem.index_ >= 0 ? number(mem.index_): -1);
+    vals.push_back(mem.scale_);
+    vals.push_back(mem.disp_);
+    key.second = mem.sym_;
+  }
+  return key;
+}
+
+
+/*
+ * Block-local value numbering. An instruction without side effects
+ * that computes what an earlier one of the block did becomes a copy
+ * of its result. A load is also the value a store of the block wrote
+ * to the same memory; the loads known are forgotten at a write that
+ * may alias them or at a call. The volatile loads are kept.
+ * The copies are left to PropagateValues.
+ */
+void NumberValues(IRFunc* func) {
+  auto escaped = EscapedSlots(func);
+  // The registers that are copies of the earlier ones
+  std::unordered_map<int, int> same;
+  // The values of the memory known, and the loads or stores of them
+  std::map<ValueKey, std::pair<Operand, const Inst*>> loads;
+  std::map<ValueKey, int> values;
+  auto replace = [&same](Inst* inst, Operand val) {
+    inst->op_ = Opcode::MOV;
+    inst->srcType_ = IRType::VOID;
+    inst->cond_ = Cond::EQ;
+    inst->args_ = {val};
+    inst->mem_ = MemRef();
+    if (val.IsReg()) {
+      auto iter = same.find(val.Reg());
+      same[inst->dst_] = iter == same.end() ? val.Reg(): iter->second;
+    }
+  };
+  auto clobber = [&](const MemRef* mem, long size) {
+    for (auto iter = loads.begin(); iter != loads.end();) {
+      auto access = iter->second.second;
+      auto& ref = access->mem_;
+      bool clobbered = mem ?
+          MayAlias(ref, SizeOf(access->type_), *mem, size, escaped):
+          ref.base_ != MemRef::SLOT || escaped.count(ref.reg_);
+      iter = clobbered ? loads.erase(iter): ++iter;
+    }
+  };
+
+  for (auto bb: func->blocks_) {
+    loads.clear();
+    values.clear();
+    for (auto inst: bb->insts_) {
+      switch (inst->op_) {
+      case Opcode::ADD: case Opcode::SUB: case Opcode::MUL: case Opcode::DIV:
+      case Opcode::UDIV: case Opcode::MOD: case Opcode::UMOD:
+      case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+      case Opcode::SHL: case Opcode::SHR: case Opcode::SAR:
+      case Opcode::NEG: case Opcode::NOT: case Opcode::SET:
+      case Opcode::SEXT: case Opcode::ZEXT: case Opcode::TRUNC:
+      case Opcode::ITOF: case Opcode::UTOF: case Opcode::FTOI:
+      case Opcode::FTOU: case Opcode::FCVT: case Opcode::LEA: {
+        auto key = KeyOf(inst->op_, inst->type_, inst, same);
+        auto iter = values.find(key);
+        if (iter != values.end())
+          replace(inst, Operand::Reg(iter->second));
+        else
+          values[key] = inst->dst_;
+      } break;
+      case Opcode::LOAD: {
+        if (inst->volatile_)
+          break;
+        auto key = KeyOf(Opcode::LOAD, inst->type_, inst, same);
+        auto iter = loads.find(key);
+        if (iter != loads.end())
+          replace(inst, iter->second.first);
+        else
+          loads[key] = {Operand::Reg(inst->dst_), inst};
+      } break;
+      case Opcode::STORE: {
+        auto type = inst->type_;
+        clobber(&inst->mem_, SizeOf(type));
+        const auto& val = inst->args_[0];
+        if (!inst->volatile_ &&
+            (val.IsImm() || func->RegType(val.Reg()) == type)) {
+          loads[KeyOf(Opcode::LOAD, type, inst, same)] = {val, inst};
+        }
+      } break;
+      case Opcode::COPY: case Opcode::ZERO:
+        clobber(&inst->mem_, inst->size_);
+        break;
+      case Opcode::CALL:
+        clobber(nullptr, 0);
+        break;
+      default: break;
+      }
+    }
+  }
+}
+
+
+/*
+ * Tail calls
+ */
+
+bool IsTailCall(BasicBlock* bb, size_t pos) {
+  auto& insts = bb->insts_;
+  auto call = insts[pos];
+  auto ret = insts.back();
+  if (call->op_ != Opcode::CALL || ret->op_ != Opcode::RET)
+    return false;
+  if (ret->args_.empty())
+    return pos + 2 == insts.size();
+  if (call->type_ != ret->type_ || !call->HasDst())
+    return false;
+  auto val = Operand::Reg(call->dst_);
+  // Extended like the value of a narrow return
+  if (pos + 3 == insts.size()) {
+    auto ext = insts[pos + 1];
+    if ((ext->op_ != Opcode::SEXT && ext->op_ != Opcode::ZEXT) ||
+        ext->srcType_ != call->type_ || ext->args_[0] != val) {
+      return false;
+    }
+    val = Operand::Reg(ext->dst_);
+  } else if (pos + 2 != insts.size()) {
+    return false;
+  }
+  return ret->args_[0] == val;
+}
+
+
+/*
+ * Whether the call returns the value of the function 'func' itself,
+ * whose parameters are its arguments, a narrow integer is passed
+ * extended to 32 bits.
+ */
+static bool SelfCall(IRFunc* func, Inst* call) {
+  auto info = call->call_;
+  if (info->sym_ != func->def_->Name() || info->variadic_ ||
+      info->retStruct_ || func->retPtr_ >= 0) {
+    return false;
+  }
+  if (info->args_.size() != func->params_.size())
+    return false;
+  for (size_t i = 0; i < info->args_.size(); ++i) {
+    const auto& arg = info->args_[i];
+    auto reg = func->params_[i].reg_;
+    if (reg < 0 || arg.size_)
+      return false;
+    auto type = func->RegType(reg);
+    if (arg.type_ != type &&
+        (IsFloat(type) || SizeOf(type) >= 4 || arg.type_ != IRType::I32)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/*
+ * Makes the entry the header of a loop, entered from a new entry.
+ * The parameters are the phis of the header, which are returned.
+ */
+static InstList AddEntryLoop(IRFunc* func) {
+  auto entry = func->blocks_[0];
+  auto pre = func->NewBlock();
+  func->blocks_.pop_back();
+  func->blocks_.insert(func->blocks_.begin(), pre);
+  auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+  jmp->targets_[0] = entry;
+  pre->insts_.push_back(jmp);
+
+  std::unordered_map<int, int> params;
+  InstList phis;
+  for (const auto& param: func->params_) {
+    auto type = func->RegType(param.reg_);
+    auto phi = new Inst(Opcode::PHI, type);
+    phi->dst_ = func->NewReg(type);
+    phis.push_back(phi);
+    params[param.reg_] = phi->dst_;
+  }
+  auto rename = [&params](int reg) {
+    auto iter = params.find(reg);
+    return iter == params.end() ? reg: iter->second;
+  };
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      for (auto& arg: inst->args_) {
+        if (arg.IsReg())
+          arg = Operand::Reg(rename(arg.Reg()));
+      }
+      if (inst->mem_.base_ == MemRef::REG)
+        inst->mem_.reg_ = rename(inst->mem_.reg_);
+      if (inst->mem_.index_ >= 0)
+        inst->mem_.index_ = rename(inst->mem_.index_);
+      if (inst->call_ && inst->call_->callee_.IsReg()) {
+        auto reg = rename(inst->call_->callee_.Reg());
+        inst->call_->callee_ = Operand::Reg(reg);
+      }
+    }
+  }
+  for (size_t i = 0; i < phis.size(); ++i) {
+    phis[i]->args_.push_back(Operand::Reg(func->params_[i].reg_));
+    phis[i]->incoming_.push_back(pre);
+  }
+  entry->insts_.insert(entry->insts_.begin(), phis.begin(), phis.end());
+  return phis;
+}
+
+
+/*
+ * The tail calls are exposed: a block that calls and jumps to a block
+ * that only returns, like the return of a function inlined, returns
+ * itself. A recursive call whose value is returned jumps back to the
+ * entry with the arguments as the parameters, if no address of a slot
+ * is taken: the slots of the caller are those of the callee then.
+ * The other tail calls are left to the backend (ir_code_gen.h).
+ */
+void EliminateTailCalls(IRFunc* func) {
+  for (auto bb: func->blocks_) {
+    auto jmp = bb->Terminator();
+    if (jmp->op_ != Opcode::JMP || bb->insts_.size() < 2 ||
+        bb->insts_[bb->insts_.size() - 2]->op_ != Opcode::CALL) {
+      continue;
+    }
+    auto target = jmp->targets_[0];
+    auto& insts = target->insts_;
+    auto ret = insts.back();
+    if (ret->op_ != Opcode::RET || insts.size() > 2 ||
+        (insts.size() == 2 && insts[0]->op_ != Opcode::PHI)) {
+      continue;
+    }
+    auto dup = new Inst(Opcode::RET, ret->type_);
+    dup->tok_ = ret->tok_;
+    dup->args_ = ret->args_;
+    if (insts.size() == 2 && dup->args_.size() &&
+        dup->args_[0] == Operand::Reg(insts[0]->dst_)) {
+      auto phi = insts[0];
+      auto iter = std::find(phi->incoming_.begin(), phi->incoming_.end(), bb);
+      dup->args_[0] = phi->args_[iter - phi->incoming_.begin()];
+    }
+    RemoveIncoming(target, bb);
+    bb->insts_.back() = dup;
+    delete jmp;
+  }
+  func->ComputePreds();
+
+  if (func->blocks_[0]->preds_.size() || EscapedSlots(func).size())
+    return;
+  // The blocks that end with a recursive tail call, and its position
+  std::vector<std::pair<BasicBlock*, size_t>> calls;
+  for (auto bb: func->blocks_) {
+    auto size = bb->insts_.size();
+    for (size_t pos = size < 3 ? 0: size - 3; pos + 1 < size; ++pos) {
+      if (IsTailCall(bb, pos) && SelfCall(func, bb->insts_[pos])) {
+        calls.push_back({bb, pos});
+        break;
+      }
+    }
+  }
+  if (calls.empty())
+    return;
+
+  auto params = AddEntryLoop(func);
+  auto header = func->blocks_[1];
+  for (const auto& tail: calls) {
+    auto bb = tail.first;
+    auto& insts = bb->insts_;
+    auto call = insts[tail.second];
+    // The call, its value and the return
+    for (auto iter = insts.begin() + tail.second + 1; iter != insts.end();
+         ++iter) {
+      delete *iter;
+    }
+    insts.resize(tail.second);
+    for (size_t i = 0; i < params.size(); ++i) {
+      auto type = params[i]->type_;
+      auto argType = call->call_->args_[i].type_;
+      auto arg = call->args_[i];
+      if (argType != type && arg.IsReg()) {
+        auto trunc = new Inst(Opcode::TRUNC, type);
+        trunc->srcType_ = argType;
+        trunc->dst_ = func->NewReg(type);
+        trunc->args_.push_back(arg);
+        trunc->tok_ = call->tok_;
+        insts.push_back(trunc);
+        arg = Operand::Reg(trunc->dst_);
+      }
+      params[i]->args_.push_back(arg);
+      params[i]->incoming_.push_back(bb);
+    }
+    auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+    jmp->targets_[0] = header;
+    jmp->tok_ = call->tok_;
+    insts.push_back(jmp);
+    delete call;
+  }
+  func->ComputePreds();
+  func->SortIncoming();
+}
@@ -0,0 +1,53 @@
+#ifndef _WGTCC_IR_OPT_H_
+#define _WGTCC_IR_OPT_H_
+
+#include "ir.h"
+
+#include <cstdio>
+#include <set>
+
+
+class FuncDef;
+class TranslationUnit;
+
+/*
+ * Builds the IR of a function in SSA form, and optimizes it
+ * if 'optLevel' > 0. Returns nullptr if the backend doesn't
+ * support the function.
+ */
+IRFunc* BuildIR(FuncDef* def);
+
+// Dumps the IR of each function ('-emit-ir')
+void EmitIR(TranslationUnit* unit, FILE* fp);
+
+// Copy propagation, constant folding and removal of constant branches
+void PropagateValues(IRFunc* func);
+
+// Removes the instructions whose results are never used
+void EliminateDeadCode(IRFunc* func);
+
+// Replaces a value computed again in a block by a copy of the first one
+void NumberValues(IRFunc* func);
+
+// The slots whose addresses are taken
+std::set<int> EscapedSlots(IRFunc* func);
+
+/*
+ * Whether two accesses of 'lsize' and 'rsize' bytes may overlap.
+ * The symbols and the slots are distinct objects, a register points
+ * to any memory but the slots whose addresses are never taken.
+ */
+bool MayAlias(const MemRef& lhs, long lsize, const MemRef& rhs,
+              long rsize, const std::set<int>& escaped);
+
+// Whether the call at 'pos' of 'bb' is followed by the return of its value
+bool IsTailCall(BasicBlock* bb, size_t pos);
+
+// Turns the recursive tail calls into loops
+void EliminateTailCalls(IRFunc* func);
+
+// Hoists the loop invariants and reduces the strength of the induction
+// variables (loop_opt.cc)
+void OptimizeLoops(IRFunc* func);
+
+#endif
@@ -0,0 +1,600 @@
+#include "ir_opt.h"
+
+#include "ssa.h"
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+
+/*
+ * A natural loop: the header, and the blocks that reach a back edge to
+ * the header without passing it. The loop is entered only from the
+ * preheader, which jumps to the header and nowhere else.
+ */
+struct Loop {
+  bool Contains(BasicBlock* bb) const { return blocks_.count(bb); }
+
+  BasicBlock* header_;
+  BasicBlock* preheader_;
+  std::set<BasicBlock*> blocks_;
+};
+
+
+/*
+ * An induction variable, 'phi_' of the header is 'init_' from the
+ * preheader and increased by 'step_' each iteration. The increment,
+ * the value from all the latches, is 'inc_' of block 'incBlock_'.
+ */
+struct IndVar {
+  int phi_;
+  Operand init_;
+  long step_;
+  Inst* inc_;
+  BasicBlock* incBlock_;
+};
+
+
+// The definition of each register and its block
+typedef std::unordered_map<int, std::pair<Inst*, BasicBlock*>> DefMap;
+
+
+static long Truncate(long val, int size) {
+  switch (size) {
+  case 1: return static_cast<signed char>(val);
+  case 2: return static_cast<short>(val);
+  case 4: return static_cast<int>(val);
+  default: return val;
+  }
+}
+
+
+// The inner loops come first
+static std::vector<Loop> FindLoops(const DomTree& dom) {
+  std::vector<Loop> loops;
+  std::unordered_map<BasicBlock*, size_t> index;
+  for (auto bb: dom.RPO()) {
+    for (auto succ: bb->Succs()) {
+      if (!dom.Dominates(succ, bb))
+        continue;
+      auto iter = index.find(succ);
+      if (iter == index.end()) {
+        iter = index.insert({succ, loops.size()}).first;
+        loops.push_back(Loop());
+        loops.back().header_ = succ;
+        loops.back().preheader_ = nullptr;
+        loops.back().blocks_.insert(succ);
+      }
+      auto& blocks = loops[iter->second].blocks_;
+      BlockList stack {bb};
+      while (stack.size()) {
+        auto cur = stack.back();
+        stack.pop_back();
+        if (!blocks.insert(cur).second)
+          continue;
+        for (auto pred: cur->preds_) {
+          if (dom.Reachable(pred))
+            stack.push_back(pred);
+        }
+      }
+    }
+  }
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const Loop& lhs, const Loop& rhs) {
+    return lhs.blocks_.size() < rhs.blocks_.size();
+  });
+  return loops;
+}
+
+
+/*
+ * Finds or makes the preheader of the loop. The operands that the phis
+ * of the header take from outside the loop are merged in a new
+ * preheader. Returns false if the loop is entered from nowhere, or is
+ * the entry of the function.
+ */
+static bool AddPreheader(IRFunc* func, Loop& loop) {
+  auto header = loop.header_;
+  BlockList outside;
+  for (auto pred: header->preds_) {
+    if (!loop.Contains(pred))
+      outside.push_back(pred);
+  }
+  if (outside.empty() || header == func->blocks_[0])
+    return false;
+  if (outside.size() == 1 && outside[0]->Succs().size() == 1) {
+    loop.preheader_ = outside[0];
+    return true;
+  }
+
+  auto pre = func->NewBlock();
+  auto& blocks = func->blocks_;
+  blocks.pop_back();
+  blocks.insert(std::find(blocks.begin(), blocks.end(), header), pre);
+  for (auto pred: outside) {
+    auto term = pred->Terminator();
+    for (auto& target: term->targets_) {
+      if (target == header)
+        target = pre;
+    }
+    std::replace(term->table_.begin(), term->table_.end(), header, pre);
+  }
+  for (auto inst: header->insts_) {
+    if (inst->op_ != Opcode::PHI)
+      break;
+    auto phi = new Inst(Opcode::PHI, inst->type_);
+    std::vector<Operand> args;
+    BlockList incoming;
+    for (size_t i = 0; i < inst->args_.size(); ++i) {
+      auto pred = inst->incoming_[i];
+      if (loop.Contains(pred)) {
+        args.push_back(inst->args_[i]);
+        incoming.push_back(pred);
+      } else {
+        phi->args_.push_back(inst->args_[i]);
+        phi->incoming_.push_back(pred);
+      }
+    }
+    auto val = phi->args_[0];
+    if (std::all_of(phi->args_.begin(), phi->args_.end(),
+                    [&val](const Operand& arg) { return arg == val; })) {
+      delete phi;
+    } else {
+      phi->dst_ = func->NewReg(phi->type_);
+      pre->insts_.push_back(phi);
+      val = Operand::Reg(phi->dst_);
+    }
+    args.push_back(val);
+    incoming.push_back(pre);
+    inst->args_ = args;
+    inst->incoming_ = incoming;
+  }
+  auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+  jmp->targets_[0] = header;
+  pre->insts_.push_back(jmp);
+  func->ComputePreds();
+  loop.preheader_ = pre;
+  return true;
+}
+
+
+// The preheader made by AddPreheader, or nullptr
+static BasicBlock* FindPreheader(const Loop& loop) {
+  BasicBlock* pre = nullptr;
+  for (auto pred: loop.header_->preds_) {
+    if (loop.Contains(pred))
+      continue;
+    if (pre || pred->Succs().size() != 1)
+      return nullptr;
+    pre = pred;
+  }
+  return pre;
+}
+
+
+// The integer condition that is true if 'cond' is false
+static Cond Negate(Cond cond) {
+  switch (cond) {
+  case Cond::EQ: return Cond::NE;
+  case Cond::NE: return Cond::EQ;
+  case Cond::LT: return Cond::GE;
+  case Cond::LE: return Cond::GT;
+  case Cond::GT: return Cond::LE;
+  case Cond::GE: return Cond::LT;
+  case Cond::ULT: return Cond::UGE;
+  case Cond::ULE: return Cond::UGT;
+  case Cond::UGT: return Cond::ULE;
+  case Cond::UGE: return Cond::ULT;
+  }
+  return cond;
+}
+
+
+// The condition with the operands swapped
+static Cond Swap(Cond cond) {
+  switch (cond) {
+  case Cond::LT: return Cond::GT;
+  case Cond::LE: return Cond::GE;
+  case Cond::GT: return Cond::LT;
+  case Cond::GE: return Cond::LE;
+  case Cond::ULT: return Cond::UGT;
+  case Cond::ULE: return Cond::UGE;
+  case Cond::UGT: return Cond::ULT;
+  case Cond::UGE: return Cond::ULE;
+  default: return cond;
+  }
+}
+
+
+/*
+ * The optimization of the loops of a function, the inner ones first.
+ * Each loop needs a preheader, where the invariants are hoisted and
+ * the induction variables start.
+ */
+class LoopOptimizer {
+public:
+  explicit LoopOptimizer(IRFunc* func);
+
+  void HoistInvariants(const Loop& loop, const DomTree& dom);
+  void ReduceStrength(const Loop& loop, const DomTree& dom);
+
+private:
+  bool Invariant(const Loop& loop, int reg) const {
+    auto iter = defs_.find(reg);
+    return iter == defs_.end() || !loop.Contains(iter->second.second);
+  }
+  bool Invariant(const Loop& loop, const Operand& opd) const {
+    return !opd.IsReg() || Invariant(loop, opd.Reg());
+  }
+  bool Hoistable(const Loop& loop, Inst* inst) const;
+  bool Clobbered(const Loop& loop, Inst* load) const;
+  bool FindIndVar(const Loop& loop, Inst* phi, IndVar& iv) const;
+  void Widen(const Loop& loop, const DomTree& dom,
+             std::vector<IndVar>& ivs,
+             std::unordered_map<int, size_t>& ivOf);
+  IndVar AddIndVar(const Loop& loop, const IndVar& base, IRType type,
+                   Operand init, long step);
+  void Append(BasicBlock* bb, Inst* inst);
+  Operand Extend(const Loop& loop, Operand opd);
+
+  IRFunc* func_;
+  DefMap defs_;
+  // The slots whose addresses are taken
+  std::set<int> escaped_;
+  // Of the loop being optimized
+  InstList writes_;
+  bool calls_;
+  BlockList exits_;
+  const DomTree* dom_;
+};
+
+
+LoopOptimizer::LoopOptimizer(IRFunc* func)
+    : func_(func), escaped_(EscapedSlots(func)) {
+  for (auto bb: func->blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->HasDst())
+        defs_[inst->dst_] = {inst, bb};
+    }
+  }
+}
+
+
+void LoopOptimizer::Append(BasicBlock* bb, Inst* inst) {
+  bb->insts_.insert(bb->insts_.end() - 1, inst);
+  if (inst->HasDst())
+    defs_[inst->dst_] = {inst, bb};
+}
+
+
+// Whether a write of the loop may change what 'load' reads
+bool LoopOptimizer::Clobbered(const Loop& loop, Inst* load) const {
+  const auto& mem = load->mem_;
+  auto size = SizeOf(load->type_);
+  if (calls_ && (mem.base_ != MemRef::SLOT || escaped_.count(mem.reg_)))
+    return true;
+  for (auto inst: writes_) {
+    auto width = inst->op_ == Opcode::STORE ? SizeOf(inst->type_):
+                                              inst->size_;
+    if (MayAlias(mem, size, inst->mem_, width, escaped_))
+      return true;
+  }
+  return false;
+}
+
+
+/*
+ * An instruction is hoisted if its operands are defined outside the
+ * loop, and executing it before the loop is harmless: a division
+ * must not trap, a load must not fault and read what it would in the
+ * loop. A slot or a symbol is always readable, other memory only if
+ * the load is executed whenever the loop is.
+ */
+bool LoopOptimizer::Hoistable(const Loop& loop, Inst* inst) const {
+  if (!inst->HasDst() || inst->op_ == Opcode::PHI ||
+      inst->op_ == Opcode::CALL) {
+    return false;
+  }
+  for (auto reg: inst->Uses()) {
+    if (!Invariant(loop, reg))
+      return false;
+  }
+  switch (inst->op_) {
+  case Opcode::DIV: case Opcode::UDIV: case Opcode::MOD: case Opcode::UMOD: {
+    if (IsFloat(inst->type_))
+      return true;
+    const auto& rhs = inst->args_[1];
+    if (!rhs.IsImm())
+      return false;
+    auto val = Truncate(rhs.Imm(), SizeOf(inst->type_));
+    return val != 0 && val != -1;
+  }
+  case Opcode::LOAD: {
+    if (inst->volatile_ || Clobbered(loop, inst))
+      return false;
+    if (inst->mem_.base_ != MemRef::REG)
+      return true;
+    auto bb = defs_.at(inst->dst_).second;
+    return exits_.size() &&
+           std::all_of(exits_.begin(), exits_.end(),
+                       [this, bb](BasicBlock* exit) {
+                         return dom_->Dominates(bb, exit);
+                       });
+  }
+  default: return true;
+  }
+}
+
+
+void LoopOptimizer::HoistInvariants(const Loop& loop, const DomTree& dom) {
+  dom_ = &dom;
+  writes_.clear();
+  calls_ = false;
+  exits_.clear();
+  for (auto bb: loop.blocks_) {
+    for (auto inst: bb->insts_) {
+      if (inst->op_ == Opcode::STORE || inst->op_ == Opcode::COPY ||
+          inst->op_ == Opcode::ZERO) {
+        writes_.push_back(inst);
+      } else if (inst->op_ == Opcode::CALL) {
+        calls_ = true;
+      }
+    }
+    for (auto succ: bb->Succs()) {
+      if (!loop.Contains(succ)) {
+        exits_.push_back(bb);
+        break;
+      }
+    }
+  }
+
+  for (auto bb: dom.RPO()) {
+    if (!loop.Contains(bb))
+      continue;
+    InstList insts;
+    for (auto inst: bb->insts_) {
+      if (Hoistable(loop, inst))
+        Append(loop.preheader_, inst);
+      else
+        insts.push_back(inst);
+    }
+    bb->insts_ = insts;
+  }
+}
+
+
+/*
+ * Whether 'phi' of the header is an induction variable, whose value
+ * from the latches is itself plus or minus a constant.
+ */
+bool LoopOptimizer::FindIndVar(const Loop& loop, Inst* phi,
+                               IndVar& iv) const {
+  if (IsFloat(phi->type_))
+    return false;
+  Operand init, next;
+  for (size_t i = 0; i < phi->args_.size(); ++i) {
+    if (phi->incoming_[i] == loop.preheader_) {
+      init = phi->args_[i];
+    } else if (next.IsNone()) {
+      next = phi->args_[i];
+    } else if (next != phi->args_[i]) {
+      return false;
+    }
+  }
+  if (init.IsNone() || !next.IsReg())
+    return false;
+  auto iter = defs_.find(next.Reg());
+  if (iter == defs_.end() || !loop.Contains(iter->second.second))
+    return false;
+  auto inc = iter->second.first;
+  auto self = Operand::Reg(phi->dst_);
+  const auto& args = inc->args_;
+  long step;
+  if (inc->op_ == Opcode::ADD && args[0] == self && args[1].IsImm())
+    step = args[1].Imm();
+  else if (inc->op_ == Opcode::ADD && args[1] == self && args[0].IsImm())
+    step = args[0].Imm();
+  else if (inc->op_ == Opcode::SUB && args[0] == self && args[1].IsImm())
+    step = -args[1].Imm();
+  else
+    return false;
+  iv = {phi->dst_, init, Truncate(step, SizeOf(phi->type_)), inc,
+        iter->second.second};
+  return true;
+}
+
+
+/*
+ * Adds an induction variable that starts with 'init' and is increased
+ * by 'step' where 'base' is.
+ */
+IndVar LoopOptimizer::AddIndVar(const Loop& loop, const IndVar& base,
+                                IRType type, Operand init, long step) {
+  auto header = loop.header_;
+  auto phi = new Inst(Opcode::PHI, type);
+  phi->dst_ = func_->NewReg(type);
+  auto inc = new Inst(Opcode::ADD, type);
+  inc->dst_ = func_->NewReg(type);
+  inc->args_ = {Operand::Reg(phi->dst_), Operand::Imm(step)};
+  inc->tok_ = base.inc_->tok_;
+  for (auto pred: header->preds_) {
+    phi->args_.push_back(pred == loop.preheader_ ? init:
+                                                   Operand::Reg(inc->dst_));
+    phi->incoming_.push_back(pred);
+  }
+  header->insts_.insert(header->insts_.begin(), phi);
+  defs_[phi->dst_] = {phi, header};
+  auto& insts = base.incBlock_->insts_;
+  insts.insert(std::find(insts.begin(), insts.end(), base.inc_) + 1, inc);
+  defs_[inc->dst_] = {inc, base.incBlock_};
+  return {phi->dst_, init, step, inc, base.incBlock_};
+}
+
+
+// Sign extends a 32 bits invariant to 64 bits, in the preheader
+Operand LoopOptimizer::Extend(const Loop& loop, Operand opd) {
+  if (opd.IsImm())
+    return Operand::Imm(Truncate(opd.Imm(), 4));
+  auto sext = new Inst(Opcode::SEXT, IRType::I64);
+  sext->srcType_ = IRType::I32;
+  sext->dst_ = func_->NewReg(IRType::I64);
+  sext->args_.push_back(opd);
+  Append(loop.preheader_, sext);
+  return Operand::Reg(sext->dst_);
+}
+
+
+/*
+ * A 32 bits induction variable that is sign extended in the loop,
+ * like an int used as an index, is replaced by a 64 bits one there.
+ * It is only done if the header exits the loop before the variable
+ * overflows: it counts up by 1 while less than an invariant, or down
+ * by 1 while greater.
+ */
+void LoopOptimizer::Widen(const Loop& loop, const DomTree& dom,
+                          std::vector<IndVar>& ivs,
+                          std::unordered_map<int, size_t>& ivOf) {
+  auto term = loop.header_->Terminator();
+  if (term->op_ != Opcode::BR || term->srcType_ != IRType::I32)
+    return;
+  auto in0 = loop.Contains(term->targets_[0]);
+  if (in0 == loop.Contains(term->targets_[1]))
+    return;
+  int side;
+  IndVar iv;
+  for (side = 0; side < 2; ++side) {
+    const auto& arg = term->args_[side];
+    if (!arg.IsReg() || !ivOf.count(arg.Reg()))
+      continue;
+    iv = ivs[ivOf[arg.Reg()]];
+    if (iv.phi_ == arg.Reg())
+      break;
+  }
+  if (side == 2 || !Invariant(loop, term->args_[1 - side]))
+    return;
+  auto cond = in0 ? term->cond_: Negate(term->cond_);
+  if (side == 1)
+    cond = Swap(cond);
+  if (!(cond == Cond::LT && iv.step_ == 1) &&
+      !(cond == Cond::GT && iv.step_ == -1)) {
+    return;
+  }
+
+  InstList sexts;
+  for (auto bb: dom.RPO()) {
+    if (!loop.Contains(bb))
+      continue;
+    for (auto inst: bb->insts_) {
+      if (inst->op_ == Opcode::SEXT && inst->type_ == IRType::I64 &&
+          inst->srcType_ == IRType::I32 &&
+          inst->args_[0] == Operand::Reg(iv.phi_)) {
+        sexts.push_back(inst);
+      }
+    }
+  }
+  if (sexts.empty())
+    return;
+  auto wide = AddIndVar(loop, iv, IRType::I64, Extend(loop, iv.init_),
+                        iv.step_);
+  for (auto sext: sexts) {
+    sext->op_ = Opcode::MOV;
+    sext->srcType_ = IRType::VOID;
+    sext->args_[0] = Operand::Reg(wide.phi_);
+    ivOf[sext->dst_] = ivs.size();
+  }
+  term->args_[side] = Operand::Reg(wide.phi_);
+  term->args_[1 - side] = Extend(loop, term->args_[1 - side]);
+  term->srcType_ = IRType::I64;
+  ivOf[wide.phi_] = ivs.size();
+  ivs.push_back(wide);
+}
+
+
+/*
+ * A product of an induction variable and a constant, like the offset
+ * of an element of an array, is replaced by an induction variable
+ * increased by the product of the step and the constant.
+ */
+void LoopOptimizer::ReduceStrength(const Loop& loop, const DomTree& dom) {
+  std::vector<IndVar> ivs;
+  // The induction variables and their copies
+  std::unordered_map<int, size_t> ivOf;
+  for (auto inst: loop.header_->insts_) {
+    if (inst->op_ != Opcode::PHI)
+      break;
+    IndVar iv;
+    if (FindIndVar(loop, inst, iv)) {
+      ivOf[iv.phi_] = ivs.size();
+      ivs.push_back(iv);
+    }
+  }
+  if (ivs.empty())
+    return;
+  Widen(loop, dom, ivs, ivOf);
+
+  InstList muls;
+  for (auto bb: dom.RPO()) {
+    if (!loop.Contains(bb))
+      continue;
+    for (auto inst: bb->insts_) {
+      if (inst->op_ == Opcode::MUL && !IsFloat(inst->type_))
+        muls.push_back(inst);
+    }
+  }
+  for (auto mul: muls) {
+    auto lhs = mul->args_[0], rhs = mul->args_[1];
+    if (lhs.IsImm())
+      std::swap(lhs, rhs);
+    if (!lhs.IsReg() || !rhs.IsImm() || !ivOf.count(lhs.Reg()))
+      continue;
+    auto iv = ivs[ivOf[lhs.Reg()]];
+    auto type = mul->type_;
+    if (func_->RegType(iv.phi_) != type)
+      continue;
+    auto size = SizeOf(type);
+    auto factor = rhs.Imm();
+    Operand init;
+    if (iv.init_.IsImm()) {
+      init = Operand::Imm(Truncate(iv.init_.Imm() * factor, size));
+    } else {
+      auto prod = new Inst(Opcode::MUL, type);
+      prod->dst_ = func_->NewReg(type);
+      prod->args_ = {iv.init_, rhs};
+      prod->tok_ = mul->tok_;
+      Append(loop.preheader_, prod);
+      init = Operand::Reg(prod->dst_);
+    }
+    auto var = AddIndVar(loop, iv, type, init,
+                         Truncate(iv.step_ * factor, size));
+    mul->op_ = Opcode::MOV;
+    mul->args_ = {Operand::Reg(var.phi_)};
+    ivOf[mul->dst_] = ivOf[var.phi_] = ivs.size();
+    ivs.push_back(var);
+  }
+}
+
+
+void OptimizeLoops(IRFunc* func) {
+  func->ComputePreds();
+  {
+    DomTree dom(func);
+    auto loops = FindLoops(dom);
+    if (loops.empty())
+      return;
+    for (auto& loop: loops)
+      AddPreheader(func, loop);
+  }
+  func->ComputePreds();
+  func->SortIncoming();
+
+  DomTree dom(func);
+  auto loops = FindLoops(dom);
+  LoopOptimizer optimizer(func);
+  for (auto& loop: loops) {
+    loop.preheader_ = FindPreheader(loop);
+    if (loop.preheader_ == nullptr)
+      continue;
+    optimizer.HoistInvariants(loop, dom);
+    optimizer.ReduceStrength(loop, dom);
+  }
+}
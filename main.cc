@@ -1,11 +1,16 @@
 #include "code_gen.h"
 #include "cpp.h"
 #include "error.h"
+#include "ir_opt.h"
 #include "parser.h"
+#include "pch.h"
 #include "scanner.h"
+#include "server.h"
 
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <string>
@@ -20,12 +25,25 @@ std::string program;
 std::string inFileName;
 std::string outFileName;
 bool debug = false;
+int optLevel = 0;
+// The blocks copied or zeroed by unrolled moves, see Generator::CopyStruct
+int copyUnrollMax = 32;
+int copyInlineMax = 256;
+// The cost of the functions inlined, see inliner.h
+int inlineLimit = 40;
+// Every function sets up %rbp, even without calls (-O1)
+bool framePointer = false;
 static bool onlyPreprocess = false;
 static bool onlyCompile = false;
+static bool emitPCH = false;
+static bool emitIR = false;
+static std::string pchFileName;
 static std::string gccInFileName;
 static std::list<std::string> gccArgs;
 static std::vector<std::string> defines;
 static std::list<std::string> includePaths;
+// Both -D and -I, a precompiled header is valid only for the same options
+static OptionList pchOptions;
 
 
 static void Usage() {
@@ -36,7 +54,27 @@ static void Usage() {
        "  -I        Add search path\n"
        "  -E        Preprocess only; do not compile, assemble or link\n"
        "  -S        Compile only; do not assemble or link\n"
-       "  -o        specify output file\n");
+       "  -emit-ir  Dump the SSA form IR of the functions; do not\n"
+       "            assemble or link\n"
+       "  -emit-pch Precompile the header file\n"
+       "  -include-pch <file>\n"
+       "            Include the precompiled header file\n"
+       "  -O<n>     Optimization level, -O1 and above enable the register\n"
+       "            allocating backend\n"
+       "  -o        specify output file\n"
+       "  -copy-unroll=<n>\n"
+       "            Copy and zero the blocks of up to n bytes by scalar\n"
+       "            moves (32)\n"
+       "  -copy-inline=<n>\n"
+       "            Copy and zero the blocks of up to n bytes by 16 bytes\n"
+       "            moves, the larger ones by a string instruction or\n"
+       "            a loop (256)\n"
+       "  -inline-limit=<n>\n"
+       "            Inline the calls to the 'inline' functions of up to n\n"
+       "            instructions, n/4 for the other static ones (40)\n"
+       "  --server[=socket]\n"
+       "            Run as compile server, invocations are forwarded\n"
+       "            to it if WGTCC_SERVER is set to the socket\n");
   
   exit(-2);
 }
@@ -49,7 +87,8 @@ static std::string GetExtension(const std::string& fileName) {
 
 static void ValidateFileName(const std::string& fileName) {
   auto ext = GetExtension(fileName);
-  if (ext != ".c" && ext != ".s" && ext != ".o" && ext != ".a")
+  if (ext != ".c" && ext != ".s" && ext != ".o" && ext != ".a" &&
+      (ext != ".h" || !emitPCH))
     Error("bad file name format:'%s'", fileName.c_str());
 }
 
@@ -78,7 +117,7 @@ static std::string GetName(const std::string& path) {
 
 
 static int RunWgtcc() {
-  if (inFileName.back() != 'c')
+  if (inFileName.back() != 'c' && !emitPCH)
     return 0;
 
   Preprocessor cpp(&inFileName);
@@ -87,15 +126,29 @@ static int RunWgtcc() {
   for (auto& path: includePaths)
     cpp.AddSearchPath(path);
 
+  TokenSequence ts;
+  if (pchFileName.size())
+    PCHReader(&cpp, pchOptions).Read(pchFileName, ts);
+  cpp.Process(ts);
+  if (emitPCH) {
+    auto pchOut = outFileName.size() ? outFileName: inFileName + ".pch";
+    PCHWriter(&cpp, pchOptions).Write(pchOut, ts);
+    return 0;
+  }
+
   FILE* fp = stdout;
   if (outFileName.size())
     fp = fopen(outFileName.c_str(), "w");
-  TokenSequence ts;
-  cpp.Process(ts);
   if (onlyPreprocess) {
     ts.Print(fp);
     return 0;
   }
+  if (emitIR) {
+    Parser parser(ts);
+    parser.Parse();
+    EmitIR(parser.Unit(), fp);
+    return 0;
+  }
 
   if (!onlyCompile || outFileName.size() == 0) {
     outFileName = GetName(inFileName);
@@ -135,12 +188,14 @@ static int RunGcc() {
 static void ParseInclude(int argc, char* argv[], int& i) {
   if (argv[i][2]) {
     includePaths.push_front(&argv[i][2]);
+    pchOptions.push_back(std::string("-I") + &argv[i][2]);
     return;
   }
 
   if (i == argc - 1)
     Error("missing argument to '%s'", argv[i]);
   includePaths.push_front(argv[++i]);
+  pchOptions.push_back(std::string("-I") + argv[i]);
   gccArgs.push_back(argv[i]);
 }
 
@@ -148,12 +203,14 @@ static void ParseInclude(int argc, char* argv[], int& i) {
 static void ParseDefine(int argc, char* argv[], int& i) {
   if (argv[i][2]) {
     defines.push_back(&argv[i][2]);
+    pchOptions.push_back(std::string("-D") + &argv[i][2]);
     return;
   }
 
   if (i == argc - 1)
     Error("missing argument to '%s'", argv[i]);
   defines.push_back(argv[++i]);
+  pchOptions.push_back(std::string("-D") + argv[i]);
   gccArgs.push_back(argv[i]);
 }
 
@@ -171,7 +228,16 @@ static void ParseOut(int argc, char* argv[], int& i) {
  *   gcc: assemble and link
  * Allowing multi file may not be a good idea... 
  */
-int main(int argc, char* argv[]) {
+// '-O' is '-O1', like gcc, '-Os' and others are taken as '-O1'
+static void ParseOptLevel(const char* arg) {
+  if (isdigit(arg[2]))
+    optLevel = atoi(arg + 2);
+  else
+    optLevel = 1;
+}
+
+
+static int Main(int argc, char* argv[]) {
   if (argc < 2)
     Usage();
 
@@ -182,10 +248,35 @@ int main(int argc, char* argv[]) {
   for (auto i = 1; i < argc; ++i) {
     if (argv[i][0] != '-') {
       inFileName = std::string(argv[i]);
-      ValidateFileName(inFileName);
       continue;
     }
 
+    // Options of wgtcc only
+    std::string arg = argv[i];
+    if (arg == "-emit-pch") {
+      emitPCH = true;
+      continue;
+    } else if (arg == "-emit-ir") {
+      emitIR = true;
+      continue;
+    } else if (arg == "-include-pch") {
+      if (i == argc - 1)
+        Error("missing argument to '%s'", argv[i]);
+      pchFileName = argv[++i];
+      continue;
+    } else if (arg.compare(0, 13, "-copy-unroll=") == 0) {
+      copyUnrollMax = atoi(arg.c_str() + 13);
+      continue;
+    } else if (arg.compare(0, 13, "-copy-inline=") == 0) {
+      copyInlineMax = atoi(arg.c_str() + 13);
+      continue;
+    } else if (arg.compare(0, 14, "-inline-limit=") == 0) {
+      inlineLimit = atoi(arg.c_str() + 14);
+      continue;
+    } else if (arg == "-fno-omit-frame-pointer") {
+      framePointer = true;
+    }
+
     gccArgs.push_back(argv[i]);
 
     switch (argv[i][1]) {
@@ -195,9 +286,14 @@ int main(int argc, char* argv[]) {
     case 'D': ParseDefine(argc, argv, i); break;
     case 'o': ParseOut(argc, argv, i); break;
     case 'g': gccArgs.pop_back(); debug = true; break;
+    case 'O': ParseOptLevel(argv[i]); break;
     default:;
     }
   }
+  if (inFileName.empty())
+    Error("no input files");
+  // Header files are accepted only with '-emit-pch'
+  ValidateFileName(inFileName);
 
 #ifdef DEBUG
   RunWgtcc();
@@ -218,7 +314,7 @@ int main(int argc, char* argv[]) {
     return 0;
 #endif
 
-  if (onlyPreprocess || onlyCompile)
+  if (onlyPreprocess || onlyCompile || emitPCH || emitIR)
     return 0;
 
   if (GetExtension(inFileName) == ".c") {
@@ -239,3 +335,22 @@ int main(int argc, char* argv[]) {
   if (system(cmd.c_str())) {}
   return ret;
 }
+
+
+int main(int argc, char* argv[]) {
+  program = std::string(argv[0]);
+  if (argc >= 2 && strncmp(argv[1], "--server", 8) == 0) {
+    if (argv[1][8] == '=')
+      return Server::Run(&argv[1][9], Main);
+    if (argv[1][8] == 0)
+      return Server::Run(Server::DefaultSocket(), Main);
+  }
+
+  auto socketPath = getenv("WGTCC_SERVER");
+  int status;
+  if (socketPath && *socketPath &&
+      Server::Forward(socketPath, argc, argv, status)) {
+    return status;
+  }
+  return Main(argc, argv);
+}
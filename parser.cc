@@ -4,6 +4,8 @@
 #include "encoding.h"
 #include "error.h"
 #include "evaluator.h"
+#include "fold.h"
+#include "reach.h"
 #include "scope.h"
 #include "type.h"
 
@@ -32,7 +34,7 @@ void Parser::ExitFunc() {
     auto labelStmt = FindLabel(label->str_);
     if (labelStmt == nullptr) {
       Error(label, "label '%s' used but not defined",
-          label->str_.c_str());
+          label->str_->c_str());
     }
     
     iter->second->SetLabel(labelStmt);
@@ -91,13 +93,15 @@ void Parser::ParseTranslationUnit() {
       if (decl) unit_->Add(decl);
 
       while (ts_.Try(',')) {
-        auto ident = ParseDirectDeclarator(declType, storageSpec,
-                                           funcSpec, align);
+        ident = ParseDirectDeclarator(declType, storageSpec,
+                                      funcSpec, align);
         decl = ParseInitDeclarator(ident);
         if (decl) unit_->Add(decl);
       }
       // GNU extension: function/type/variable attributes
-      TryAttributeSpecList();
+      auto attrSpec = TryAttributeSpecList();
+      if (attrSpec && ident->Type()->ToFunc())
+        ident->Type()->ToFunc()->AddFuncSpec(attrSpec);
       ts_.Expect(';');
     }
   }
@@ -119,7 +123,10 @@ FuncDef* Parser::ParseFuncDef(Identifier* ident) {
       Error(param, "param name omitted");
   }
   funcDef->SetBody(ParseCompoundStmt(funcType));
+  Folder().Visit(funcDef);
   ExitFunc();
+  // After the gotos are resolved
+  Pruner().Prune(funcDef);
   
   return funcDef;
 }
@@ -158,8 +165,8 @@ Expr* Parser::ParsePrimaryExpr() {
   if (tok->IsIdentifier()) {
     auto ident = curScope_->Find(tok);
     if (ident) return ident;
-    if (IsBuiltin(tok->str_)) return GetBuiltin(tok);
-    Error(tok, "undefined symbol '%s'", tok->str_.c_str());
+    if (IsBuiltin(*tok->str_)) return GetBuiltin(tok);
+    Error(tok, "undefined symbol '%s'", tok->str_->c_str());
   } else if (tok->IsConstant()) {
     return ParseConstant(tok);
   } else if (tok->IsLiteral()) {
@@ -168,7 +175,7 @@ Expr* Parser::ParsePrimaryExpr() {
     return ParseGeneric();
   }
 
-  Error(tok, "'%s' unexpected", tok->str_.c_str());
+  Error(tok, "'%s' unexpected", tok->str_->c_str());
   return nullptr; // Make compiler happy
 }
 
@@ -237,7 +244,7 @@ Constant* Parser::ParseConstant(const Token* tok) {
 
 
 Constant* Parser::ParseFloat(const Token* tok) {
-  const auto& str = tok->str_;
+  const auto& str = *tok->str_;
   size_t end = 0;
   double val = 0.0;
   try {
@@ -282,7 +289,7 @@ Constant* Parser::ParseCharacter(const Token* tok) {
 
 
 Constant* Parser::ParseInteger(const Token* tok) {
-  const auto& str = tok->str_;
+  const auto& str = *tok->str_;
   size_t end = 0;
   long val = 0;
   try {
@@ -462,7 +469,7 @@ BinaryOp* Parser::ParseMemberRef(const Token* tok, int op, Expr* lhs) {
   auto rhs = structUnionType->GetMember(memberName);
   if (rhs == nullptr) {
     Error(tok, "'%s' is not a member of '%s'",
-        memberName.c_str(), "[obj]");
+        memberName->c_str(), "[obj]");
   }
 
   return  BinaryOp::New(tok, op, lhs, rhs);
@@ -925,6 +932,14 @@ QualType Parser::ParseDeclSpec(int* storageSpec, int* funcSpec, int* alignSpec)
       *funcSpec |= F_NORETURN;
       break;
 
+    // GNU extension: function attributes
+    case Token::ATTRIBUTE: {
+      auto attrSpec = ParseAttributeSpec();
+      if (funcSpec)
+        *funcSpec |= attrSpec;
+      break;
+    }
+
     //alignment specifier
     case Token::ALIGNAS: {
       if (!alignSpec)
@@ -1133,7 +1148,7 @@ Type* Parser::ParseEnumSpec() {
   std::string tagName;
   auto tok = ts_.Peek();
   if (ts_.Try(Token::IDENTIFIER)) {
-    tagName = tok->str_;
+    tagName = *tok->str_;
     if (ts_.Try('{')) {
       //定义enum类型
       auto tagIdent = curScope_->FindTagInCurScope(tok);
@@ -1173,7 +1188,7 @@ Type* Parser::ParseEnumerator(ArithmType* type) {
     // GNU extension: enumerator attributes
     TryAttributeSpecList();
 
-    const auto& enumName = tok->str_;
+    const auto& enumName = *tok->str_;
     auto ident = curScope_->FindInCurScope(tok);
     if (ident) {
       Error(tok, "redefinition of enumerator '%s'", enumName.c_str());
@@ -1207,7 +1222,7 @@ Type* Parser::ParseStructUnionSpec(bool isStruct) {
   std::string tagName;
   auto tok = ts_.Peek();
   if (ts_.Try(Token::IDENTIFIER)) {
-    tagName = tok->str_;
+    tagName = *tok->str_;
     if (ts_.Try('{')) {
       //看见大括号，表明现在将定义该struct/union类型
       //我们不用关心上层scope是否定义了此tag，如果定义了，那么就直接覆盖定义      
@@ -1312,9 +1327,9 @@ StructType* Parser::ParseStructUnionDecl(StructType* type) {
         }
       }
 
-      const auto& name = tok->str_;                
+      auto name = tok->str_;
       if (type->GetMember(name)) {
-        Error(tok, "duplicate member '%s'", name.c_str());
+        Error(tok, "duplicate member '%s'", name->c_str());
       } else if (!memberType->Complete()) {
         // C11 6.7.2.1 [3]:
         if (type->IsStruct() &&
@@ -1325,10 +1340,10 @@ StructType* Parser::ParseStructUnionDecl(StructType* type) {
           ADD_MEMBER();
           goto finalize;
         } else {
-          Error(tok, "field '%s' has incomplete type", name.c_str());
+          Error(tok, "field '%s' has incomplete type", name->c_str());
         }
       } else if (memberType->ToFunc()) {
-        Error(tok, "field '%s' declared as a function", name.c_str());
+        Error(tok, "field '%s' declared as a function", name->c_str());
       }
 
       ADD_MEMBER();
@@ -1500,7 +1515,7 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
   // 如果 storage 是 typedef，那么应该往符号表里面插入 type
   // 定义 void 类型变量是非法的，只能是指向void类型的指针
   // 如果 funcSpec != 0, 那么现在必须是在定义函数，否则出错
-  const auto& name = tok->str_;
+  const auto& name = *tok->str_;
   Identifier* ident;
 
   if (storageSpec & S_TYPEDEF) {
@@ -1573,8 +1588,10 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
     if (!ident->Type()->Complete())
       ident->Type()->SetComplete(type->Complete());
     // Prio declaration of a function may omit the param name
-    if (type->ToFunc())
+    if (type->ToFunc()) {
       ident->Type()->ToFunc()->SetParams(type->ToFunc()->Params());
+      ident->Type()->ToFunc()->AddFuncSpec(funcSpec);
+    }
     else if (ident->ToObject() && !(storageSpec & S_EXTERN))
       ident->ToObject()->SetStorage(ident->ToObject()->Storage() & ~S_EXTERN);
     return ident;
@@ -1612,6 +1629,7 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
     // C11 6.7.5 [2]: alignment specifier
     if (align > 0)
       Error(tok, "alignment specified for function");
+    type->ToFunc()->AddFuncSpec(funcSpec);
     ret = Identifier::New(tok, type, linkage);
   } else {
     auto obj = Object::New(tok, type, storageSpec, linkage);
@@ -1641,7 +1659,7 @@ QualType Parser::ParseArrayFuncDeclarator(const Token* ident, QualType base) {
     if (!base->Complete()) {
       // FIXME(wgtdkp): ident could be nullptr
       Error(ident, "'%s' has incomplete element type",
-          ident->str_.c_str());
+          ident->str_->c_str());
     }
     return ArrayType::New(len, base);
   } else if (ts_.Try('(')) {	//function declaration
@@ -1739,7 +1757,7 @@ QualType Parser::ParseAbstractDeclarator(QualType type) {
   auto tok = tokenTypePair.first;
   type = tokenTypePair.second;
   if (tok) { // Not a abstract declarator!
-    Error(tok, "unexpected identifier '%s'", tok->str_.c_str());
+    Error(tok, "unexpected identifier '%s'", tok->str_->c_str());
   }
   return type;
 }
@@ -2009,7 +2027,7 @@ void Parser::ParseArrayInitializer(Declaration* decl,
 
 
 StructType::Iterator Parser::ParseStructDesignator(StructType* type,
-                                                   const std::string& name) {
+                                                   const std::string* name) {
   auto iter = type->Members().begin();
   for (; iter != type->Members().end(); ++iter) {
     if ((*iter)->Anonymous()) {
@@ -2018,7 +2036,7 @@ StructType::Iterator Parser::ParseStructDesignator(StructType* type,
       if (anonyType->GetMember(name)) {
         return iter; //ParseStructDesignator(anonyType);
       }
-    } else if ((*iter)->Name() == name) {
+    } else if ((*iter)->Name() == *name) {
       return iter;
     }
   }
@@ -2049,9 +2067,9 @@ void Parser::ParseStructInitializer(Declaration* decl,
     
     if ((designated = ts_.Try('.'))) {
       auto tok = ts_.Expect(Token::IDENTIFIER);
-      const auto& name = tok->str_;
+      auto name = tok->str_;
       if (!type->GetMember(name)) {
-        Error(tok, "member '%s' not found", name.c_str());
+        Error(tok, "member '%s' not found", name->c_str());
       }
       member = ParseStructDesignator(type, name);
     }
@@ -2380,15 +2398,7 @@ CompoundStmt* Parser::ParseDoStmt() {
 }
 
 
-/*
- * switch
- *  jump stmt (skip case labels)
- *  case labels
- *  jump stmts
- *  default jump stmt
- */
-CompoundStmt* Parser::ParseSwitchStmt() {
-  std::list<Stmt*> stmts;
+SwitchStmt* Parser::ParseSwitchStmt() {
   ts_.Expect('(');
   auto tok = ts_.Peek();
   auto expr = ParseExpr();
@@ -2398,35 +2408,15 @@ CompoundStmt* Parser::ParseSwitchStmt() {
     Error(tok, "switch quantity not an integer");
   }
 
-  auto testLabel = LabelStmt::New();
-  auto endLabel = LabelStmt::New();
-  auto t = TempVar::New(expr->Type());
-  auto assign = BinaryOp::New(tok, '=', t, expr);
-  stmts.push_back(assign);
-  stmts.push_back(JumpStmt::New(testLabel));
-
-  CaseLabelList caseLabels;
-  ENTER_SWITCH_BODY(endLabel, caseLabels);
+  auto switchStmt = SwitchStmt::New(expr);
+  ENTER_SWITCH_BODY(switchStmt->End(), switchStmt->Cases());
 
-  auto bodyStmt = ParseStmt(); // Fill caseLabels and defaultLabel
-  stmts.push_back(bodyStmt);
-  stmts.push_back(JumpStmt::New(endLabel));
-  stmts.push_back(testLabel);
-
-  for (auto iter = caseLabels.begin();
-       iter != caseLabels.end(); ++iter) {
-    auto cond = BinaryOp::New(tok, Token::EQ, t, iter->first);
-    auto then = JumpStmt::New(iter->second);
-    auto ifStmt = IfStmt::New(cond, then, nullptr);
-    stmts.push_back(ifStmt);
-  }
-  if (defaultLabel_)
-    stmts.push_back(JumpStmt::New(defaultLabel_));
+  switchStmt->SetBody(ParseStmt()); // Fill caseLabels and defaultLabel
+  switchStmt->SetDefault(defaultLabel_);
   EXIT_SWITCH_BODY();
 
-  stmts.push_back(endLabel);
-
-  return CompoundStmt::New(stmts);
+  switchStmt->Finish();
+  return switchStmt;
 }
 
 
@@ -2436,6 +2426,9 @@ CompoundStmt* Parser::ParseSwitchStmt() {
 
 CompoundStmt* Parser::ParseCaseStmt() {
   auto tok = ts_.Peek();
+  if (caseLabels_ == nullptr) {
+    Error(tok, "'case' is allowed only in switch");
+  }
 
   // case ranges: Non-standard GNU extension
   long begin, end;
@@ -2447,12 +2440,7 @@ CompoundStmt* Parser::ParseCaseStmt() {
   ts_.Expect(':');
   
   auto labelStmt = LabelStmt::New();
-  for (auto val = begin; val <= end; ++val) {
-    if (val > INT_MAX)
-      Error(tok, "case range exceed range of int");
-    auto cons = Constant::New(tok, T_INT, val);
-    caseLabels_->push_back(std::make_pair(cons, labelStmt));
-  }
+  caseLabels_->push_back({begin, end, labelStmt, tok});
   
   std::list<Stmt*> stmts;
   stmts.push_back(labelStmt);
@@ -2465,6 +2453,9 @@ CompoundStmt* Parser::ParseCaseStmt() {
 CompoundStmt* Parser::ParseDefaultStmt() {
   auto tok = ts_.Peek();
   ts_.Expect(':');
+  if (caseLabels_ == nullptr) {
+    Error(tok, "'default' is allowed only in switch");
+  }
   if (defaultLabel_) { // There is a 'default' stmt
     Error(tok, "multiple default labels in one switch");
   }
@@ -2536,10 +2527,10 @@ JumpStmt* Parser::ParseGotoStmt() {
 
 
 CompoundStmt* Parser::ParseLabelStmt(const Token* label) {
-  const auto& labelStr = label->str_;
+  auto labelStr = label->str_;
   auto stmt = ParseStmt();
   if (nullptr != FindLabel(labelStr)) {
-    Error(label, "redefinition of label '%s'", labelStr.c_str());
+    Error(label, "redefinition of label '%s'", labelStr->c_str());
   }
 
   auto labelStmt = LabelStmt::New();
@@ -2581,7 +2572,7 @@ Identifier* Parser::GetBuiltin(const Token* tok) {
   assert(vaStartType_ && vaArgType_);
   static Identifier* vaStart = nullptr;
   static Identifier* vaArg = nullptr;
-  const auto& name = tok->str_;
+  const auto& name = *tok->str_;
   if (name == "__builtin_va_start") {
     if (!vaStart)
       vaStart = Identifier::New(tok, vaStartType_, Linkage::L_EXTERNAL);
@@ -2600,39 +2591,61 @@ Identifier* Parser::GetBuiltin(const Token* tok) {
  * GNU extensions
  */
 
-// Attribute
-void Parser::TryAttributeSpecList() {
+// Attribute, returns the function attributes of the list
+int Parser::TryAttributeSpecList() {
+  int attrSpec = 0;
   while (ts_.Try(Token::ATTRIBUTE))
-    ParseAttributeSpec();
+    attrSpec |= ParseAttributeSpec();
+  return attrSpec;
 }
 
 
-void Parser::ParseAttributeSpec() {
+int Parser::ParseAttributeSpec() {
   ts_.Expect('(');
   ts_.Expect('(');
 
+  int attrSpec = 0;
   while (!ts_.Try(')')) {
-    ParseAttribute();
+    attrSpec |= ParseAttribute();
     if (!ts_.Try(',')) {
       ts_.Expect(')');
       break;
     }
   }
   ts_.Expect(')');
+  return attrSpec;
 }
 
 
-void Parser::ParseAttribute() {
-  if (!ts_.Test(Token::IDENTIFIER))
-    return;
+/*
+ * Only 'noinline' and 'always_inline' take effect, the other attributes
+ * and the arguments are skipped. The name may be a keyword, like 'const'.
+ */
+int Parser::ParseAttribute() {
+  auto tok = ts_.Peek();
+  if (!tok->IsIdentifier() && !tok->IsKeyWord())
+    return 0;
+  ts_.Next();
   if (ts_.Try('(')) {
-    if (ts_.Try(')'))
-      return;
-    
-    ts_.Expect(Token::IDENTIFIER);
-    if (ts_.Test(',')) {
-      while (ts_.Try(',')) {}
+    for (int depth = 1; depth > 0; ) {
+      auto arg = ts_.Next();
+      if (arg->IsEOF())
+        Error(arg, "unexpected end of file in attribute");
+      if (arg->tag_ == '(')
+        ++depth;
+      else if (arg->tag_ == ')')
+        --depth;
     }
-    ts_.Try(')');
   }
+
+  auto name = *tok->str_;
+  if (name.size() > 4 && name.compare(0, 2, "__") == 0 &&
+      name.compare(name.size() - 2, 2, "__") == 0) {
+    name = name.substr(2, name.size() - 4);
+  }
+  if (name == "noinline")
+    return F_NOINLINE;
+  if (name == "always_inline")
+    return F_ALWAYS_INLINE;
+  return 0;
 }
@@ -19,10 +19,11 @@ typedef std::pair<const Token*, QualType> TokenTypePair;
 class Parser {
   typedef std::vector<Constant*> LiteralList;
   typedef std::vector<Object*> StaticObjectList;
-  typedef std::vector<std::pair<Constant*, LabelStmt*>> CaseLabelList;
+  typedef SwitchStmt::CaseList CaseLabelList;
   typedef std::list<std::pair<const Token*, JumpStmt*>> LabelJumpList;
-  typedef std::map<std::string, LabelStmt*> LabelMap;
+  typedef std::unordered_map<const std::string*, LabelStmt*> LabelMap;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   explicit Parser(const TokenSequence& ts) 
@@ -125,7 +126,7 @@ public:
                              int offset,
                              bool designated);
   StructType::Iterator ParseStructDesignator(StructType* type,
-                                             const std::string& name);
+                                             const std::string* name);
   void ParseStructInitializer(Declaration* decl,
                               StructType* type,
                               int offset,
@@ -140,7 +141,7 @@ public:
   Stmt* ParseStmt();
   CompoundStmt* ParseCompoundStmt(FuncType* funcType=nullptr);
   IfStmt* ParseIfStmt();
-  CompoundStmt* ParseSwitchStmt();
+  SwitchStmt* ParseSwitchStmt();
   CompoundStmt* ParseWhileStmt();
   CompoundStmt* ParseDoStmt();
   CompoundStmt* ParseForStmt();
@@ -157,9 +158,9 @@ public:
                                 int funcSpec,
                                 int align);
   // GNU extensions
-  void TryAttributeSpecList();
-  void ParseAttributeSpec();
-  void ParseAttribute();
+  int TryAttributeSpecList();
+  int ParseAttributeSpec();
+  int ParseAttribute();
   bool IsTypeName(const Token* tok) const{
     if (tok->IsTypeSpecQual())
       return true;
@@ -195,13 +196,13 @@ public:
   FuncDef* EnterFunc(Identifier* ident);
   void ExitFunc();
 
-  LabelStmt* FindLabel(const std::string& label) {
+  LabelStmt* FindLabel(const std::string* label) {
     auto ret = curLabels_.find(label);
     if (curLabels_.end() == ret)
       return nullptr;
     return ret->second;
   }
-  void AddLabel(const std::string& label, LabelStmt* labelStmt) {
+  void AddLabel(const std::string* label, LabelStmt* labelStmt) {
     assert(nullptr == FindLabel(label));
     curLabels_[label] = labelStmt;
   }
@@ -0,0 +1,294 @@
+#include "pch.h"
+
+#include "source.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+extern std::string inFileName;
+
+static const char magic[8] = {'W', 'G', 'T', 'C', 'C', 'P', 'C', 'H'};
+static const uint32_t version = 2;
+static const uint32_t NONE = UINT32_MAX;
+
+enum {
+  MACRO_FUNC_LIKE = 0x01,
+  MACRO_VARIADIC = 0x02,
+};
+
+
+void PCHWriter::Write(const std::string& fileName, TokenSequence ts) {
+  if (!cpp_->ppCondStack_.empty())
+    Error("%s: unterminated conditional directive", inFileName.c_str());
+
+  Put(static_cast<uint32_t>(options_.size()));
+  for (const auto& option: options_)
+    PutString(option);
+  PutFiles();
+  PutMacros();
+
+  Put(static_cast<uint32_t>(cpp_->includeGuards_.size()));
+  for (const auto& guard: cpp_->includeGuards_) {
+    PutString(guard.first);
+    PutString(guard.second);
+  }
+  Put(static_cast<uint32_t>(cpp_->onceFiles_.size()));
+  for (const auto& file: cpp_->onceFiles_)
+    PutString(file);
+
+  std::vector<const Token*> toks;
+  while (!ts.Empty())
+    toks.push_back(ts.Next());
+  Put(static_cast<uint32_t>(toks.size()));
+  for (auto tok: toks)
+    PutToken(tok);
+
+  auto fp = fopen(fileName.c_str(), "wb");
+  if (fp == nullptr)
+    Error("%s: can't open for writing", fileName.c_str());
+  uint32_t head[3];
+  memcpy(head, magic, sizeof(magic));
+  head[2] = version;
+  auto strings = StringTable();
+  bool ok = fwrite(head, sizeof(head), 1, fp) == 1
+         && fwrite(strings.data(), 4, strings.size(), fp) == strings.size()
+         && fwrite(words_.data(), 4, words_.size(), fp) == words_.size();
+  if (fclose(fp) != 0 || !ok)
+    Error("%s: write failed", fileName.c_str());
+}
+
+
+void PCHWriter::PutString(const std::string* str) {
+  if (str == nullptr)
+    return Put(NONE);
+  auto res = stringIndex_.insert({str, strings_.size()});
+  if (res.second)
+    strings_.push_back(str);
+  Put(res.first->second);
+}
+
+
+std::vector<uint32_t> PCHWriter::StringTable() {
+  std::vector<uint32_t> table {static_cast<uint32_t>(strings_.size())};
+  for (auto str: strings_) {
+    table.push_back(str->size());
+    auto pos = table.size();
+    table.resize(pos + (str->size() + 3) / 4);
+    memcpy(&table[pos], str->data(), str->size());
+  }
+  return table;
+}
+
+
+void PCHWriter::PutToken(const Token* tok) {
+  Put(static_cast<uint32_t>(tok->tag_));
+  Put(static_cast<uint32_t>(tok->ws_));
+  PutString(tok->str_);
+  PutString(tok->loc_.fileName_ ? Intern(*tok->loc_.fileName_): nullptr);
+  Put(static_cast<uint32_t>(tok->loc_.line_));
+  Put(static_cast<uint32_t>(tok->loc_.column_));
+
+  // Only lines of the listed files can be found again
+  const SourceBuffer* buf = nullptr;
+  if (tok->loc_.fileName_ && *tok->loc_.fileName_ != "-")
+    buf = SourceBuffer::Find(*tok->loc_.fileName_);
+  auto lineBegin = tok->loc_.lineBegin_;
+  if (buf && buf->Begin() <= lineBegin && lineBegin <= buf->End())
+    Put(static_cast<uint32_t>(lineBegin - buf->Begin()));
+  else
+    Put(NONE);
+}
+
+
+void PCHWriter::PutFiles() {
+  std::vector<const SourceBuffer*> files;
+  for (auto buf: SourceBuffer::Loaded()) {
+    if (buf->FileName() != "-")
+      files.push_back(buf);
+  }
+  Put(static_cast<uint32_t>(files.size()));
+  for (auto buf: files) {
+    PutString(buf->FileName());
+    Put(static_cast<uint64_t>(buf->MTime()));
+    Put(static_cast<uint32_t>(buf->MTimeNsec()));
+    Put(static_cast<uint64_t>(buf->Size()));
+  }
+}
+
+
+// Predefined macros are defined by every preprocessor, hence not saved
+void PCHWriter::PutMacros() {
+  std::vector<std::pair<const std::string*, Macro*>> macros;
+  for (auto& macro: cpp_->macroMap_) {
+    if (!macro.second.PreDef())
+      macros.push_back({macro.first, &macro.second});
+  }
+
+  Put(static_cast<uint32_t>(macros.size()));
+  for (auto& macro: macros) {
+    auto m = macro.second;
+    PutString(macro.first);
+    Put(static_cast<uint32_t>((m->FuncLike() ? MACRO_FUNC_LIKE: 0) |
+                              (m->Variadic() ? MACRO_VARIADIC: 0)));
+    Put(static_cast<uint32_t>(m->Params().size()));
+    for (auto param: m->Params())
+      PutString(param);
+    Put(static_cast<uint32_t>(m->GetBody().size()));
+    for (const auto& item: m->GetBody()) {
+      Put(static_cast<uint32_t>(item.param_));
+      PutToken(item.tok_);
+    }
+  }
+}
+
+
+PCHReader::~PCHReader() {
+  if (begin_)
+    munmap(const_cast<uint32_t*>(begin_), size_);
+}
+
+
+void PCHReader::Read(const std::string& fileName, TokenSequence& os) {
+  fileName_ = fileName;
+  auto fd = open(fileName.c_str(), O_RDONLY);
+  if (fd == -1)
+    Error("%s: No such file or directory", fileName.c_str());
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 12 || st.st_size % 4) {
+    close(fd);
+    Error("%s: malformed precompiled header", fileName.c_str());
+  }
+  size_ = st.st_size;
+  auto text = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED)
+    Error("%s: can't map the file", fileName.c_str());
+  begin_ = p_ = static_cast<const uint32_t*>(text);
+  end_ = begin_ + size_ / 4;
+
+  if (memcmp(begin_, magic, sizeof(magic)) != 0)
+    Error("%s: not a precompiled header", fileName.c_str());
+  p_ += sizeof(magic) / 4;
+  if (Get() != version)
+    Error("%s: precompiled header of another version", fileName.c_str());
+
+  ReadStrings();
+  CheckOptions();
+  CheckFiles();
+  ReadMacros();
+
+  for (auto n = Get(); n > 0; --n) {
+    auto path = GetString();
+    auto macro = GetString();
+    cpp_->includeGuards_[*path] = macro;
+  }
+  for (auto n = Get(); n > 0; --n)
+    cpp_->AddOnceFile(*GetString());
+  for (auto n = Get(); n > 0; --n)
+    os.InsertBack(GetToken());
+  cpp_->pchLoaded_ = true;
+}
+
+
+void PCHReader::ReadStrings() {
+  auto n = Get();
+  strings_.reserve(n);
+  for (; n > 0; --n) {
+    auto len = Get();
+    auto words = (len + 3) / 4;
+    if (static_cast<size_t>(end_ - p_) < words)
+      Error("%s: malformed precompiled header", fileName_.c_str());
+    auto str = reinterpret_cast<const char*>(p_);
+    strings_.push_back(Intern(std::string(str, len)));
+    p_ += words;
+  }
+}
+
+
+const std::string* PCHReader::GetString() {
+  auto idx = Get();
+  if (idx == NONE)
+    return nullptr;
+  if (idx >= strings_.size())
+    Error("%s: malformed precompiled header", fileName_.c_str());
+  return strings_[idx];
+}
+
+
+const Token* PCHReader::GetToken() {
+  static const char* const noLine = "";
+  int tag = Get();
+  bool ws = Get();
+  auto str = GetString();
+  auto file = GetString();
+  SourceLocation loc {file, noLine, 0, 0};
+  loc.line_ = Get();
+  loc.column_ = Get();
+  auto offset = Get();
+  if (offset != NONE && file) {
+    auto iter = texts_.find(file);
+    if (iter == texts_.end()) {
+      auto buf = SourceBuffer::Get(*file);
+      iter = texts_.insert({file, buf->Begin()}).first;
+    }
+    loc.lineBegin_ = iter->second + offset;
+  }
+  return Token::New(tag, loc, str ? str: Intern(""), ws);
+}
+
+
+void PCHReader::CheckOptions() {
+  auto n = Get();
+  bool same = n == options_.size();
+  for (size_t i = 0; i < n; ++i) {
+    auto option = GetString();
+    same = same && option && *option == options_[i];
+  }
+  if (!same) {
+    Error("%s: precompiled header was created with other -D/-I options",
+          fileName_.c_str());
+  }
+}
+
+
+void PCHReader::CheckFiles() {
+  for (auto n = Get(); n > 0; --n) {
+    auto path = GetString();
+    auto mtime = Get64();
+    auto mtimeNsec = Get();
+    auto size = Get64();
+    // A file rewritten within a second differs in nanoseconds
+    struct stat st;
+    if (path == nullptr || stat(path->c_str(), &st) != 0 ||
+        static_cast<uint64_t>(st.st_mtim.tv_sec) != mtime ||
+        static_cast<uint32_t>(st.st_mtim.tv_nsec) != mtimeNsec ||
+        static_cast<uint64_t>(st.st_size) != size) {
+      Error("%s: precompiled header is out of date, '%s' has changed",
+            fileName_.c_str(), path ? path->c_str(): "");
+    }
+  }
+}
+
+
+void PCHReader::ReadMacros() {
+  for (auto n = Get(); n > 0; --n) {
+    auto name = GetString();
+    auto flags = Get();
+    ParamList params;
+    for (auto m = Get(); m > 0; --m)
+      params.push_back(GetString());
+    Macro::Body body;
+    for (auto m = Get(); m > 0; --m) {
+      int param = Get();
+      body.push_back({GetToken(), param});
+    }
+    cpp_->AddMacro(name, Macro(flags & MACRO_FUNC_LIKE,
+                               flags & MACRO_VARIADIC, params, body));
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef _WGTCC_PCH_H_
+#define _WGTCC_PCH_H_
+
+#include "cpp.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// -D and -I options, in the order of command line
+typedef std::vector<std::string> OptionList;
+
+
+/*
+ * Precompiled header: the state of the preprocessor after a prefix
+ * header is processed, i.e. the macro table, the include guards,
+ * the '#pragma once' files and the expanded token sequence.
+ *
+ * The file is a sequence of 32-bit words in host byte order:
+ *   magic, version,
+ *   strings:  count, {length, bytes padded to word}...
+ *   options:  count, {string}...
+ *   files:    count, {path, mtime(2 words), nsec, size(2 words)}...
+ *   macros:   count, {name, flags, params, {string}..., body,
+ *                     {param, token}...}...
+ *   guards:   count, {path, macro}...
+ *   once:     count, {path}...
+ *   tokens:   count, {token}...
+ * where a string is an index into the string table (NONE for nullptr)
+ * and a token is {tag, ws, spelling, file, line, column, offset}.
+ * 'offset' locates the line in the file, so diagnostics can still
+ * print the source line. The 'files' are every file the header read,
+ * the precompiled header is out of date if any of them is modified.
+ */
+class PCHWriter {
+  typedef std::unordered_map<const std::string*, uint32_t> StringIndex;
+
+public:
+  PCHWriter(Preprocessor* cpp, const OptionList& options)
+      : cpp_(cpp), options_(options) {}
+  ~PCHWriter() {}
+
+  void Write(const std::string& fileName, TokenSequence ts);
+
+private:
+  void Put(uint32_t word) { words_.push_back(word); }
+  void Put(uint64_t dword) {
+    Put(static_cast<uint32_t>(dword));
+    Put(static_cast<uint32_t>(dword >> 32));
+  }
+  void PutString(const std::string* str);
+  void PutString(const std::string& str) { PutString(Intern(str)); }
+  void PutToken(const Token* tok);
+  void PutFiles();
+  void PutMacros();
+  std::vector<uint32_t> StringTable();
+
+  Preprocessor* cpp_;
+  const OptionList& options_;
+  std::vector<uint32_t> words_;
+  StringIndex stringIndex_;
+  std::vector<const std::string*> strings_;
+};
+
+
+class PCHReader {
+public:
+  PCHReader(Preprocessor* cpp, const OptionList& options)
+      : cpp_(cpp), options_(options), begin_(nullptr),
+        p_(nullptr), end_(nullptr), size_(0) {}
+  ~PCHReader();
+
+  // Restores the state of 'cpp', and appends the tokens to 'os'
+  void Read(const std::string& fileName, TokenSequence& os);
+
+private:
+  uint32_t Get() {
+    if (p_ == end_)
+      Error("%s: malformed precompiled header", fileName_.c_str());
+    return *p_++;
+  }
+  uint64_t Get64() {
+    uint64_t lo = Get();
+    return lo | (static_cast<uint64_t>(Get()) << 32);
+  }
+  const std::string* GetString();
+  const Token* GetToken();
+  void ReadStrings();
+  void CheckOptions();
+  void CheckFiles();
+  void ReadMacros();
+
+  Preprocessor* cpp_;
+  const OptionList& options_;
+  std::string fileName_;
+  const uint32_t* begin_;
+  const uint32_t* p_;
+  const uint32_t* end_;
+  size_t size_;
+  std::vector<const std::string*> strings_;
+  // File name -> beginning of the text
+  std::unordered_map<const std::string*, const char*> texts_;
+};
+
+#endif
@@ -0,0 +1,567 @@
+#include "peephole.h"
+
+#include <cctype>
+#include <map>
+#include <set>
+
+
+static std::string Trim(const std::string& str) {
+  auto begin = str.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return "";
+  auto end = str.find_last_not_of(" \t");
+  return str.substr(begin, end - begin + 1);
+}
+
+
+AsmInst AsmInst::Parse(const std::string& line) {
+  if (line.empty() || line[0] == '.' || line[0] == '#')
+    return {DIRECTIVE, line, {}};
+
+  AsmInst inst {INST, "", {}};
+  auto pos = line.find_first_of(" \t");
+  inst.op_ = line.substr(0, pos);
+  if (pos == std::string::npos)
+    return inst;
+  // The commas of a memory operand are in the parentheses
+  std::string opd;
+  int depth = 0;
+  for (auto i = pos + 1; i < line.size(); ++i) {
+    auto c = line[i];
+    if (c == '(') {
+      ++depth;
+    } else if (c == ')') {
+      --depth;
+    } else if (c == ',' && depth == 0) {
+      inst.opds_.push_back(Trim(opd));
+      opd.clear();
+      continue;
+    }
+    opd.push_back(c);
+  }
+  opd = Trim(opd);
+  if (opd.size())
+    inst.opds_.push_back(opd);
+  return inst;
+}
+
+
+void AsmInst::Print(FILE* fp) const {
+  if (kind_ == LABEL) {
+    fprintf(fp, "%s:\n", op_.c_str());
+  } else if (kind_ == DIRECTIVE || opds_.empty()) {
+    fprintf(fp, "\t%s\n", op_.c_str());
+  } else {
+    std::string line = op_ + "\t" + opds_[0];
+    for (size_t i = 1; i < opds_.size(); ++i)
+      line += ", " + opds_[i];
+    fprintf(fp, "\t%s\n", line.c_str());
+  }
+}
+
+
+// The lines that are no code, a removed line is an empty directive
+static bool IsNote(const AsmInst& inst) {
+  if (inst.kind_ != AsmInst::DIRECTIVE)
+    return false;
+  return inst.op_.empty() || inst.op_[0] == '#' ||
+         inst.op_.compare(0, 4, ".loc") == 0;
+}
+
+
+static bool IsReturn(const std::string& op) {
+  return op == "ret" || op == "retq";
+}
+
+
+static bool IsCall(const std::string& op) {
+  return op.compare(0, 4, "call") == 0;
+}
+
+
+static bool IsJump(const AsmInst& inst) {
+  return inst.kind_ == AsmInst::INST && inst.op_.size() &&
+         inst.op_[0] == 'j';
+}
+
+
+static std::string Negate(const std::string& cc) {
+  static const char* pairs[][2] = {
+    {"e", "ne"}, {"z", "nz"}, {"l", "ge"}, {"le", "g"},
+    {"b", "ae"}, {"be", "a"}, {"s", "ns"}, {"p", "np"},
+  };
+  for (auto pair: pairs) {
+    if (cc == pair[0]) return pair[1];
+    if (cc == pair[1]) return pair[0];
+  }
+  return "";
+}
+
+
+static bool IsMove(const std::string& op) {
+  static const std::set<std::string> moves {
+    "movb", "movw", "movl", "movq", "movss", "movsd",
+  };
+  return moves.count(op);
+}
+
+
+static bool IsReg(const std::string& opd) {
+  return opd.size() && opd[0] == '%';
+}
+
+
+// A slot of the frame, the other memory may be volatile
+static bool IsStackMem(const std::string& opd) {
+  auto pos = opd.find('(');
+  if (pos == std::string::npos)
+    return false;
+  auto base = opd.substr(pos);
+  return base == "(%rbp)" || base == "(%rsp)";
+}
+
+
+static bool HasRax(const std::string& opd) {
+  for (auto reg: {"%rax", "%eax", "%ax", "%al", "%ah"}) {
+    if (opd.find(reg) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+
+enum class Use { NONE, READ, WRITE };
+
+// How 'inst' uses %rax; READ if not sure
+static Use RaxUse(const AsmInst& inst) {
+  static const std::set<std::string> fullWrites {
+    "mov", "movl", "movq", "movabsq", "movd", "leal", "leaq", "popq",
+    "movzbl", "movzwl", "movzbq", "movzwq",
+    "movsbl", "movswl", "movsbq", "movswq", "movslq",
+    "cvttss2si", "cvttsd2si", "cvttss2sil", "cvttsd2sil",
+    "cvttss2siq", "cvttsd2siq",
+  };
+  const auto& op = inst.op_;
+  const auto& opds = inst.opds_;
+  // The string instructions, 'rep stosb' stores %al
+  if (IsReturn(op) || IsCall(op) || op == "rep")
+    return Use::READ;
+  if (opds.empty()) {
+    auto none = op == "leave" || op == "leaveq" || op == "nop";
+    return none ? Use::NONE: Use::READ;
+  }
+  // The implicit operand of the one operand multiply and divide
+  if (opds.size() == 1 && (op.compare(0, 3, "mul") == 0 ||
+                           op.compare(0, 4, "imul") == 0 ||
+                           op.compare(0, 3, "div") == 0 ||
+                           op.compare(0, 4, "idiv") == 0)) {
+    return Use::READ;
+  }
+  auto des = opds.back();
+  if (opds.size() == 2 && (des == "%eax" || des == "%rax")) {
+    if ((op == "xorl" || op == "xorq") && opds[0] == des)
+      return Use::WRITE;
+    if (fullWrites.count(op) && !HasRax(opds[0]))
+      return Use::WRITE;
+  }
+  for (const auto& opd: opds) {
+    if (HasRax(opd))
+      return Use::READ;
+  }
+  return Use::NONE;
+}
+
+
+static bool SetsFlags(const std::string& op) {
+  static const std::set<std::string> ops {
+    "cmp", "test", "add", "sub", "and", "or", "xor",
+  };
+  if (op == "ucomiss" || op == "ucomisd" ||
+      op == "comiss" || op == "comisd") {
+    return true;
+  }
+  if (op.empty() || ops.count(op))
+    return op.size();
+  auto suffix = op.back();
+  return (suffix == 'b' || suffix == 'w' || suffix == 'l' || suffix == 'q')
+         && ops.count(op.substr(0, op.size() - 1));
+}
+
+
+static bool ReadsFlags(const std::string& op) {
+  return (op.compare(0, 1, "j") == 0 && op != "jmp") ||
+         op.compare(0, 3, "set") == 0 || op.compare(0, 4, "cmov") == 0 ||
+         op.compare(0, 3, "adc") == 0 || op.compare(0, 3, "sbb") == 0;
+}
+
+
+/*
+ * A round of the peephole pass. The removed lines are left as empty
+ * directives, so the indices of the labels stay valid in a round.
+ */
+class PeepholePass {
+public:
+  explicit PeepholePass(AsmList& insts): insts_(insts) {
+    for (size_t i = 0; i < insts_.size(); ++i) {
+      const auto& inst = insts_[i];
+      if (inst.kind_ == AsmInst::LABEL) {
+        labels_[inst.op_] = i;
+      } else if (inst.kind_ == AsmInst::DIRECTIVE) {
+        AddRefs(inst.op_);
+      } else {
+        for (const auto& opd: inst.opds_)
+          AddRefs(opd);
+      }
+    }
+  }
+
+  bool Run();
+
+private:
+  static const size_t npos = static_cast<size_t>(-1);
+  // How far the liveness of %rax and the flags is searched
+  static const int maxScan = 64;
+  static const int maxDepth = 4;
+
+  bool ForwardStore(size_t i);
+  bool RemoveMove(size_t i);
+  bool FuseSet(size_t i);
+  bool ThreadJump(size_t i);
+  bool RemoveUnreachable(size_t i);
+  bool RemoveLabel(size_t i);
+  void AddRefs(const std::string& text);
+
+  size_t NextInst(size_t i) const;
+  size_t SkipLabels(size_t i) const;
+  size_t Target(const AsmInst& jump) const;
+  bool RaxLive(size_t i, int depth=0) const;
+  bool FlagsLive(size_t i, int depth=0) const;
+  void Remove(size_t i) { insts_[i] = {AsmInst::DIRECTIVE, "", {}}; }
+
+  AsmList& insts_;
+  std::map<std::string, size_t> labels_;
+  // The names that the code and the data refer to
+  std::set<std::string> refs_;
+};
+
+
+void PeepholePass::AddRefs(const std::string& text) {
+  std::string name;
+  for (auto c: text + " ") {
+    if (isalnum(c) || c == '_' || c == '.' || c == '$') {
+      name.push_back(c);
+    } else if (name.size()) {
+      refs_.insert(name);
+      name.clear();
+    }
+  }
+}
+
+
+// The next line that is an instruction or a label
+size_t PeepholePass::NextInst(size_t i) const {
+  for (++i; i < insts_.size() && IsNote(insts_[i]); ++i) {}
+  return i;
+}
+
+
+// The first line from 'i' that is code
+size_t PeepholePass::SkipLabels(size_t i) const {
+  while (i < insts_.size() &&
+         (insts_[i].kind_ == AsmInst::LABEL || IsNote(insts_[i]))) {
+    ++i;
+  }
+  return i;
+}
+
+
+// The index of the label that 'jump' goes to, npos if not local
+size_t PeepholePass::Target(const AsmInst& jump) const {
+  if (jump.opds_.size() != 1)
+    return npos;
+  auto iter = labels_.find(jump.opds_[0]);
+  return iter == labels_.end() ? npos: iter->second;
+}
+
+
+// Whether %rax may be read from 'i' on, before it is written
+bool PeepholePass::RaxLive(size_t i, int depth) const {
+  if (depth > maxDepth)
+    return true;
+  for (int n = 0; n < maxScan && i < insts_.size(); ++n) {
+    const auto& inst = insts_[i];
+    if (inst.kind_ == AsmInst::LABEL || IsNote(inst)) {
+      ++i;
+      continue;
+    }
+    if (inst.kind_ == AsmInst::DIRECTIVE)
+      return true;
+    if (IsJump(inst)) {
+      auto target = Target(inst);
+      if (target == npos)
+        return true;
+      if (inst.op_ == "jmp") {
+        i = target;
+        continue;
+      }
+      if (RaxLive(target, depth + 1))
+        return true;
+      ++i;
+      continue;
+    }
+    auto use = RaxUse(inst);
+    if (use != Use::NONE)
+      return use == Use::READ;
+    ++i;
+  }
+  return true;
+}
+
+
+// Whether the flags may be read from 'i' on, before they are set
+bool PeepholePass::FlagsLive(size_t i, int depth) const {
+  if (depth > maxDepth)
+    return true;
+  for (int n = 0; n < maxScan && i < insts_.size(); ++n) {
+    const auto& inst = insts_[i];
+    if (inst.kind_ == AsmInst::LABEL || IsNote(inst)) {
+      ++i;
+      continue;
+    }
+    if (inst.kind_ == AsmInst::DIRECTIVE)
+      return true;
+    if (inst.op_ == "jmp") {
+      i = Target(inst);
+      if (i == npos)
+        return true;
+      continue;
+    }
+    if (ReadsFlags(inst.op_))
+      return true;
+    if (IsReturn(inst.op_) || IsCall(inst.op_))
+      return false;
+    if (SetsFlags(inst.op_))
+      return false;
+    ++i;
+  }
+  return true;
+}
+
+
+// movq %rax, -8(%rbp); movq -8(%rbp), %r11 => movq %rax, %r11
+bool PeepholePass::ForwardStore(size_t i) {
+  const auto& store = insts_[i];
+  if (!IsMove(store.op_) || store.opds_.size() != 2 || store.volatile_ ||
+      !IsReg(store.opds_[0]) || !IsStackMem(store.opds_[1])) {
+    return false;
+  }
+  auto j = NextInst(i);
+  if (j >= insts_.size())
+    return false;
+  auto& load = insts_[j];
+  if (load.kind_ != AsmInst::INST || load.op_ != store.op_ ||
+      load.volatile_ || load.opds_.size() != 2 ||
+      load.opds_[0] != store.opds_[1] || !IsReg(load.opds_[1])) {
+    return false;
+  }
+  // A 32 bits move clears the upper half
+  if (load.opds_[1] == store.opds_[0] && store.op_ != "movl") {
+    Remove(j);
+  } else {
+    load.opds_[0] = store.opds_[0];
+  }
+  return true;
+}
+
+
+// movq %rax, %rax; or movq %rax, %r11; movq %r11, %rax
+bool PeepholePass::RemoveMove(size_t i) {
+  const auto& move = insts_[i];
+  if (!IsMove(move.op_) || move.opds_.size() != 2 || move.volatile_)
+    return false;
+  const auto& src = move.opds_[0];
+  const auto& des = move.opds_[1];
+  if (src == des && IsReg(src) && move.op_ != "movl") {
+    Remove(i);
+    return true;
+  }
+
+  // The second move writes back 'src'
+  if (IsReg(src) ? move.op_ == "movl": !IsStackMem(src))
+    return false;
+  if (!IsReg(des) && (!IsStackMem(des) || !IsReg(src)))
+    return false;
+  auto j = NextInst(i);
+  if (j >= insts_.size())
+    return false;
+  const auto& back = insts_[j];
+  if (back.kind_ != AsmInst::INST || back.op_ != move.op_ ||
+      back.volatile_ || back.opds_.size() != 2 || back.opds_[0] != des ||
+      back.opds_[1] != src) {
+    return false;
+  }
+  Remove(j);
+  return true;
+}
+
+
+/*
+ * setl %al; movzbq %al, %rax; cmp $0, %eax; je .L1 => jge .L1,
+ * if neither %rax nor the flags are read after the jump.
+ */
+bool PeepholePass::FuseSet(size_t i) {
+  const auto& set = insts_[i];
+  if (set.op_.compare(0, 3, "set") != 0 || set.opds_.size() != 1 ||
+      set.opds_[0] != "%al") {
+    return false;
+  }
+  auto cc = set.op_.substr(3);
+  if (Negate(cc).empty())
+    return false;
+
+  auto j = NextInst(i);
+  if (j >= insts_.size())
+    return false;
+  const auto& ext = insts_[j];
+  if (!(ext.op_ == "movzbq" && ext.opds_ ==
+        std::vector<std::string> {"%al", "%rax"}) &&
+      !(ext.op_ == "movzbl" && ext.opds_ ==
+        std::vector<std::string> {"%al", "%eax"})) {
+    return false;
+  }
+
+  auto k = NextInst(j);
+  if (k >= insts_.size())
+    return false;
+  const auto& cmp = insts_[k];
+  if (cmp.kind_ != AsmInst::INST || cmp.op_.compare(0, 3, "cmp") != 0 ||
+      cmp.op_.size() > 4 || cmp.opds_.size() != 2 ||
+      cmp.opds_[0] != "$0" || !HasRax(cmp.opds_[1])) {
+    return false;
+  }
+
+  auto m = NextInst(k);
+  if (m >= insts_.size())
+    return false;
+  auto& jump = insts_[m];
+  if (jump.kind_ != AsmInst::INST || (jump.op_ != "je" && jump.op_ != "jne"))
+    return false;
+  auto target = Target(jump);
+  if (target == npos || RaxLive(m + 1) || RaxLive(target) ||
+      FlagsLive(m + 1) || FlagsLive(target)) {
+    return false;
+  }
+
+  jump.op_ = "j" + (jump.op_ == "je" ? Negate(cc): cc);
+  Remove(i);
+  Remove(j);
+  Remove(k);
+  return true;
+}
+
+
+bool PeepholePass::ThreadJump(size_t i) {
+  auto& jump = insts_[i];
+  if (!IsJump(jump))
+    return false;
+  auto target = Target(jump);
+  if (target == npos)
+    return false;
+
+  // A jump to the next instruction
+  auto next = SkipLabels(i + 1);
+  if (target > i && target < next) {
+    Remove(i);
+    return true;
+  }
+
+  // A jump to a jump
+  auto dest = SkipLabels(target);
+  if (dest < insts_.size() && insts_[dest].op_ == "jmp") {
+    auto newTarget = Target(insts_[dest]);
+    if (newTarget != npos && SkipLabels(newTarget) != dest) {
+      jump.opds_[0] = insts_[dest].opds_[0];
+      return true;
+    }
+  }
+
+  // jl .L1; jmp .L2; .L1: => jge .L2
+  auto cc = jump.op_.substr(1);
+  if (jump.op_ == "jmp" || Negate(cc).empty())
+    return false;
+  auto j = NextInst(i);
+  if (j >= insts_.size() || insts_[j].op_ != "jmp" ||
+      Target(insts_[j]) == npos) {
+    return false;
+  }
+  next = SkipLabels(j + 1);
+  if (target > j && target < next) {
+    jump.op_ = "j" + Negate(cc);
+    jump.opds_ = insts_[j].opds_;
+    Remove(j);
+    return true;
+  }
+  return false;
+}
+
+
+// The code after a jmp or ret, up to the next label, is never executed
+bool PeepholePass::RemoveUnreachable(size_t i) {
+  const auto& op = insts_[i].op_;
+  if (op != "jmp" && !IsReturn(op))
+    return false;
+  auto changed = false;
+  for (auto j = i + 1; j < insts_.size(); ++j) {
+    if (insts_[j].kind_ == AsmInst::LABEL)
+      break;
+    if (insts_[j].kind_ == AsmInst::INST) {
+      Remove(j);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+
+// A local label of the code that nothing refers to
+bool PeepholePass::RemoveLabel(size_t i) {
+  const auto& label = insts_[i].op_;
+  if (label.compare(0, 2, ".L") != 0 || refs_.count(label))
+    return false;
+  auto next = SkipLabels(i + 1);
+  if (next >= insts_.size() || insts_[next].kind_ != AsmInst::INST)
+    return false;
+  Remove(i);
+  return true;
+}
+
+
+bool PeepholePass::Run() {
+  auto changed = false;
+  for (size_t i = 0; i < insts_.size(); ++i) {
+    if (insts_[i].kind_ == AsmInst::LABEL && RemoveLabel(i))
+      changed = true;
+    if (insts_[i].kind_ != AsmInst::INST)
+      continue;
+    if (ForwardStore(i) || RemoveMove(i) || FuseSet(i) ||
+        ThreadJump(i) || RemoveUnreachable(i)) {
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+
+void Peephole(AsmList& insts) {
+  // Bounds the rounds, a cycle of jumps keeps threading
+  for (int round = 0; round < 8; ++round) {
+    if (!PeepholePass(insts).Run())
+      break;
+    AsmList live;
+    for (auto& inst: insts) {
+      if (inst.kind_ != AsmInst::DIRECTIVE || inst.op_.size())
+        live.push_back(inst);
+    }
+    insts.swap(live);
+  }
+}
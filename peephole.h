@@ -0,0 +1,41 @@
+#ifndef _WGTCC_PEEPHOLE_H_
+#define _WGTCC_PEEPHOLE_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+/*
+ * A line of the assembly, as emitted by the generators. An instruction
+ * is kept as its mnemonic and operands, a label or a directive (including
+ * a comment) is kept as its text.
+ */
+struct AsmInst {
+  enum Kind { INST, LABEL, DIRECTIVE };
+
+  static AsmInst Parse(const std::string& line);
+  static AsmInst Label(const std::string& label) {
+    return {LABEL, label, {}};
+  }
+  void Print(FILE* fp) const;
+
+  Kind kind_;
+  std::string op_;
+  std::vector<std::string> opds_;
+  // Accesses a volatile object, it is neither forwarded nor removed
+  bool volatile_;
+};
+
+typedef std::vector<AsmInst> AsmList;
+
+/*
+ * Runs over the code of a function with a small window: forwards
+ * the stores to the stack to the loads that follow them, removes
+ * the redundant moves, fuses a 'setcc' whose value only feeds a
+ * conditional jump into the jump, and threads the jumps. The accesses
+ * to the volatile objects are kept as they are.
+ */
+void Peephole(AsmList& insts);
+
+#endif
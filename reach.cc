@@ -0,0 +1,346 @@
+#include "reach.h"
+
+#include <cctype>
+
+
+// Whether 'expr' is an arithmetic constant, its truth in 'val'
+static bool ConstantCond(Expr* expr, bool& val) {
+  auto cons = dynamic_cast<Constant*>(expr);
+  if (!cons || !cons->Type()->ToArithm() ||
+      cons->Type()->ToArithm()->IsComplex()) {
+    return false;
+  }
+  val = cons->Type()->IsFloat() ? cons->FVal() != 0: cons->IVal() != 0;
+  return true;
+}
+
+
+void Pruner::Prune(FuncDef* funcDef) {
+  Stmt* body = funcDef->Body();
+  // The labels reached are found first, up to a fixed point
+  size_t size;
+  do {
+    size = live_.size();
+    Flow(body, true);
+  } while (live_.size() != size);
+  prune_ = true;
+  Flow(body, true);
+}
+
+
+bool Pruner::HasLive(Stmt* stmt) {
+  if (auto label = dynamic_cast<LabelStmt*>(stmt))
+    return live_.count(label);
+  if (auto compStmt = dynamic_cast<CompoundStmt*>(stmt)) {
+    for (auto child: compStmt->Stmts()) {
+      if (HasLive(child))
+        return true;
+    }
+  } else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+    return HasLive(ifStmt->then_) ||
+           (ifStmt->else_ && HasLive(ifStmt->else_));
+  } else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+    return HasLive(switchStmt->body_);
+  }
+  return false;
+}
+
+
+/*
+ * Whether 'stmt' can be removed if it is not reached. A static object
+ * is kept, it may be referred to after a label; so the statements of
+ * a compound that has no scope are removed one by one.
+ */
+bool Pruner::Removable(Stmt* stmt) {
+  if (auto decl = dynamic_cast<Declaration*>(stmt))
+    return !decl->Obj()->IsStatic();
+  if (auto compStmt = dynamic_cast<CompoundStmt*>(stmt)) {
+    if (!compStmt->Scope())
+      return false;
+  }
+  return !HasLive(stmt);
+}
+
+
+bool Pruner::FlowBranch(Stmt*& stmt, bool reached) {
+  if (prune_ && !reached && Removable(stmt)) {
+    if (!dynamic_cast<EmptyStmt*>(stmt))
+      stmt = EmptyStmt::New();
+    return false;
+  }
+  return Flow(stmt, reached);
+}
+
+
+/*
+ * Whether the end of 'stmt' is reached, if its beginning is 'reached'.
+ * The labels that the reached jumps go to are live; in the last round
+ * the statements not reached are removed.
+ */
+bool Pruner::Flow(Stmt*& stmt, bool reached) {
+  if (auto compStmt = dynamic_cast<CompoundStmt*>(stmt)) {
+    auto& stmts = compStmt->Stmts();
+    for (auto iter = stmts.begin(); iter != stmts.end();) {
+      if (prune_ && !reached && Removable(*iter)) {
+        iter = stmts.erase(iter);
+        continue;
+      }
+      reached = Flow(*iter, reached);
+      ++iter;
+    }
+    return reached;
+  } else if (auto ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+    bool val;
+    if (ConstantCond(ifStmt->cond_, val)) {
+      auto taken = val ? ifStmt->then_: ifStmt->else_;
+      auto other = val ? ifStmt->else_: ifStmt->then_;
+      if (prune_ && (!other || !HasLive(other))) {
+        stmt = taken ? taken: EmptyStmt::New();
+        return Flow(stmt, reached);
+      }
+      // The branch not taken is entered only by its labels
+      auto then = FlowBranch(ifStmt->then_, reached && val);
+      auto els = ifStmt->else_ ?
+          FlowBranch(ifStmt->else_, reached && !val): reached && !val;
+      return then || els;
+    }
+    auto then = FlowBranch(ifStmt->then_, reached);
+    auto els = ifStmt->else_ ? FlowBranch(ifStmt->else_, reached): reached;
+    return then || els;
+  } else if (auto switchStmt = dynamic_cast<SwitchStmt*>(stmt)) {
+    // The cases are kept even if the switch is not reached
+    for (const auto& c: switchStmt->Cases())
+      live_.insert(c.label_);
+    if (switchStmt->Default())
+      live_.insert(switchStmt->Default());
+    FlowBranch(switchStmt->body_, false);
+    return true;
+  } else if (auto label = dynamic_cast<LabelStmt*>(stmt)) {
+    return reached || live_.count(label);
+  } else if (auto jumpStmt = dynamic_cast<JumpStmt*>(stmt)) {
+    if (reached)
+      live_.insert(jumpStmt->label_);
+    return false;
+  } else if (dynamic_cast<ReturnStmt*>(stmt)) {
+    return false;
+  }
+  return reached;
+}
+
+
+Reachability::Reachability(TranslationUnit* unit) {
+  for (auto extDecl: unit->ExtDecls()) {
+    if (auto funcDef = dynamic_cast<FuncDef*>(extDecl)) {
+      if (funcDef->Linkage() == L_INTERNAL)
+        AddDef(funcDef->Name(), funcDef);
+      else
+        worklist_.push_back(funcDef);
+    } else if (auto decl = dynamic_cast<Declaration*>(extDecl)) {
+      if (decl->Obj()->Linkage() == L_EXTERNAL)
+        worklist_.push_back(decl);
+      else
+        AddDef(decl->Obj()->Repr(), decl);
+    }
+  }
+
+  while (worklist_.size()) {
+    auto def = worklist_.back();
+    worklist_.pop_back();
+    if (auto decl = dynamic_cast<Declaration*>(def))
+      VisitInits(decl);
+    else
+      Visit(def);
+  }
+}
+
+
+bool Reachability::Reached(ExtDecl* extDecl) const {
+  if (auto funcDef = dynamic_cast<FuncDef*>(extDecl)) {
+    return funcDef->Linkage() != L_INTERNAL ||
+           reached_.count(funcDef->Name());
+  } else if (auto decl = dynamic_cast<Declaration*>(extDecl)) {
+    auto obj = decl->Obj();
+    return !obj->IsStatic() || obj->Linkage() == L_EXTERNAL ||
+           reached_.count(obj->Repr());
+  }
+  return true;
+}
+
+
+void Reachability::AddDef(const std::string& name, ASTNode* def) {
+  if (reached_.count(name))
+    worklist_.push_back(def);
+  else
+    defs_[name].push_back(def);
+}
+
+
+void Reachability::Reach(const std::string& name) {
+  if (!reached_.insert(name).second)
+    return;
+  auto iter = defs_.find(name);
+  if (iter == defs_.end())
+    return;
+  for (auto def: iter->second)
+    worklist_.push_back(def);
+  defs_.erase(iter);
+}
+
+
+void Reachability::VisitInits(Declaration* decl) {
+  for (const auto& init: decl->Inits())
+    Visit(init.expr_);
+}
+
+
+void Reachability::VisitBinaryOp(BinaryOp* binary) {
+  Visit(binary->lhs_);
+  // The right operand of '.' is a member
+  if (binary->op_ != '.')
+    Visit(binary->rhs_);
+}
+
+
+void Reachability::VisitUnaryOp(UnaryOp* unary) {
+  Visit(unary->operand_);
+}
+
+
+void Reachability::VisitConditionalOp(ConditionalOp* condOp) {
+  Visit(condOp->cond_);
+  Visit(condOp->exprTrue_);
+  Visit(condOp->exprFalse_);
+}
+
+
+void Reachability::VisitFuncCall(FuncCall* funcCall) {
+  Visit(funcCall->designator_);
+  for (auto arg: funcCall->args_)
+    Visit(arg);
+}
+
+
+void Reachability::VisitIdentifier(Identifier* ident) {
+  // A function
+  if (ident->Linkage() != L_NONE)
+    Reach(ident->Name());
+}
+
+
+void Reachability::VisitObject(Object* obj) {
+  if (obj->IsStatic()) {
+    Reach(obj->Repr());
+  } else if (obj->Anonymous() && obj->Decl()) {
+    // A compound literal, initialized where it is used
+    VisitInits(obj->Decl());
+  }
+}
+
+
+// A static object of a function is emitted only if it is reached
+void Reachability::VisitDeclaration(Declaration* decl) {
+  if (decl->Obj()->IsStatic())
+    AddDef(decl->Obj()->Repr(), decl);
+  else
+    VisitInits(decl);
+}
+
+
+void Reachability::VisitIfStmt(IfStmt* ifStmt) {
+  Visit(ifStmt->cond_);
+  Visit(ifStmt->then_);
+  if (ifStmt->else_)
+    Visit(ifStmt->else_);
+}
+
+
+void Reachability::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  Visit(switchStmt->select_);
+  Visit(switchStmt->body_);
+}
+
+
+void Reachability::VisitReturnStmt(ReturnStmt* returnStmt) {
+  if (returnStmt->expr_)
+    Visit(returnStmt->expr_);
+}
+
+
+void Reachability::VisitCompoundStmt(CompoundStmt* compStmt) {
+  for (auto stmt: compStmt->Stmts())
+    Visit(stmt);
+}
+
+
+void Reachability::VisitFuncDef(FuncDef* funcDef) {
+  Visit(funcDef->Body());
+}
+
+
+void HeldCode::Hold(const std::string& name, AsmList& insts) {
+  Peephole(insts);
+  if (name.size())
+    funcs_[name] = chunks_.size();
+  chunks_.push_back({name, std::move(insts)});
+  insts.clear();
+}
+
+
+// The names in the operands, a local label or a static object has '.'
+void HeldCode::Reach(const AsmList& insts, std::vector<size_t>& worklist) {
+  auto reach = [&](const std::string& text) {
+    size_t begin = 0;
+    while (begin < text.size()) {
+      auto end = begin;
+      while (end < text.size() &&
+             (isalnum(text[end]) || text[end] == '_' || text[end] == '.')) {
+        ++end;
+      }
+      if (end == begin) {
+        ++begin;
+        continue;
+      }
+      auto iter = funcs_.find(text.substr(begin, end - begin));
+      if (iter != funcs_.end() && !reached_[iter->second]) {
+        reached_[iter->second] = true;
+        worklist.push_back(iter->second);
+      }
+      begin = end;
+    }
+  };
+  for (const auto& inst: insts) {
+    if (inst.kind_ == AsmInst::DIRECTIVE)
+      reach(inst.op_);
+    for (const auto& opd: inst.opds_)
+      reach(opd);
+  }
+}
+
+
+void HeldCode::Print(FILE* fp) {
+  reached_.assign(chunks_.size(), false);
+  std::vector<size_t> worklist;
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    if (chunks_[i].name_.empty()) {
+      reached_[i] = true;
+      Reach(chunks_[i].insts_, worklist);
+    }
+  }
+  while (worklist.size()) {
+    auto i = worklist.back();
+    worklist.pop_back();
+    Reach(chunks_[i].insts_, worklist);
+  }
+
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    for (const auto& inst: chunks_[i].insts_) {
+      // The file numbers of the debug info are used by the code after
+      if (reached_[i] || (inst.kind_ == AsmInst::DIRECTIVE &&
+                          inst.op_.compare(0, 6, ".file\t") == 0)) {
+        inst.Print(fp);
+      }
+    }
+  }
+  chunks_.clear();
+  funcs_.clear();
+}
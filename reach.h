@@ -0,0 +1,113 @@
+#ifndef _WGTCC_REACH_H_
+#define _WGTCC_REACH_H_
+
+#include "ast.h"
+#include "peephole.h"
+#include "visitor.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+/*
+ * Removes the code of a function that is never executed, after it is
+ * folded (fold.h) and its gotos are resolved. An if statement on
+ * a constant condition is replaced by the branch taken, the statements
+ * that no path reaches are removed, like those after a jump or return
+ * up to a label that a reached jump goes to.
+ */
+class Pruner {
+public:
+  Pruner() {}
+  void Prune(FuncDef* funcDef);
+
+private:
+  bool Flow(Stmt*& stmt, bool reached);
+  bool FlowBranch(Stmt*& stmt, bool reached);
+  bool HasLive(Stmt* stmt);
+  bool Removable(Stmt* stmt);
+
+  // The labels that the reached jumps and the switches go to
+  std::set<LabelStmt*> live_;
+  bool prune_ {false};
+};
+
+
+/*
+ * The definitions that need not be emitted: the functions and objects
+ * of internal linkage, and the static objects of functions, that are
+ * not reached from the external definitions of the unit through their
+ * references.
+ */
+class Reachability: public Visitor {
+public:
+  explicit Reachability(TranslationUnit* unit);
+  virtual ~Reachability() {}
+
+  bool Reached(ExtDecl* extDecl) const;
+
+  void Visit(ASTNode* node) { node->Accept(this); }
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* cond);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitEnumerator(Enumerator* enumer) {}
+  virtual void VisitIdentifier(Identifier* ident);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitConstant(Constant* cons) {}
+  virtual void VisitTempVar(TempVar* tempVar) {}
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+  virtual void VisitFuncDef(FuncDef* funcDef);
+  virtual void VisitTranslationUnit(TranslationUnit* unit) {}
+
+private:
+  void AddDef(const std::string& name, ASTNode* def);
+  void Reach(const std::string& name);
+  void VisitInits(Declaration* decl);
+
+  // The definitions not reached yet, by the names they define
+  std::map<std::string, std::vector<ASTNode*>> defs_;
+  std::set<std::string> reached_;
+  std::vector<ASTNode*> worklist_;
+};
+
+
+/*
+ * The code of the unit, held from the first function of internal
+ * linkage at -O1: its calls may all be inlined into the functions that
+ * follow. The code of such a function is dropped at the end, if no code
+ * printed references its name. Its literals and static objects are
+ * kept, the inlined copies may use them.
+ */
+class HeldCode {
+public:
+  HeldCode() {}
+
+  bool Empty() const { return chunks_.empty(); }
+  // Takes 'insts', 'name' is the function it defines or empty
+  void Hold(const std::string& name, AsmList& insts);
+  void Print(FILE* fp);
+
+private:
+  void Reach(const AsmList& insts, std::vector<size_t>& worklist);
+
+  struct Chunk {
+    std::string name_;
+    AsmList insts_;
+  };
+  std::vector<Chunk> chunks_;
+  std::map<std::string, size_t> funcs_;
+  std::vector<bool> reached_;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "reg_alloc.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <unordered_map>
+
+
+static const int intArgRegs[] = {RDI, RSI, RDX, RCX, R8, R9};
+
+// The caller-saved ones first, for the callee-saved ones must be preserved
+static const int allocOrder[] = {
+  RCX, RDX, RSI, RDI, R8, R9, RAX, RBX, R12, R13, R14, R15,
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+  XMM8, XMM9, XMM10, XMM11, XMM12, XMM13,
+};
+
+
+int RegAlloc::IntArgReg(int idx) {
+  return intArgRegs[idx];
+}
+
+
+RegMask RegAlloc::Clobbers(const Inst* inst) {
+  switch (inst->op_) {
+  case Opcode::CALL:
+    return (gprMask & ~calleeSavedMask) | xmmMask;
+  case Opcode::DIV: case Opcode::UDIV: case Opcode::MOD: case Opcode::UMOD:
+    return IsFloat(inst->type_) ? 0: MaskOf(RAX) | MaskOf(RDX);
+  case Opcode::SHL: case Opcode::SHR: case Opcode::SAR:
+    return inst->args_[1].IsImm() ? 0: MaskOf(RCX);
+  case Opcode::COPY:
+    return MaskOf(RCX);
+  default:
+    return 0;
+  }
+}
+
+
+static bool Test(const std::vector<uint64_t>& set, int reg) {
+  return set[reg / 64] & (1UL << (reg % 64));
+}
+
+
+static void Set(std::vector<uint64_t>& set, int reg) {
+  set[reg / 64] |= 1UL << (reg % 64);
+}
+
+
+static void Reset(std::vector<uint64_t>& set, int reg) {
+  set[reg / 64] &= ~(1UL << (reg % 64));
+}
+
+
+template<typename Func>
+static void ForEach(const std::vector<uint64_t>& set, Func func) {
+  for (size_t i = 0; i < set.size(); ++i) {
+    auto word = set[i];
+    while (word) {
+      auto bit = __builtin_ctzl(word);
+      func(i * 64 + bit);
+      word &= word - 1;
+    }
+  }
+}
+
+
+void RegAlloc::Run() {
+  auto numRegs = func_->NumRegs();
+  phys_.assign(numRegs, -1);
+  spill_.assign(numRegs, -1);
+  hint_.assign(numRegs, -1);
+  copyHint_.assign(numRegs, -1);
+  forbidden_.assign(numRegs, 0);
+  ComputeLiveness();
+  BuildIntervals();
+  LinearScan();
+}
+
+
+void RegAlloc::ComputeLiveness() {
+  auto& blocks = func_->blocks_;
+  auto words = (func_->NumRegs() + 63) / 64;
+  std::unordered_map<BasicBlock*, int> index;
+  std::vector<RegSet> uses(blocks.size(), RegSet(words));
+  std::vector<RegSet> defs(blocks.size(), RegSet(words));
+  int pos = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    index[blocks[i]] = i;
+    blockBegins_.push_back(pos);
+    for (auto inst: blocks[i]->insts_) {
+      for (auto reg: inst->Uses()) {
+        if (!Test(defs[i], reg))
+          Set(uses[i], reg);
+      }
+      if (inst->HasDst())
+        Set(defs[i], inst->dst_);
+      pos += 2;
+    }
+  }
+  blockBegins_.push_back(pos);
+
+  liveIn_.assign(blocks.size(), RegSet(words));
+  liveOut_.assign(blocks.size(), RegSet(words));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = blocks.size() - 1; i >= 0; --i) {
+      auto& out = liveOut_[i];
+      for (auto succ: blocks[i]->Succs()) {
+        const auto& in = liveIn_[index[succ]];
+        for (size_t w = 0; w < words; ++w)
+          out[w] |= in[w];
+      }
+      for (size_t w = 0; w < words; ++w) {
+        auto in = uses[i][w] | (out[w] & ~defs[i][w]);
+        if (in != liveIn_[i][w]) {
+          liveIn_[i][w] = in;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+
+void RegAlloc::BuildIntervals() {
+  auto numRegs = func_->NumRegs();
+  std::vector<int> begins(numRegs, INT_MAX);
+  std::vector<int> ends(numRegs, -1);
+  auto extend = [&begins, &ends](int reg, int pos) {
+    begins[reg] = std::min(begins[reg], pos);
+    ends[reg] = std::max(ends[reg], pos);
+  };
+
+  // Parameters arrive in registers
+  size_t regCnt = func_->retPtr_ >= 0, xregCnt = 0;
+  if (func_->retPtr_ >= 0) {
+    Hint(func_->retPtr_, IntArgReg(0));
+    extend(func_->retPtr_, 0);
+  }
+  for (const auto& param: func_->params_) {
+    if (param.reg_ < 0)
+      continue;
+    extend(param.reg_, 0);
+    if (param.offset_)
+      continue;
+    auto type = func_->RegType(param.reg_);
+    Hint(param.reg_, ArgReg(type, IsFloat(type) ? xregCnt++: regCnt++));
+  }
+
+  auto& blocks = func_->blocks_;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    auto live = liveOut_[i];
+    auto begin = blockBegins_[i];
+    auto end = blockBegins_[i + 1] - 1;
+    ForEach(live, [&](int reg) { extend(reg, end); });
+    ForEach(liveIn_[i], [&](int reg) { extend(reg, begin); });
+
+    auto& insts = blocks[i]->insts_;
+    for (int k = insts.size() - 1; k >= 0; --k) {
+      auto inst = insts[k];
+      auto pos = begin + 2 * k;
+      if (inst->HasDst()) {
+        extend(inst->dst_, pos + 1);
+        Reset(live, inst->dst_);
+      }
+      // The registers live across the instruction
+      auto clobbers = Clobbers(inst);
+      if (clobbers) {
+        ForEach(live, [&](int reg) { forbidden_[reg] |= clobbers; });
+      }
+      auto uses = inst->Uses();
+      for (auto reg: uses) {
+        extend(reg, pos);
+        Set(live, reg);
+      }
+
+      // Hints
+      switch (inst->op_) {
+      case Opcode::CALL: {
+        if (inst->HasDst())
+          Hint(inst->dst_, RetReg(inst->type_));
+        size_t gp = 0, fp = 0;
+        for (size_t j = 0; j < inst->args_.size(); ++j) {
+          const auto& arg = inst->call_->args_[j];
+          if (arg.size_)
+            continue;
+          int phys = -1;
+          if (IsFloat(arg.type_)) {
+            if (fp < 8)
+              phys = XMM0 + fp;
+            ++fp;
+          } else {
+            if (gp < 6)
+              phys = IntArgReg(gp);
+            ++gp;
+          }
+          const auto& opd = inst->args_[j];
+          if (phys >= 0 && opd.IsReg() && !Test(live, opd.Reg()))
+            Hint(opd.Reg(), phys);
+        }
+      } break;
+      case Opcode::RET:
+        if (inst->args_.size() && inst->args_[0].IsReg())
+          Hint(inst->args_[0].Reg(), RetReg(inst->type_));
+        break;
+      case Opcode::DIV: case Opcode::UDIV:
+        if (!IsFloat(inst->type_))
+          Hint(inst->dst_, RAX);
+        break;
+      case Opcode::MOD: case Opcode::UMOD:
+        Hint(inst->dst_, RDX);
+        break;
+      default:
+        break;
+      }
+      if (inst->HasDst() && inst->args_.size() && inst->args_[0].IsReg() &&
+          inst->op_ != Opcode::CALL) {
+        copyHint_[inst->dst_] = inst->args_[0].Reg();
+      }
+    }
+  }
+
+  for (size_t reg = 0; reg < numRegs; ++reg) {
+    if (ends[reg] >= 0)
+      intervals_.push_back({static_cast<int>(reg), begins[reg], ends[reg]});
+  }
+  std::sort(intervals_.begin(), intervals_.end(),
+            [](const Interval& lhs, const Interval& rhs) {
+    return lhs.begin_ < rhs.begin_ ||
+           (lhs.begin_ == rhs.begin_ && lhs.reg_ < rhs.reg_);
+  });
+}
+
+
+void RegAlloc::LinearScan() {
+  // Sorted by the ends
+  std::vector<const Interval*> active;
+  RegMask free = gprMask | xmmMask;
+  for (const auto& cur: intervals_) {
+    while (active.size() && active.front()->end_ < cur.begin_) {
+      free |= MaskOf(phys_[active.front()->reg_]);
+      active.erase(active.begin());
+    }
+
+    auto isFloat = IsFloat(func_->RegType(cur.reg_));
+    auto allowed = (isFloat ? xmmMask: gprMask) & ~forbidden_[cur.reg_];
+    int phys = -1;
+    auto copy = copyHint_[cur.reg_];
+    if (copy >= 0 && phys_[copy] >= 0 &&
+        (free & allowed & MaskOf(phys_[copy]))) {
+      phys = phys_[copy];
+    } else if (hint_[cur.reg_] >= 0 &&
+               (free & allowed & MaskOf(hint_[cur.reg_]))) {
+      phys = hint_[cur.reg_];
+    } else {
+      for (auto reg: allocOrder) {
+        if (free & allowed & MaskOf(reg)) {
+          phys = reg;
+          break;
+        }
+      }
+    }
+
+    const Interval* assigned = &cur;
+    if (phys < 0) {
+      // Spills the one that ends last
+      for (int i = active.size() - 1; i >= 0; --i) {
+        auto other = active[i];
+        if (other->end_ <= cur.end_)
+          break;
+        if (allowed & MaskOf(phys_[other->reg_])) {
+          phys = phys_[other->reg_];
+          phys_[other->reg_] = -1;
+          spill_[other->reg_] = numSpillSlots_++;
+          active.erase(active.begin() + i);
+          break;
+        }
+      }
+      if (phys < 0) {
+        spill_[cur.reg_] = numSpillSlots_++;
+        assigned = nullptr;
+      }
+    }
+    if (assigned) {
+      phys_[cur.reg_] = phys;
+      free &= ~MaskOf(phys);
+      used_ |= MaskOf(phys);
+      auto iter = std::upper_bound(active.begin(), active.end(), &cur,
+          [](const Interval* lhs, const Interval* rhs) {
+        return lhs->end_ < rhs->end_;
+      });
+      active.insert(iter, &cur);
+    }
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef _WGTCC_REG_ALLOC_H_
+#define _WGTCC_REG_ALLOC_H_
+
+#include "ir.h"
+
+#include <vector>
+
+
+// Hardware encodings of x86-64 registers, xmm registers follow
+enum PhysReg {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+  XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+  NUM_PHYS_REGS,
+};
+
+typedef unsigned long RegMask;
+
+inline RegMask MaskOf(int reg) { return 1UL << reg; }
+
+// r10, r11, xmm14 and xmm15 are the scratch registers of code generation
+const RegMask gprMask = 0xFFFF & ~(MaskOf(RSP) | MaskOf(RBP) |
+                                   MaskOf(R10) | MaskOf(R11));
+const RegMask xmmMask = 0x3FFFUL << XMM0;
+const RegMask calleeSavedMask = MaskOf(RBX) | MaskOf(R12) | MaskOf(R13) |
+                                MaskOf(R14) | MaskOf(R15);
+
+
+/*
+ * Linear scan register allocation (Poletto and Sarkar).
+ * The lifetime of a virtual register is approximated by one interval,
+ * the registers are assigned to the intervals in the order of their
+ * beginnings. If there are not enough registers, the interval that
+ * ends last is spilled. Instead of fixed intervals, a virtual register
+ * excludes the physical registers clobbered while it is live, like
+ * the caller-saved registers for calls and %rax, %rdx for divisions.
+ */
+class RegAlloc {
+public:
+  explicit RegAlloc(IRFunc* func): func_(func) {}
+  void Run();
+
+  // The physical register of 'reg', or -1 if it is spilled
+  int Phys(int reg) const { return phys_[reg]; }
+  // The spill slot of 'reg', from 0
+  int SpillSlot(int reg) const { return spill_[reg]; }
+  int NumSpillSlots() const { return numSpillSlots_; }
+  // The physical registers ever assigned
+  RegMask Used() const { return used_; }
+
+  static RegMask Clobbers(const Inst* inst);
+  // Argument and return registers
+  static int IntArgReg(int idx);
+  static int ArgReg(IRType type, int idx) {
+    return IsFloat(type) ? XMM0 + idx: IntArgReg(idx);
+  }
+  static int RetReg(IRType type) { return IsFloat(type) ? XMM0: RAX; }
+
+private:
+  struct Interval {
+    int reg_;
+    int begin_;
+    int end_;
+  };
+
+  void ComputeLiveness();
+  void BuildIntervals();
+  void LinearScan();
+  void Hint(int reg, int phys) { if (hint_[reg] < 0) hint_[reg] = phys; }
+
+  IRFunc* func_;
+  std::vector<int> phys_;
+  std::vector<int> spill_;
+  int numSpillSlots_ {0};
+  RegMask used_ {0};
+
+  // Positions of the first instructions of the blocks, an instruction
+  // reads its operands at 2 * index and writes its result at 2 * index + 1.
+  std::vector<int> blockBegins_;
+  typedef std::vector<uint64_t> RegSet;
+  std::vector<RegSet> liveIn_;
+  std::vector<RegSet> liveOut_;
+
+  std::vector<Interval> intervals_;
+  std::vector<RegMask> forbidden_;
+  std::vector<int> hint_;
+  // Prefers the register of another virtual register
+  std::vector<int> copyHint_;
+};
+
+#endif
@@ -1,7 +1,44 @@
 #include "scanner.h"
 
+#include <array>
 #include <cctype>
 #include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+enum {
+  CC_SPACE  = 0x01, // White spaces except '\n'
+  CC_IDENT  = 0x02, // Identifier characters except '\\'
+  CC_NUMBER = 0x04, // PP-number characters that never change the tag
+  CC_STRING = 0x08, // Characters in literals except '"', '\\', '\n'
+  CC_CHAR   = 0x10, // Characters in constants except '\'', '\\', '\n'
+};
+
+
+static std::array<uint8_t, 256> BuildCharClass() {
+  std::array<uint8_t, 256> cc;
+  for (int c = 0; c < 256; ++c) {
+    uint8_t cls = 0;
+    if (c != '\n' && isspace(c))
+      cls |= CC_SPACE;
+    if (isalnum(c) || c == '_' || c == '$' || (0x80 <= c && c <= 0xfd))
+      cls |= CC_IDENT;
+    if ((isalnum(c) || c == '_') && !strchr("eEpPxX", c))
+      cls |= CC_NUMBER;
+    if (c != 0 && c != '\"' && c != '\\' && c != '\n')
+      cls |= CC_STRING;
+    if (c != 0 && c != '\'' && c != '\\' && c != '\n')
+      cls |= CC_CHAR;
+    cc[c] = cls;
+  }
+  return cc;
+}
+
+static const std::array<uint8_t, 256> charClass = BuildCharClass();
 
 
 void Scanner::Tokenize(TokenSequence& ts) {
@@ -11,7 +48,7 @@ void Scanner::Tokenize(TokenSequence& ts) {
       if (ts.Empty() || (ts.Back()->tag_ != Token::NEW_LINE)) {
         auto t = Token::New(*tok);
         t->tag_ = Token::NEW_LINE;
-        t->str_ = "\n";
+        t->str_ = Intern("\n");
         ts.InsertBack(t);
       }
       break;
@@ -138,9 +175,14 @@ Token* Scanner::Scan(bool ws) {
 
 
 void Scanner::SkipWhiteSpace() {
+  auto begin = p_;
+  SkipClass(CC_SPACE);
+  if (p_ != begin)
+    tok_.ws_ = true;
   while (isspace(Peek()) && Peek() != '\n') {
     tok_.ws_ = true;
     Next();
+    SkipClass(CC_SPACE);
   }
 }
 
@@ -149,6 +191,7 @@ void Scanner::SkipComment() {
   if (Try('/')) {
     // Line comment terminated an newline or eof
     while (!Empty()) {
+      SkipLineCommentBody();
       if (Peek() == '\n')
         return;
       Next();
@@ -156,6 +199,7 @@ void Scanner::SkipComment() {
     return;
   } else if (Try('*')) {
     while (!Empty()) {
+      SkipBlockCommentBody();
       auto c = Next();
       if (c  == '*' && Peek() == '/') {
         Next();
@@ -193,6 +237,7 @@ Token* Scanner::SkipIdentifier() {
        || IsUCN(c)) {
     if (IsUCN(c))
       c = ScanEscaped(); // Just read it
+    SkipIdentChars();
     c = Next();
   }
   PutBack();
@@ -218,6 +263,7 @@ Token* Scanner::SkipNumber() {
     } else if (c == 'x' || c == 'X') {
       sawHexPrefix = true;
     }
+    SkipClass(CC_NUMBER);
     c = Next();
   }
   PutBack();
@@ -244,9 +290,11 @@ Encoding Scanner::ScanLiteral(std::string& val) {
 
 
 Token* Scanner::SkipLiteral() {
+  SkipClass(CC_STRING);
   auto c = Next();
   while (c != '\"' && c != '\n' && c != '\0') {
     if (c == '\\') Next();
+    SkipClass(CC_STRING);
     c = Next();
   }
   if (c != '\"')
@@ -273,9 +321,11 @@ Encoding Scanner::ScanCharacter(int& val) {
 
 
 Token* Scanner::SkipCharacter() {
+  SkipClass(CC_CHAR);
   auto c = Next();
   while (c != '\'' && c != '\n' && c != '\0') {
     if (c == '\\') Next();
+    SkipClass(CC_CHAR);
     c = Next();
   }
   if (c != '\'')
@@ -371,18 +421,6 @@ Encoding Scanner::ScanEncoding(int c) {
 }
 
 
-std::string* ReadFile(const std::string& fileName) {
-  FILE* f = fopen(fileName.c_str(), "r");
-  if (!f) Error("%s: No such file or directory", fileName.c_str());
-  auto text = new std::string;
-  int c;
-  while (EOF != (c = fgetc(f)))
-      text->push_back(c);
-  fclose(f);
-  return text;
-}
-
-
 int Scanner::Next() {
   int c = Peek();
   ++p_;
@@ -428,17 +466,141 @@ void Scanner::PutBack() {
 }
 
 
+const char* Scanner::SpliceFreeEnd() {
+  if (splice_ == nullptr || p_ < spliceBegin_ || p_ > splice_) {
+    auto q = p_;
+    while (*(q = strchrnul(q, '\\')) && q[1] != '\n')
+      ++q;
+    spliceBegin_ = p_;
+    splice_ = q;
+  }
+  return splice_;
+}
+
+
+// Skip characters of class 'cls' that are not spliced,
+// none of the classes contains '\n' or '\0'.
+void Scanner::SkipClass(int cls) {
+  auto end = SpliceFreeEnd();
+  auto p = p_;
+  while (p < end && (charClass[(uint8_t)*p] & cls))
+    ++p;
+  loc_.column_ += p - p_;
+  p_ = p;
+}
+
+
+void Scanner::SkipIdentChars() {
+  auto end = SpliceFreeEnd();
+  auto p = p_;
+#ifdef __SSE2__
+  // Unsigned range checks by biased signed compares
+  const auto lower = _mm_set1_epi8(0x80 - 'a');
+  const auto upper = _mm_set1_epi8(0x80 - 'A');
+  const auto digit = _mm_set1_epi8(0x80 - '0');
+  const auto lt26 = _mm_set1_epi8(-128 + 26);
+  const auto lt10 = _mm_set1_epi8(-128 + 10);
+  const auto underscore = _mm_set1_epi8('_');
+  const auto dollar = _mm_set1_epi8('$');
+  const auto gtfd = _mm_set1_epi8(-2);
+  while (end - p >= 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto m = _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmplt_epi8(_mm_add_epi8(v, lower), lt26),
+            _mm_cmplt_epi8(_mm_add_epi8(v, upper), lt26)),
+        _mm_or_si128(
+            _mm_cmplt_epi8(_mm_add_epi8(v, digit), lt10),
+            _mm_cmplt_epi8(v, gtfd)));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, underscore),
+                                     _mm_cmpeq_epi8(v, dollar)));
+    auto mask = ~_mm_movemask_epi8(m) & 0xffff;
+    if (mask) {
+      p += __builtin_ctz(mask);
+      loc_.column_ += p - p_;
+      p_ = p;
+      return;
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && (charClass[(uint8_t)*p] & CC_IDENT))
+    ++p;
+  loc_.column_ += p - p_;
+  p_ = p;
+}
+
+
+// Stop at '\n' or a line splice
+void Scanner::SkipLineCommentBody() {
+  auto end = SpliceFreeEnd();
+  auto q = static_cast<const char*>(memchr(p_, '\n', end - p_));
+  if (q == nullptr)
+    q = end;
+  loc_.column_ += q - p_;
+  p_ = q;
+}
+
+
+// Stop at '*' or a line splice, new lines are consumed
+void Scanner::SkipBlockCommentBody() {
+  auto end = SpliceFreeEnd();
+  auto p = p_;
+  while (p < end) {
+#ifdef __SSE2__
+    const auto star = _mm_set1_epi8('*');
+    const auto newline = _mm_set1_epi8('\n');
+    int mask = 0;
+    while (end - p >= 16) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, star),
+                                            _mm_cmpeq_epi8(v, newline)));
+      if (mask)
+        break;
+      p += 16;
+    }
+    if (mask) {
+      p += __builtin_ctz(mask);
+    } else {
+      while (p < end && *p != '*' && *p != '\n')
+        ++p;
+    }
+#else
+    while (p < end && *p != '*' && *p != '\n')
+      ++p;
+#endif
+    if (p == end || *p == '*')
+      break;
+    // New line
+    ++p;
+    ++loc_.line_;
+    loc_.column_ = 1;
+    loc_.lineBegin_ = p;
+    p_ = p;
+  }
+  loc_.column_ += p - p_;
+  p_ = p;
+}
+
+
 Token* Scanner::MakeToken(int tag) {
   tok_.tag_ = tag;
-  auto& str = tok_.str_;
-  str.resize(0);
+  auto& str = str_;
   const char* p = tok_.loc_.lineBegin_ + tok_.loc_.column_ - 1;
+  // A token spans lines only by line splices
+  if (p >= p_ || !memchr(p, '\n', p_ - p)) {
+    str.assign(p, p < p_ ? p_: p);
+    tok_.str_ = Intern(str);
+    return Token::New(tok_);
+  }
+  str.resize(0);
   for (; p < p_; ++p) {
     if (p[0] == '\n' && p[-1] == '\\')
       str.pop_back();
     else
       str.push_back(p[0]);
   }
+  tok_.str_ = Intern(str);
   return Token::New(tok_);
 }
 
@@ -447,6 +609,7 @@ Token* Scanner::MakeToken(int tag) {
 // It is generated before reading the character '\n'
 Token* Scanner::MakeNewLine() {
   tok_.tag_ = '\n';
-  tok_.str_ = std::string(p_, p_ + 1);
+  str_.assign(p_, p_ + 1);
+  tok_.str_ = Intern(str_);
   return Token::New(tok_);
 }
@@ -3,6 +3,7 @@
 
 #include "error.h"
 #include "encoding.h"
+#include "source.h"
 #include "token.h"
 
 #include <string>
@@ -12,15 +13,22 @@
 class Scanner {
 public:
   explicit Scanner(const Token* tok)
-      : Scanner(&tok->str_, tok->loc_) {}
+      : Scanner(tok->str_, tok->loc_) {}
   Scanner(const std::string* text, const SourceLocation& loc)
       : Scanner(text, loc.fileName_, loc.line_, loc.column_) {}
   explicit Scanner(const std::string* text,
                    const std::string* fileName=nullptr,
                    unsigned line=1, unsigned column=1)
-      : text_(text), tok_(Token::END) {
+      : Scanner(text->c_str(), fileName, line, column) {}
+  // The text of 'buf' is shared, not copied
+  Scanner(const SourceBuffer* buf, const std::string* fileName)
+      : Scanner(buf->Begin(), fileName) {}
+  Scanner(const char* text, const std::string* fileName,
+          unsigned line=1, unsigned column=1)
+      : text_(text), tok_(Token::END),
+        spliceBegin_(nullptr), splice_(nullptr) {
     // TODO(wgtdkp): initialization
-    p_ = &(*text_)[0];
+    p_ = text_;
     loc_ = {fileName, p_, line, 1};
   }
 
@@ -55,6 +63,12 @@ private:
   int ScanUCN(int len);
   void SkipWhiteSpace();
   void SkipComment();
+  // Fast paths, they never step over a line splice
+  const char* SpliceFreeEnd();
+  void SkipClass(int cls);
+  void SkipIdentChars();
+  void SkipLineCommentBody();
+  void SkipBlockCommentBody();
   bool IsUCN(int c) { return c == '\\' && (Test('u') || Test('U')); }
   bool IsOctal(int c) { return '0' <= c && c <= '7'; }
   int XDigit(int c);
@@ -72,15 +86,20 @@ private:
   };
   void Mark() { tok_.loc_ = loc_; };
 
-  const std::string* text_;
+  // Must be terminated by '\0'
+  const char* text_;
   SourceLocation loc_;
   Token tok_;
+  // Spelling of the current token, before it is interned
+  std::string str_;
   const char* p_;
+  // There is no line splice in [spliceBegin_, splice_), and
+  // 'splice_' points to the next splice or the terminating '\0'
+  const char* spliceBegin_;
+  const char* splice_;
   const char* tokLineBegin_;
   unsigned tokColumn_;
 };
 
 
-std::string* ReadFile(const std::string& fileName);
-
 #endif
@@ -35,16 +35,24 @@ Identifier* Scope::FindTagInCurScope(const Token* tok) {
 
 
 void Scope::Insert(Identifier* ident) {
-  Insert(ident->Name(), ident);
+  Insert(ident->Tok()->str_, ident);
+}
+
+
+void Scope::Insert(const std::string& name, Identifier* ident) {
+  Insert(Intern(name), ident);
 }
 
 
 void Scope::InsertTag(Identifier* ident) {
-  Insert(TagName(ident->Name()), ident);
+  auto name = ident->Tok()->str_;
+  assert(FindTagInCurScope(name) == nullptr);
+  tagMap_[name] = ident;
+  tagList_.push_back(ident);
 }
 
 
-Identifier* Scope::Find(const std::string& name) {
+Identifier* Scope::Find(const std::string* name) {
   auto ident = identMap_.find(name);
   if (ident != identMap_.end())
     return ident->second;
@@ -54,7 +62,7 @@ Identifier* Scope::Find(const std::string& name) {
 }
 
 
-Identifier* Scope::FindInCurScope(const std::string& name) {
+Identifier* Scope::FindInCurScope(const std::string* name) {
   auto ident = identMap_.find(name);
   if (ident == identMap_.end())
     return nullptr;
@@ -62,42 +70,43 @@ Identifier* Scope::FindInCurScope(const std::string& name) {
 }
 
 
-void Scope::Insert(const std::string& name, Identifier* ident) {
+void Scope::Insert(const std::string* name, Identifier* ident) {
   assert(FindInCurScope(name) == nullptr);
   identMap_[name] = ident;
+  identList_.emplace_back(name, ident);
 }
 
 
-Identifier* Scope::FindTag(const std::string& name) {
-  auto tag = Find(TagName(name));
-  if (tag) assert(tag->ToTypeName());
-  return tag;
+Identifier* Scope::FindTag(const std::string* name) {
+  auto tag = FindTagInCurScope(name);
+  if (tag)
+    return tag;
+  if (type_ == S_FILE || parent_ == nullptr)
+    return nullptr;
+  return parent_->FindTag(name);
 }
 
 
-Identifier* Scope::FindTagInCurScope(const std::string& name) {
-  auto tag = FindInCurScope(TagName(name));
-  assert(tag == nullptr || tag->ToTypeName());
-  return tag;
+Identifier* Scope::FindTagInCurScope(const std::string* name) {
+  auto iter = tagMap_.find(name);
+  if (iter == tagMap_.end())
+    return nullptr;
+  assert(iter->second->ToTypeName());
+  return iter->second;
 }
 
 
 Scope::TagList Scope::AllTagsInCurScope() const {
-  TagList tags;
-  for (auto& kv: identMap_) {
-    if (IsTagName(kv.first))
-      tags.push_back(kv.second);
-  }
-  return tags;
+  return tagList_;
 }
 
 
 void Scope::Print() {
   std::cout << "scope: " << this << std::endl;
 
-  auto iter = identMap_.begin();
-  for (; iter != identMap_.end(); ++iter) {
-    auto name = iter->first;
+  auto iter = identList_.begin();
+  for (; iter != identList_.end(); ++iter) {
+    const auto& name = *iter->first;
     auto ident = iter->second;
     if (ident->ToTypeName()) {
       std::cout << name << "\t[type:\t"
@@ -2,8 +2,9 @@
 #define _WGTCC_SCOPE_H_
 
 #include <iostream>
-#include <map>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 
@@ -22,7 +23,10 @@ enum ScopeType {
 class Scope {
   friend class StructType;
   typedef std::vector<Identifier*> TagList;
-  typedef std::map<std::string, Identifier*> IdentMap;
+  // Names are interned, hence hashed and compared by pointer
+  typedef std::unordered_map<const std::string*, Identifier*> IdentMap;
+  // In the order of insertion, so that iterating a scope is deterministic
+  typedef std::vector<std::pair<const std::string*, Identifier*>> IdentList;
 
 public:
   explicit Scope(Scope* parent, enum ScopeType type)
@@ -43,21 +47,16 @@ public:
   void InsertTag(Identifier* ident);
   void Print();
   bool operator==(const Scope& other) const { return type_ == other.type_; }
-  IdentMap::iterator begin() { return identMap_.begin(); }
-  IdentMap::iterator end() { return identMap_.end(); }
-  size_t size() const { return identMap_.size(); }
+  IdentList::iterator begin() { return identList_.begin(); }
+  IdentList::iterator end() { return identList_.end(); }
+  size_t size() const { return identList_.size(); }
 
 private:
-  Identifier* Find(const std::string& name);
-  Identifier* FindInCurScope(const std::string& name);
-  Identifier* FindTag(const std::string& name);
-  Identifier* FindTagInCurScope(const std::string& name);
-  std::string TagName(const std::string& name) {
-    return name + "@:tag";
-  }
-  static bool IsTagName(const std::string& name) {
-    return name.size() > 5 && name[name.size() - 5] == '@';
-  }
+  Identifier* Find(const std::string* name);
+  Identifier* FindInCurScope(const std::string* name);
+  Identifier* FindTag(const std::string* name);
+  Identifier* FindTagInCurScope(const std::string* name);
+  void Insert(const std::string* name, Identifier* ident);
   const Scope& operator=(const Scope& other);
   Scope(const Scope& scope);
 
@@ -65,6 +64,10 @@ private:
   enum ScopeType type_;
 
   IdentMap identMap_;
+  IdentList identList_;
+  // Tags live in a name space of their own
+  IdentMap tagMap_;
+  TagList tagList_;
 };
 
 #endif
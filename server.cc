@@ -0,0 +1,383 @@
+#include "server.h"
+
+#include "cpp.h"
+#include "error.h"
+#include "source.h"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+typedef std::vector<std::string> StringList;
+
+int Server::reportFd_ = -1;
+std::string Server::socketPath_;
+pid_t Server::serverPid_ = -1;
+
+
+static bool WriteAll(int fd, const void* buf, size_t len) {
+  auto p = static_cast<const char*>(buf);
+  while (len > 0) {
+    auto n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+
+static bool ReadAll(int fd, void* buf, size_t len) {
+  auto p = static_cast<char*>(buf);
+  while (len > 0) {
+    auto n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+
+/*
+ * A request is a list of strings: argc, argv..., cwd, environ...
+ * Each string is its 32-bit length followed by the bytes.
+ */
+static bool WriteString(int fd, const std::string& str) {
+  uint32_t len = str.size();
+  return WriteAll(fd, &len, sizeof(len)) && WriteAll(fd, str.data(), len);
+}
+
+
+static bool ReadString(int fd, std::string& str) {
+  uint32_t len;
+  if (!ReadAll(fd, &len, sizeof(len)))
+    return false;
+  str.resize(len);
+  return ReadAll(fd, &str[0], len);
+}
+
+
+static bool ReadStrings(int fd, StringList& strs) {
+  uint32_t n;
+  if (!ReadAll(fd, &n, sizeof(n)))
+    return false;
+  strs.resize(n);
+  for (auto& str: strs) {
+    if (!ReadString(fd, str))
+      return false;
+  }
+  return true;
+}
+
+
+static bool WriteStrings(int fd, const StringList& strs) {
+  uint32_t n = strs.size();
+  if (!WriteAll(fd, &n, sizeof(n)))
+    return false;
+  for (const auto& str: strs) {
+    if (!WriteString(fd, str))
+      return false;
+  }
+  return true;
+}
+
+
+// Standard streams are passed as ancillary data of one byte
+static bool SendFds(int sock, const int* fds, int n) {
+  char byte = 0;
+  iovec iov {&byte, 1};
+  char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+  memset(ctrl, 0, sizeof(ctrl));
+  msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+  return sendmsg(sock, &msg, 0) == 1;
+}
+
+
+static bool RecvFds(int sock, int* fds, int n) {
+  char byte;
+  iovec iov {&byte, 1};
+  char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+  msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+  if (recvmsg(sock, &msg, 0) != 1)
+    return false;
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * n)) {
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+  return true;
+}
+
+
+static bool MakeAddress(const std::string& path, sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+
+std::string Server::DefaultSocket() {
+  return "/tmp/wgtcc-" + std::to_string(getuid()) + ".socket";
+}
+
+
+int Server::Run(const std::string& socketPath, MainFunc main) {
+  sockaddr_un addr;
+  if (!MakeAddress(socketPath, addr))
+    Error("%s: socket path too long", socketPath.c_str());
+  auto sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath.c_str());
+  if (sock == -1 ||
+      bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(sock, SOMAXCONN) != 0) {
+    Error("%s: %s", socketPath.c_str(), strerror(errno));
+  }
+  socketPath_ = socketPath;
+  serverPid_ = getpid();
+  atexit(RemoveSocket);
+  signal(SIGTERM, OnSignal);
+  signal(SIGINT, OnSignal);
+  signal(SIGHUP, OnSignal);
+
+  int report[2];
+  if (pipe(report) != 0)
+    Error("pipe: %s", strerror(errno));
+  fcntl(report[0], F_SETFL, O_NONBLOCK);
+  reportFd_ = report[1];
+
+  // Workers are not waited
+  signal(SIGCHLD, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::string pending;
+  while (true) {
+    pollfd fds[2] = {{sock, POLLIN, 0}, {report[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      Error("poll: %s", strerror(errno));
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buf[4096];
+      ssize_t n;
+      while ((n = read(report[0], buf, sizeof(buf))) > 0)
+        WarmFiles(pending, buf, n);
+    }
+
+    if (fds[0].revents & POLLIN) {
+      auto conn = accept(sock, nullptr, nullptr);
+      if (conn == -1)
+        continue;
+      Preprocessor::ForgetModified();
+      auto pid = fork();
+      if (pid == 0) {
+        close(sock);
+        close(report[0]);
+        Serve(conn, main);
+      }
+      close(conn);
+    }
+  }
+}
+
+
+// The forked processes leave the socket to the server
+void Server::RemoveSocket() {
+  if (getpid() == serverPid_)
+    unlink(socketPath_.c_str());
+}
+
+
+void Server::OnSignal(int sig) {
+  RemoveSocket();
+  _exit(128 + sig);
+}
+
+
+/*
+ * A scanning error exits the process, thus the file is tokenized in a
+ * child first. The buffer is loaded before fork, so that the server
+ * tokenizes exactly what the child has tried.
+ */
+void Server::WarmFile(const std::string& path) {
+  if (SourceBuffer::TryGet(path) == nullptr)
+    return;
+  int result[2];
+  if (pipe(result) != 0)
+    return;
+  auto pid = fork();
+  if (pid == 0) {
+    close(result[0]);
+    auto null = open("/dev/null", O_WRONLY);
+    if (null != -1)
+      dup2(null, STDERR_FILENO);
+    Preprocessor::WarmFile(path);
+    char ok = 1;
+    WriteAll(result[1], &ok, 1);
+    _exit(0);
+  }
+  close(result[1]);
+  char ok;
+  auto tokenized = pid > 0 && ReadAll(result[0], &ok, 1);
+  close(result[0]);
+  if (tokenized)
+    Preprocessor::WarmFile(path);
+}
+
+
+void Server::WarmFiles(std::string& pending, const char* buf, size_t len) {
+  static std::unordered_set<std::string> warmed;
+  pending.append(buf, len);
+  size_t begin = 0, end;
+  while ((end = pending.find('\n', begin)) != std::string::npos) {
+    auto path = pending.substr(begin, end - begin);
+    begin = end + 1;
+    if (path[0] == '?') {
+      Preprocessor::WarmSearch(path.substr(1));
+      continue;
+    }
+    // The modified ones are warmed again
+    if (warmed.insert(path).second || !SourceBuffer::Find(path))
+      WarmFile(path);
+  }
+  pending.erase(0, begin);
+}
+
+
+/*
+ * A line is a path, or '?' followed by a search (see WarmSearch).
+ * Relative paths are meaningless to the server.
+ */
+void Server::ReportFiles() {
+  StringList lines;
+  for (auto buf: SourceBuffer::Loaded()) {
+    if (buf->FileName()[0] == '/')
+      lines.push_back(buf->FileName() + "\n");
+  }
+  for (const auto& search: Preprocessor::NewSearches())
+    lines.push_back("?" + search + "\n");
+  for (const auto& line: lines) {
+    if (line.size() <= PIPE_BUF)
+      WriteAll(reportFd_, line.data(), line.size());
+  }
+}
+
+
+void Server::Serve(int conn, MainFunc main) {
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+
+  int fds[3];
+  StringList args, env;
+  std::string cwd;
+  if (!RecvFds(conn, fds, 3) || !ReadStrings(conn, args) ||
+      !ReadString(conn, cwd) || !ReadStrings(conn, env) || args.empty()) {
+    _exit(1);
+  }
+
+  auto pid = fork();
+  if (pid == 0) {
+    for (int i = 0; i < 3; ++i) {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+    close(conn);
+    if (chdir(cwd.c_str()) != 0)
+      Error("%s: %s", cwd.c_str(), strerror(errno));
+    clearenv();
+    for (auto& var: env)
+      putenv(strdup(var.c_str()));
+
+    std::vector<char*> argv;
+    for (auto& arg: args)
+      argv.push_back(strdup(arg.c_str()));
+    argv.push_back(nullptr);
+    // Only the files of a successful compilation are worth warming
+    auto status = main(args.size(), argv.data());
+    if (status == 0)
+      ReportFiles();
+    exit(status);
+  }
+
+  int status = 1 << 8;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid)
+    status = 1 << 8;
+  int32_t reply = status;
+  WriteAll(conn, &reply, sizeof(reply));
+  _exit(0);
+}
+
+
+bool Server::Forward(const std::string& socketPath,
+                     int argc, char* argv[], int& status) {
+  sockaddr_un addr;
+  if (!MakeAddress(socketPath, addr))
+    return false;
+  auto sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == -1)
+    return false;
+  if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(sock);
+    return false;
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr)
+    Error("getcwd: %s", strerror(errno));
+  StringList args(argv, argv + argc);
+  StringList env;
+  for (auto var = environ; *var; ++var)
+    env.push_back(*var);
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  int32_t reply;
+  if (!SendFds(sock, fds, 3) || !WriteStrings(sock, args) ||
+      !WriteString(sock, cwd) || !WriteStrings(sock, env) ||
+      !ReadAll(sock, &reply, sizeof(reply))) {
+    Error("%s: lost connection to the server", socketPath.c_str());
+  }
+  close(sock);
+  status = WIFEXITED(reply) ? WEXITSTATUS(reply): 1;
+  return true;
+}
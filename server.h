@@ -0,0 +1,49 @@
+#ifndef _WGTCC_SERVER_H_
+#define _WGTCC_SERVER_H_
+
+#include <string>
+
+#include <sys/types.h>
+
+
+/*
+ * Compile server.
+ * 'wgtcc --server[=socket]' listens on a UNIX socket. A client sends its
+ * argv, working directory and environment, along with its stdin, stdout
+ * and stderr. For each request, the server forks a process that runs
+ * the compilation as if it is invoked by the client, and replies the
+ * exit status. The headers read by the compilations are loaded,
+ * tokenized and listed into the server's caches (those of SourceBuffer
+ * and Preprocessor), so are the names they have searched for. Later compilations inherit them by fork, after the
+ * modified files and directories are dropped. Only successful
+ * compilations report their files, and a file that fails to scan is
+ * not cached. The socket is removed when the server exits.
+ *
+ * wgtcc forwards the invocation to the server, if the environment
+ * variable WGTCC_SERVER is the socket of a running server.
+ */
+class Server {
+public:
+  typedef int (*MainFunc)(int argc, char* argv[]);
+
+  static std::string DefaultSocket();
+  static int Run(const std::string& socketPath, MainFunc main);
+  // Returns false if the server isn't running
+  static bool Forward(const std::string& socketPath,
+                      int argc, char* argv[], int& status);
+
+private:
+  static void Serve(int conn, MainFunc main);
+  static void WarmFile(const std::string& path);
+  static void WarmFiles(std::string& pending, const char* buf, size_t len);
+  static void ReportFiles();
+  static void RemoveSocket();
+  static void OnSignal(int sig);
+
+  // Write end of the pipe, through which compilations report files
+  static int reportFd_;
+  static std::string socketPath_;
+  static pid_t serverPid_;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "source.h"
+
+#include "error.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+SourceBuffer::BufferMap SourceBuffer::bufferMap_;
+
+
+const SourceBuffer* SourceBuffer::Get(const std::string& fileName) {
+  auto buf = TryGet(fileName);
+  if (buf == nullptr)
+    Error("%s: No such file or directory", fileName.c_str());
+  return buf;
+}
+
+
+const SourceBuffer* SourceBuffer::TryGet(const std::string& fileName) {
+  auto iter = bufferMap_.find(fileName);
+  if (iter != bufferMap_.end())
+    return iter->second;
+
+  auto buf = new SourceBuffer(fileName);
+  if (!buf->Load()) {
+    delete buf;
+    return nullptr;
+  }
+  bufferMap_[fileName] = buf;
+  return buf;
+}
+
+
+const SourceBuffer* SourceBuffer::Find(const std::string& fileName) {
+  auto iter = bufferMap_.find(fileName);
+  return iter == bufferMap_.end() ? nullptr: iter->second;
+}
+
+
+std::vector<const SourceBuffer*> SourceBuffer::Loaded() {
+  std::vector<const SourceBuffer*> bufs;
+  for (const auto& buf: bufferMap_)
+    bufs.push_back(buf.second);
+  return bufs;
+}
+
+
+void SourceBuffer::ForgetModified() {
+  for (auto iter = bufferMap_.begin(); iter != bufferMap_.end();) {
+    if (iter->second->Modified())
+      iter = bufferMap_.erase(iter);
+    else
+      ++iter;
+  }
+}
+
+
+bool SourceBuffer::Modified() const {
+  if (fileName_ == "-")
+    return false;
+  struct stat st;
+  return stat(fileName_.c_str(), &st) != 0 ||
+         st.st_ino != ino_ ||
+         static_cast<size_t>(st.st_size) != size_ ||
+         st.st_mtim.tv_sec != mtime_ ||
+         st.st_mtim.tv_nsec != mtimeNsec_;
+}
+
+
+SourceBuffer::~SourceBuffer() {
+  if (mapSize_) {
+    munmap(const_cast<char*>(text_), mapSize_);
+  } else {
+    free(const_cast<char*>(text_));
+  }
+}
+
+
+bool SourceBuffer::Load() {
+  int fd = STDIN_FILENO;
+  if (fileName_ != "-")
+    fd = open(fileName_.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  if (ok) {
+    mtime_ = st.st_mtim.tv_sec;
+    mtimeNsec_ = st.st_mtim.tv_nsec;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    if (!S_ISREG(st.st_mode) || !Map(fd, st.st_size))
+      ok = Read(fd);
+  }
+
+  if (fd != STDIN_FILENO)
+    close(fd);
+  return ok;
+}
+
+
+/*
+ * Reserve one more page than the file needs, then map the file over
+ * the head of the reservation. The tail of the last file page and the
+ * extra page are both zero filled, so the text is always terminated
+ * by '\0', even if the size of file is a multiple of the page size.
+ */
+bool SourceBuffer::Map(int fd, size_t size) {
+  if (size == 0)
+    return false;
+  static const size_t pageSize = sysconf(_SC_PAGESIZE);
+  auto fileMapSize = (size + pageSize - 1) / pageSize * pageSize;
+  auto mapSize = fileMapSize + pageSize;
+
+  auto base = mmap(nullptr, mapSize, PROT_READ,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+  auto text = mmap(base, fileMapSize, PROT_READ,
+                   MAP_PRIVATE | MAP_FIXED, fd, 0);
+  if (text == MAP_FAILED) {
+    munmap(base, mapSize);
+    return false;
+  }
+  madvise(text, fileMapSize, MADV_SEQUENTIAL);
+
+  text_ = static_cast<const char*>(text);
+  size_ = size;
+  mapSize_ = mapSize;
+  return true;
+}
+
+
+// For pipes and stdin, whose size is unknown, and empty files.
+bool SourceBuffer::Read(int fd) {
+  size_t cap = 64 * 1024;
+  size_t size = 0;
+  auto text = static_cast<char*>(malloc(cap + 1));
+  while (true) {
+    if (size == cap) {
+      cap *= 2;
+      text = static_cast<char*>(realloc(text, cap + 1));
+    }
+    auto n = read(fd, text + size, cap - size);
+    if (n == 0)
+      break;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      free(text);
+      return false;
+    }
+    size += n;
+  }
+  text[size] = 0;
+
+  text_ = text;
+  size_ = size;
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef _WGTCC_SOURCE_H_
+#define _WGTCC_SOURCE_H_
+
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+
+/*
+ * The content of a source or header file.
+ * Regular files are mapped read-only into memory, other files
+ * (pipes, stdin) are read with bulk read() calls. The text is always
+ * followed by at least one '\0', so that the scanner can detect the end
+ * of text by '*p == 0' without knowing the size.
+ * A buffer is never freed before the process exits, hence pointers into
+ * the text (Scanner::p_, SourceLocation::lineBegin_) are always valid.
+ */
+class SourceBuffer {
+  typedef std::unordered_map<std::string, SourceBuffer*> BufferMap;
+
+public:
+  // Returns the buffer of 'fileName', the file is loaded only once.
+  // The file name "-" stands for the standard input.
+  static const SourceBuffer* Get(const std::string& fileName);
+  // Returns nullptr instead of error if the file can't be read
+  static const SourceBuffer* TryGet(const std::string& fileName);
+  // Returns nullptr if 'fileName' is not loaded
+  static const SourceBuffer* Find(const std::string& fileName);
+  static std::vector<const SourceBuffer*> Loaded();
+  // For long running processes(the compile server): forget the files
+  // that have changed since they were loaded, so they are loaded again.
+  // The forgotten buffers are still valid.
+  static void ForgetModified();
+
+  const char* Begin() const { return text_; }
+  const char* End() const { return text_ + size_; }
+  size_t Size() const { return size_; }
+  const std::string& FileName() const { return fileName_; }
+  time_t MTime() const { return mtime_; }
+  long MTimeNsec() const { return mtimeNsec_; }
+  // The identity of the file, whatever path it is opened by
+  std::pair<dev_t, ino_t> FileId() const { return {dev_, ino_}; }
+  bool Mapped() const { return mapSize_ != 0; }
+  bool Modified() const;
+
+private:
+  SourceBuffer(const std::string& fileName)
+      : fileName_(fileName), text_(nullptr),
+        size_(0), mapSize_(0), mtime_(0), mtimeNsec_(0),
+        dev_(0), ino_(0) {}
+  ~SourceBuffer();
+  SourceBuffer(const SourceBuffer& other) = delete;
+  SourceBuffer& operator=(const SourceBuffer& other) = delete;
+
+  bool Load();
+  bool Map(int fd, size_t size);
+  bool Read(int fd);
+
+  static BufferMap bufferMap_;
+
+  std::string fileName_;
+  const char* text_;
+  size_t size_;
+  // Size of the whole mapping (including the zero padding),
+  // 0 if the text is on heap.
+  size_t mapSize_;
+  time_t mtime_;
+  long mtimeNsec_;
+  dev_t dev_;
+  ino_t ino_;
+};
+
+#endif
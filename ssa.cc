@@ -0,0 +1,392 @@
+#include "ssa.h"
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+
+DomTree::DomTree(IRFunc* func) {
+  // Reverse postorder
+  auto entry = func->blocks_[0];
+  std::vector<std::pair<BasicBlock*, size_t>> stack {{entry, 0}};
+  std::set<BasicBlock*> visited {entry};
+  while (stack.size()) {
+    auto bb = stack.back().first;
+    auto succs = bb->Succs();
+    auto& next = stack.back().second;
+    if (next < succs.size()) {
+      auto succ = succs[next++];
+      if (visited.insert(succ).second)
+        stack.push_back({succ, 0});
+    } else {
+      rpo_.push_back(bb);
+      stack.pop_back();
+    }
+  }
+  std::reverse(rpo_.begin(), rpo_.end());
+  for (size_t i = 0; i < rpo_.size(); ++i)
+    index_[rpo_[i]] = i;
+
+  auto size = rpo_.size();
+  idom_.assign(size, -1);
+  idom_[0] = 0;
+  auto intersect = [this](int lhs, int rhs) {
+    while (lhs != rhs) {
+      while (lhs > rhs) lhs = idom_[lhs];
+      while (rhs > lhs) rhs = idom_[rhs];
+    }
+    return lhs;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < size; ++i) {
+      int idom = -1;
+      for (auto pred: rpo_[i]->preds_) {
+        auto iter = index_.find(pred);
+        if (iter == index_.end() || idom_[iter->second] < 0)
+          continue;
+        idom = idom < 0 ? iter->second: intersect(iter->second, idom);
+      }
+      if (idom != idom_[i]) {
+        idom_[i] = idom;
+        changed = true;
+      }
+    }
+  }
+
+  children_.resize(size);
+  frontier_.resize(size);
+  for (size_t i = 1; i < size; ++i)
+    children_[idom_[i]].push_back(rpo_[i]);
+  for (size_t i = 0; i < size; ++i) {
+    auto& preds = rpo_[i]->preds_;
+    if (preds.size() < 2)
+      continue;
+    for (auto pred: preds) {
+      auto iter = index_.find(pred);
+      if (iter == index_.end())
+        continue;
+      for (int runner = iter->second; runner != idom_[i];
+           runner = idom_[runner]) {
+        auto& frontier = frontier_[runner];
+        if (frontier.empty() || frontier.back() != rpo_[i])
+          frontier.push_back(rpo_[i]);
+      }
+    }
+  }
+
+  enter_.resize(size);
+  exit_.resize(size);
+  int clock = 0;
+  std::vector<std::pair<int, size_t>> walk {{0, 0}};
+  enter_[0] = clock++;
+  while (walk.size()) {
+    auto cur = walk.back().first;
+    auto& next = walk.back().second;
+    if (next < children_[cur].size()) {
+      auto child = index_[children_[cur][next++]];
+      enter_[child] = clock++;
+      walk.push_back({child, 0});
+    } else {
+      exit_[cur] = clock++;
+      walk.pop_back();
+    }
+  }
+}
+
+
+BasicBlock* DomTree::IDom(BasicBlock* bb) const {
+  auto idx = index_.at(bb);
+  return idx == 0 ? nullptr: rpo_[idom_[idx]];
+}
+
+
+bool DomTree::Dominates(BasicBlock* lhs, BasicBlock* rhs) const {
+  auto l = index_.at(lhs), r = index_.at(rhs);
+  return enter_[l] <= enter_[r] && exit_[r] <= exit_[l];
+}
+
+
+/*
+ * SSA construction
+ */
+
+// Replaces each register read by 'inst' with 'func(reg)'
+template<typename Func>
+static void MapUses(Inst* inst, Func func) {
+  for (auto& arg: inst->args_) {
+    if (arg.IsReg())
+      arg = Operand::Reg(func(arg.Reg()));
+  }
+  if (inst->mem_.base_ == MemRef::REG)
+    inst->mem_.reg_ = func(inst->mem_.reg_);
+  if (inst->mem_.index_ >= 0)
+    inst->mem_.index_ = func(inst->mem_.index_);
+  auto call = inst->call_;
+  if (call && call->callee_.IsReg())
+    call->callee_ = Operand::Reg(func(call->callee_.Reg()));
+}
+
+
+void BuildSSA(IRFunc* func) {
+  func->ComputePreds();
+  auto& blocks = func->blocks_;
+  if (blocks[0]->preds_.size()) {
+    // The entry has no phi
+    auto entry = func->NewBlock();
+    auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+    jmp->targets_[0] = blocks[0];
+    entry->insts_.push_back(jmp);
+    blocks.pop_back();
+    blocks.insert(blocks.begin(), entry);
+    func->ComputePreds();
+  }
+  DomTree dom(func);
+  auto entry = blocks[0];
+
+  // The definitions
+  auto numRegs = func->NumRegs();
+  std::vector<BlockList> defBlocks(numRegs);
+  std::vector<int> defCount(numRegs, 0);
+  auto addDef = [&](int reg, BasicBlock* bb) {
+    ++defCount[reg];
+    if (defBlocks[reg].empty() || defBlocks[reg].back() != bb)
+      defBlocks[reg].push_back(bb);
+  };
+  if (func->retPtr_ >= 0)
+    addDef(func->retPtr_, entry);
+  for (const auto& param: func->params_) {
+    if (param.reg_ >= 0)
+      addDef(param.reg_, entry);
+  }
+  for (auto bb: blocks) {
+    for (auto inst: bb->insts_) {
+      if (inst->HasDst())
+        addDef(inst->dst_, bb);
+    }
+  }
+
+  // The registers to rename: those defined more than once,
+  // or used where the only definition may not have been reached.
+  std::vector<bool> rename(numRegs);
+  for (size_t reg = 0; reg < numRegs; ++reg)
+    rename[reg] = defCount[reg] != 1;
+  std::vector<bool> defined(numRegs);
+  for (auto bb: blocks) {
+    for (auto inst: bb->insts_) {
+      for (auto reg: inst->Uses()) {
+        if (rename[reg] || defined[reg])
+          continue;
+        auto defBlock = defBlocks[reg][0];
+        if (defBlock == bb || !dom.Dominates(defBlock, bb))
+          rename[reg] = true;
+      }
+      if (inst->HasDst())
+        defined[inst->dst_] = true;
+    }
+    for (auto inst: bb->insts_) {
+      if (inst->HasDst())
+        defined[inst->dst_] = false;
+    }
+  }
+  // Parameters are defined before the entry
+  if (func->retPtr_ >= 0)
+    rename[func->retPtr_] = defCount[func->retPtr_] > 1;
+  for (const auto& param: func->params_) {
+    if (param.reg_ >= 0)
+      rename[param.reg_] = defCount[param.reg_] > 1;
+  }
+
+  // Phis at the iterated dominance frontiers
+  std::unordered_map<Inst*, int> phiRegs;
+  std::unordered_map<BasicBlock*, int> hasPhi, inWork;
+  for (size_t reg = 0; reg < numRegs; ++reg) {
+    if (!rename[reg] || defBlocks[reg].empty())
+      continue;
+    auto work = defBlocks[reg];
+    for (auto bb: work)
+      inWork[bb] = reg + 1;
+    while (work.size()) {
+      auto bb = work.back();
+      work.pop_back();
+      for (auto df: dom.Frontier(bb)) {
+        if (hasPhi[df] == static_cast<int>(reg + 1))
+          continue;
+        hasPhi[df] = reg + 1;
+        auto phi = new Inst(Opcode::PHI, func->RegType(reg));
+        phi->dst_ = reg;
+        phi->incoming_ = df->preds_;
+        phi->args_.resize(df->preds_.size());
+        df->insts_.insert(df->insts_.begin(), phi);
+        phiRegs[phi] = reg;
+        if (inWork[df] != static_cast<int>(reg + 1)) {
+          inWork[df] = reg + 1;
+          work.push_back(df);
+        }
+      }
+    }
+  }
+
+  // Renaming, in preorder of the dominator tree. The value of
+  // a register not yet defined is undefined, taken as zero.
+  std::vector<std::vector<int>> stacks(numRegs);
+  std::vector<int> undefs(numRegs, -1);
+  InstList undefMovs;
+  auto top = [&](int reg) {
+    if (stacks[reg].size())
+      return stacks[reg].back();
+    if (undefs[reg] < 0) {
+      auto type = func->RegType(reg);
+      undefs[reg] = func->NewReg(type);
+      auto mov = new Inst(Opcode::MOV, type);
+      mov->dst_ = undefs[reg];
+      mov->args_.push_back(Operand::Imm(0));
+      undefMovs.push_back(mov);
+    }
+    return undefs[reg];
+  };
+  if (func->retPtr_ >= 0 && rename[func->retPtr_])
+    stacks[func->retPtr_].push_back(func->retPtr_);
+  for (const auto& param: func->params_) {
+    if (param.reg_ >= 0 && rename[param.reg_])
+      stacks[param.reg_].push_back(param.reg_);
+  }
+
+  struct Frame {
+    BasicBlock* bb_;
+    size_t next_;
+    std::vector<int> pushed_;
+  };
+  std::vector<Frame> walk {{entry, 0, {}}};
+  bool enter = true;
+  while (walk.size()) {
+    auto& frame = walk.back();
+    auto bb = frame.bb_;
+    if (enter) {
+      for (auto inst: bb->insts_) {
+        if (inst->op_ != Opcode::PHI) {
+          MapUses(inst, [&](int reg) {
+            return rename[reg] ? top(reg): reg;
+          });
+        }
+        if (inst->HasDst() && rename[inst->dst_]) {
+          auto reg = inst->dst_;
+          inst->dst_ = func->NewReg(func->RegType(reg));
+          stacks[reg].push_back(inst->dst_);
+          frame.pushed_.push_back(reg);
+        }
+      }
+      for (auto succ: bb->Succs()) {
+        for (auto inst: succ->insts_) {
+          if (inst->op_ != Opcode::PHI)
+            break;
+          auto iter = std::find(inst->incoming_.begin(),
+                                inst->incoming_.end(), bb);
+          auto idx = iter - inst->incoming_.begin();
+          inst->args_[idx] = Operand::Reg(top(phiRegs[inst]));
+        }
+      }
+    }
+    auto& children = dom.Children(bb);
+    if (frame.next_ < children.size()) {
+      auto child = children[frame.next_++];
+      walk.push_back({child, 0, {}});
+      enter = true;
+    } else {
+      for (auto reg: frame.pushed_)
+        stacks[reg].pop_back();
+      walk.pop_back();
+      enter = false;
+    }
+  }
+  entry->insts_.insert(entry->insts_.begin(),
+                       undefMovs.begin(), undefMovs.end());
+  func->ssa_ = true;
+}
+
+
+/*
+ * SSA destruction
+ */
+
+void DestroySSA(IRFunc* func) {
+  func->ComputePreds();
+  // Copies of the edges, in the order of the blocks
+  auto blocks = func->blocks_;
+  for (auto bb: blocks) {
+    InstList phis;
+    for (auto inst: bb->insts_) {
+      if (inst->op_ != Opcode::PHI)
+        break;
+      phis.push_back(inst);
+    }
+    if (phis.empty())
+      continue;
+    bb->insts_.erase(bb->insts_.begin(), bb->insts_.begin() + phis.size());
+
+    for (auto pred: bb->preds_) {
+      auto from = pred;
+      if (pred->Succs().size() > 1) {
+        // Splits the critical edge
+        from = func->NewBlock();
+        auto jmp = new Inst(Opcode::JMP, IRType::VOID);
+        jmp->targets_[0] = bb;
+        from->insts_.push_back(jmp);
+        auto term = pred->Terminator();
+        for (auto& target: term->targets_) {
+          if (target == bb)
+            target = from;
+        }
+        std::replace(term->table_.begin(), term->table_.end(), bb, from);
+      }
+
+      // The parallel copies, sequentialized
+      std::vector<std::pair<int, Operand>> copies;
+      for (auto phi: phis) {
+        auto iter = std::find(phi->incoming_.begin(),
+                              phi->incoming_.end(), pred);
+        assert(iter != phi->incoming_.end());
+        auto val = phi->args_[iter - phi->incoming_.begin()];
+        if (!val.IsReg() || val.Reg() != phi->dst_)
+          copies.push_back({phi->dst_, val});
+      }
+      InstList movs;
+      auto emit = [&](int dst, Operand val) {
+        auto mov = new Inst(Opcode::MOV, func->RegType(dst));
+        mov->dst_ = dst;
+        mov->args_.push_back(val);
+        movs.push_back(mov);
+      };
+      while (copies.size()) {
+        auto iter = std::find_if(copies.begin(), copies.end(),
+            [&copies](const std::pair<int, Operand>& copy) {
+          for (const auto& other: copies) {
+            if (other.second.IsReg() && other.second.Reg() == copy.first)
+              return false;
+          }
+          return true;
+        });
+        if (iter != copies.end()) {
+          emit(iter->first, iter->second);
+          copies.erase(iter);
+          continue;
+        }
+        // A cycle, saves the destination of the first copy
+        auto blocked = copies[0].first;
+        auto tmp = func->NewReg(func->RegType(blocked));
+        emit(tmp, Operand::Reg(blocked));
+        for (auto& copy: copies) {
+          if (copy.second.IsReg() && copy.second.Reg() == blocked)
+            copy.second = Operand::Reg(tmp);
+        }
+      }
+      auto& insts = from->insts_;
+      insts.insert(insts.end() - 1, movs.begin(), movs.end());
+    }
+    for (auto phi: phis)
+      delete phi;
+  }
+  func->ssa_ = false;
+  func->ComputePreds();
+}
@@ -0,0 +1,49 @@
+#ifndef _WGTCC_SSA_H_
+#define _WGTCC_SSA_H_
+
+#include "ir.h"
+
+#include <unordered_map>
+
+
+/*
+ * The dominator tree of the reachable blocks, by the iterative algorithm
+ * of Cooper, Harvey and Kennedy. The predecessors must be up to date.
+ */
+class DomTree {
+public:
+  explicit DomTree(IRFunc* func);
+
+  // The blocks in reverse postorder
+  const BlockList& RPO() const { return rpo_; }
+  bool Reachable(BasicBlock* bb) const { return index_.count(bb); }
+  BasicBlock* IDom(BasicBlock* bb) const;
+  const BlockList& Children(BasicBlock* bb) const {
+    return children_[index_.at(bb)];
+  }
+  const BlockList& Frontier(BasicBlock* bb) const {
+    return frontier_[index_.at(bb)];
+  }
+  // 'lhs' dominates 'rhs', a block dominates itself
+  bool Dominates(BasicBlock* lhs, BasicBlock* rhs) const;
+
+private:
+  std::unordered_map<BasicBlock*, int> index_;
+  BlockList rpo_;
+  std::vector<int> idom_;
+  std::vector<BlockList> children_;
+  std::vector<BlockList> frontier_;
+  // Numbering of the tree walk, for constant time dominance tests
+  std::vector<int> enter_;
+  std::vector<int> exit_;
+};
+
+
+// Puts the function in SSA form (Cytron et al.)
+void BuildSSA(IRFunc* func);
+
+// Replaces the phis by the moves on the incoming edges,
+// the critical edges are split.
+void DestroySSA(IRFunc* func);
+
+#endif
@@ -0,0 +1,52 @@
+#include "switch_lowering.h"
+
+#include "ast.h"
+
+
+// A jump table needs this many cases at least
+static const size_t minTableCases = 4;
+// Percentage of the entries of a table that have a case
+static const unsigned long minTableDensity = 40;
+static const unsigned long maxTableSize = 4096;
+
+
+ClusterList ClusterCases(SwitchStmt* switchStmt) {
+  const auto& cases = switchStmt->Cases();
+  ClusterList clusters;
+  size_t i = 0;
+  while (i < cases.size()) {
+    // The longest run from case i that is dense enough
+    size_t last = i;
+    unsigned long values = 0;
+    for (auto j = i; j < cases.size(); ++j) {
+      unsigned long span = cases[j].end_ - cases[i].begin_;
+      if (span >= maxTableSize)
+        break;
+      values += cases[j].end_ - cases[j].begin_ + 1;
+      if (values * 100 >= (span + 1) * minTableDensity)
+        last = j;
+    }
+
+    CaseCluster cluster;
+    cluster.low_ = cases[i].begin_;
+    if (last + 1 - i >= minTableCases) {
+      cluster.high_ = cases[last].end_;
+      cluster.label_ = nullptr;
+      cluster.table_.resize(cluster.high_ - cluster.low_ + 1, nullptr);
+      for (auto j = i; j <= last; ++j) {
+        for (auto val = cases[j].begin_; ; ++val) {
+          cluster.table_[val - cluster.low_] = cases[j].label_;
+          if (val == cases[j].end_)
+            break;
+        }
+      }
+      i = last + 1;
+    } else {
+      cluster.high_ = cases[i].end_;
+      cluster.label_ = cases[i].label_;
+      ++i;
+    }
+    clusters.push_back(cluster);
+  }
+  return clusters;
+}
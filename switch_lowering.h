@@ -0,0 +1,35 @@
+#ifndef _WGTCC_SWITCH_LOWERING_H_
+#define _WGTCC_SWITCH_LOWERING_H_
+
+#include <cstddef>
+#include <vector>
+
+
+class LabelStmt;
+class SwitchStmt;
+
+/*
+ * How both backends dispatch a switch. The sorted cases are split into
+ * clusters: a dense run of cases becomes a jump table with a bounds
+ * check, the others stay single values or ranges. The clusters are
+ * searched by a balanced binary tree of comparisons, the leaves of no
+ * more than 'maxLinearClusters' clusters are tested one by one.
+ */
+struct CaseCluster {
+  bool IsTable() const { return table_.size(); }
+
+  long low_;
+  long high_;
+  // The destination of the range [low_, high_], if not a table
+  LabelStmt* label_;
+  // The destination of each value from 'low_', nullptr for default
+  std::vector<LabelStmt*> table_;
+};
+
+typedef std::vector<CaseCluster> ClusterList;
+
+const size_t maxLinearClusters = 3;
+
+ClusterList ClusterCases(SwitchStmt* switchStmt);
+
+#endif
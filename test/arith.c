@@ -89,6 +89,68 @@ static void test_comma() {
     expect(7.0, (1, 3, 5, 7.0));
 }
 
+static void test_fold() {
+    expect(-2147483647 - 1, INT_MAX + 1);
+    expect(1, 0xFFFFFFFFU + 2);
+    expect(-1, -7 / 4);
+    expect(-3, -7 % 4);
+    expect(1, (unsigned char)257);
+    expect(1, (_Bool)0.5);
+    expect(-3, (int)-3.9);
+    expect(1, 0.1f + 0.2f == 0.3f);
+    expect(0, 0.1 + 0.2 == 0.3);
+    expect(1, (float)16777217 == 16777216.0f);
+    expect(1, -1 >> 1 == -1);
+    expect(0, 0 && (1 / 0));
+    expect(1, 1 || (1 / 0));
+    int x = 5, n = 0;
+    expect(5, x + 0);
+    expect(5, x * 1);
+    expect(5, -(-x));
+    expect(5, ~~x);
+    expect(0, x++ * 0);
+    expect(6, x);
+    expect(0, (n = 7) * 0);
+    expect(7, n);
+}
+
+static void test_pow2() {
+    int a = -7, b = 7;
+    unsigned c = 7;
+    long d = -9;
+    expect(-1, a / 4);
+    expect(-3, a % 4);
+    expect(1, b / 4);
+    expect(3, b % 4);
+    expect(-7, a / 1);
+    expect(0, a % 1);
+    expect(1, c / 4);
+    expect(3, c % 4);
+    expect(-56, a * 8);
+    expect(-56, 8 * a);
+    expect(-4, d / 2);
+    expect(-1, d % 2);
+    expect(-9, (int)(d % 4294967296));
+    expect(0, (int)(d / 4294967296));
+}
+
+static int never;
+
+// Out of range conversions are not folded, nor evaluated here
+static void test_fold_range() {
+    int a = 0;
+    unsigned b = 0;
+    if (never) {
+        a = (int)1e10;
+        a = (int)(float)4294967295u;
+        b = (unsigned)-1.5;
+    }
+    expect(0, a);
+    expect(0, b);
+    expect(1000, (int)1e3);
+    expect(-2, (int)-2.5);
+}
+
 int main() {
     test_basic();
     test_relative();
@@ -97,5 +159,8 @@ int main() {
     test_unary();
     test_ternary();
     test_comma();
+    test_fold();
+    test_pow2();
+    test_fold_range();
     return 0;
 }
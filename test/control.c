@@ -200,6 +200,61 @@ static void test_switch() {
         ;
 }
 
+static int switch_dense(int x) {
+    switch (x) {
+    case 0: return 10;
+    case 1: return 11;
+    case 2: return 12;
+    case 3: return 13;
+    case 5: return 15;
+    case 6 ... 9: return 16;
+    default: return -1;
+    }
+}
+
+static int switch_sparse(long x) {
+    switch (x) {
+    case -1000000000000L: return 1;
+    case 7: return 2;
+    case 1000: return 3;
+    case 70000: return 4;
+    case 1L << 40: return 5;
+    }
+    return 0;
+}
+
+static int switch_unsigned(unsigned x) {
+    switch (x) {
+    case 0xffffffff: return 1;
+    case 0x80000000: return 2;
+    case 1: return 3;
+    case 2: return 4;
+    case 3: return 5;
+    case 10 ... 20: return 6;
+    }
+    return 0;
+}
+
+static void test_switch_lowering() {
+    expect(-1, switch_dense(-1));
+    expect(10, switch_dense(0));
+    expect(13, switch_dense(3));
+    expect(-1, switch_dense(4));
+    expect(16, switch_dense(9));
+    expect(-1, switch_dense(10));
+    expect(1, switch_sparse(-1000000000000L));
+    expect(2, switch_sparse(7));
+    expect(4, switch_sparse(70000));
+    expect(5, switch_sparse(1L << 40));
+    expect(0, switch_sparse(8));
+    expect(1, switch_unsigned(-1));
+    expect(2, switch_unsigned(0x80000000));
+    expect(5, switch_unsigned(3));
+    expect(6, switch_unsigned(15));
+    expect(0, switch_unsigned(21));
+    expect(0, switch_unsigned(0));
+}
+
 static void test_goto() {
     int acc = 0;
     goto x;
@@ -271,21 +326,123 @@ static void test_label() {
     expect(8, z);
 }
 
+static int unreachable_static(int n) {
+    static int count = 3;
+    goto L;
+    static int *p = &count;
+    n = 100;
+    while (n) n--;
+L:
+    return *p + n;
+}
+
+static void test_unreachable() {
+    int x = 0;
+    goto in;
+    x = 100;
+    {
+        x = 200;
+    in:
+        x += 1;
+    }
+    expect(1, x);
+    if (0) {
+    back:
+        x += 10;
+    }
+    if (x < 10)
+        goto back;
+    expect(11, x);
+    while (1) {
+        if (x > 20)
+            break;
+        x += 5;
+        continue;
+        x = -1;
+    }
+    expect(21, x);
+    expect(5, unreachable_static(2));
+}
+
 static void test_logor() {
     expect(1, 0 || 3);
     expect(1, 5 || 0);
     expect(0, 0 || 0);
 }
 
+// A condition whose value is also used, jumps to jumps, write backs
+static int cond_value(int a, int b) {
+    int c = a < b;
+    if (c)
+        return c + 10;
+    return c;
+}
+
+static int else_chain(int x) {
+    int r = 0;
+    if (x == 0) {
+    } else if (x == 1) {
+        r = 1;
+    } else if (x == 2) {
+    } else {
+        r = 3;
+    }
+    return r;
+}
+
+static void test_peephole() {
+    expect(11, cond_value(1, 2));
+    expect(0, cond_value(2, 1));
+    expect(0, else_chain(0));
+    expect(1, else_chain(1));
+    expect(0, else_chain(2));
+    expect(3, else_chain(5));
+
+    int a = 5, b = 7;
+    a = b;
+    b = a;
+    a = a;
+    expect(14, a + b);
+    int r = (a == b);
+    expect(2, r + (a == b) + (a != b));
+    volatile int v = 1;
+    v = v + 1;
+    v++;
+    expect(3, v);
+
+    union {
+        long l;
+        char c;
+    } u;
+    u.l = -1;
+    u.c = 0;
+    expect(1, u.l == (long)-256);
+
+    int n = 0;
+    for (;;) {
+        if (++n >= 3)
+            break;
+        continue;
+    }
+    while (0) {
+    }
+    do {
+    } while (n-- > 1);
+    expect(0, n);
+}
+
 int main() {
     test_if();
     test_for();
     test_while();
     test_do();
     test_switch();
+    test_switch_lowering();
     test_goto();
     test_label();
     //test_computed_goto();
+    test_unreachable();
     test_logor();
+    test_peephole();
     return 0;
 }
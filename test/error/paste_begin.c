@@ -0,0 +1,2 @@
+// '##' cannot begin the body of a macro
+#define paste(x) ## x
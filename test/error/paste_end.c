@@ -0,0 +1,2 @@
+// '##' cannot end the body of a macro
+#define paste(x) x ##
@@ -0,0 +1,2 @@
+// Nor that of an object-like macro
+#define PASTE ##
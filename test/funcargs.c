@@ -37,6 +37,15 @@ static void mixed(float v01, int v02, float v03, int v04, float v05, int v06, fl
     expectf(37.0, v37); expect(38, v38); expectf(39.0, v39); expect(40, v40);
 }
 
+static int twice(int v) {
+    return v * 2;
+}
+
+static void staged(double v1, int v2, int *v3, double v4, long v5, int v6) {
+    expectf(0.5, v1); expect(3, v2); expect(7, *v3);
+    expectf(2.5, v4); expect(-2, v5); expect(8, v6);
+}
+
 int main() {
     many_ints(1, 2, 3, 4, 5, 6, 7, 8, 9);
 
@@ -48,5 +57,10 @@ int main() {
           11.0, 12, 13.0, 14, 15.0, 16, 17.0, 18, 19.0, 20,
           21.0, 22, 23.0, 24, 25.0, 26, 27.0, 28, 29.0, 30,
           31.0, 32, 33.0, 34, 35.0, 36, 37.0, 38, 39.0, 40);
+
+    int i = 7;
+    double d = 2.5;
+    staged(twice(i) / 28.0, i % 4, &i, d, -i / 3, twice(4));
+    staged(0.5, twice(i) - 11, &i, (i << 1) / 5.6, -2L, i + 1);
     return 0;
 }
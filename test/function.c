@@ -222,6 +222,145 @@ static void test_func_ret_struct() {
 }
 
 
+static inline int inl_abs(int x) {
+    if (x < 0)
+        return -x;
+    return x;
+}
+
+static inline short inl_narrow(char c, short s) {
+    return c + s;
+}
+
+static inline int inl_count(void) {
+    static int count;
+    return ++count;
+}
+
+static inline int inl_sum(const int* arr, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += arr[i];
+    return sum;
+}
+
+static inline int inl_fact(int n) {
+    return n <= 1 ? 1 : n * inl_fact(n - 1);
+}
+
+static int inl_twice(int x) {
+    return x * 2;
+}
+
+__attribute__((noinline)) static int inl_never(int x) {
+    return x + 1;
+}
+
+// The literals of the dropped callee are kept, and the callees referenced
+static inline const char* inl_name(void) {
+    return "inl";
+}
+
+static int inl_half(int x) {
+    return x / 2;
+}
+
+static int (*const inl_table[])(int) = {inl_half};
+
+static void test_inline() {
+    int arr[] = {1, 2, 3, 4};
+    int (*fp)(int) = inl_twice;
+    expect(5, inl_abs(-5));
+    expect(7, inl_abs(7));
+    expect(43, inl_narrow(3, 40));
+    inl_count();
+    expect(2, inl_count());
+    expect(10, inl_sum(arr, 4));
+    expect(120, inl_fact(5));
+    expect(8, inl_twice(4) + fp(0) + inl_twice(0));
+    expect(6, inl_never(5));
+    expect(0, strcmp(inl_name(), "inl"));
+    expect(3, inl_table[0](6) + inl_half(1));
+    expect(1, strcmp(__func__, "test_inline") == 0);
+}
+
+
+long leaf_args(long a, long b, long c, long d, long e, long f,
+               long g, long h, double x) {
+    long arr[4] = {a, b, c, d};
+    long* p = &arr[1];
+    return arr[0] + *p + p[1] + arr[3] + e + f + g * 10 + h * 100 + (long)x;
+}
+
+int leaf_frame(int n) {
+    int buf[100];
+    int sum = 0;
+    for (int i = 0; i < 100; ++i)
+        buf[i] = i * n;
+    for (int i = 0; i < 100; i += 7)
+        sum += buf[i];
+    return sum;
+}
+
+static void test_leaf() {
+    expect(900, leaf_args(1, 2, 3, 4, 5, 6, 7, 8, 9.5));
+    expect(2205, leaf_frame(3));
+}
+
+long tail_sum(long n, long acc) {
+    if (n == 0)
+        return acc;
+    return tail_sum(n - 1, acc + n);
+}
+
+short tail_narrow(short n, char step) {
+    if (n > 100)
+        return n;
+    return tail_narrow(n + step, step);
+}
+
+int tail_odd(int n);
+
+int tail_even(int n) {
+    if (n == 0)
+        return 1;
+    return tail_odd(n - 1);
+}
+
+int tail_odd(int n) {
+    if (n == 0)
+        return 0;
+    return tail_even(n - 1);
+}
+
+int tail_many(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+int tail_shuffle(int a, int b, int c, int d, int e, int f, int g, int h) {
+    if (a > 0)
+        return tail_many(h, g, f, e, d, c, b, a);
+    return tail_shuffle(-a, b, c, d, e, f, g, h);
+}
+
+int tail_local(int n, int* p) {
+    int x = n;
+    if (n == 0)
+        return *p;
+    return tail_local(n - 1, &x);
+}
+
+static void test_tail() {
+    expect(500500, tail_sum(1000, 0));
+    expect(103, tail_narrow(-5, 9));
+    expect(1, tail_even(1000));
+    expect(0, tail_odd(1000));
+    expect(120, tail_many(8, 7, 6, 5, 4, 3, 2, 1));
+    expect(120, tail_shuffle(-1, 2, 3, 4, 5, 6, 7, 8));
+    expect(1, tail_local(3, 0));
+}
+
+
 int main() {
     expect(77, t1());
     t2(79);
@@ -246,5 +385,8 @@ int main() {
     test_return_struct();
     test_func_param();
     test_func_ret_struct();
+    test_inline();
+    test_leaf();
+    test_tail();
     return 0;
 }
@@ -0,0 +1,7 @@
+// Included by macro.c, the guard may be undefined to include it again
+#ifndef _WGTCC_TEST_GUARD_H_
+#define _WGTCC_TEST_GUARD_H_
+
+++guard;
+
+#endif
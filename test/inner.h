@@ -0,0 +1,2 @@
+// Included by macro.c, and not by "sub/outer.h"
+inner = 1;
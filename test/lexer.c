@@ -56,11 +56,51 @@ static void dollar() {
     expect(3, a$);
 }
 
+// The runs around 16 bytes, stopped by the characters next to the ranges
+static void long_runs() {
+    int abcdefghijklmno = 15, abcdefghijklmnop = 16, abcdefghijklmnopq = 17;
+    expect(48, abcdefghijklmno + abcdefghijklmnop + abcdefghijklmnopq);
+    int _$ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 = 1;
+    expect(1, _$ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789);
+    int zyxwvutsrqponml[2] = {1, 2}, zyxwvutsrqponmlk = 3;
+    expect(6, zyxwvutsrqponml[0]+zyxwvutsrqponml[1]+zyxwvutsrqponmlk);
+    int long_identifier_with_a_splice = 4;
+    expect(4, long_identifier_\
+with_a_splice);
+
+    int line = __LINE__;          /* a comment ** with * / and /* ***/
+    expect(line + 1, __LINE__);
+    // A splice continues the line comment \
+    expect(0, 1);
+    expect(line + 4, __LINE__);
+    /**********************************
+     * A block comment of a few lines *
+     **********************************/
+    expect(line + 8, __LINE__);
+
+    expect_string("a\tb                    c", "a\tb                    c");
+    expectf(0.25, 0x1p-2);
+    expectf(10000000000.0, 1e+10);
+    expectf(0.0015f, 1.5e-3f);
+    expect(255, 0xfF);
+    expectl(1234567890123456789L, 1234567890123456789L);
+}
+
+// The headers end without a newline, at the end of a page or empty
+static void source_end() {
+    int page = 0;
+#include "empty.h"
+#include "page.h"
+    expect(4096, page);
+}
+
 int main() {
     digraph();
     escape();
     whitespace();
     newline();
     dollar();
+    long_runs();
+    source_end();
     return 0;
 }
@@ -33,11 +33,33 @@ static void test3() {
 	expect_float(1.0f, a || !b);
 }
 
+static void test_branch() {
+	int a = 3, b = 0, n = 0;
+	unsigned u = 1;
+	double d = 0.5;
+	if (a > 2 && (b || a != 3)) n = 1;
+	expect(0, n);
+	if (!(a < 2) && !(b == 1 || u < 1)) n = 2;
+	expect(2, n);
+	if (b || (n++, a == 3)) n += 10;
+	expect(13, n);
+	if (a == 3 || n++) n += 10;
+	expect(23, n);
+	if (-1 < u) n = 0;
+	expect(23, n);
+	if (d >= 0.5 && !(d > 1.0)) n = 5;
+	expect(5, n);
+	for (n = 0; n < 10 && !(a == 0); n++) a--;
+	expect(3, n);
+	do n++; while (n < 7 || a);
+	expect(7, n);
+}
 
 int main()
 {
 	test1();
 	test2();
 	test3();
+	test_branch();
 	return 0;
 }
\ No newline at end of file
@@ -31,11 +31,109 @@ void test3()
     expect(sum, 45);
 }
 
+struct point { int x, y, z; };
+
+int grid[10][20];
+
+static void fill(int* p, int n, int k)
+{
+    for (int i = n - 1; i > 0 - 1; --i)
+        p[i] = i * k + k * 3;
+}
+
+void test4()
+{
+    struct point pts[7];
+    for (int i = 0; i < 7; ++i) {
+        pts[i].x = i;
+        pts[i].y = i * 3;
+        pts[i].z = -i;
+    }
+    int sum = 0;
+    for (int i = 0; i < 7; ++i)
+        sum += pts[i].y - pts[i].z;
+    expect(sum, 84);
+
+    for (int i = 0; i < 10; ++i)
+        for (int j = 0; j < 20; ++j)
+            grid[i][j] = i + j;
+    sum = 0;
+    for (int j = 0; j < 20; j += 2)
+        for (int i = 0; i < 10; ++i)
+            sum += grid[i][j];
+    expect(sum, 1350);
+
+    // The store may change what the loop reads
+    int buf[4];
+    int* p = buf;
+    buf[0] = 1;
+    sum = 0;
+    for (int i = 1; i < 4; ++i) {
+        sum += buf[0];
+        p[i - 1] = buf[0] * 2;
+    }
+    expect(sum, 5);
+    fill(buf, 4, 2);
+    expect(buf[3], 12);
+}
+
+// The values swapped, or used after their next ones are defined
+static int swap(int n)
+{
+    int a = 1, b = 2, t;
+    while (n--) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    return a * 10 + b;
+}
+
+static int lost_copy(int n)
+{
+    int x = 1, y;
+    do {
+        y = x;
+        x = x + 1;
+    } while (x < n);
+    return y;
+}
+
+static int jumps(int n)
+{
+    int i = 0, sum = 0;
+again:
+    for (; i < n; ++i) {
+        if (i % 3 == 0)
+            continue;
+        if (i == 7) {
+            ++i;
+            goto again;
+        }
+        sum += i;
+        if (sum > 30)
+            break;
+    }
+    return sum;
+}
+
+void test5()
+{
+    expect(21, swap(3));
+    expect(12, swap(4));
+    expect(4, lost_copy(5));
+    expect(1, lost_copy(0));
+    expect(1 + 2 + 4 + 5 + 8 + 10 + 11, jumps(12));
+    expect(1 + 2 + 4 + 5, jumps(7));
+}
+
 int main()
 {
     test1();
     test2();
     test3();
+    test4();
+    test5();
     return 0;
 }
 
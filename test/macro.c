@@ -385,6 +385,128 @@ static void null() {
     #
 }
 
+// Expansions of many tokens, inserted in the middle of longer lines
+static void long_expansion() {
+#define SUM8(x) x + x + x + x + x + x + x + x
+#define PICK20(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, q, r, s, t) \
+    t - a
+    expect(512, SUM8(SUM8(SUM8(1))));
+    expect(523, 1 + 2 + 3 + SUM8(SUM8(SUM8(1))) + 1 + 2 - 3 + 4 - 5 + 6);
+    expect_string("1 + 1 + 1 + 1 + 1 + 1 + 1 + 1", TO_STRING(SUM8(1)));
+    expect(19, PICK20(1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                      11, 12, 13, 14, 15, 16, 17, 18, 19, SUM8(2) + 4));
+    expect(64, SUM8(PICK20(0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                           0, 0, 0, 0, 0, 0, 0, 0, 0, SUM8(1))));
+}
+
+// A name is the same whether it is written, pasted or spelled by UCNs
+static void interned() {
+#define glue2(x, y) x ## y
+#define VALUE 42
+    glue2(in, t) glue2(val, ue) = glue2(VAL, UE);
+    expect(42, value);
+    expect(42, glue2(v, alue));
+    expect_string("42", TO_STRING(glue2(VAL, UE)));
+    expect_string("glue2(VAL, UE)", STRINGIZE(glue2(VAL, UE)));
+    glue2(wh, ile) (glue2(val, ue) < 45)
+        ++value;
+    expect(45, value);
+    int \u00e9t\u00e9 = 3;
+    expect(3, été);
+#undef VALUE
+}
+
+// The example of C11 6.10.3.5, and names hidden by the expansions
+static void hide_sets() {
+#define x 3
+#define f(a) f(x * (a))
+#undef x
+#define x 2
+#define g f
+#define z z[0]
+#define t(a) a
+    expect_string("f(2 * (y+1)) + f(2 * (f(2 * (z[0])))) % f(2 * (0)) + t(1);",
+                  TO_STRING(f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);));
+#undef x
+#undef f
+#undef g
+#undef z
+#undef t
+
+#define id(x) x
+#define lparen (
+#define call id lparen 7)
+#define self self + id(self)
+#define ab(x) ba(x) + x
+#define ba(x) ab(x)
+    expect_string("id(5)", TO_STRING(id(id)(5)));
+    expect_string("id ( 7)", TO_STRING(call));
+    expect_string("self + self", TO_STRING(self));
+    expect_string("ab(ab(1) + 1) + ab(1) + 1", TO_STRING(ab(ab(1))));
+}
+
+// A parameter used as is, stringified and pasted in the same body
+static void params() {
+    int xy = 1, yxy = 2, x = 4, y = 3, i = 5;
+    const char* str;
+    int v[3];
+#define put(s, p, q, r) (str = s, v[0] = p, v[1] = q, v[2] = r)
+#define apply(m, ...) m(__VA_ARGS__)
+#define use3(a, b) #a "-" #b, a ## b, a + b, b ## a ## b
+    apply(put, use3(x, y));
+    expect_string("x-y", str);
+    expect(1, v[0]);
+    expect(7, v[1]);
+    expect(2, v[2]);
+#define va(fmt, ...) #fmt #__VA_ARGS__, fmt ## __VA_ARGS__
+    apply(put, va(x, y, i), 0);
+    expect_string("xy, i", str);
+    expect(1, v[0]);
+    expect(5, v[1]);
+    expect(0, v[2]);
+#define shadow(ONE, TWO) ONE * TWO
+    expect(12, shadow(3, 4));
+    expect(2, shadow(ONE, TWO));
+#define empty_paste(a, b, c) a ## b ## c + 0
+    expect(5, empty_paste(, 5, ));
+    expect(0, empty_paste(, , ));
+}
+
+// The same name is searched from the directories of the includers
+static void search() {
+    int inner = 0;
+#include "inner.h"
+    expect(1, inner);
+#include "sub/outer.h"
+    expect(2, inner);
+#include "inner.h"
+    expect(1, inner);
+#include "sub/inner.h"
+    expect(2, inner);
+#include "sub/../inner.h"
+    expect(1, inner);
+}
+
+static void include_once() {
+    int guard = 0;
+#include "guard.h"
+#include "guard.h"
+#include "./guard.h"
+    expect(1, guard);
+#undef _WGTCC_TEST_GUARD_H_
+#include "guard.h"
+    expect(2, guard);
+#include "guard.h"
+    expect(2, guard);
+
+    int once = 0;
+#include "once.h"
+#include "once.h"
+#include "./once.h"
+#include "../test/once.h"
+    expect(1, once);
+}
+
 
 // Not supported
 /*
@@ -418,6 +540,12 @@ int main() {
   empty();
   noarg();
   null();
+  long_expansion();
+  interned();
+  hide_sets();
+  params();
+  search();
+  include_once();
   //counter();
   //gnuext();
   return 0;
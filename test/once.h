@@ -0,0 +1,4 @@
+#pragma once
+
+// Included by macro.c, also by other paths of the same file
+++once;
@@ -0,0 +1,16 @@
+// @wgtcc: passed
+// Also compiled with test/pch.h precompiled, see 'make test'
+
+#include "pch.h"
+#include "pch.h"
+
+int main() {
+    pch_point p = {3, 4};
+    expect(7, pch_sum(p));
+    expect(49, PCH_SQUARE(pch_sum(p)));
+    expect(12, PCH_JOIN(1, 2));
+    expect_string("pch", PCH_NAME);
+    expect_string("test/pch.c", __FILE__);
+    expect(14, __LINE__);
+    return 0;
+}
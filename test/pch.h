@@ -0,0 +1,19 @@
+// Precompiled for test/pch.c, see 'make test'
+#ifndef _WGTCC_TEST_PCH_H_
+#define _WGTCC_TEST_PCH_H_
+
+#include "test.h"
+
+#define PCH_SQUARE(x) ((x) * (x))
+#define PCH_JOIN(a, ...) a ## __VA_ARGS__
+#define PCH_NAME "pch"
+
+typedef struct {
+    int x, y;
+} pch_point;
+
+static inline int pch_sum(pch_point p) {
+    return p.x + p.y;
+}
+
+#endif
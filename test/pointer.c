@@ -85,6 +85,35 @@ static void compare() {
     expect(4, sizeof(p >= p + 1));
 }
 
+struct pair { int a[4]; int n; };
+static int counter;
+
+static void bump(int *p) {
+    *p += 1;
+    counter++;
+}
+
+static void alias() {
+    struct pair s = {{1, 2, 3, 4}, 2};
+    struct pair *ps = &s;
+    int *p = &s.a[2];
+    int x = ps->a[ps->n] + ps->a[ps->n];
+    *p = 10;
+    expect(6, x);
+    expect(20, ps->a[ps->n] + ps->a[ps->n]);
+    bump(&ps->a[ps->n]);
+    expect(11, ps->a[ps->n]);
+    int c = counter;
+    bump(p);
+    expect(1, counter - c);
+    union { int i; float f; } u;
+    u.f = 1.0f;
+    int bits = u.i;
+    u.i = 0;
+    expect(0x3f800000, bits);
+    expect(0, u.i);
+}
+
 int main() {
     t1();
     t2();
@@ -95,5 +124,6 @@ int main() {
     t7();
     subtract();
     compare();
+    alias();
     return 0;
 }
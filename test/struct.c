@@ -539,6 +539,84 @@ static void test_unnamed_bitfield() {
   expect(2, foo.c);
 }
 
+typedef struct { double x; int n; } small_di;
+typedef struct { float x, y, z; } small_f3;
+typedef struct { char *p; long len; } small_slice;
+typedef struct { long a; double d; } small_ld;
+
+static small_di small_add(small_di a, int k, small_di b) {
+  small_di r = {a.x + b.x, a.n + b.n + k};
+  return r;
+}
+
+static small_f3 small_scale(small_f3 v, float s) {
+  small_f3 r = {v.x * s, v.y * s, v.z * s};
+  return r;
+}
+
+static small_slice small_tail(small_slice s) {
+  if (s.len <= 1)
+    return s;
+  small_slice t = {s.p + 1, s.len - 1};
+  return small_tail(t);
+}
+
+// Too few registers left for 's' and 'x', they are passed in memory
+static long small_spill(long a, long b, long c, long d, long e,
+                        small_slice s, long f, small_ld x) {
+  return a + b + c + d + e + s.len + f + x.a + (long)x.d;
+}
+
+static void test_small_struct() {
+  small_di a = {1.5, 2}, b = {2.25, 3};
+  small_di c = small_add(a, 10, b);
+  expectf(3.75, c.x);
+  expect(15, c.n);
+  expect(30, small_add(c, 0, c).n);
+  small_f3 v = small_scale((small_f3){1, 2, 3}, 2);
+  expectf(2, v.x);
+  expectf(4, v.y);
+  expectf(6, v.z);
+  char str[] = "abcd";
+  small_slice s = {str, 4};
+  expect('d', *small_tail(s).p);
+  expect(1, small_tail(s).len);
+  small_ld x = {7, 8.5};
+  expect(40, small_spill(1, 2, 3, 4, 5, s, 6, x));
+}
+
+typedef struct { char c[4096]; } block_big;
+typedef struct { long a[9]; char t[3]; } block_mid;
+
+static block_mid block_pass(block_mid m) {
+  m.t[2] = 7;
+  return m;
+}
+
+static void test_block_copy() {
+  static block_big big;
+  for (int i = 0; i < 4096; i++)
+    big.c[i] = i % 100;
+  block_big b = big;
+  expect(0, b.c[0]);
+  expect(17, b.c[317]);
+  expect(95, b.c[4095]);
+  block_mid m = {{1, 2, 3, 4, 5, 6, 7, 8, 9}, {1, 2}}, m2;
+  m2 = block_pass(m);
+  expect(9, m2.a[8]);
+  expect(2, m2.t[1]);
+  expect(7, m2.t[2]);
+  char buf[4096] = {1};
+  char mid[100] = {1, 2};
+  int sum = 0;
+  for (int i = 1; i < 4096; i++)
+    sum += buf[i];
+  for (int i = 2; i < 100; i++)
+    sum += mid[i];
+  expect(0, sum);
+  expect(2, mid[1]);
+}
+
 int main()
 {
     test1();
@@ -583,5 +661,7 @@ int main()
     flexible_member();
 #endif
     empty_struct();
+    test_small_struct();
+    test_block_copy();
     return 0;
 }
@@ -0,0 +1,2 @@
+// Included by "outer.h" of this directory
+inner = 2;
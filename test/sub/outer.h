@@ -0,0 +1,2 @@
+// The directory of this file is searched first
+#include "inner.h"
@@ -72,6 +72,24 @@ static int test_struct(int a1, int a2, int a3, int a4, int a5, int a6, int a7, .
   return pos.x + pos.y;
 }
 
+typedef struct {
+  int n;
+  double d;
+} mixed_t;
+
+static double sum_mixed(int n, ...) {
+  va_list args;
+  va_start(args, n);
+  double acc = 0;
+  for (int i = 0; i < n; ++i) {
+    mixed_t m = va_arg(args, mixed_t);
+    pos_t pos = va_arg(args, pos_t);
+    acc += m.n + m.d + pos.x * pos.y;
+  }
+  va_end(args);
+  return acc;
+}
+
 static void test() {
   expect(28, sumi(8, 0, 1, 2, 3, 4, 5, 6, 7));
   expect(210, sumi(21, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20));
@@ -83,6 +101,8 @@ static void test() {
 
   pos_t pos = {3, 7};
   expect(10, test_struct(1, 2, 3, 4, 5, 6, 7, pos));
+  mixed_t m = {1, 0.5};
+  expectf(90.0, sum_mixed(4, m, pos, m, pos, m, pos, m, pos));
 }
 
 int main() {
@@ -3,6 +3,11 @@
 #include "mem_pool.h"
 #include "parser.h"
 
+#include <algorithm>
+#include <map>
+#include <unordered_set>
+#include <utility>
+
 
 static MemPoolImp<Token> TokenPool;
 
@@ -170,11 +175,205 @@ Token* Token::New(const Token& other) {
 
 Token* Token::New(int tag,
                   const SourceLocation& loc,
-                  const std::string& str,
+                  const std::string* str,
                   bool ws) {
   return new (TokenPool.Alloc()) Token(tag, loc, str, ws);
 }
 
+
+const std::string* Intern(const std::string& str) {
+  static std::unordered_set<std::string> strTable;
+  return &*strTable.insert(str).first;
+}
+
+
+namespace {
+
+struct PairHash {
+  template<typename T, typename U>
+  size_t operator()(const std::pair<T*, U*>& pair) const {
+    auto first = reinterpret_cast<size_t>(pair.first);
+    auto second = reinterpret_cast<size_t>(pair.second);
+    return first * 31 + second;
+  }
+};
+
+}
+
+
+const HideSet* HideSet::Get(const NameList& names) {
+  static std::map<NameList, const HideSet*> hsTable;
+  auto& hs = hsTable[names];
+  if (!hs)
+    hs = new HideSet(names);
+  return hs;
+}
+
+
+const HideSet* HideSet::Add(const HideSet* hs, const std::string* name) {
+  typedef std::pair<const HideSet*, const std::string*> Key;
+  static std::unordered_map<Key, const HideSet*, PairHash> addCache;
+  auto& ret = addCache[{hs, name}];
+  if (!ret) {
+    NameList names;
+    if (hs)
+      names = hs->names_;
+    auto pos = std::lower_bound(names.begin(), names.end(), name,
+                                std::less<const std::string*>());
+    if (pos == names.end() || *pos != name)
+      names.insert(pos, name);
+    ret = Get(names);
+  }
+  return ret;
+}
+
+
+const HideSet* HideSet::Union(const HideSet* lhs, const HideSet* rhs) {
+  if (!lhs || lhs == rhs)
+    return rhs;
+  if (!rhs)
+    return lhs;
+  typedef std::pair<const HideSet*, const HideSet*> Key;
+  static std::unordered_map<Key, const HideSet*, PairHash> unionCache;
+  auto& ret = unionCache[{lhs, rhs}];
+  if (!ret) {
+    NameList names;
+    std::set_union(lhs->names_.begin(), lhs->names_.end(),
+                   rhs->names_.begin(), rhs->names_.end(),
+                   std::back_inserter(names),
+                   std::less<const std::string*>());
+    ret = Get(names);
+  }
+  return ret;
+}
+
+
+bool HideSet::Contains(const std::string* name) const {
+  // Hide sets are small, a linear search is the fastest
+  for (auto iter: names_) {
+    if (iter == name)
+      return true;
+  }
+  return false;
+}
+
+
+int Token::KeyWordTag(const std::string* key) {
+  static std::unordered_map<const std::string*, int> kwTagMap;
+  if (kwTagMap.empty()) {
+    for (const auto& kv: kwTypeMap_)
+      kwTagMap[Intern(kv.first)] = kv.second;
+  }
+  auto kwIter = kwTagMap.find(key);
+  if (kwTagMap.end() == kwIter)
+    return Token::NOTOK;	//not a key word type
+  return kwIter->second;
+}
+
+
+MemPoolImp<TokenList::Chunk> TokenList::chunkPool_;
+
+
+TokenList::~TokenList() {
+  auto chunk = head_.next_;
+  while (chunk != &head_) {
+    auto next = chunk->next_;
+    FreeChunk(chunk);
+    chunk = next;
+  }
+}
+
+
+// Links a new chunk before 'next', whose slots are used from 'lo'.
+TokenList::Chunk* TokenList::NewChunk(Link* next, int lo) {
+  auto chunk = new (chunkPool_.Alloc()) Chunk();
+  chunk->lo_ = chunk->hi_ = lo;
+  chunk->next_ = next;
+  chunk->prev_ = next->prev_;
+  next->prev_->next_ = chunk;
+  next->prev_ = chunk;
+  return chunk;
+}
+
+
+void TokenList::FreeChunk(Link* chunk) {
+  chunk->prev_->next_ = chunk->next_;
+  chunk->next_->prev_ = chunk->prev_;
+  chunkPool_.Free(chunk);
+}
+
+
+/*
+ * Makes 'pos' the first used slot of its chunk, by moving the tokens
+ * before it to the tail of the previous chunk, or to a new chunk if
+ * there is no room. Returns the chunk of 'pos'.
+ */
+TokenList::Link* TokenList::Split(iterator pos) {
+  if (pos.link_ == &head_ || pos.idx_ == pos.link_->lo_)
+    return pos.link_;
+
+  auto chunk = static_cast<Chunk*>(pos.link_);
+  auto cnt = pos.idx_ - chunk->lo_;
+  auto prev = chunk->prev_;
+  if (prev == &head_ || Chunk::CAPACITY - prev->hi_ < cnt)
+    prev = NewChunk(chunk, 0);
+  memcpy(&static_cast<Chunk*>(prev)->toks_[prev->hi_],
+         &chunk->toks_[chunk->lo_], cnt * sizeof(const Token*));
+  prev->hi_ += cnt;
+  chunk->lo_ = pos.idx_;
+  return chunk;
+}
+
+
+TokenList::iterator TokenList::insert(iterator pos, const Token* tok) {
+  auto prev = Split(pos)->prev_;
+  if (prev == &head_ || prev->hi_ == Chunk::CAPACITY)
+    prev = NewChunk(pos.link_, 0);
+  static_cast<Chunk*>(prev)->toks_[prev->hi_] = tok;
+  return iterator(prev, prev->hi_++);
+}
+
+
+TokenList::iterator TokenList::insert(iterator pos,
+                                      iterator first,
+                                      iterator last) {
+  if (first == last)
+    return pos;
+  // After the first insertion, 'pos' is at the begin of its chunk
+  auto ret = insert(pos, *first);
+  while (++first != last)
+    insert(pos, *first);
+  return ret;
+}
+
+
+TokenList::iterator TokenList::insert_front(iterator pos,
+                                            iterator first,
+                                            iterator last) {
+  if (first == last)
+    return pos;
+  auto next = Split(pos);
+  int cnt = 0;
+  for (auto iter = first; iter != last; ++iter)
+    ++cnt;
+  if (next == &head_ || next->lo_ < cnt)
+    return insert(pos, first, last);
+
+  auto chunk = static_cast<Chunk*>(next);
+  chunk->lo_ -= cnt;
+  for (auto i = chunk->lo_; first != last; ++first)
+    chunk->toks_[i++] = *first;
+  return iterator(chunk, chunk->lo_);
+}
+
+
+void TokenList::pop_back() {
+  assert(!empty());
+  auto last = head_.prev_;
+  if (--last->hi_ == last->lo_)
+    FreeChunk(last);
+}
+
 bool TokenSequence::Empty() {
   return Peek()->tag_ == Token::END;
 }
@@ -209,6 +408,7 @@ bool TokenSequence::IsBeginOfLine() const {
 
 const Token* TokenSequence::Peek() {
   static auto eof = Token::New(Token::END);
+  static auto funcName = Intern("__func__");
   if (begin_ != end_ && (*begin_)->tag_ == Token::NEW_LINE) {
     ++begin_;
     return Peek();
@@ -218,10 +418,10 @@ const Token* TokenSequence::Peek() {
     eof->tag_ = Token::END;
     return eof;
   } else if (parser_ && (*begin_)->tag_ == Token::IDENTIFIER &&
-             (*begin_)->str_ == "__func__") {
+             (*begin_)->str_ == funcName) {
     auto fileName = Token::New(*(*begin_));
     fileName->tag_ = Token::LITERAL;
-    fileName->str_ = "\"" + parser_->CurFunc()->Name() + "\"";
+    fileName->str_ = Intern("\"" + parser_->CurFunc()->Name() + "\"");
     *begin_ = fileName;
   }
   return *begin_;
@@ -232,7 +432,7 @@ const Token* TokenSequence::Expect(int expect) {
   auto tok = Peek();
   if (!Try(expect)) {
     Error(tok, "'%s' expected, but got '%s'",
-        Token::Lexeme(expect), tok->str_.c_str());
+        Token::Lexeme(expect), tok->str_->c_str());
   }
   return tok;
 }
@@ -250,7 +450,7 @@ void TokenSequence::Print(FILE* fp) const {
     } else if (tok->ws_) {
       fputc(' ', fp);
     }
-    fputs(tok->str_.c_str(), fp);
+    fputs(tok->str_->c_str(), fp);
     fflush(fp);
     lastLine = tok->loc_.line_;
   }
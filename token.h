@@ -2,24 +2,51 @@
 #define _WGTCC_TOKEN_H_
 
 #include "error.h"
+#include "mem_pool.h"
 
 #include <cassert>
 #include <cstring>
+#include <initializer_list>
 #include <iostream>
-#include <list>
-#include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class Generator;
 class Parser;
 class Scanner;
 class Token;
+class TokenList;
 class TokenSequence;
 
-typedef std::set<std::string> HideSet;
-typedef std::list<const Token*> TokenList;
+// Returns the unique copy of 'str'. Interned strings are never freed,
+// and two of them are equal iff they are the same pointer.
+const std::string* Intern(const std::string& str);
+
+
+/*
+ * The names of macros that a token must not be expanded by.
+ * Hide sets are immutable and hash-consed: equal sets are the same
+ * object, and nullptr is the empty set. Results of Add() and Union()
+ * are cached, so copying a token copies a pointer, and propagating a
+ * hide set allocates nothing once the combination has been seen.
+ */
+class HideSet {
+  // Interned names, sorted by address
+  typedef std::vector<const std::string*> NameList;
+
+public:
+  static const HideSet* Add(const HideSet* hs, const std::string* name);
+  static const HideSet* Union(const HideSet* lhs, const HideSet* rhs);
+  bool Contains(const std::string* name) const;
+
+private:
+  explicit HideSet(const NameList& names): names_(names) {}
+  static const HideSet* Get(const NameList& names);
+
+  NameList names_;
+};
 
 
 struct SourceLocation {
@@ -198,25 +225,20 @@ public:
   static Token* New(const Token& other);
   static Token* New(int tag,
                     const SourceLocation& loc,
-                    const std::string& str,
+                    const std::string* str,
                     bool ws=false);
   Token& operator=(const Token& other) {
     tag_ = other.tag_;
     ws_ = other.ws_;
     loc_ = other.loc_;
     str_ = other.str_;
-    hs_ = other.hs_ ? new HideSet(*other.hs_): nullptr;
+    hs_ = other.hs_;
     return *this;
   }
   virtual ~Token() {}
   
   //Token::NOTOK represents not a kw.
-  static int KeyWordTag(const std::string& key) {
-    auto kwIter = kwTypeMap_.find(key); 
-    if (kwTypeMap_.end() == kwIter)
-      return Token::NOTOK;	//not a key word type
-    return kwIter->second;
-  }
+  static int KeyWordTag(const std::string* key);
   static bool IsKeyWord(const std::string& name);
   static bool IsKeyWord(int tag) { return CONST <= tag && tag < IDENTIFIER; }
   bool IsKeyWord() const { return IsKeyWord(tag_); }
@@ -247,14 +269,15 @@ public:
 
   // ws_ standards for weither there is preceding white space
   // This is to simplify the '#' operator(stringize) in macro expansion
-  std::string str_;
-  HideSet* hs_ { nullptr };
+  // The spelling is interned, tokens of the same spelling share it
+  const std::string* str_ { nullptr };
+  const HideSet* hs_ { nullptr };
 
 private:
-  explicit Token(int tag): tag_(tag) {}
+  explicit Token(int tag): tag_(tag), str_(Intern("")) {}
   Token(int tag,
         const SourceLocation& loc,
-        const std::string& str,
+        const std::string* str,
         bool ws=false)
       : tag_(tag), ws_(ws), loc_(loc), str_(str) {}
 
@@ -267,6 +290,117 @@ private:
 };
 
 
+/*
+ * Storage of token sequences: a doubly linked list of fixed-size chunks,
+ * each holding a contiguous run of token pointers. Walking the tokens
+ * touches sequential memory, and inserting a token costs no allocation
+ * unless its chunk is full. Chunks of the same list are linked in a
+ * ring through the sentinel 'head_', which is also the end position.
+ *
+ * Like std::list, inserting never invalidates iterators at or after the
+ * insert position, nor iterators into other chunks. The one exception:
+ * inserting in the middle of a chunk first moves the tokens before the
+ * position (those already consumed, for the preprocessor) to the
+ * previous chunk. So don't keep iterators that point before an insert
+ * position in the same list; copy the tokens out instead (see Macro).
+ */
+class TokenList {
+  struct Link {
+    Link* prev_;
+    Link* next_;
+    // Used slots are [lo_, hi_), never empty except for the sentinel
+    int lo_;
+    int hi_;
+  };
+
+  struct Chunk: public Link {
+    enum { CAPACITY = 16 };
+    const Token* toks_[CAPACITY];
+  };
+
+public:
+  class iterator {
+    friend class TokenList;
+  public:
+    iterator(): link_(nullptr), idx_(0) {}
+    const Token*& operator*() const {
+      return static_cast<Chunk*>(link_)->toks_[idx_];
+    }
+    iterator& operator++() {
+      if (++idx_ == link_->hi_) {
+        link_ = link_->next_;
+        idx_ = link_->lo_;
+      }
+      return *this;
+    }
+    iterator& operator--() {
+      if (idx_ == link_->lo_) {
+        link_ = link_->prev_;
+        idx_ = link_->hi_;
+      }
+      --idx_;
+      return *this;
+    }
+    iterator operator++(int) { auto ret = *this; ++*this; return ret; }
+    iterator operator--(int) { auto ret = *this; --*this; return ret; }
+    bool operator==(const iterator& other) const {
+      return link_ == other.link_ && idx_ == other.idx_;
+    }
+    bool operator!=(const iterator& other) const { return !(*this == other); }
+
+  private:
+    iterator(Link* link, int idx): link_(link), idx_(idx) {}
+
+    Link* link_;
+    int idx_;
+  };
+
+  TokenList() {
+    head_.prev_ = head_.next_ = &head_;
+    head_.lo_ = head_.hi_ = 0;
+  }
+  TokenList(iterator first, iterator last): TokenList() {
+    insert(end(), first, last);
+  }
+  TokenList(std::initializer_list<const Token*> toks): TokenList() {
+    for (auto tok: toks)
+      push_back(tok);
+  }
+  ~TokenList();
+  TokenList(const TokenList& other) = delete;
+  TokenList& operator=(const TokenList& other) = delete;
+
+  iterator begin() { return iterator(head_.next_, head_.next_->lo_); }
+  iterator end() { return iterator(&head_, 0); }
+  bool empty() const { return head_.next_ == &head_; }
+  const Token* back() const {
+    auto last = static_cast<const Chunk*>(head_.prev_);
+    return last->toks_[last->hi_ - 1];
+  }
+  void push_back(const Token* tok) { insert(end(), tok); }
+  void pop_back();
+
+  // Both return the position of the first inserted token
+  // ('pos' if nothing is inserted). Tokens are appended to the tail of
+  // the chunk before 'pos', so inserting repeatedly at the same 'pos'
+  // is cheap.
+  iterator insert(iterator pos, const Token* tok);
+  iterator insert(iterator pos, iterator first, iterator last);
+  // Prefers the free slots in front of 'pos' (left by a previous split
+  // or front insertion), so inserting repeatedly in front of the
+  // returned position is cheap. This is what macro expansion does.
+  iterator insert_front(iterator pos, iterator first, iterator last);
+
+private:
+  Link* Split(iterator pos);
+  static Chunk* NewChunk(Link* next, int lo);
+  static void FreeChunk(Link* chunk);
+
+  static MemPoolImp<Chunk> chunkPool_;
+  Link head_;
+};
+
+
 struct TokenSequence {
   friend class Preprocessor;
 
@@ -305,14 +439,11 @@ public:
     auto tok = const_cast<Token*>(Peek());
     tok->loc_ = loc;
   }
-  void FinalizeSubst(bool leadingWS, const HideSet& hs) {
+  void FinalizeSubst(bool leadingWS, const HideSet* hs) {
     auto ts = *this;
     while (!ts.Empty()) {
       auto tok = const_cast<Token*>(ts.Next());
-      if (!tok->hs_)
-        tok->hs_ = new HideSet(hs);
-      else
-        tok->hs_->insert(hs.begin(), hs.end());
+      tok->hs_ = HideSet::Union(tok->hs_, hs);
     }
     // Even if the token sequence is empty
     const_cast<Token*>(Peek())->ws_ = leadingWS;
@@ -382,7 +513,7 @@ public:
   // If there is preceding newline
   void InsertFront(TokenSequence& ts) {
     auto pos = GetInsertFrontPos();
-    begin_ = tokList_->insert(pos, ts.begin_, ts.end_);
+    begin_ = tokList_->insert_front(pos, ts.begin_, ts.end_);
   }
   void InsertFront(const Token* tok) {
     auto pos = GetInsertFrontPos();
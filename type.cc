@@ -331,7 +331,7 @@ StructType::StructType(MemPool* pool,
       bitFieldAlign_(1) {}
 
 
-Object* StructType::GetMember(const std::string& member) {
+Object* StructType::GetMember(const std::string* member) {
   auto ident = memberMap_->FindInCurScope(member);
   if (ident == nullptr)
     return nullptr;
@@ -341,8 +341,8 @@ Object* StructType::GetMember(const std::string& member) {
 
 void StructType::CalcWidth() {
   width_ = 0;
-  auto iter = memberMap_->identMap_.begin();
-  for (; iter != memberMap_->identMap_.end(); ++iter) {
+  auto iter = memberMap_->identList_.begin();
+  for (; iter != memberMap_->identList_.end(); ++iter) {
     width_ += iter->second->Type()->Width();
   }
 }
@@ -378,7 +378,7 @@ void StructType::AddMember(Object* member) {
   member->SetOffset(offset);
   
   members_.push_back(member);
-  memberMap_->Insert(member->Name(), member);
+  memberMap_->Insert(member);
 
   align_ = std::max(align_, member->Align());
   bitFieldAlign_ = std::max(bitFieldAlign_, align_);
@@ -398,7 +398,7 @@ void StructType::AddBitField(Object* bitField, int offset) {
   bitField->SetOffset(offset);
   members_.push_back(bitField);
   if (!bitField->Anonymous())
-    memberMap_->Insert(bitField->Name(), bitField);
+    memberMap_->Insert(bitField);
 
   auto bytes = MakeAlign(bitField->BitFieldEnd(), 8) / 8;
   bitFieldAlign_ = std::max(bitFieldAlign_, bitField->Align());
@@ -420,14 +420,14 @@ void StructType::MergeAnony(Object* anony) {
 
   // Members in map are never anonymous
   for (auto& kv: *anonyType->memberMap_) {
-    auto& name = kv.first;
+    auto name = kv.first;
     auto member = kv.second->ToObject();
     // Every member of anonymous struct/union
     // are offseted by external struct/union
     member->SetOffset(offset + member->Offset());
 
     if (GetMember(name)) {
-      Error(member, "duplicated member '%s'", name.c_str());
+      Error(member, "duplicated member '%s'", name->c_str());
     }
     // Simplify anony struct's member searching
     memberMap_->Insert(name, member);
@@ -61,6 +61,9 @@ enum {
   // Function specifier
   F_INLINE = 0x4000000,
   F_NORETURN = 0x8000000,
+  // GNU function attributes
+  F_NOINLINE = 0x10000000,
+  F_ALWAYS_INLINE = 0x20000000,
 };
 
 
@@ -334,6 +337,9 @@ public:
   const ParamList& Params() const { return params_; }
   void SetParams(const ParamList& params) { params_ = params; }
   bool Variadic() const { return variadic_; }
+  // The function specifiers and attributes of all the declarations
+  int FuncSpec() const { return inlineNoReturn_; }
+  void AddFuncSpec(int funcSpec) { inlineNoReturn_ |= funcSpec; }
 
 protected:
   FuncType(MemPool* pool, QualType derived, int inlineReturn,
@@ -371,7 +377,7 @@ public:
   void AddMember(Object* member);
   void AddBitField(Object* member, int offset);
   bool IsStruct() const { return isStruct_; }
-  Object* GetMember(const std::string& member);
+  Object* GetMember(const std::string* member);
   Scope* MemberMap() { return memberMap_; }
   MemberList& Members() { return members_; }
   int Offset() const { return offset_; }
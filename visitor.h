@@ -15,6 +15,7 @@ class TempVar;
 class Declaration;
 class IfStmt;
 class JumpStmt;
+class SwitchStmt;
 class ReturnStmt;
 class LabelStmt;
 class EmptyStmt;
@@ -39,6 +40,7 @@ public:
   virtual void VisitDeclaration(Declaration* init) = 0;
   virtual void VisitIfStmt(IfStmt* ifStmt) = 0;
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) = 0;
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) = 0;
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) = 0;
   virtual void VisitLabelStmt(LabelStmt* labelStmt) = 0;
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) = 0;